@@ -19,4 +19,10 @@ typedef float r32;
 typedef double r64;
 
 #define true 1
-#define false 0
\ No newline at end of file
+#define false 0
+
+#if defined(_MSC_VER)
+#define light_thread_local __declspec(thread)
+#else
+#define light_thread_local __thread
+#endif
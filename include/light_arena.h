@@ -14,6 +14,7 @@
 
     void* calloc(size_t num, size_t size)
     void  free(void* block)
+    void* memset(void* dest, int ch, size_t count)
 
     ----------------------------------------------------------------------------------
 
@@ -29,13 +30,24 @@
         void* m1 = arena_alloc(arena, 64);
         void* m2 = arena_alloc(arena, 84);
 
+        Light_Arena_Marker marker = arena_mark(arena);
+        void* scratch = arena_alloc(arena, 4096);
+        arena_restore(arena, marker); // scratch is released
+
         arena_free(arena);
 
         return 0;
     }
 
-    The arena will grow and is not limited by the block size, new blocks will be allocated
-    incrementing by the initial size each time.
+    The arena will grow and is not limited by the block size, every new block doubles the
+    size of the previous one, up to LIGHT_ARENA_MAX_BLOCK_SIZE. Allocations bigger than half
+    of the current block get a side block of their own, so the current block is not wasted.
+
+    arena_alloc returns memory aligned to LIGHT_ARENA_DEFAULT_ALIGNMENT, use arena_alloc_aligned
+    for any other power of 2 alignment.
+
+    arena_stats returns the usage numbers of the arena: bytes requested, bytes wasted in
+    padding and at the end of blocks, bytes reserved and the number of blocks.
 */
 
 #if !defined(LIGHT_ARENA_NO_CRT)
@@ -43,55 +55,148 @@
 #endif
 
 #define LIGHT_ARENA_API extern
+#define LIGHT_ARENA_DEFAULT_ALIGNMENT 16
+#define LIGHT_ARENA_MAX_BLOCK_SIZE (64 * 1024 * 1024)
+
+typedef struct {
+    size_t bytes_requested;
+    size_t bytes_wasted;
+    size_t bytes_reserved;
+    size_t blocks;
+} Light_Arena_Stats;
 
 typedef struct Light_Arena_t{
     size_t capacity;
     void*  ptr;
     struct Light_Arena_t* next;
     struct Light_Arena_t* last;
+    struct Light_Arena_t* side; /* blocks of oversized allocations, newest first */
+
+    /* only valid in the first block */
+    Light_Arena_Stats stats;
 } Light_Arena;
 
+typedef struct {
+    Light_Arena* block;
+    void*        ptr;
+    Light_Arena* side;
+    Light_Arena_Stats stats;
+} Light_Arena_Marker;
+
 LIGHT_ARENA_API Light_Arena* arena_create(size_t size);
 LIGHT_ARENA_API void* arena_alloc(Light_Arena* arena, size_t size_bytes);
+LIGHT_ARENA_API void* arena_alloc_aligned(Light_Arena* arena, size_t size_bytes, size_t alignment);
 LIGHT_ARENA_API void  arena_free(Light_Arena* arena);
 LIGHT_ARENA_API void  arena_clear(Light_Arena* arena);
+LIGHT_ARENA_API Light_Arena_Marker arena_mark(Light_Arena* arena);
+LIGHT_ARENA_API void  arena_restore(Light_Arena* arena, Light_Arena_Marker marker);
+LIGHT_ARENA_API Light_Arena_Stats  arena_stats(Light_Arena* arena);
+LIGHT_ARENA_API void  arena_stats_accumulate(Light_Arena_Stats* total, Light_Arena* arena);
 
 #if defined(LIGHT_ARENA_IMPLEMENT)
+#if !defined(LIGHT_ARENA_NO_CRT)
+#include <string.h>
+#endif
+
+/* called with the size of every allocation, define it before the implementation to count them */
+#if !defined(LIGHT_ARENA_ON_ALLOC)
+#define LIGHT_ARENA_ON_ALLOC(SIZE)
+#endif
+
+#define LIGHT_ARENA_ALIGN(P, A) (((size_t)(P) + ((A) - 1)) & ~((size_t)(A) - 1))
+
+static Light_Arena*
+arena_block_create(size_t size) {
+    Light_Arena* block = (Light_Arena*)calloc(1, size + sizeof(Light_Arena));
+    if (!block) return 0;
+	block->capacity = size;
+	block->ptr = (void*)(block + 1);
+	block->last = block;
+    return block;
+}
+
 /* creates an arena with 'size' number of bytes of block, meaning it will take 'size' bytes
    until a new allocation happens, since an allocation of 'size' is performed, although the
-   arena will grow dynamically with new blocks of 'size' bytes each growth. */
+   arena will grow dynamically with new blocks, each one twice the size of the previous. */
 LIGHT_ARENA_API Light_Arena* 
 arena_create(size_t size) {
-    Light_Arena* base = (Light_Arena*)calloc(1, size + sizeof(Light_Arena));
-	base->capacity = size;
-	base->ptr = (void*)(base + 1);
-	base->last = base;
-	base->next = 0;
+    Light_Arena* base = arena_block_create(size);
+    base->stats.bytes_reserved = size;
+    base->stats.blocks = 1;
     return base;
 }
 
+/* allocates memory in the arena aligned to 'alignment', which must be a power of 2, and may
+   cause a growth in the size of it. Allocation works just like 'calloc', meaning the memory
+   will be zeroed. */
+LIGHT_ARENA_API void*
+arena_alloc_aligned(Light_Arena* arena, size_t size_bytes, size_t alignment) {
+    Light_Arena* block = arena->last;
+    size_t start = LIGHT_ARENA_ALIGN(block->ptr, alignment);
+    size_t end = (size_t)(block + 1) + block->capacity;
+
+    arena->stats.bytes_requested += size_bytes;
+    LIGHT_ARENA_ON_ALLOC(size_bytes);
+
+    if (start + size_bytes > end) {
+        size_t capacity = block->capacity * 2;
+        if (capacity > LIGHT_ARENA_MAX_BLOCK_SIZE)
+            capacity = LIGHT_ARENA_MAX_BLOCK_SIZE;
+
+        if (size_bytes + alignment > capacity / 2) {
+            /* oversized, keep using the current block for the next allocations */
+            Light_Arena* side = arena_block_create(size_bytes + alignment);
+            side->next = arena->side;
+            arena->side = side;
+            arena->stats.bytes_reserved += side->capacity;
+            arena->stats.bytes_wasted += side->capacity - size_bytes;
+            arena->stats.blocks += 1;
+            start = LIGHT_ARENA_ALIGN(side->ptr, alignment);
+            side->ptr = (void*)(start + size_bytes);
+            return (void*)start;
+        }
+
+        arena->stats.bytes_wasted += end - (size_t)block->ptr;
+        if (!block->next) {
+            block->next = arena_block_create(capacity);
+            arena->stats.bytes_reserved += capacity;
+            arena->stats.blocks += 1;
+        }
+        block = block->next;
+        arena->last = block;
+        start = LIGHT_ARENA_ALIGN(block->ptr, alignment);
+    }
+
+    arena->stats.bytes_wasted += start - (size_t)block->ptr;
+    block->ptr = (void*)(start + size_bytes);
+    return (void*)start;
+}
+
 /* allocates memory in the arena and may cause a growth in the size of it. Allocation works
    just like 'calloc', meaning the memory will be zeroed. */
 LIGHT_ARENA_API void*
 arena_alloc(Light_Arena* arena, size_t size_bytes) {
-#define arena_size(A) ((char*)((A)->ptr) - (char*)(A) + sizeof(Light_Arena))
-    void* result;
-    if (size_bytes + arena_size(arena->last) > arena->last->capacity) {
-        Light_Arena* narena = arena_create(arena->capacity);
-        arena->last->next = narena;
-        arena->last = narena;
-		arena->ptr = narena->ptr;
-    }
-#undef arena_size
-    result = arena->last->ptr;
-    arena->last->ptr = (char*)arena->last->ptr + size_bytes;
-    return result;
+    return arena_alloc_aligned(arena, size_bytes, LIGHT_ARENA_DEFAULT_ALIGNMENT);
+}
+
+static void
+arena_side_free(Light_Arena* arena, Light_Arena* until) {
+	Light_Arena* aux = arena->side;
+	while (aux != until) {
+		Light_Arena* next = aux->next;
+        arena->stats.bytes_reserved -= aux->capacity;
+        arena->stats.blocks -= 1;
+		free(aux);
+		aux = next;
+	}
+    arena->side = until;
 }
 
 /* frees all arena content making its pointer invalid. */
 LIGHT_ARENA_API void
 arena_free(Light_Arena* arena) {
 	Light_Arena* aux = arena;
+    arena_side_free(arena, 0);
 	while (aux) {
 		Light_Arena* next = aux->next;
 		free(aux);
@@ -99,16 +204,71 @@ arena_free(Light_Arena* arena) {
 	}
 }
 
-/* clears all the memory in the arena, not freeing it */
+/* clears all the memory in the arena, not freeing its blocks, except the side ones */
 LIGHT_ARENA_API void
 arena_clear(Light_Arena* arena) {
 	Light_Arena* aux = arena;
+    arena_side_free(arena, 0);
 	while (aux) {
 		Light_Arena* next = aux->next;
+        memset(aux + 1, 0, (char*)aux->ptr - (char*)(aux + 1));
         aux->ptr = aux + 1;
 		aux = next;
 	}
+    arena->last = arena;
+    arena->stats.bytes_requested = 0;
+    arena->stats.bytes_wasted = 0;
+}
+
+/* saves the current position of the arena, everything allocated after it can be released
+   at once with arena_restore. */
+LIGHT_ARENA_API Light_Arena_Marker
+arena_mark(Light_Arena* arena) {
+    Light_Arena_Marker marker;
+    marker.block = arena->last;
+    marker.ptr = arena->last->ptr;
+    marker.side = arena->side;
+    marker.stats = arena->stats;
+    return marker;
+}
+
+/* releases everything allocated since the marker was taken, the blocks are kept to be reused. */
+LIGHT_ARENA_API void
+arena_restore(Light_Arena* arena, Light_Arena_Marker marker) {
+    Light_Arena* aux = marker.block;
+    Light_Arena_Stats stats;
+
+    /* side blocks are freed, regular blocks are kept */
+    arena_side_free(arena, marker.side);
+    stats = marker.stats;
+    stats.bytes_reserved = arena->stats.bytes_reserved;
+    stats.blocks = arena->stats.blocks;
+
+    memset(marker.ptr, 0, (char*)aux->ptr - (char*)marker.ptr);
+    aux->ptr = marker.ptr;
+    for (aux = aux->next; aux && aux != arena->last->next; aux = aux->next) {
+        memset(aux + 1, 0, (char*)aux->ptr - (char*)(aux + 1));
+        aux->ptr = aux + 1;
+    }
+    arena->last = marker.block;
+    arena->stats = stats;
+}
+
+/* returns the usage numbers of the arena */
+LIGHT_ARENA_API Light_Arena_Stats
+arena_stats(Light_Arena* arena) {
+    return arena->stats;
+}
+
+/* adds the usage numbers of the arena to 'total' */
+LIGHT_ARENA_API void
+arena_stats_accumulate(Light_Arena_Stats* total, Light_Arena* arena) {
+    total->bytes_requested += arena->stats.bytes_requested;
+    total->bytes_wasted += arena->stats.bytes_wasted;
+    total->bytes_reserved += arena->stats.bytes_reserved;
+    total->blocks += arena->stats.blocks;
 }
 
+#undef LIGHT_ARENA_ALIGN
+#endif /* LIGHT_ARENA_IMPLEMENT */
 #endif /* H_LIGHT_ARENA */
-#endif
\ No newline at end of file
@@ -3,29 +3,147 @@
 #include "utils/utils.h"
 #include "utils/allocator.h"
 #include "eval.h"
+#include "error.h"
+#include "utils/thread.h"
 #include <stdio.h>
 #include <assert.h>
 #include <light_array.h>
+#include <light_arena.h>
+#include <string.h>
+
+// Node and scope ids come from shared counters. Files parsed concurrently log
+// what they create instead and number it locally, the ids are rebased on the
+// shared counters once the files are merged in order (see ast_id_rebase).
+static int32_t ast_id_next = 0;
+static int32_t scope_id_next = 1;
+static light_thread_local Light_Ast***   ast_id_log = 0;
+static light_thread_local Light_Scope*** scope_id_log = 0;
 
 static int32_t
-ast_new_id() {
-    static int32_t id = 0;
-    return id++;
+ast_new_id(Light_Ast* node) {
+    if(ast_id_log) {
+        array_push(*ast_id_log, node);
+        return (int32_t)array_length(*ast_id_log) - 1;
+    }
+    return ast_id_next++;
 }
 
 static int32_t
-scope_new_id() {
-    static int32_t id = 1;
-    return id++;
+scope_new_id(Light_Scope* scope) {
+    if(scope_id_log) {
+        array_push(*scope_id_log, scope);
+        return (int32_t)array_length(*scope_id_log) - 1;
+    }
+    return scope_id_next++;
+}
+
+void
+ast_id_log_begin(Light_Ast*** nodes, Light_Scope*** scopes) {
+    ast_id_log = nodes;
+    scope_id_log = scopes;
+}
+
+void
+ast_id_log_end() {
+    ast_id_log = 0;
+    scope_id_log = 0;
+}
+
+s32
+ast_id_count() {
+    return ast_id_next;
+}
+
+void
+ast_id_rebase(Light_Ast** nodes, Light_Scope** scopes) {
+    for(u64 i = 0; i < array_length(nodes); ++i) {
+        nodes[i]->id += ast_id_next;
+    }
+    ast_id_next += (int32_t)array_length(nodes);
+
+    for(u64 i = 0; i < array_length(scopes); ++i) {
+        scopes[i]->id += scope_id_next;
+    }
+    scope_id_next += (int32_t)array_length(scopes);
+}
+
+// Nodes and scopes are bump allocated, each one in its own arena so nodes are
+// packed together. Every thread allocates from its own arenas, all of them are
+// released at once by ast_arenas_free.
+typedef struct Light_Ast_Arena_t {
+    Light_Arena* nodes;
+    Light_Arena* scopes;
+    Light_Arena* arrays;
+    struct Light_Ast_Arena_t* next;
+} Light_Ast_Arena;
+
+static light_thread_local Light_Ast_Arena* ast_arena = 0;
+static Light_Ast_Arena* volatile ast_arenas = 0;
+
+static Light_Ast_Arena*
+ast_arena_get() {
+    if(!ast_arena) {
+        ast_arena = light_alloc(sizeof(Light_Ast_Arena));
+        ast_arena->nodes = arena_create(1024 * sizeof(Light_Ast));
+        ast_arena->scopes = arena_create(256 * sizeof(Light_Scope));
+        ast_arena->arrays = arena_create(16 * 1024);
+        ast_arena->next = light_atomic_exchange_pointer((void* volatile*)&ast_arenas, ast_arena);
+    }
+    return ast_arena;
+}
+
+static Light_Ast*
+ast_alloc() {
+    return arena_alloc(ast_arena_get()->nodes, sizeof(Light_Ast));
+}
+
+// Moves a finished array next to its nodes and frees the heap buffer.
+// Only for arrays that are never pushed to after parsing.
+static void*
+ast_array_pack(void* array, size_t element_size) {
+    if(!array) return 0;
+
+    size_t length = array_length(array);
+    Dynamic_ArrayBase* base = arena_alloc(ast_arena_get()->arrays, sizeof(Dynamic_ArrayBase) + length * element_size);
+    base->capacity = length;
+    base->length = length;
+    memcpy(base + 1, array, length * element_size);
+    array_free(array);
+
+    return base + 1;
+}
+
+void
+ast_arenas_stats(Light_Arena_Stats* stats) {
+    for(Light_Ast_Arena* a = ast_arenas; a; a = a->next) {
+        arena_stats_accumulate(stats, a->nodes);
+        arena_stats_accumulate(stats, a->scopes);
+        arena_stats_accumulate(stats, a->arrays);
+    }
+}
+
+void
+ast_arenas_free() {
+    Light_Ast_Arena* a = ast_arenas;
+    while(a) {
+        Light_Ast_Arena* next = a->next;
+        arena_free(a->nodes);
+        arena_free(a->scopes);
+        arena_free(a->arrays);
+        light_free(a);
+        a = next;
+    }
+    ast_arenas = 0;
+    ast_arena = 0;
 }
 
 Light_Scope* 
 light_scope_new(Light_Ast* creator_node, Light_Scope* parent, uint32_t flags) {
-    Light_Scope* scope = light_alloc(sizeof(Light_Scope));
+    Light_Scope* scope = arena_alloc(ast_arena_get()->scopes, sizeof(Light_Scope));
     
     assert(parent);
 
-    scope->id = scope_new_id();
+    scope->id = scope_new_id(scope);
     scope->decl_count = 0;
     scope->creator_node = creator_node;
     scope->parent = parent;
@@ -36,14 +154,32 @@ light_scope_new(Light_Ast* creator_node, Light_Scope* parent, uint32_t flags) {
     return scope;
 }
 
+// Copies of nodes and scopes loaded from a module image, they get new ids
+// in the same order as the originals did.
+Light_Ast*
+ast_new_copy(const Light_Ast* node) {
+    Light_Ast* result = ast_alloc();
+    *result = *node;
+    result->id = ast_new_id(result);
+    return result;
+}
+
+Light_Scope*
+light_scope_new_copy(const Light_Scope* scope) {
+    Light_Scope* result = arena_alloc(ast_arena_get()->scopes, sizeof(Light_Scope));
+    *result = *scope;
+    result->id = scope_new_id(result);
+    return result;
+}
+
 Light_Ast* ast_new_expr_directive(Light_Scope* scope, Light_Expr_Directive_Type directive_type, Light_Token* token, Light_Ast* expr, Light_Type* type) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_EXPRESSION_DIRECTIVE;
     result->scope_at = scope;
     result->type = 0;
     result->flags = AST_FLAG_EXPRESSION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->expr_directive.directive_token = token;
     result->expr_directive.type = directive_type;
@@ -58,13 +194,13 @@ Light_Ast* ast_new_expr_directive(Light_Scope* scope, Light_Expr_Directive_Type
 
 Light_Ast* 
 ast_new_expr_dot(Light_Scope* scope, Light_Ast* left, Light_Token* identifier) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_EXPRESSION_DOT;
     result->scope_at = scope;
     result->type = 0;
     result->flags = AST_FLAG_EXPRESSION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->expr_dot.left = left;
     result->expr_dot.identifier = identifier;
@@ -74,13 +210,13 @@ ast_new_expr_dot(Light_Scope* scope, Light_Ast* left, Light_Token* identifier) {
 
 Light_Ast* 
 ast_new_expr_variable(Light_Scope* scope, Light_Token* name) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_EXPRESSION_VARIABLE;
     result->scope_at = scope;
     result->type = 0;
     result->flags = AST_FLAG_EXPRESSION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->expr_variable.name = name;
     result->expr_variable.decl = 0;
@@ -90,13 +226,13 @@ ast_new_expr_variable(Light_Scope* scope, Light_Token* name) {
 
 Light_Ast* 
 ast_new_expr_proc_call(Light_Scope* scope, Light_Ast* caller, Light_Ast** arguments, s32 args_count, Light_Token* op) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_EXPRESSION_PROCEDURE_CALL;
     result->scope_at = scope;
     result->type = 0;
     result->flags = AST_FLAG_EXPRESSION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->expr_proc_call.arg_count = args_count;
     result->expr_proc_call.args = arguments;
@@ -108,13 +244,13 @@ ast_new_expr_proc_call(Light_Scope* scope, Light_Ast* caller, Light_Ast** argume
 
 Light_Ast* 
 ast_new_expr_unary(Light_Scope* scope, Light_Ast* operand, Light_Token* op_token, Light_Operator_Unary op) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_EXPRESSION_UNARY;
     result->scope_at = scope;
     result->type = 0;
     result->flags = AST_FLAG_EXPRESSION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     if(operand->type && operand->type->flags & TYPE_FLAG_INTERNALIZED) {
         switch(op){
@@ -151,13 +287,13 @@ ast_new_expr_unary(Light_Scope* scope, Light_Ast* operand, Light_Token* op_token
 
 Light_Ast* 
 ast_new_expr_binary(Light_Scope* scope, Light_Ast* left, Light_Ast* right, Light_Token* op_token, Light_Operator_Binary op) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_EXPRESSION_BINARY;
     result->scope_at = scope;
     result->type = 0;
     result->flags = AST_FLAG_EXPRESSION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->expr_binary.left = left;
     result->expr_binary.right = right;
@@ -169,13 +305,13 @@ ast_new_expr_binary(Light_Scope* scope, Light_Ast* left, Light_Ast* right, Light
 
 Light_Ast* 
 ast_new_expr_literal_struct(Light_Scope* scope, Light_Token* name, Light_Token* token, Light_Ast** struct_exprs, bool named, Light_Scope* struct_scope) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_EXPRESSION_LITERAL_STRUCT;
     result->scope_at = scope;
     result->type = 0;
     result->flags = AST_FLAG_EXPRESSION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->expr_literal_struct.named = named;
     result->expr_literal_struct.struct_exprs = struct_exprs;
@@ -189,13 +325,13 @@ ast_new_expr_literal_struct(Light_Scope* scope, Light_Token* name, Light_Token*
 
 Light_Ast*
 ast_new_expr_literal_array(Light_Scope* scope, Light_Token* token, Light_Ast** array_exprs) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_EXPRESSION_LITERAL_ARRAY;
     result->scope_at = scope;
     result->type = 0;
     result->flags = AST_FLAG_EXPRESSION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->expr_literal_array.token_array = token;
     result->expr_literal_array.array_exprs = array_exprs;
@@ -209,13 +345,13 @@ ast_new_expr_literal_array(Light_Scope* scope, Light_Token* token, Light_Ast** a
 // TODO(psv): refactor to be more generic
 Light_Ast*
 ast_new_expr_literal_primitive_u32(Light_Scope* scope, u32 val) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_EXPRESSION_LITERAL_PRIMITIVE;
     result->scope_at = scope;
     result->type = type_primitive_get(TYPE_PRIMITIVE_U32);
     result->flags = AST_FLAG_EXPRESSION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->expr_literal_primitive.type = LITERAL_DEC_UINT;
     result->expr_literal_primitive.flags = 0;
@@ -228,13 +364,13 @@ ast_new_expr_literal_primitive_u32(Light_Scope* scope, u32 val) {
 
 Light_Ast*
 ast_new_expr_literal_primitive_u64(Light_Scope* scope, u64 val) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_EXPRESSION_LITERAL_PRIMITIVE;
     result->scope_at = scope;
     result->type = type_primitive_get(TYPE_PRIMITIVE_U64);
     result->flags = AST_FLAG_EXPRESSION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->expr_literal_primitive.type = LITERAL_DEC_UINT;
     result->expr_literal_primitive.flags = 0;
@@ -247,13 +383,13 @@ ast_new_expr_literal_primitive_u64(Light_Scope* scope, u64 val) {
 
 Light_Ast*
 ast_new_expr_literal_primitive(Light_Scope* scope, Light_Token* token) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_EXPRESSION_LITERAL_PRIMITIVE;
     result->scope_at = scope;
     result->type = type_from_token(token);
     result->flags = AST_FLAG_EXPRESSION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->expr_literal_primitive.flags = 0;
     result->expr_literal_primitive.storage_class = STORAGE_CLASS_REGISTER;
@@ -291,13 +427,13 @@ ast_new_expr_literal_primitive(Light_Scope* scope, Light_Token* token) {
 
 Light_Ast* 
 ast_new_expr_compiler_generated(Light_Scope* scope, Light_Compiler_Generated_Kind kind) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_EXPRESSION_COMPILER_GENERATED;
     result->scope_at = scope;
     result->type = type_new_pointer(type_primitive_get(TYPE_PRIMITIVE_VOID));
     result->flags = AST_FLAG_EXPRESSION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->expr_compiler_generated.kind = kind;
 
@@ -306,13 +442,13 @@ ast_new_expr_compiler_generated(Light_Scope* scope, Light_Compiler_Generated_Kin
 
 Light_Ast* 
 ast_new_decl_typedef(Light_Scope* scope, Light_Type* type, Light_Token* name) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_DECL_TYPEDEF;
     result->scope_at = scope;
     result->type = type_primitive_get(TYPE_PRIMITIVE_VOID);
     result->flags = AST_FLAG_DECLARATION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->decl_typedef.name = name;
     result->decl_typedef.type_referenced = type;
@@ -322,13 +458,13 @@ ast_new_decl_typedef(Light_Scope* scope, Light_Type* type, Light_Token* name) {
 
 Light_Ast* 
 ast_new_decl_variable(Light_Scope* scope, Light_Token* name, Light_Type* type, Light_Ast* expr, Light_Storage_Class storage, u32 flags) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_DECL_VARIABLE;
     result->scope_at = scope;
     result->type = type_primitive_get(TYPE_PRIMITIVE_VOID);
     result->flags = AST_FLAG_DECLARATION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->decl_variable.name = name;
     result->decl_variable.flags = flags;
@@ -341,13 +477,13 @@ ast_new_decl_variable(Light_Scope* scope, Light_Token* name, Light_Type* type, L
 
 Light_Ast* 
 ast_new_decl_constant(Light_Scope* scope, Light_Token* name, Light_Type* type, Light_Ast* expr, u32 flags) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_DECL_CONSTANT;
     result->scope_at = scope;
     result->type = type_primitive_get(TYPE_PRIMITIVE_VOID);
     result->flags = AST_FLAG_DECLARATION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->decl_constant.name = name;
     result->decl_constant.flags = flags;
@@ -362,19 +498,21 @@ ast_new_decl_procedure(
     Light_Scope* scope, Light_Token* name, Light_Ast* body, Light_Type* return_type, 
     Light_Scope* args_scope, Light_Ast** args, s32 args_count, u32 flags) 
 {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_DECL_PROCEDURE;
     result->scope_at = scope;
     result->type = type_primitive_get(TYPE_PRIMITIVE_VOID);
     result->flags = AST_FLAG_DECLARATION;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->decl_proc.name = name;
     result->decl_proc.argument_count = args_count;
-    result->decl_proc.arguments = args;
+    result->decl_proc.arguments = ast_array_pack(args, sizeof(*args));
     result->decl_proc.body = body;
     result->decl_proc.arguments_scope = args_scope;
+    if(args_scope)
+        args_scope->decls = ast_array_pack(args_scope->decls, sizeof(*args_scope->decls));
     result->decl_proc.flags = flags;
     result->decl_proc.return_type = return_type;
     result->decl_proc.proc_type = 0;
@@ -384,13 +522,13 @@ ast_new_decl_procedure(
 
 Light_Ast* 
 ast_new_comm_assignment(Light_Scope* scope, Light_Ast* lvalue, Light_Ast* rvalue, Light_Token* op_token) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_COMMAND_ASSIGNMENT;
     result->scope_at = scope;
     result->type = 0;
     result->flags = AST_FLAG_COMMAND;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->comm_assignment.lvalue = lvalue;
     result->comm_assignment.rvalue = rvalue;
@@ -401,17 +539,19 @@ ast_new_comm_assignment(Light_Scope* scope, Light_Ast* lvalue, Light_Ast* rvalue
 
 Light_Ast* 
 ast_new_comm_block(Light_Scope* scope, Light_Ast** commands, s32 command_count, Light_Scope* block_scope) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_COMMAND_BLOCK;
     result->scope_at = scope;
     result->type = type_primitive_get(TYPE_PRIMITIVE_VOID);
     result->flags = AST_FLAG_COMMAND;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->comm_block.block_scope = block_scope;
+    if(block_scope)
+        block_scope->decls = ast_array_pack(block_scope->decls, sizeof(*block_scope->decls));
     result->comm_block.command_count = command_count;
-    result->comm_block.commands = commands;
+    result->comm_block.commands = ast_array_pack(commands, sizeof(*commands));
     result->comm_block.defer_stack = 0;
 
     return result;
@@ -419,13 +559,13 @@ ast_new_comm_block(Light_Scope* scope, Light_Ast** commands, s32 command_count,
 
 Light_Ast* 
 ast_new_comm_if(Light_Scope* scope, Light_Ast* condition, Light_Ast* if_true, Light_Ast* if_false, Light_Token* if_token) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_COMMAND_IF;
     result->scope_at = scope;
     result->type = type_primitive_get(TYPE_PRIMITIVE_VOID);
     result->flags = AST_FLAG_COMMAND;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->comm_if.condition = condition;
     result->comm_if.body_true = if_true;
@@ -437,13 +577,13 @@ ast_new_comm_if(Light_Scope* scope, Light_Ast* condition, Light_Ast* if_true, Li
 
 Light_Ast* 
 ast_new_comm_while(Light_Scope* scope, Light_Ast* condition, Light_Ast* body, Light_Token* while_token) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_COMMAND_WHILE;
     result->scope_at = scope;
     result->type = type_primitive_get(TYPE_PRIMITIVE_VOID);
     result->flags = AST_FLAG_COMMAND;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->comm_while.condition = condition;
     result->comm_while.body = body;
@@ -457,13 +597,13 @@ Light_Ast*
 ast_new_comm_for(Light_Scope* scope, Light_Scope* for_scope, Light_Ast* condition, Light_Ast* body, 
     Light_Ast** prologue, Light_Ast** epilogue, Light_Token* for_token) 
 {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_COMMAND_FOR;
     result->scope_at = scope;
     result->type = type_primitive_get(TYPE_PRIMITIVE_VOID);
     result->flags = AST_FLAG_COMMAND;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->comm_for.body = body;
     result->comm_for.condition = condition;
@@ -477,13 +617,13 @@ ast_new_comm_for(Light_Scope* scope, Light_Scope* for_scope, Light_Ast* conditio
 
 Light_Ast* 
 ast_new_comm_break(Light_Scope* scope, Light_Token* break_keyword, Light_Ast* level) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_COMMAND_BREAK;
     result->scope_at = scope;
     result->type = type_primitive_get(TYPE_PRIMITIVE_VOID);
     result->flags = AST_FLAG_COMMAND;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->comm_break.token_break = break_keyword;
     result->comm_break.level = level;
@@ -493,13 +633,13 @@ ast_new_comm_break(Light_Scope* scope, Light_Token* break_keyword, Light_Ast* le
 
 Light_Ast* 
 ast_new_comm_continue(Light_Scope* scope, Light_Token* continue_keyword, Light_Ast* level) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_COMMAND_CONTINUE;
     result->scope_at = scope;
     result->type = type_primitive_get(TYPE_PRIMITIVE_VOID);
     result->flags = AST_FLAG_COMMAND;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->comm_continue.token_continue = continue_keyword;
     result->comm_continue.level = level;
@@ -509,13 +649,13 @@ ast_new_comm_continue(Light_Scope* scope, Light_Token* continue_keyword, Light_A
 
 Light_Ast* 
 ast_new_comm_return(Light_Scope* scope, Light_Ast* expr, Light_Token* return_token) {
-    Light_Ast* result = light_alloc(sizeof(Light_Ast));
+    Light_Ast* result = ast_alloc();
 
     result->kind = AST_COMMAND_RETURN;
     result->scope_at = scope;
     result->type = type_primitive_get(TYPE_PRIMITIVE_VOID);
     result->flags = AST_FLAG_COMMAND;
-    result->id = ast_new_id();
+    result->id = ast_new_id(result);
 
     result->comm_return.expression = expr;
     result->comm_return.token_return = return_token;
@@ -546,14 +686,14 @@ print_indent_level(FILE* out, s32 level) {
     return length;
 }
 //#define fprintf(F, ...) fprintf(F, __VA_ARGS__); fflush(F)
-#define TOKEN_STR(T) (T)->length, (T)->data
+#define TOKEN_STR(T) (T)->length, token_data(T)
 
 static FILE* ast_file_from_flags(u32 flags) {
     FILE* out = 0;
     if(flags & LIGHT_AST_PRINT_STDOUT)
         out = stdout;
     else if(flags & LIGHT_AST_PRINT_STDERR)
-        out = stderr;
+        out = TYPE_ERROR_STREAM; // only used to print errors
     else
         out = 0;
     return out;
@@ -941,7 +1081,7 @@ ast_print_type(Light_Type* type, u32 flags, s32 indent_level) {
             length += ast_print_type(type->pointer_to, flags, indent_level);
         } break;
         case TYPE_KIND_ALIAS:{
-            length += fprintf(out, "%.*s", type->alias.name->length, type->alias.name->data);
+            length += fprintf(out, "%.*s", type->alias.name->length, token_data(type->alias.name));
         } break;
         case TYPE_KIND_ARRAY:{
             length += fprintf(out, "[%llu]", (unsigned long long int)type->array_info.dimension);
@@ -981,7 +1121,7 @@ ast_print_type(Light_Type* type, u32 flags, s32 indent_level) {
             for(s32 i = 0; i < type->enumerator.field_count; ++i) {
                 if(i != 0) length += fprintf(out, "%s, ", color);
                 Light_Ast* field = type->enumerator.fields[i];
-                length += fprintf(out, "%.*s", field->decl_constant.name->length, field->decl_constant.name->data);
+                length += fprintf(out, "%.*s", field->decl_constant.name->length, token_data(field->decl_constant.name));
                 #if 0
                 if(field->decl_constant.value) {
                     length += fprintf(out, " :: ");
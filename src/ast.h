@@ -1,4 +1,5 @@
 #pragma once
+#include <light_arena.h>
 #include <stdint.h>
 #include "lexer.h"
 
@@ -535,6 +536,7 @@ typedef struct Light_Type_t{
     uint32_t        flags;
 	uint32_t        type_table_index;
     uint64_t        size_bits;
+    uint64_t        hash; // structural hash, valid once TYPE_FLAG_INTERNALIZED
 
     union {
         Light_Type_Primitive primitive;
@@ -593,6 +595,20 @@ Light_Ast* ast_new_user_value_struct_literal(Light_Scope* scope, Light_Ast* expr
 // Utils
 bool literal_primitive_evaluate(Light_Ast* p);
 
+// Memory
+void ast_arenas_stats(Light_Arena_Stats* stats);
+void ast_arenas_free();
+
+// Copies with a new id
+Light_Ast*   ast_new_copy(const Light_Ast* node);
+Light_Scope* light_scope_new_copy(const Light_Scope* scope);
+
+// Ids
+void ast_id_log_begin(Light_Ast*** nodes, Light_Scope*** scopes);
+void ast_id_log_end();
+void ast_id_rebase(Light_Ast** nodes, Light_Scope** scopes);
+s32  ast_id_count(); // nodes numbered so far, merged files included
+
 // -------------- --------- ----------------
 // --------------   Print   ----------------
 // -------------- --------- ----------------
@@ -7,6 +7,11 @@
 #include "../../symbol_table.h"
 #include "light_array.h"
 #include "../../utils/catstring.h"
+#include "../../utils/thread.h"
+#include "../../utils/string_table.h"
+#include "../../utils/os.h"
+#include "../../utils/profile.h"
+#include "../../cache.h"
 
 static void emit_typed_declaration(catstring* buffer, Light_Type* type, Light_Token* name, u32 flags);
 static void emit_declaration(catstring* buffer, Light_Ast* node, u32 flags);
@@ -37,11 +42,7 @@ decl_from_name(Light_Scope* scope, Light_Token* name) {
 static Light_Token
 token_from_name(char buffer[256], const char* name, int id) {
     int len = sprintf(buffer, "%s_%d", name, id);
-    Light_Token result = {0};
-    result.data = (u8*)buffer;
-    result.length = len;
-    result.type = TOKEN_IDENTIFIER;
-    return result;
+    return token_identifier(buffer, len);
 }
 
 // Change level to parent scopes
@@ -73,10 +74,7 @@ emit_type_end(catstring* buffer, Light_Type* type) {
                 if(i > 0) catsprint(buffer, ", ");
 
                 if(type->function.arguments_names) {
-                    Light_Token arg_name = {0};
-                    arg_name.type = TOKEN_IDENTIFIER;
-                    arg_name.data = (u8*)(type->function.arguments_names[i]);
-                    arg_name.length = type->function.arguments_names_length[i];
+                    Light_Token arg_name = token_identifier(type->function.arguments_names[i], type->function.arguments_names_length[i]);
                     emit_typed_declaration(buffer, type->function.arguments_type[i], &arg_name, 0);
                 } else {
                     emit_typed_declaration(buffer, type->function.arguments_type[i], 0, 0);
@@ -921,7 +919,7 @@ emit_type_table(catstring* buffer, Light_Type** type_table) {
                 break;
             case TYPE_KIND_ALIAS:
                 catsprint(&table, " .alias_desc = { {0, %d, \"%s+\"}, &__light_type_table[%l] }", type->alias.name->length, 
-                    type->alias.name->length, type->alias.name->data, type->alias.alias_to->type_table_index);
+                    type->alias.name->length, token_data(type->alias.name), type->alias.alias_to->type_table_index);
                 break;
             case TYPE_KIND_ENUM:
                 // TODO(psv):
@@ -931,7 +929,7 @@ emit_type_table(catstring* buffer, Light_Type** type_table) {
                 // TODO(psv): arguments_types, arguments_names
                 if(type->function.arguments_count > 0) {
                     // forward declarations
-                    catsprint(&arrays_before, "User_Type_Info* __function_args_types_%x[%l] = {0};\n", type, type->function.arguments_count);
+                    catsprint(&arrays_before, "User_Type_Info* __function_args_types_%d[%l] = {0};\n", type->type_table_index, type->function.arguments_count);
 
                     if(type->function.arguments_names) {
                         catsprint(&arrays_after, "__type_names[] = {");
@@ -946,12 +944,12 @@ emit_type_table(catstring* buffer, Light_Type** type_table) {
 
                     for(int f = 0; f < type->function.arguments_count; ++f) {
                         Light_Type* arg_type = type->function.arguments_type[f];
-                        catsprint(&loader, "__function_args_types_%x[%l] = &__light_type_table[%l];\n", type, f, arg_type->type_table_index);
+                        catsprint(&loader, "__function_args_types_%d[%l] = &__light_type_table[%l];\n", type->type_table_index, f, arg_type->type_table_index);
                     }
                     catsprint(&loader, "\n");
-                    catsprint(&table, " .function_desc = { &__light_type_table[%l], (User_Type_Info**)&__function_args_types_%x, 0, %d }", 
+                    catsprint(&table, " .function_desc = { &__light_type_table[%l], (User_Type_Info**)&__function_args_types_%d, 0, %d }", 
                         type->function.return_type->type_table_index,
-                        type,
+                        type->type_table_index,
                         type->function.arguments_count);
                 } else {
                     catsprint(&table, " .function_desc = { &__light_type_table[%l], 0, 0, %d }", 
@@ -963,22 +961,22 @@ emit_type_table(catstring* buffer, Light_Type** type_table) {
             case TYPE_KIND_STRUCT:{
                 if(type->struct_info.fields_count > 0) {
                     // forward declaration
-                    catsprint(&arrays_before, "User_Type_Info* __struct_field_types_%x[%l] = {0};\n", type, type->struct_info.fields_count);
+                    catsprint(&arrays_before, "User_Type_Info* __struct_field_types_%d[%l] = {0};\n", type->type_table_index, type->struct_info.fields_count);
 
                     // Emit array with the names of all fields before, since we don't depend
                     // on any information other than the name string and length.
-                    catsprint(&arrays_before, "string __struct_field_names_%x[%l] = {", type, type->struct_info.fields_count);
+                    catsprint(&arrays_before, "string __struct_field_names_%d[%l] = {", type->type_table_index, type->struct_info.fields_count);
                     for(int f = 0; f < type->struct_info.fields_count; ++f) {
                         Light_Ast* field = type->struct_info.fields[f];
                         assert(field->kind == AST_DECL_VARIABLE);
                         if(f > 0) catsprint(&arrays_before, ", ");
                         catsprint(&arrays_before, "{ 0, %l, \"%s+\" }", 
-                            field->decl_variable.name->length, field->decl_variable.name->length, field->decl_variable.name->data);
+                            field->decl_variable.name->length, field->decl_variable.name->length, token_data(field->decl_variable.name));
                     }
                     catsprint(&arrays_before, "};\n");
                     
                     // Fields offsets
-                    catsprint(&arrays_before, "s64 __struct_field_offsets_%x[%l] = {", type, type->struct_info.fields_count);
+                    catsprint(&arrays_before, "s64 __struct_field_offsets_%d[%l] = {", type->type_table_index, type->struct_info.fields_count);
                     for(int f = 0; f < type->struct_info.fields_count; ++f) {
                         if(f > 0) catsprint(&arrays_before, ", ");
                         catsprint(&arrays_before, "%l", type->struct_info.offset_bits[f]);
@@ -989,12 +987,12 @@ emit_type_table(catstring* buffer, Light_Type** type_table) {
                     for(int f = 0; f < type->struct_info.fields_count; ++f) {
                         Light_Ast* field = type->struct_info.fields[f];
                         assert(field->kind == AST_DECL_VARIABLE);
-                        catsprint(&loader, "__struct_field_types_%x[%l] = &__light_type_table[%l];\n", type, f, type->struct_info.fields[f]->decl_variable.type->type_table_index);
+                        catsprint(&loader, "__struct_field_types_%d[%l] = &__light_type_table[%l];\n", type->type_table_index, f, type->struct_info.fields[f]->decl_variable.type->type_table_index);
                     }
                     catsprint(&loader, "\n");
 
-                    catsprint(&table, " .struct_desc = { (User_Type_Info**)&__struct_field_types_%x, __struct_field_names_%x, (s64*)__struct_field_offsets_%x, %d, %d }", 
-                        type, type, type,
+                    catsprint(&table, " .struct_desc = { (User_Type_Info**)&__struct_field_types_%d, __struct_field_names_%d, (s64*)__struct_field_offsets_%d, %d, %d }", 
+                        type->type_table_index, type->type_table_index, type->type_table_index,
                         type->struct_info.fields_count, 
                         type->struct_info.alignment_bytes);
                 } else {
@@ -1005,29 +1003,29 @@ emit_type_table(catstring* buffer, Light_Type** type_table) {
             case TYPE_KIND_UNION: {
                 if(type->union_info.fields_count > 0) {
                     // forward declaration
-                    catsprint(&arrays_before, "User_Type_Info* __union_field_types_%x[%l] = {0};\n", type, type->union_info.fields_count);
+                    catsprint(&arrays_before, "User_Type_Info* __union_field_types_%d[%l] = {0};\n", type->type_table_index, type->union_info.fields_count);
 
                     // Emit array with the names of all fields before, since we don't depend
                     // on any information other than the name string and length.
-                    catsprint(&arrays_before, "string __union_field_names_%x[%l] = {", type, type->union_info.fields_count);
+                    catsprint(&arrays_before, "string __union_field_names_%d[%l] = {", type->type_table_index, type->union_info.fields_count);
                     for(int f = 0; f < type->union_info.fields_count; ++f) {
                         Light_Ast* field = type->union_info.fields[f];
                         assert(field->kind == AST_DECL_VARIABLE);
                         if(f > 0) catsprint(&arrays_before, ", ");
                         catsprint(&arrays_before, "{ 0, %l, \"%s+\" }", 
-                            field->decl_variable.name->length, field->decl_variable.name->length, field->decl_variable.name->data);
+                            field->decl_variable.name->length, field->decl_variable.name->length, token_data(field->decl_variable.name));
                     }
                     catsprint(&arrays_before, "};\n");
 
                     for(int f = 0; f < type->union_info.fields_count; ++f) {
                         Light_Ast* field = type->union_info.fields[f];
                         assert(field->kind == AST_DECL_VARIABLE);
-                        catsprint(&loader, "__union_field_types_%x[%l] = &__light_type_table[%l];\n", type, f, type->union_info.fields[f]->decl_variable.type->type_table_index);
+                        catsprint(&loader, "__union_field_types_%d[%l] = &__light_type_table[%l];\n", type->type_table_index, f, type->union_info.fields[f]->decl_variable.type->type_table_index);
                     }
                     catsprint(&loader, "\n");
 
-                    catsprint(&table, " .union_desc = { (User_Type_Info**)&__union_field_types_%x, __union_field_names_%x, %d, %d }", 
-                        type, type,
+                    catsprint(&table, " .union_desc = { (User_Type_Info**)&__union_field_types_%d, __union_field_names_%d, %d, %d }", 
+                        type->type_table_index, type->type_table_index,
                         type->union_info.fields_count, 
                         type->union_info.alignment_bytes);
                 } else {
@@ -1051,9 +1049,187 @@ emit_type_table(catstring* buffer, Light_Type** type_table) {
     catstring_append(buffer, &loader);
 }
 
+// Procedures are emitted by the worker threads, each into its own buffer,
+// and appended to the output in declaration order.
+typedef struct {
+    Light_Ast**  procs;
+    catstring*   buffers;
+    volatile s32 next;
+} Light_Emit_Queue;
+
+static void
+emit_procedure_worker(void* arg, s32 worker_index) {
+    Light_Emit_Queue* queue = (Light_Emit_Queue*)arg;
+    while(true) {
+        s32 index = light_atomic_add(&queue->next, 1);
+        if(index >= (s32)array_length(queue->procs)) break;
+        Light_Token* name = queue->procs[index]->decl_proc.name;
+        light_profile_begin("emit procedure", (const char*)token_data(name), name->length);
+        emit_declaration(&queue->buffers[index], queue->procs[index], 0);
+        light_profile_end();
+    }
+}
+
+// A generated C file and the object it compiles to
+typedef struct {
+    catstring source;
+    catstring object;
+} Light_C_Unit;
+
+// Units written by the last backend_c_generate_top_level, main unit first
+static Light_C_Unit* c_units = 0;
+
+// The first line of every unit is a hash of its content, of the header and
+// of the compiler version, a unit is only rewritten when that line changes.
+// Without the build cache its object is removed along with it, with the
+// cache the object is named after the hash instead.
+static void
+unit_write_if_changed(Light_C_Unit* c_unit, u64 header_hash, catstring* unit) {
+    u64 hash = fnv_1_hash_from_start(header_hash, (u8*)unit->data, unit->length);
+    catstring content = {0};
+    catsprint(&content, "// light unit %x\n", hash);
+    int first_line_length = content.length;
+    catstring_append(&content, unit);
+
+    bool changed = true;
+    char first_line[64] = {0};
+    FILE* existing = fopen(c_unit->source.data, "rb");
+    if(existing) {
+        changed = fread(first_line, 1, first_line_length, existing) != first_line_length ||
+            memcmp(first_line, content.data, first_line_length) != 0;
+        fclose(existing);
+    }
+
+    if(light_cache_enabled()) {
+        light_cache_object_path(&c_unit->object, hash);
+    } else if(changed) {
+        remove(c_unit->object.data);
+    }
+    if(changed) catstring_to_file(c_unit->source.data, content);
+    catstring_free(&content);
+}
+
+static void
+unit_filename(catstring* out, const char* path, const char* filename, int unit, const char* extension) {
+    out->length = 0;
+    if(unit == 0) catsprint(out, "%s%s.%s\0", path, filename, extension);
+    else catsprint(out, "%s%s_%d.%s\0", path, filename, unit, extension);
+}
+
+// Procedures of every unit, in declaration order. Contiguous runs of about
+// the same size, or with the build cache one unit per source file, so an
+// edit only changes the units of the files touched.
+static s32**
+units_partition(Light_Emit_Queue* procs, s32 unit_count) {
+    s32** units = array_new(s32*);
+
+    if(light_cache_enabled()) {
+        u16* unit_files = array_new(u16);
+        for(s32 p = 0; p < (s32)array_length(procs->procs); ++p) {
+            u16 file_id = procs->procs[p]->decl_proc.name->file_id;
+            u64 u = 0;
+            while(u < array_length(unit_files) && unit_files[u] != file_id) ++u;
+            if(u == array_length(unit_files)) {
+                array_push(unit_files, file_id);
+                array_push(units, array_new(s32));
+            }
+            array_push(units[u], p);
+        }
+        array_free(unit_files);
+        return units;
+    }
+
+    u64 total_bytes = 0;
+    for(u64 i = 0; i < array_length(procs->procs); ++i)
+        total_bytes += procs->buffers[i].length;
+
+    s32 p = 0;
+    for(s32 u = 0; u < unit_count; ++u) {
+        s32* unit = array_new(s32);
+        u64 unit_bytes = 0;
+        for(; p < (s32)array_length(procs->procs); ++p) {
+            if(u < unit_count - 1 && unit_bytes > 0 && unit_bytes * unit_count >= total_bytes) break;
+            array_push(unit, p);
+            unit_bytes += procs->buffers[p].length;
+        }
+        array_push(units, unit);
+    }
+    return units;
+}
+
+// Writes <filename>.h with everything the units share, <filename>.c with
+// the globals, the type table and main, and the procedures in the units
+// given by units_partition.
+static void
+backend_c_write_units(Light_Ast** ast, catstring* prelude, catstring* table, catstring* init,
+    Light_Emit_Queue* procs, const char* path, const char* filename, s32 unit_count)
+{
+    catstring header = {0};
+    catstring_append(&header, prelude);
+    catsprint(&header, "\n// Forward Declarations\n\n");
+    for(int i = 0; i < array_length(ast); ++i) {
+        if(ast[i]->kind == AST_DECL_PROCEDURE) {
+            emit_proc_forward_decl(&header, ast[i]);
+        } else if(ast[i]->kind == AST_DECL_VARIABLE) {
+            catsprint(&header, "extern ");
+            emit_declaration(&header, ast[i], 0);
+        }
+    }
+    catsprint(&header, "extern User_Type_Info __light_type_table[];\n");
+    catsprint(&header, "void __light_load_type_table();\n");
+    u64 header_hash = fnv_1_hash_from_start(light_cache_seed(), (u8*)header.data, header.length);
+
+    catstring name = {0};
+    unit_filename(&name, path, filename, 0, "h");
+    catstring_to_file(name.data, header);
+    catstring_free(&name);
+
+    catstring include = {0};
+    catsprint(&include, "#include \"%s.h\"\n", filename);
+
+    catstring unit = {0};
+    catstring_append(&unit, &include);
+    catsprint(&unit, "\n// Type table\n\n");
+    catstring_append(&unit, table);
+    catsprint(&unit, "\n// Declarations\n\n");
+    for(int i = 0; i < array_length(ast); ++i) {
+        if(ast[i]->kind == AST_DECL_VARIABLE)
+            emit_declaration(&unit, ast[i], 0);
+    }
+    catstring_append(&unit, init);
+    catsprint(&unit, "int main() { __light_load_type_table(); __light_initialize_top_level(); return __light_main(); }\n");
+
+    s32** units = units_partition(procs, unit_count);
+    c_units = array_new(Light_C_Unit);
+    for(s32 u = 0; u <= (s32)array_length(units); ++u) {
+        if(u > 0) {
+            unit.length = 0;
+            catstring_append(&unit, &include);
+            catsprint(&unit, "\n// Declarations\n\n");
+            s32* unit_procs = units[u - 1];
+            for(u64 i = 0; i < array_length(unit_procs); ++i) {
+                if(!procs->procs[unit_procs[i]]->decl_proc.body) continue; // already in the header
+                catstring_append(&unit, &procs->buffers[unit_procs[i]]);
+            }
+            array_free(unit_procs);
+        }
+
+        Light_C_Unit c_unit = {0};
+        unit_filename(&c_unit.source, path, filename, u, "c");
+        unit_filename(&c_unit.object, path, filename, u, "o");
+        unit_write_if_changed(&c_unit, header_hash, &unit);
+        array_push(c_units, c_unit);
+    }
+    array_free(units);
+
+    catstring_free(&header);
+    catstring_free(&include);
+    catstring_free(&unit);
+}
+
 void 
 backend_c_generate_top_level(Light_Ast** ast, Type_Table type_table, Light_Scope* global_scope,
-    const char* path, const char* filename, const char* compiler_path) 
+    const char* path, const char* filename, const char* compiler_path, s32 thread_count, s32 unit_count) 
 {
     Light_Token* user_type_info_token = token_new_identifier_from_string("User_Type_Info", sizeof("User_Type_Info") - 1);
     Light_Ast* user_type_info_decl = decl_from_name(global_scope, user_type_info_token);
@@ -1077,58 +1253,145 @@ backend_c_generate_top_level(Light_Ast** ast, Type_Table type_table, Light_Scope
 	catsprint(&code, "#define false 0\n");
     catsprint(&code, "\n\n");
 
-    catsprint(&code, "void __memory_copy(void* dest, void* src, u64 size) {\n");
+    // Every unit gets its own copy when the output is split
+    bool split = unit_count > 1 || light_cache_enabled();
+    catsprint(&code, split ? "static void __memory_copy(void* dest, void* src, u64 size) {\n" : "void __memory_copy(void* dest, void* src, u64 size) {\n");
 	catsprint(&code, "\tfor(u64 i = 0; i < size; ++i) ((char*)dest)[i] = ((char*)src)[i];\n");
 	catsprint(&code, "}\n");
 
     // Emit, in order, all type aliases
     emit_forward_type_decl(&code, global_type_array);
 
-    catstring decls = {0};
-    catsprint(&decls, "\n// Forward Declarations\n\n");
+    // Emit type table, this also assigns the indices used by the procedures
+    catstring table = {0};
+    emit_type_table(&table, global_type_array);
 
+    Light_Emit_Queue procs = {0};
+    procs.procs = array_new(Light_Ast*);
     for(int i = 0; i < array_length(ast); ++i) {
-        if(ast[i]->kind == AST_DECL_PROCEDURE) {
-            emit_proc_forward_decl(&decls, ast[i]);
-        } else if(ast[i]->kind == AST_DECL_VARIABLE) {
-            emit_declaration(&decls, ast[i], 0);
-        }
+        if(ast[i]->kind == AST_DECL_PROCEDURE) array_push(procs.procs, ast[i]);
     }
-
-    // Emit type table
-    catsprint(&decls, "\n// Type table\n\n");
-    emit_type_table(&decls, global_type_array);
+    procs.buffers = calloc(array_length(procs.procs) + 1, sizeof(catstring));
+    light_threads_run(thread_count, emit_procedure_worker, &procs);
 
     // Emit top level initialization
     catstring init_function = {0};
     catstring init_function_before = {0};
     catsprint(&init_function, "void __light_initialize_top_level() {\n");
-
-    catsprint(&decls, "\n// Declarations\n\n");
     for(int i = 0; i < array_length(ast); ++i) {
         Light_Ast* node = ast[i];
-        emit_declaration(&decls, node, 0);
-        if(node->kind == AST_DECL_VARIABLE && node->decl_variable.assignment) {            
+        if(node->kind == AST_DECL_VARIABLE && node->decl_variable.assignment) {
             //emit_variable_assignment(&init_function, node->decl_variable.name, node->decl_variable.assignment);
             emit_variable_assignment_top_level(&init_function, &init_function_before, node->decl_variable.name, node->decl_variable.assignment);
             catsprint(&init_function, ";\n");
         }
     }
     catsprint(&init_function, "}\n");
+    catstring_append(&init_function_before, &init_function);
 
-    catstring_append(&code, &decls);
-    catstring_append(&code, &init_function_before);
-    catstring_append(&code, &init_function);
+    if(split) {
+        backend_c_write_units(ast, &code, &table, &init_function_before, &procs, path, filename, unit_count);
+    } else {
+        catstring decls = {0};
+        catsprint(&decls, "\n// Forward Declarations\n\n");
+
+        for(int i = 0; i < array_length(ast); ++i) {
+            if(ast[i]->kind == AST_DECL_PROCEDURE) {
+                emit_proc_forward_decl(&decls, ast[i]);
+            } else if(ast[i]->kind == AST_DECL_VARIABLE) {
+                emit_declaration(&decls, ast[i], 0);
+            }
+        }
 
-    catsprint(&code, "int main() { __light_load_type_table(); __light_initialize_top_level(); return __light_main(); }\n");
+        catsprint(&decls, "\n// Type table\n\n");
+        catstring_append(&decls, &table);
 
-    catstring outfile = {0};
-    catsprint(&outfile, "%s%s.c\0", path, filename);
-    catstring_to_file(outfile.data, code);
+        catsprint(&decls, "\n// Declarations\n\n");
+        for(int i = 0, p = 0; i < array_length(ast); ++i) {
+            Light_Ast* node = ast[i];
+            if(node->kind == AST_DECL_PROCEDURE) {
+                catstring_append(&decls, &procs.buffers[p++]);
+            } else {
+                emit_declaration(&decls, node, 0);
+            }
+        }
+
+        catstring_append(&code, &decls);
+        catstring_append(&code, &init_function_before);
+
+        catsprint(&code, "int main() { __light_load_type_table(); __light_initialize_top_level(); return __light_main(); }\n");
+
+        catstring outfile = {0};
+        catsprint(&outfile, "%s%s.c\0", path, filename);
+        catstring_to_file(outfile.data, code);
+    }
+
+    for(u64 i = 0; i < array_length(procs.procs); ++i)
+        catstring_free(&procs.buffers[i]);
+    array_free(procs.procs);
+    free(procs.buffers);
 }
 
-void 
-backend_c_compile_with_gcc(Light_Ast** ast, const char* filename, const char* working_directory) {
+// Units whose object file is missing are compiled by the worker threads,
+// one gcc process each, then everything is linked.
+typedef struct {
+    volatile s32 next;
+    volatile s32 failed;
+} Light_Compile_Queue;
+
+static void
+compile_unit_worker(void* arg, s32 worker_index) {
+    Light_Compile_Queue* queue = (Light_Compile_Queue*)arg;
+    catstring command = {0};
+    while(true) {
+        s32 index = light_atomic_add(&queue->next, 1);
+        if(index >= (s32)array_length(c_units)) break;
+
+        Light_C_Unit* unit = &c_units[index];
+        if(light_file_exists(unit->object.data)) continue;
+
+        command.length = 0;
+        catsprint(&command, "gcc -g -c %s -o %s\0", unit->source.data, unit->object.data);
+        light_profile_begin("gcc unit", unit->source.data, (s32)strlen(unit->source.data));
+        if(system(command.data) != 0)
+            light_atomic_add(&queue->failed, 1);
+        light_profile_end();
+    }
+    catstring_free(&command);
+}
+
+bool 
+backend_c_compile_with_gcc(Light_Ast** ast, const char* filename, const char* working_directory, s32 thread_count) {
+    if(c_units) {
+        Light_Compile_Queue queue = {0};
+        light_threads_run(thread_count, compile_unit_worker, &queue);
+
+        catstring command = {0};
+        catsprint(&command, "gcc -g");
+        for(u64 i = 0; i < array_length(c_units); ++i) {
+            catsprint(&command, " %s", c_units[i].object.data);
+            catstring_free(&c_units[i].source);
+            catstring_free(&c_units[i].object);
+        }
+        array_free(c_units);
+        c_units = 0;
+        if(queue.failed) {
+            catstring_free(&command);
+            return false;
+        }
+
+        #if defined(__linux__)
+        catsprint(&command, " -o %s%s -lX11 -lGL -lm\0", working_directory, filename);
+        #elif defined(_WIN32) || defined(_WIN64)
+        catsprint(&command, " -o %s%s.exe\0", working_directory, filename);
+        #endif
+        light_profile_begin("link", 0, 0);
+        bool linked = system(command.data) == 0;
+        light_profile_end();
+        catstring_free(&command);
+        return linked;
+    }
+
     char command_buffer[2048] = {0};
     #if defined(__linux__)
     sprintf(command_buffer, "gcc -g %s%s.c -o %s%s -lX11 -lGL -lm", 
@@ -1137,5 +1400,5 @@ backend_c_compile_with_gcc(Light_Ast** ast, const char* filename, const char* wo
     sprintf(command_buffer, "gcc -g %s%s.c -o %s%s.exe", 
         working_directory, filename, working_directory, filename);
     #endif
-    system(command_buffer);
-}
\ No newline at end of file
+    return system(command_buffer) == 0;
+}
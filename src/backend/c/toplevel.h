@@ -2,5 +2,9 @@
 #include "../../ast.h"
 #include "../../global_tables.h"
 
-void backend_c_generate_top_level(Light_Ast** ast, Type_Table type_table, Light_Scope* global_scope, const char* path, const char* filename, const char* compiler_path);
-void backend_c_compile_with_gcc(Light_Ast** ast, const char* filename, const char* working_directory);
\ No newline at end of file
+// With unit_count > 1, or with the build cache, the output is split in a
+// header, a main unit and procedure units compiled by parallel gcc jobs.
+// Units whose content did not change since the last build are not
+// compiled again.
+void backend_c_generate_top_level(Light_Ast** ast, Type_Table type_table, Light_Scope* global_scope, const char* path, const char* filename, const char* compiler_path, s32 thread_count, s32 unit_count);
+bool backend_c_compile_with_gcc(Light_Ast** ast, const char* filename, const char* working_directory, s32 thread_count);
\ No newline at end of file
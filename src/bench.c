@@ -0,0 +1,464 @@
+#include "bench.h"
+#include "lexer.h"
+#include "parser.h"
+#include "ast.h"
+#include "type.h"
+#include "global_tables.h"
+#include "top_typecheck.h"
+#include "backend/c/toplevel.h"
+#include "utils/os.h"
+#include "utils/catstring.h"
+#include <light_array.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+#endif
+
+#define LIGHT_BENCH_MAX_RUNS 1024
+
+typedef struct {
+    s32 procedures;  // spread over the imported files
+    s32 depth;       // operators in the expression of every procedure
+    s32 fields;      // fields of the struct of every procedure
+    s32 imports;     // files imported by main, 0 puts everything in main
+    s32 prints;      // print calls in every procedure
+    s32 runs;
+    s32 thread_count;
+    const char* directory;
+    const char* baseline_file;
+    const char* save_file;
+    double      tolerance; // percent
+} Light_Bench_Config;
+
+typedef enum {
+    BENCH_PHASE_LEX = 0,
+    BENCH_PHASE_PARSE,
+    BENCH_PHASE_TYPE_CHECK,
+    BENCH_PHASE_GENERATE,
+
+    BENCH_PHASE_COUNT,
+} Light_Bench_Phase;
+
+static const char* bench_phase_names[BENCH_PHASE_COUNT] = {
+    "lex", "parse", "type check", "code generation",
+};
+static const char* bench_phase_units[BENCH_PHASE_COUNT] = {
+    "tokens", "nodes", "types", "bytes",
+};
+// Keys of the baseline file
+static const char* bench_phase_keys[BENCH_PHASE_COUNT] = {
+    "tokens_per_second", "nodes_per_second", "types_per_second", "bytes_per_second",
+};
+
+// One compilation, written by the child that ran it
+typedef struct {
+    double elapsed_us[BENCH_PHASE_COUNT];
+    u64    count[BENCH_PHASE_COUNT];
+    bool   failed;
+} Light_Bench_Sample;
+
+static void
+print_usage() {
+    fprintf(stderr, "usage: light --bench [-procs N] [-depth N] [-fields N] [-imports N] [-prints N]\n");
+    fprintf(stderr, "                     [-runs N] [-jN] [-dir path] [-save file] [-baseline file] [-tolerance P]\n");
+    fprintf(stderr, "  -procs     procedures generated (default: 400)\n");
+    fprintf(stderr, "  -depth     operators in the expression of every procedure (default: 24)\n");
+    fprintf(stderr, "  -fields    fields of the struct of every procedure (default: 16)\n");
+    fprintf(stderr, "  -imports   files the procedures are spread over (default: 8)\n");
+    fprintf(stderr, "  -prints    print calls in every procedure (default: 4)\n");
+    fprintf(stderr, "  -runs      compilations measured, the median is reported (default: 10)\n");
+    fprintf(stderr, "  -jN        use N threads (default: 1)\n");
+    fprintf(stderr, "  -dir       where the program is generated (default: .light_bench)\n");
+    fprintf(stderr, "  -save      write the throughput of this run as a baseline\n");
+    fprintf(stderr, "  -baseline  fail if a throughput is below the one in file by more than the tolerance\n");
+    fprintf(stderr, "  -tolerance percent a throughput may drop (default: 10)\n");
+}
+
+static bool
+parse_count(const char* arg, s32 min, s32* out) {
+    char* end = 0;
+    long value = strtol(arg, &end, 10);
+    if(*arg == 0 || *end != 0 || value < min || value > 1000000) return false;
+    *out = (s32)value;
+    return true;
+}
+
+static bool
+parse_options(int argc, char** argv, Light_Bench_Config* config) {
+    config->procedures = 400;
+    config->depth = 24;
+    config->fields = 16;
+    config->imports = 8;
+    config->prints = 4;
+    config->runs = 10;
+    config->thread_count = 1;
+    config->directory = ".light_bench";
+    config->tolerance = 10.0;
+
+    for(int i = 0; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+        if(argv[i][0] == '-' && argv[i][1] == 'j') {
+            ok = parse_count(argv[i] + 2, 1, &config->thread_count);
+        } else if(strcmp(argv[i], "-procs") == 0 && has_value) {
+            ok = parse_count(argv[++i], 1, &config->procedures);
+        } else if(strcmp(argv[i], "-depth") == 0 && has_value) {
+            ok = parse_count(argv[++i], 0, &config->depth);
+        } else if(strcmp(argv[i], "-fields") == 0 && has_value) {
+            ok = parse_count(argv[++i], 1, &config->fields);
+        } else if(strcmp(argv[i], "-imports") == 0 && has_value) {
+            ok = parse_count(argv[++i], 0, &config->imports);
+        } else if(strcmp(argv[i], "-prints") == 0 && has_value) {
+            ok = parse_count(argv[++i], 0, &config->prints);
+        } else if(strcmp(argv[i], "-runs") == 0 && has_value) {
+            ok = parse_count(argv[++i], 1, &config->runs) && config->runs <= LIGHT_BENCH_MAX_RUNS;
+        } else if(strcmp(argv[i], "-dir") == 0 && has_value) {
+            config->directory = argv[++i];
+        } else if(strcmp(argv[i], "-save") == 0 && has_value) {
+            config->save_file = argv[++i];
+        } else if(strcmp(argv[i], "-baseline") == 0 && has_value) {
+            config->baseline_file = argv[++i];
+        } else if(strcmp(argv[i], "-tolerance") == 0 && has_value) {
+            config->tolerance = atof(argv[++i]);
+            ok = config->tolerance >= 0.0;
+        } else {
+            ok = false;
+        }
+        if(!ok) return false;
+    }
+    // Every file gets at least one procedure
+    if(config->imports > config->procedures)
+        config->imports = config->procedures;
+    return true;
+}
+
+// -------------------------------------------
+// -------------- Generator ------------------
+// -------------------------------------------
+
+static const char* bench_field_types[] = { "s32", "r32", "s64", "u16" };
+static const char* bench_operators[] = { "+", "*", "-" };
+
+// Procedure k takes its own struct and calls k - 1 when it is in the same file
+static void
+generate_procedure(catstring* out, Light_Bench_Config* config, s32 k, bool calls_previous) {
+    catsprint(out, "Bench_%d struct {\n", k);
+    catsprint(out, "    field_0 : s32;\n");
+    for(s32 f = 1; f < config->fields; ++f)
+        catsprint(out, "    field_%d : %s;\n", f, bench_field_types[f % 4]);
+    catsprint(out, "}\n\n");
+
+    catsprint(out, "bench_%d : (a : s32, b : s32, s : ^Bench_%d) -> s32 {\n", k, k);
+
+    // (((a + b) * 7) - s.field_0) ...
+    catsprint(out, "    x : s32 = ");
+    for(s32 d = 0; d < config->depth; ++d)
+        catsprint(out, "(");
+    catsprint(out, "a");
+    for(s32 d = 0; d < config->depth; ++d) {
+        switch(d % 3) {
+            case 0: catsprint(out, " %s b)", bench_operators[d % 3]); break;
+            case 1: catsprint(out, " %s %d)", bench_operators[d % 3], (k + d) % 7 + 1); break;
+            case 2: catsprint(out, " %s s.field_0)", bench_operators[d % 3]); break;
+        }
+    }
+    catsprint(out, ";\n");
+    catsprint(out, "    s.field_0 = x;\n");
+
+    if(calls_previous) {
+        catsprint(out, "    t : Bench_%d;\n", k - 1);
+        catsprint(out, "    x = x + bench_%d(b, x, &t);\n", k - 1);
+    }
+    catsprint(out, "    if x > a {\n        x = x - b;\n    } else {\n        x = x + b;\n    }\n");
+    catsprint(out, "    while x > 1000 {\n        x = x / 2;\n    }\n");
+    for(s32 p = 0; p < config->prints; ++p)
+        catsprint(out, "    print(\"bench_%d %s\\n\", x, a, s.field_%d);\n", k, "% % %", p % config->fields);
+    catsprint(out, "    return x;\n}\n\n");
+}
+
+// Returns the number of files written, the first one is main.li, 0 on failure
+static s32
+generate_program(Light_Bench_Config* config, const char* print_module, catstring* main_path) {
+    s32 file_count = (config->imports > 0) ? config->imports : 1;
+
+    catstring main_file = {0};
+    catsprint(&main_file, "#import \"%s\"\n", print_module);
+    for(s32 i = 0; i < config->imports; ++i)
+        catsprint(&main_file, "#import \"bench_%d.li\"\n", i);
+    catsprint(&main_file, "\n");
+
+    catstring calls = {0};
+    catstring path = {0};
+    for(s32 i = 0; i < file_count; ++i) {
+        s32 first = (s32)((s64)i * config->procedures / file_count);
+        s32 last = (s32)((s64)(i + 1) * config->procedures / file_count);
+
+        catstring file = {0};
+        catstring* out = &main_file;
+        if(config->imports > 0) {
+            out = &file;
+            catsprint(out, "#import \"%s\"\n\n", print_module);
+        }
+        for(s32 k = first; k < last; ++k)
+            generate_procedure(out, config, k, k > first);
+
+        if(config->imports > 0) {
+            path.length = 0;
+            catsprint(&path, "%s/bench_%d.li\0", config->directory, i);
+            bool written = catstring_to_file(path.data, file) == 0;
+            catstring_free(&file);
+            if(!written) return 0;
+        }
+        catsprint(&calls, "    s_%d : Bench_%d;\n", i, last - 1);
+        catsprint(&calls, "    x = x + bench_%d(x, %d, &s_%d);\n", last - 1, i + 1, i);
+    }
+
+    catsprint(&main_file, "main : () -> s32 {\n    x : s32 = 0;\n");
+    catstring_append(&main_file, &calls);
+    catsprint(&main_file, "    print(\"%s\\n\", x);\n    return 0;\n}\n", "%");
+
+    catsprint(main_path, "%s/main.li\0", config->directory);
+    bool written = catstring_to_file(main_path->data, main_file) == 0;
+
+    catstring_free(&main_file);
+    catstring_free(&calls);
+    catstring_free(&path);
+    return written ? config->imports + 1 : 0;
+}
+
+// -------------------------------------------
+// -------------- Measurement ----------------
+// -------------------------------------------
+
+// A full compilation without gcc, it leaves the global tables filled
+static void
+bench_sample(Light_Bench_Config* config, const char* main_path, s32 file_count, Light_Bench_Sample* sample) {
+    // Lexing alone, only the generated files
+    catstring path = {0};
+    double start = os_time_us();
+    for(s32 i = 0; i < file_count; ++i) {
+        path.length = 0;
+        if(i == 0) catsprint(&path, "%s\0", main_path);
+        else catsprint(&path, "%s/bench_%d.li\0", config->directory, i - 1);
+
+        Light_Lexer lexer = {0};
+        Light_Token* tokens = lexer_file(&lexer, path.data, 0);
+        if(!tokens) {
+            sample->failed = true;
+            return;
+        }
+        sample->count[BENCH_PHASE_LEX] += array_length(tokens);
+    }
+    sample->elapsed_us[BENCH_PHASE_LEX] = os_time_us() - start;
+
+    Light_Parser parser = {0};
+    Light_Scope  global_scope = {0};
+    parse_init_modules(&parser, &global_scope, global_compiler_path.data, global_compiler_path.length);
+    parse_push_root(&parser, main_path);
+
+    u32 parser_error = 0;
+    s32 nodes_before = ast_id_count();
+    start = os_time_us();
+    Light_Ast** ast = parse_files(&parser, config->thread_count, &parser_error);
+    sample->elapsed_us[BENCH_PHASE_PARSE] = os_time_us() - start;
+    sample->count[BENCH_PHASE_PARSE] = ast_id_count() - nodes_before;
+    if(parser_error & PARSER_ERROR_FATAL) {
+        sample->failed = true;
+        return;
+    }
+
+    u64 types_before = type_internalize_count();
+    start = os_time_us();
+    Light_Type_Error type_error = top_typecheck(ast, &global_scope, config->thread_count);
+    sample->elapsed_us[BENCH_PHASE_TYPE_CHECK] = os_time_us() - start;
+    sample->count[BENCH_PHASE_TYPE_CHECK] = type_internalize_count() - types_before;
+    if(type_error & TYPE_ERROR) {
+        sample->failed = true;
+        return;
+    }
+
+    path.length = 0;
+    catsprint(&path, "%s/\0", config->directory);
+    start = os_time_us();
+    backend_c_generate_top_level(ast, global_type_table, &global_scope, path.data, "main", global_compiler_path.data, config->thread_count, 1);
+    sample->elapsed_us[BENCH_PHASE_GENERATE] = os_time_us() - start;
+
+    path.length = 0;
+    catsprint(&path, "%s/main.c\0", config->directory);
+    size_t size_bytes = 0;
+    char* generated = light_read_entire_file(path.data, &size_bytes);
+    if(!generated) {
+        sample->failed = true;
+        return;
+    }
+    free(generated);
+    sample->count[BENCH_PHASE_GENERATE] = size_bytes;
+    catstring_free(&path);
+}
+
+#if defined(__linux__)
+// Every run compiles in a fresh child, the compiler has no way to reset
+// its global tables.
+static bool
+bench_run_isolated(Light_Bench_Config* config, const char* main_path, s32 file_count, Light_Bench_Sample* sample) {
+    int fds[2];
+    if(pipe(fds) != 0) {
+        fprintf(stderr, "could not create a pipe: %s\n", strerror(errno));
+        return false;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if(pid == 0) {
+        close(fds[0]);
+        Light_Bench_Sample result = {0};
+        bench_sample(config, main_path, file_count, &result);
+        bool sent = write(fds[1], &result, sizeof(result)) == sizeof(result);
+        close(fds[1]);
+        _exit(sent ? 0 : 1);
+    } else if(pid < 0) {
+        fprintf(stderr, "fork failed: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    close(fds[1]);
+    ssize_t size = 0;
+    while((size = read(fds[0], sample, sizeof(*sample))) < 0 && errno == EINTR);
+    close(fds[0]);
+    waitpid(pid, 0, 0);
+    return size == sizeof(*sample) && !sample->failed;
+}
+#endif
+
+static int
+compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Baseline files hold one "key value" line per phase
+static bool
+baseline_read(const char* filename, double throughput[BENCH_PHASE_COUNT]) {
+    FILE* file = fopen(filename, "r");
+    if(!file) return false;
+
+    char key[64];
+    double value = 0.0;
+    while(fscanf(file, "%63s %lf", key, &value) == 2) {
+        for(s32 p = 0; p < BENCH_PHASE_COUNT; ++p) {
+            if(strcmp(key, bench_phase_keys[p]) == 0)
+                throughput[p] = value;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+static bool
+baseline_write(const char* filename, double throughput[BENCH_PHASE_COUNT]) {
+    FILE* file = fopen(filename, "w");
+    if(!file) return false;
+    for(s32 p = 0; p < BENCH_PHASE_COUNT; ++p)
+        fprintf(file, "%s %.0f\n", bench_phase_keys[p], throughput[p]);
+    return fclose(file) == 0;
+}
+
+int
+light_bench_run(int argc, char** argv) {
+    Light_Bench_Config config = {0};
+    if(!parse_options(argc, argv, &config)) {
+        print_usage();
+        return 1;
+    }
+#if !defined(__linux__)
+    // Without fork the global tables keep the first compilation
+    config.runs = 1;
+#endif
+
+    if(!light_make_directory(config.directory)) {
+        fprintf(stderr, "could not create directory %s\n", config.directory);
+        return 1;
+    }
+
+    uint64_t print_module_length = 0;
+    const char* print_module = light_real_path_from(global_compiler_path.data, global_compiler_path.length, "/../modules/print.li", &print_module_length);
+    if(!print_module) {
+        fprintf(stderr, "could not find modules/print.li\n");
+        return 1;
+    }
+
+    catstring main_path = {0};
+    s32 file_count = generate_program(&config, print_module, &main_path);
+    if(file_count == 0) return 1;
+
+    printf("- benchmark: %d procedures in %d files, depth %d, %d fields, %d prints, %d threads\n\n",
+        config.procedures, file_count, config.depth, config.fields, config.prints, config.thread_count);
+
+    static double elapsed[BENCH_PHASE_COUNT][LIGHT_BENCH_MAX_RUNS];
+    u64 count[BENCH_PHASE_COUNT] = {0};
+    for(s32 r = 0; r < config.runs; ++r) {
+        Light_Bench_Sample sample = {0};
+#if defined(__linux__)
+        bool ok = bench_run_isolated(&config, main_path.data, file_count, &sample);
+#else
+        bench_sample(&config, main_path.data, file_count, &sample);
+        bool ok = !sample.failed;
+#endif
+        if(!ok) {
+            fprintf(stderr, "could not compile %s\n", main_path.data);
+            return 1;
+        }
+        for(s32 p = 0; p < BENCH_PHASE_COUNT; ++p) {
+            elapsed[p][r] = sample.elapsed_us[p];
+            count[p] = sample.count[p];
+        }
+    }
+
+    double throughput[BENCH_PHASE_COUNT] = {0};
+    for(s32 p = 0; p < BENCH_PHASE_COUNT; ++p) {
+        qsort(elapsed[p], config.runs, sizeof(double), compare_double);
+        double median_us = elapsed[p][config.runs / 2];
+        if(config.runs % 2 == 0)
+            median_us = (median_us + elapsed[p][config.runs / 2 - 1]) / 2.0;
+        if(median_us > 0.0)
+            throughput[p] = count[p] / (median_us / 1000000.0);
+
+        printf("  %-16s %9.2f ms (min %.2f, max %.2f)  %10llu %-6s %12.0f %s/s\n", bench_phase_names[p],
+            median_us / 1000.0, elapsed[p][0] / 1000.0, elapsed[p][config.runs - 1] / 1000.0,
+            (unsigned long long)count[p], bench_phase_units[p], throughput[p], bench_phase_units[p]);
+    }
+    printf("\n  median of %d runs\n", config.runs);
+
+    int result = 0;
+    if(config.baseline_file) {
+        double baseline[BENCH_PHASE_COUNT] = {0};
+        if(!baseline_read(config.baseline_file, baseline)) {
+            fprintf(stderr, "could not read the baseline %s\n", config.baseline_file);
+            return 1;
+        }
+        printf("\n- baseline %s, tolerance %.1f%%:\n\n", config.baseline_file, config.tolerance);
+        for(s32 p = 0; p < BENCH_PHASE_COUNT; ++p) {
+            if(baseline[p] <= 0.0) continue;
+            double change = (throughput[p] - baseline[p]) / baseline[p] * 100.0;
+            bool regressed = change < -config.tolerance;
+            printf("  %-16s %+7.1f%% %s\n", bench_phase_names[p], change, regressed ? "REGRESSION" : "ok");
+            if(regressed) result = 1;
+        }
+    }
+    if(config.save_file && !baseline_write(config.save_file, throughput)) {
+        fprintf(stderr, "could not write the baseline %s\n", config.save_file);
+        result = 1;
+    }
+
+    catstring_free(&main_path);
+    return result;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <common.h>
+
+// Compiler throughput benchmark, run with light --bench [options].
+//
+// Generates a synthetic program in a scratch directory, then compiles it
+// several times measuring lexing, parsing, type checking and C generation
+// separately, and reports the median time and throughput of each phase:
+// tokens, AST nodes, type internalizations and emitted C bytes per second.
+//
+// The results can be saved as a baseline, a later run compared against it
+// fails when any throughput dropped by more than the tolerance.
+//
+// The global tables must be set up as for a normal compilation, the
+// modules are parsed by every run.
+
+int light_bench_run(int argc, char** argv);
@@ -5,13 +5,14 @@
 #include "type.h"
 #include "bytecode.h"
 #include "utils/allocator.h"
+#include "utils/intern.h"
 
 u64 call_info_hash(Bytecode_CallInfo ci) {
-    return fnv_1_hash(ci.name->data, ci.name->length);
+    return light_intern_hash(token_data(ci.name));
 }
 
 int call_info_equal(Bytecode_CallInfo t1, Bytecode_CallInfo t2) {
-    return t1.name->data == t2.name->data;
+    return t1.name->ident == t2.name->ident;
 }
 
 GENERATE_HASH_TABLE_IMPLEMENTATION(Bytecode_Calls, bytecode_calls, Bytecode_CallInfo, 
@@ -918,7 +919,7 @@ bytecode_gen_ast(Light_Ast** ast) {
 
     state.vmstate = light_vm_init();
 
-    bytecode_calls_table_new(&state.call_table, 65536);
+    bytecode_calls_table_new(&state.call_table, 256);
 
     Light_VM_Instruction_Info call = 
         light_vm_push(state.vmstate, "call 0xff");
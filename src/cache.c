@@ -0,0 +1,180 @@
+#include "cache.h"
+#include "utils/os.h"
+#include "utils/string_table.h"
+#include <light_array.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Any rebuild of the compiler invalidates the cache
+#define LIGHT_CACHE_VERSION "light " __DATE__ " " __TIME__
+
+static catstring cache_directory;
+static bool      cache_enabled;
+static u64*      cache_objects; // keys of the objects the current build links
+
+void
+light_cache_init(const char* main_file_directory) {
+    cache_directory.length = 0;
+    catsprint(&cache_directory, "%s.light_cache/\0", main_file_directory);
+    if(!cache_objects) cache_objects = array_new(u64);
+    array_length(cache_objects) = 0;
+    cache_enabled = light_make_directory(cache_directory.data);
+    if(!cache_enabled)
+        fprintf(stderr, "Could not create the build cache directory %s\n", cache_directory.data);
+}
+
+bool
+light_cache_enabled() {
+    return cache_enabled;
+}
+
+u64
+light_cache_seed() {
+    return fnv_1_hash((const u8*)LIGHT_CACHE_VERSION, sizeof(LIGHT_CACHE_VERSION) - 1);
+}
+
+void
+light_cache_path(catstring* out, u64 key, const char* extension) {
+    out->length = 0;
+    catsprint(out, "%s%x.%s\0", cache_directory.data, key, extension);
+}
+
+void
+light_cache_object_path(catstring* out, u64 key) {
+    light_cache_path(out, key, "o");
+    array_push(cache_objects, key);
+}
+
+static void
+manifest_path(catstring* out, const char* name) {
+    out->length = 0;
+    catsprint(out, "%s%s.manifest\0", cache_directory.data, name);
+}
+
+static u64
+file_content_hash(const char* filepath, bool* found) {
+    *found = light_file_exists(filepath);
+    if(!*found) return 0;
+
+    size_t size = 0;
+    char* data = light_read_entire_file(filepath, &size);
+    if(!data) {
+        *found = false;
+        return 0;
+    }
+    u64 hash = fnv_1_hash_from_start(light_cache_seed(), (const u8*)data, size);
+    free(data);
+    return hash;
+}
+
+// The manifest is the compiler version followed by a line with the
+// content hash and path of every source file, then an objects line and
+// the key of every object the build linked.
+bool
+light_cache_manifest_fresh(const char* name, const char* output) {
+    if(!cache_enabled || !light_file_exists(output)) return false;
+
+    catstring path = {0};
+    manifest_path(&path, name);
+    FILE* manifest = fopen(path.data, "rb");
+    catstring_free(&path);
+    if(!manifest) return false;
+
+    char line[4096] = {0};
+    bool fresh = fgets(line, sizeof(line), manifest) && strcmp(line, LIGHT_CACHE_VERSION "\n") == 0;
+    s32 files = 0;
+    while(fresh && fgets(line, sizeof(line), manifest)) {
+        if(strcmp(line, "objects\n") == 0) break;
+        char* newline = strchr(line, '\n');
+        char* space = strchr(line, ' ');
+        if(!newline || !space) {
+            fresh = false;
+            break;
+        }
+        *newline = 0;
+
+        bool found = false;
+        u64 hash = file_content_hash(space + 1, &found);
+        fresh = found && hash == strtoull(line, 0, 16);
+        files++;
+    }
+    fclose(manifest);
+
+    return fresh && files > 0;
+}
+
+void
+light_cache_manifest_write(const char* name, Light_Parse_Queue* queue) {
+    if(!cache_enabled) return;
+
+    catstring manifest = {0};
+    catsprint(&manifest, "%s\n", LIGHT_CACHE_VERSION);
+    for(u64 i = 0; i < array_length(queue->units); ++i) {
+        Light_Parse_Unit* unit = queue->units[i];
+        u64 hash = fnv_1_hash_from_start(light_cache_seed(), unit->lexer.stream, unit->lexer.stream_size_bytes);
+        catsprint(&manifest, "%x %s+\n", hash, unit->filepath.length, unit->filepath.data);
+    }
+    catsprint(&manifest, "objects\n");
+    for(u64 i = 0; i < array_length(cache_objects); ++i)
+        catsprint(&manifest, "%x\n", cache_objects[i]);
+
+    catstring path = {0};
+    manifest_path(&path, name);
+    catstring_to_file(path.data, manifest);
+    catstring_free(&path);
+    catstring_free(&manifest);
+
+    light_cache_evict();
+}
+
+// Adds to the array user the objects listed by a manifest of this compiler
+// version, the ones of other versions can never be used again.
+static void
+evict_collect_objects(const char* name, void* user) {
+    u64** keep = (u64**)user;
+    size_t length = strlen(name);
+    if(length < sizeof(".manifest") || strcmp(name + length - sizeof(".manifest") + 1, ".manifest") != 0) return;
+
+    catstring path = {0};
+    catsprint(&path, "%s%s\0", cache_directory.data, name);
+    FILE* manifest = fopen(path.data, "rb");
+    catstring_free(&path);
+    if(!manifest) return;
+
+    char line[4096] = {0};
+    bool objects = false;
+    if(fgets(line, sizeof(line), manifest) && strcmp(line, LIGHT_CACHE_VERSION "\n") == 0) {
+        while(fgets(line, sizeof(line), manifest)) {
+            if(objects) array_push(*keep, strtoull(line, 0, 16));
+            else objects = strcmp(line, "objects\n") == 0;
+        }
+    }
+    fclose(manifest);
+}
+
+static void
+evict_remove_object(const char* name, void* user) {
+    u64* keep = (u64*)user;
+    char* end = 0;
+    u64 key = strtoull(name, &end, 16);
+    if(end == name || strcmp(end, ".o") != 0) return;
+
+    for(u64 i = 0; i < array_length(keep); ++i)
+        if(keep[i] == key) return;
+
+    catstring path = {0};
+    catsprint(&path, "%s%s\0", cache_directory.data, name);
+    remove(path.data);
+    catstring_free(&path);
+}
+
+void
+light_cache_evict() {
+    if(!cache_enabled) return;
+
+    u64* keep = array_new(u64);
+    if(light_directory_each(cache_directory.data, evict_collect_objects, &keep))
+        light_directory_each(cache_directory.data, evict_remove_object, keep);
+    array_free(keep);
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <common.h>
+#include "parser.h"
+
+// On-disk build cache, in a .light_cache directory next to the main file.
+// Everything stored is keyed by a content hash mixed with the compiler
+// version, so a different compiler never picks up stale entries.
+//
+// - <name>.manifest: content hash of every source file of the last good
+//   build, when none changed the whole build is skipped.
+// - <key>.o: object file of a generated C unit, keyed by the unit content.
+//   Objects no manifest lists are removed after each build.
+
+void        light_cache_init(const char* main_file_directory);
+bool        light_cache_enabled();
+u64         light_cache_seed(); // hash of the compiler version, to start keys from
+void        light_cache_path(catstring* out, u64 key, const char* extension);
+void        light_cache_object_path(catstring* out, u64 key); // also lists the object in the next manifest
+
+bool        light_cache_manifest_fresh(const char* name, const char* output);
+void        light_cache_manifest_write(const char* name, Light_Parse_Queue* queue);
+void        light_cache_evict(); // removes the objects no manifest of this compiler version lists
@@ -3,7 +3,9 @@
 #include <stdarg.h>
 #include "top_typecheck.h"
 
-#define TOKEN_STR(T) (T)->length, (T)->data
+#define TOKEN_STR(T) (T)->length, token_data(T)
+
+light_thread_local FILE* type_error_stream = 0;
 
 static const char* ColorReset   = "\x1B[0m";
 static const char* ColorRed     = "\x1B[31m";
@@ -11,9 +13,9 @@ static const char* ColorRed     = "\x1B[31m";
 s32
 type_error_location(Light_Token* t) {
     if(!t) {
-        return 0;//fprintf(stderr, "%s: ", t->filepath);
+        return 0;
     } else {
-        return fprintf(stderr, "%s:%d:%d: ", t->filepath, t->line + 1, t->column + 1);
+        return fprintf(TYPE_ERROR_STREAM, "%s:%d:%d: ", token_filepath(t), token_line(t) + 1, token_column(t) + 1);
     }
     return 0;
 }
@@ -28,8 +30,8 @@ type_error(u32* error, Light_Token* location, const char* fmt, ...) {
     if(location) {
         length += type_error_location(location);
     }
-    length += fprintf(stderr, "%sType Error%s: ", ColorRed, ColorReset);
-    length += vfprintf(stderr, fmt, args);
+    length += fprintf(TYPE_ERROR_STREAM, "%sType Error%s: ", ColorRed, ColorReset);
+    length += vfprintf(TYPE_ERROR_STREAM, fmt, args);
     va_end(args);
     
     return length;
@@ -41,7 +43,7 @@ type_error_undeclared_identifier(u32* error, Light_Token* t) {
     
     s32 length = 0;
     length += type_error_location(t);
-    length += fprintf(stderr, "%sType Error%s: undeclared identifier '%.*s'\n", ColorRed, ColorReset, TOKEN_STR(t));
+    length += fprintf(TYPE_ERROR_STREAM, "%sType Error%s: undeclared identifier '%.*s'\n", ColorRed, ColorReset, TOKEN_STR(t));
     
     return length;
 }
@@ -52,11 +54,11 @@ type_error_mismatch(u32* error, Light_Token* location, Light_Type* left, Light_T
     
     s32 length = 0;
     length += type_error_location(location);
-    length += fprintf(stderr, "%sType Error%s: type mismatch '", ColorRed, ColorReset);
+    length += fprintf(TYPE_ERROR_STREAM, "%sType Error%s: type mismatch '", ColorRed, ColorReset);
     length += ast_print_type(left, LIGHT_AST_PRINT_STDERR, 0);
-    length += fprintf(stderr, "' vs '");
+    length += fprintf(TYPE_ERROR_STREAM, "' vs '");
     length += ast_print_type(right, LIGHT_AST_PRINT_STDERR, 0);
-    length += fprintf(stderr, "'");
+    length += fprintf(TYPE_ERROR_STREAM, "'");
 
     return length;
 }
\ No newline at end of file
@@ -1,4 +1,11 @@
+#pragma once
 #include "ast.h"
+#include <stdio.h>
+
+// Type errors are written here, procedure bodies checked in parallel
+// point it to their own buffer so errors come out in source order.
+extern light_thread_local FILE* type_error_stream;
+#define TYPE_ERROR_STREAM (type_error_stream ? type_error_stream : stderr)
 
 s32 type_error_location(Light_Token* t);
 s32 type_error(u32* error, Light_Token* location, const char* fmt, ...);
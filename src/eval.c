@@ -7,14 +7,14 @@
 #include <stdio.h>
 #include <light_array.h>
 
-#define TOKEN_STR(T) (T)->length, (T)->data
+#define TOKEN_STR(T) (T)->length, token_data(T)
 
 static s32
 eval_error_location(Light_Token* t) {
     if(!t) {
-        return fprintf(stderr, "%s: ", t->filepath);
+        return 0;
     } else {
-        return fprintf(stderr, "%s:%d:%d: ", t->filepath, t->line + 1, t->column + 1);
+        return fprintf(TYPE_ERROR_STREAM, "%s:%d:%d: ", token_filepath(t), token_line(t) + 1, token_column(t) + 1);
     }
     return 0;
 }
@@ -63,7 +63,7 @@ eval_expr_is_constant(Light_Ast* expr, u32 flags, u32* error) {
 		case AST_EXPRESSION_PROCEDURE_CALL:{
 			if(flags & EVAL_ERROR_REPORT) {
 				eval_error_location(expr->expr_proc_call.token);
-                fprintf(stderr, "Type Error: Procedure call cannot be evaluated to a constant expression\n");
+                fprintf(TYPE_ERROR_STREAM, "Type Error: Procedure call cannot be evaluated to a constant expression\n");
                 *error |= TYPE_ERROR;
 			}
 			return false;
@@ -74,7 +74,7 @@ eval_expr_is_constant(Light_Ast* expr, u32 flags, u32* error) {
 				case OP_UNARY_DEREFERENCE: {
                     if(flags & EVAL_ERROR_REPORT) {
                         eval_error_location(expr->expr_unary.token_op);
-                        fprintf(stderr, "Type Error: 'Dereference' operation cannot be evaluated to a constant expression\n");
+                        fprintf(TYPE_ERROR_STREAM, "Type Error: 'Dereference' operation cannot be evaluated to a constant expression\n");
                         *error |= TYPE_ERROR;
                     }
 					return false;
@@ -82,7 +82,7 @@ eval_expr_is_constant(Light_Ast* expr, u32 flags, u32* error) {
 				case OP_UNARY_ADDRESSOF:{
                     if(flags & EVAL_ERROR_REPORT) {
                         eval_error_location(expr->expr_unary.token_op);
-                        fprintf(stderr, "Type Error: 'Address of' operation cannot be evaluated to a constant expression\n");
+                        fprintf(TYPE_ERROR_STREAM, "Type Error: 'Address of' operation cannot be evaluated to a constant expression\n");
                         *error |= TYPE_ERROR;
                     }
 					return false;
@@ -102,7 +102,7 @@ eval_expr_is_constant(Light_Ast* expr, u32 flags, u32* error) {
 			if(!decl){
 				if(flags & EVAL_ERROR_REPORT){
 					eval_error_location(expr->expr_variable.name);
-                    fprintf(stderr, "Type Error: Undeclared identifier '%.*s'\n", TOKEN_STR(expr->expr_variable.name));
+                    fprintf(TYPE_ERROR_STREAM, "Type Error: Undeclared identifier '%.*s'\n", TOKEN_STR(expr->expr_variable.name));
                     *error |= TYPE_ERROR;
 				}
 				return false;
@@ -112,7 +112,7 @@ eval_expr_is_constant(Light_Ast* expr, u32 flags, u32* error) {
 				} else {
 					if(flags & EVAL_ERROR_REPORT){
                         eval_error_location(expr->expr_variable.name);
-                        fprintf(stderr, "Type Error: '%.*s' cannot be evaluated to a constant value\n", TOKEN_STR(expr->expr_variable.name));
+                        fprintf(TYPE_ERROR_STREAM, "Type Error: '%.*s' cannot be evaluated to a constant value\n", TOKEN_STR(expr->expr_variable.name));
                         *error |= TYPE_ERROR;
 					}
 					return false;
@@ -127,7 +127,7 @@ eval_expr_is_constant(Light_Ast* expr, u32 flags, u32* error) {
                 case TYPE_KIND_UNION:
                 case TYPE_KIND_STRUCT:{
                     eval_error_location(expr->expr_dot.identifier);
-                    fprintf(stderr, "Type Error: expression cannot be evaluated to a constant value\n");
+                    fprintf(TYPE_ERROR_STREAM, "Type Error: expression cannot be evaluated to a constant value\n");
                 } break;
                 default: assert(0); break;
             }
@@ -153,7 +153,7 @@ eval_expr_constant_int(Light_Ast* expr, u32* error) {
 				case OP_BINARY_DIV:{
 					if(right == 0){
 						eval_error_location(expr->expr_binary.token_op);
-						fprintf(stderr, "Type Error: Division by 0 while evaluating constant expression\n");
+						fprintf(TYPE_ERROR_STREAM, "Type Error: Division by 0 while evaluating constant expression\n");
 						*error |= TYPE_ERROR;
 						return 0;
 					} else {
@@ -163,7 +163,7 @@ eval_expr_constant_int(Light_Ast* expr, u32* error) {
 				case OP_BINARY_MOD:{
 					if(right == 0){
 						eval_error_location(expr->expr_binary.token_op);
-						fprintf(stderr, "Type Error: Division by 0 while evaluating constant expression\n");
+						fprintf(TYPE_ERROR_STREAM, "Type Error: Division by 0 while evaluating constant expression\n");
 						*error |= TYPE_ERROR;
 						return 0;
 					} else {
@@ -273,7 +273,7 @@ eval_literal_primitive(Light_Ast* p) {
 
 	Light_Literal_Type ltype = p->expr_literal_primitive.type;
 
-	char* token_data = (char*)p->expr_literal_primitive.token->data;
+	char* literal_data = (char*)token_data(p->expr_literal_primitive.token);
 	s32 token_length = 	p->expr_literal_primitive.token->length;
 
 	if(ltype == LITERAL_BOOL) {
@@ -284,45 +284,45 @@ eval_literal_primitive(Light_Ast* p) {
 	{
 		switch(root_type->primitive) {
 			case TYPE_PRIMITIVE_R32:
-				p->expr_literal_primitive.value_r32 = str_to_r32(token_data, token_length);
+				p->expr_literal_primitive.value_r32 = str_to_r32(literal_data, token_length);
 				break;
 			case TYPE_PRIMITIVE_R64:
-				p->expr_literal_primitive.value_r64 = str_to_r64(token_data, token_length);
+				p->expr_literal_primitive.value_r64 = str_to_r64(literal_data, token_length);
 				break;
 
 			case TYPE_PRIMITIVE_S8:
-				p->expr_literal_primitive.value_s8 = (s8)str_to_s64(token_data, token_length);
+				p->expr_literal_primitive.value_s8 = (s8)str_to_s64(literal_data, token_length);
 				break;
 			case TYPE_PRIMITIVE_S16:
-				p->expr_literal_primitive.value_s16 = (s16)str_to_s64(token_data, token_length);
+				p->expr_literal_primitive.value_s16 = (s16)str_to_s64(literal_data, token_length);
 				break;
 			case TYPE_PRIMITIVE_S32:
-				p->expr_literal_primitive.value_s32 = (s32)str_to_s64(token_data, token_length);
+				p->expr_literal_primitive.value_s32 = (s32)str_to_s64(literal_data, token_length);
 				break;
 			case TYPE_PRIMITIVE_S64:
-				p->expr_literal_primitive.value_s64 = str_to_s64(token_data, token_length);
+				p->expr_literal_primitive.value_s64 = str_to_s64(literal_data, token_length);
 				break;
 			case TYPE_PRIMITIVE_U8:
-				p->expr_literal_primitive.value_u8 = (u8)str_to_u64(token_data, token_length);
+				p->expr_literal_primitive.value_u8 = (u8)str_to_u64(literal_data, token_length);
 				break;
 			case TYPE_PRIMITIVE_U16:
-				p->expr_literal_primitive.value_u16 = (u16)str_to_u64(token_data, token_length);
+				p->expr_literal_primitive.value_u16 = (u16)str_to_u64(literal_data, token_length);
 				break;
 			case TYPE_PRIMITIVE_U32:
-				p->expr_literal_primitive.value_u32 = (u32)str_to_u64(token_data, token_length);
+				p->expr_literal_primitive.value_u32 = (u32)str_to_u64(literal_data, token_length);
 				break;
 			case TYPE_PRIMITIVE_U64:
-				p->expr_literal_primitive.value_u64 = str_to_u64(token_data, token_length);
+				p->expr_literal_primitive.value_u64 = str_to_u64(literal_data, token_length);
 				break;
 			case TYPE_PRIMITIVE_VOID: break;
 			default: assert(0); break;
 		}
 	} else if(ltype == LITERAL_HEX_INT) {
-		p->expr_literal_primitive.value_u64 = str_hex_to_u64(token_data, token_length);
+		p->expr_literal_primitive.value_u64 = str_hex_to_u64(literal_data, token_length);
 	} else if(ltype == LITERAL_BIN_INT) {
-		p->expr_literal_primitive.value_u64 = str_bin_to_u64(token_data, token_length);
+		p->expr_literal_primitive.value_u64 = str_bin_to_u64(literal_data, token_length);
 	} else if(ltype == LITERAL_CHAR) {
-		p->expr_literal_primitive.value_u32 = (u32)str_to_u8(token_data + 1, token_length - 2);
+		p->expr_literal_primitive.value_u32 = (u32)str_to_u8(literal_data + 1, token_length - 2);
 	}
     
     return true;
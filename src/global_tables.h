@@ -4,21 +4,20 @@
 #include <light_arena.h>
 
 // Tables
-extern String_Table global_identifiers_table;
 extern String_Table global_imports_table;
 extern string*      global_imports_queue;
 
 // Paths
 extern string global_compiler_path;
 
-// Memory
-extern Light_Arena* global_type_arena;
+// Memory (one arena per thread)
+extern light_thread_local Light_Arena* global_type_arena;
 
 // Types
 extern Type_Table   global_type_table;
 extern Light_Type** global_type_array;
 
 // Ast
-extern Light_Ast**  global_infer_queue;
+extern light_thread_local Light_Ast** global_infer_queue;
 
 void light_set_global_tables(const char* compiler_path);
\ No newline at end of file
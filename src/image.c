@@ -0,0 +1,837 @@
+#include "image.h"
+#include "cache.h"
+#include "type.h"
+#include "utils/os.h"
+#include "utils/hash.h"
+#include "utils/intern.h"
+#include "utils/allocator.h"
+#include "utils/string_table.h"
+#include <light_array.h>
+#include <string.h>
+
+#define LIGHT_IMAGE_MAGIC 0x474d494c // "LIMG"
+#define LIGHT_IMAGE_ALIGN 16
+
+// Pointers are stored as a reference, the kind in the top byte and an
+// index in the rest. Arrays are an offset in the arrays section, where
+// the length is followed by the references of the elements.
+typedef enum {
+    IMAGE_REF_NULL = 0,
+    IMAGE_REF_NODE,
+    IMAGE_REF_SCOPE,
+    IMAGE_REF_TYPE,
+    IMAGE_REF_BUILTIN_TYPE,
+    IMAGE_REF_TOKEN,
+    IMAGE_REF_ARRAY,
+    IMAGE_REF_GLOBAL_SCOPE,
+} Light_Image_Ref_Kind;
+
+#define IMAGE_REF(K, I)    (((u64)(K) << 56) | (u64)(I))
+#define IMAGE_REF_KIND(R)  ((u32)((u64)(R) >> 56))
+#define IMAGE_REF_INDEX(R) ((u64)(R) & 0x00ffffffffffffffull)
+
+// Primitives, then the empty struct, union and enum
+#define IMAGE_BUILTIN_TYPE_COUNT (TYPE_PRIMITIVE_COUNT + 3)
+
+typedef struct {
+    u32 magic;
+    u32 header_size;
+    u64 version;      // light_cache_seed of the compiler that wrote it
+    u64 source_size;
+    u64 source_hash;
+
+    u32 node_count;
+    u32 scope_count;
+    u32 type_count;
+    u32 token_count;       // tokens of the lexer, then the ones made up by the parser
+    u32 lexer_token_count;
+    u32 ident_count;
+    u32 top_level_count;
+    u32 import_count;
+    u32 type_log_count;
+    s32 decl_count;
+    u64 ident_bytes;
+    u64 array_words;
+
+    // Section offsets from the start of the file
+    u64 nodes;
+    u64 scopes;
+    u64 types;
+    u64 tokens;
+    u64 idents;    // u32 length and the bytes, padded to 4
+    u64 arrays;
+    u64 top_level;
+    u64 imports;   // references to the filename tokens
+    u64 type_log;
+} Light_Image_Header;
+
+// Types and tokens found while writing, by address
+typedef struct {
+    const void* pointer;
+    u32         index;
+} Light_Image_Entry;
+
+static u64
+image_entry_hash(Light_Image_Entry entry) {
+    return fnv_1_hash((const u8*)&entry.pointer, sizeof(entry.pointer));
+}
+
+static int
+image_entry_equal(Light_Image_Entry e1, Light_Image_Entry e2) {
+    return e1.pointer == e2.pointer;
+}
+
+GENERATE_HASH_TABLE(Image_Entry, image_entry, Light_Image_Entry)
+GENERATE_HASH_TABLE_IMPLEMENTATION(Image_Entry, image_entry, Light_Image_Entry, image_entry_hash, light_alloc, light_free, image_entry_equal)
+
+// The same visitors write and load, when writing they turn the pointers of
+// a copy into references and when loading they turn them back.
+typedef struct {
+    bool              loading;
+    bool              failed;
+    Light_Parse_Unit* unit;
+    Light_Scope*      global_scope;
+    Light_Type**      types;
+
+    // Writing
+    Image_Entry_Table type_indices;
+    Image_Entry_Table token_indices; // tokens made up by the parser
+    Light_Token**     extra_tokens;
+    u64*              arrays;
+
+    // Loading
+    const Light_Image_Header* header;
+    const u8*         data;
+    Light_Ast**       nodes;
+    Light_Scope**     scopes;
+    Light_Token*      tokens;
+    Light_Token*      extra_token_data;
+} Light_Image;
+
+static void
+image_path(catstring* out, const char* filepath) {
+    size_t length = strlen(filepath);
+    out->length = 0;
+    if(length > 3 && strcmp(filepath + length - 3, ".li") == 0)
+        catsprint(out, "%sm\0", filepath);
+    else
+        catsprint(out, "%s.lim\0", filepath);
+}
+
+static u64
+image_source_hash(Light_Lexer* lexer) {
+    return fnv_1_hash_from_start(light_cache_seed(), lexer->stream, lexer->stream_size_bytes);
+}
+
+static Light_Type*
+image_builtin_type(u64 index) {
+    if(index < TYPE_PRIMITIVE_COUNT) return type_primitive_get((Light_Type_Primitive)index);
+    switch(index - TYPE_PRIMITIVE_COUNT) {
+        case 0: return global_type_empty_struct;
+        case 1: return global_type_empty_union;
+        case 2: return global_type_empty_enum;
+        default: break;
+    }
+    return 0;
+}
+
+// -------------- References ----------------
+
+static u64
+image_type_ref(Light_Image* img, Light_Type* type) {
+    for(u64 i = 0; i < IMAGE_BUILTIN_TYPE_COUNT; ++i)
+        if(image_builtin_type(i) == type) return IMAGE_REF(IMAGE_REF_BUILTIN_TYPE, i);
+
+    Light_Image_Entry entry = {type, (u32)array_length(img->types)};
+    int index = 0;
+    if(!image_entry_table_add(&img->type_indices, entry, &index))
+        return IMAGE_REF(IMAGE_REF_TYPE, image_entry_table_get(&img->type_indices, index).index);
+    array_push(img->types, type);
+    return IMAGE_REF(IMAGE_REF_TYPE, entry.index);
+}
+
+static u64
+image_token_ref(Light_Image* img, Light_Token* token) {
+    Light_Token* tokens = img->unit->lexer.tokens;
+    u64 count = array_length(tokens);
+    if(token >= tokens && token < tokens + count)
+        return IMAGE_REF(IMAGE_REF_TOKEN, token - tokens);
+
+    Light_Image_Entry entry = {token, (u32)(count + array_length(img->extra_tokens))};
+    int index = 0;
+    if(!image_entry_table_add(&img->token_indices, entry, &index))
+        return IMAGE_REF(IMAGE_REF_TOKEN, image_entry_table_get(&img->token_indices, index).index);
+    array_push(img->extra_tokens, token);
+    return IMAGE_REF(IMAGE_REF_TOKEN, entry.index);
+}
+
+static u64
+image_ref(Light_Image* img, void* pointer, u32 kind) {
+    if(!pointer) return 0;
+
+    switch(kind) {
+        case IMAGE_REF_NODE: {
+            Light_Ast* node = (Light_Ast*)pointer;
+            if(node->id >= 0 && node->id < (s32)array_length(img->unit->nodes) && img->unit->nodes[node->id] == node)
+                return IMAGE_REF(IMAGE_REF_NODE, node->id);
+        } break;
+        case IMAGE_REF_SCOPE: {
+            Light_Scope* scope = (Light_Scope*)pointer;
+            if(scope == img->global_scope)
+                return IMAGE_REF(IMAGE_REF_GLOBAL_SCOPE, 0);
+            if(scope->id >= 0 && scope->id < (s32)array_length(img->unit->scopes) && img->unit->scopes[scope->id] == scope)
+                return IMAGE_REF(IMAGE_REF_SCOPE, scope->id);
+        } break;
+        case IMAGE_REF_TYPE:  return image_type_ref(img, (Light_Type*)pointer);
+        case IMAGE_REF_TOKEN: return image_token_ref(img, (Light_Token*)pointer);
+        default: break;
+    }
+
+    // Points outside of the unit
+    img->failed = true;
+    return 0;
+}
+
+static void*
+image_resolve(Light_Image* img, u64 ref, u32 kind) {
+    const Light_Image_Header* header = img->header;
+    u64 index = IMAGE_REF_INDEX(ref);
+    u32 ref_kind = IMAGE_REF_KIND(ref);
+
+    if(ref_kind == IMAGE_REF_NULL && index == 0) return 0;
+    switch(kind) {
+        case IMAGE_REF_NODE:
+            if(ref_kind == IMAGE_REF_NODE && index < header->node_count) return img->nodes[index];
+            break;
+        case IMAGE_REF_SCOPE:
+            if(ref_kind == IMAGE_REF_GLOBAL_SCOPE) return img->global_scope;
+            if(ref_kind == IMAGE_REF_SCOPE && index < header->scope_count) return img->scopes[index];
+            break;
+        case IMAGE_REF_TYPE:
+            if(ref_kind == IMAGE_REF_BUILTIN_TYPE && index < IMAGE_BUILTIN_TYPE_COUNT) return image_builtin_type(index);
+            if(ref_kind == IMAGE_REF_TYPE && index < header->type_count) return img->types[index];
+            break;
+        case IMAGE_REF_TOKEN:
+            if(ref_kind != IMAGE_REF_TOKEN || index >= header->token_count) break;
+            if(index < header->lexer_token_count) return &img->tokens[index];
+            return &img->extra_token_data[index - header->lexer_token_count];
+        default: break;
+    }
+
+    img->failed = true;
+    return 0;
+}
+
+static void
+image_pointer(Light_Image* img, void** field, u32 kind) {
+    if(img->loading)
+        *field = image_resolve(img, (u64)(uintptr_t)*field, kind);
+    else
+        *field = (void*)(uintptr_t)image_ref(img, *field, kind);
+}
+
+static void
+image_array(Light_Image* img, void*** field, u32 kind) {
+    if(img->loading) {
+        u64 ref = (u64)(uintptr_t)*field;
+        *field = 0;
+        if(ref == 0) return;
+
+        const u64* words = (const u64*)(img->data + img->header->arrays);
+        u64 offset = IMAGE_REF_INDEX(ref);
+        u64 available = img->header->array_words;
+        if(IMAGE_REF_KIND(ref) != IMAGE_REF_ARRAY || offset >= available || words[offset] > available - offset - 1) {
+            img->failed = true;
+            return;
+        }
+
+        u64 length = words[offset];
+        void** array = array_new_len(void*, length + 1);
+        for(u64 i = 0; i < length; ++i) {
+            void* element = image_resolve(img, words[offset + 1 + i], kind);
+            array_push(array, element);
+        }
+        *field = array;
+    } else if(*field) {
+        void** array = *field;
+        u64 offset = array_length(img->arrays);
+        u64 length = array_length(array);
+        array_push(img->arrays, length);
+        for(u64 i = 0; i < length; ++i) {
+            u64 ref = image_ref(img, array[i], kind);
+            array_push(img->arrays, ref);
+        }
+        *field = (void*)(uintptr_t)IMAGE_REF(IMAGE_REF_ARRAY, offset);
+    }
+}
+
+// Fields only filled by the type checker, they must still be empty
+static void
+image_none(Light_Image* img, void** field) {
+    if(*field && !img->loading) img->failed = true;
+    *field = 0;
+}
+
+#define image_node(I, F)  image_pointer(I, (void**)(F), IMAGE_REF_NODE)
+#define image_scope(I, F) image_pointer(I, (void**)(F), IMAGE_REF_SCOPE)
+#define image_type(I, F)  image_pointer(I, (void**)(F), IMAGE_REF_TYPE)
+#define image_token(I, F) image_pointer(I, (void**)(F), IMAGE_REF_TOKEN)
+#define image_nodes(I, F) image_array(I, (void***)(F), IMAGE_REF_NODE)
+#define image_types(I, F) image_array(I, (void***)(F), IMAGE_REF_TYPE)
+
+// -------------- Visitors ----------------
+
+static void
+image_visit_node(Light_Image* img, Light_Ast* node) {
+    image_type(img, &node->type);
+    image_scope(img, &node->scope_at);
+
+    switch(node->kind) {
+        case AST_DECL_PROCEDURE:
+            image_token(img, &node->decl_proc.name);
+            image_nodes(img, &node->decl_proc.arguments);
+            image_node(img, &node->decl_proc.body);
+            image_type(img, &node->decl_proc.return_type);
+            image_type(img, &node->decl_proc.proc_type);
+            image_scope(img, &node->decl_proc.arguments_scope);
+            image_token(img, &node->decl_proc.extern_library_name);
+            break;
+        case AST_DECL_VARIABLE:
+            image_token(img, &node->decl_variable.name);
+            image_node(img, &node->decl_variable.assignment);
+            image_type(img, &node->decl_variable.type);
+            break;
+        case AST_DECL_CONSTANT:
+            image_token(img, &node->decl_constant.name);
+            image_node(img, &node->decl_constant.value);
+            image_type(img, &node->decl_constant.type_info);
+            break;
+        case AST_DECL_TYPEDEF:
+            image_token(img, &node->decl_typedef.name);
+            image_type(img, &node->decl_typedef.type_referenced);
+            break;
+
+        case AST_COMMAND_BLOCK:
+            image_nodes(img, &node->comm_block.commands);
+            image_nodes(img, &node->comm_block.defer_stack);
+            image_scope(img, &node->comm_block.block_scope);
+            break;
+        case AST_COMMAND_ASSIGNMENT:
+            image_node(img, &node->comm_assignment.lvalue);
+            image_node(img, &node->comm_assignment.rvalue);
+            image_token(img, &node->comm_assignment.op_token);
+            break;
+        case AST_COMMAND_IF:
+            image_node(img, &node->comm_if.condition);
+            image_node(img, &node->comm_if.body_true);
+            image_node(img, &node->comm_if.body_false);
+            image_token(img, &node->comm_if.if_token);
+            break;
+        case AST_COMMAND_FOR:
+            image_node(img, &node->comm_for.condition);
+            image_node(img, &node->comm_for.body);
+            image_nodes(img, &node->comm_for.prologue);
+            image_nodes(img, &node->comm_for.epilogue);
+            image_scope(img, &node->comm_for.for_scope);
+            image_token(img, &node->comm_for.for_token);
+            break;
+        case AST_COMMAND_WHILE:
+            image_node(img, &node->comm_while.condition);
+            image_node(img, &node->comm_while.body);
+            image_token(img, &node->comm_while.while_token);
+            break;
+        case AST_COMMAND_BREAK:
+            image_node(img, &node->comm_break.level);
+            image_token(img, &node->comm_break.token_break);
+            break;
+        case AST_COMMAND_CONTINUE:
+            image_node(img, &node->comm_continue.level);
+            image_token(img, &node->comm_continue.token_continue);
+            break;
+        case AST_COMMAND_RETURN:
+            image_node(img, &node->comm_return.expression);
+            image_token(img, &node->comm_return.token_return);
+            break;
+
+        case AST_EXPRESSION_BINARY:
+            image_node(img, &node->expr_binary.left);
+            image_node(img, &node->expr_binary.right);
+            image_token(img, &node->expr_binary.token_op);
+            break;
+        case AST_EXPRESSION_UNARY:
+            image_node(img, &node->expr_unary.operand);
+            image_token(img, &node->expr_unary.token_op);
+            image_type(img, &node->expr_unary.type_to_cast);
+            break;
+        case AST_EXPRESSION_LITERAL_PRIMITIVE:
+            image_token(img, &node->expr_literal_primitive.token);
+            break;
+        case AST_EXPRESSION_LITERAL_ARRAY: {
+            Light_Ast_Expr_Literal_Array* array = &node->expr_literal_array;
+            // Raw data is a string literal, it points into the source
+            bool from_source = array->raw_data && array->token_array;
+            if(!img->loading && array->data && (!from_source || array->data != token_data(array->token_array)))
+                img->failed = true;
+            image_token(img, &array->token_array);
+            image_nodes(img, &array->array_exprs);
+            image_type(img, &array->array_strong_type);
+            array->data = (img->loading && from_source && array->token_array) ? token_data(array->token_array) : 0;
+        } break;
+        case AST_EXPRESSION_LITERAL_STRUCT:
+            image_token(img, &node->expr_literal_struct.name);
+            image_token(img, &node->expr_literal_struct.token_struct);
+            image_scope(img, &node->expr_literal_struct.struct_scope);
+            image_nodes(img, &node->expr_literal_struct.struct_exprs);
+            break;
+        case AST_EXPRESSION_VARIABLE:
+            image_token(img, &node->expr_variable.name);
+            image_node(img, &node->expr_variable.decl);
+            break;
+        case AST_EXPRESSION_PROCEDURE_CALL:
+            image_node(img, &node->expr_proc_call.caller_expr);
+            image_nodes(img, &node->expr_proc_call.args);
+            image_token(img, &node->expr_proc_call.token);
+            break;
+        case AST_EXPRESSION_DOT:
+            image_node(img, &node->expr_dot.left);
+            image_token(img, &node->expr_dot.identifier);
+            break;
+        case AST_EXPRESSION_DIRECTIVE:
+            image_token(img, &node->expr_directive.directive_token);
+            if(node->expr_directive.type == EXPR_DIRECTIVE_TYPEOF || node->expr_directive.type == EXPR_DIRECTIVE_RUN)
+                image_node(img, &node->expr_directive.expr);
+            else
+                image_type(img, &node->expr_directive.type_expr);
+            break;
+        case AST_EXPRESSION_COMPILER_GENERATED:
+            image_type(img, &node->expr_compiler_generated.type_value);
+            break;
+
+        default: img->failed = true; break;
+    }
+}
+
+static void
+image_visit_scope(Light_Image* img, Light_Scope* scope) {
+    image_scope(img, &scope->parent);
+    image_nodes(img, &scope->decls);
+    if(scope->flags & (SCOPE_STRUCTURE|SCOPE_UNION|SCOPE_ENUM))
+        image_type(img, &scope->creator_type);
+    else
+        image_node(img, &scope->creator_node);
+
+    // Symbol tables are built by the type checker
+    image_none(img, (void**)&scope->symb_table);
+}
+
+static void
+image_visit_type(Light_Image* img, Light_Type* type) {
+    switch(type->kind) {
+        case TYPE_KIND_PRIMITIVE: break;
+        case TYPE_KIND_POINTER:
+            image_type(img, &type->pointer_to);
+            break;
+        case TYPE_KIND_ARRAY:
+            image_type(img, &type->array_info.array_of);
+            image_token(img, &type->array_info.token_array);
+            image_node(img, &type->array_info.const_expr);
+            break;
+        case TYPE_KIND_STRUCT:
+            image_nodes(img, &type->struct_info.fields);
+            image_scope(img, &type->struct_info.struct_scope);
+            image_none(img, (void**)&type->struct_info.offset_bits);
+            break;
+        case TYPE_KIND_UNION:
+            image_nodes(img, &type->union_info.fields);
+            image_scope(img, &type->union_info.union_scope);
+            break;
+        case TYPE_KIND_FUNCTION:
+            image_type(img, &type->function.return_type);
+            image_types(img, &type->function.arguments_type);
+            image_none(img, (void**)&type->function.arguments_names);
+            image_none(img, (void**)&type->function.arguments_names_length);
+            break;
+        case TYPE_KIND_ENUM:
+            image_type(img, &type->enumerator.type_hint);
+            image_scope(img, &type->enumerator.enum_scope);
+            image_nodes(img, &type->enumerator.fields);
+            image_none(img, (void**)&type->enumerator.evaluated_values);
+            break;
+        case TYPE_KIND_ALIAS:
+            image_token(img, &type->alias.name);
+            image_scope(img, &type->alias.scope);
+            image_type(img, &type->alias.alias_to);
+            break;
+        case TYPE_KIND_DIRECTIVE:
+            image_node(img, &type->directive);
+            break;
+        default: img->failed = true; break;
+    }
+}
+
+// -------------- Write ----------------
+
+static void
+image_append(catstring* out, const void* data, u64 size) {
+    catstring s = {size, size, (char*)data};
+    if(size > 0) catstring_append(out, &s);
+}
+
+// Pads the image and returns the offset of the next section
+static u64
+image_section(catstring* out) {
+    static const u8 zeros[LIGHT_IMAGE_ALIGN] = {0};
+    image_append(out, zeros, (LIGHT_IMAGE_ALIGN - out->length % LIGHT_IMAGE_ALIGN) % LIGHT_IMAGE_ALIGN);
+    return out->length;
+}
+
+bool
+light_image_write(Light_Parse_Unit* unit, Light_Scope* global_scope) {
+    Light_Image img = {0};
+    img.unit = unit;
+    img.global_scope = global_scope;
+    img.types = array_new(Light_Type*);
+    img.extra_tokens = array_new(Light_Token*);
+    img.arrays = array_new(u64);
+    image_entry_table_new(&img.type_indices, 256);
+    image_entry_table_new(&img.token_indices, 64);
+
+    Light_Image_Header header = {0};
+    header.magic = LIGHT_IMAGE_MAGIC;
+    header.header_size = sizeof(header);
+    header.version = light_cache_seed();
+    header.source_size = unit->lexer.stream_size_bytes;
+    header.source_hash = image_source_hash(&unit->lexer);
+    header.decl_count = unit->decl_count;
+
+    catstring out = {0};
+    image_append(&out, &header, sizeof(header));
+
+    // The types internalized come first, they are the only ones that may
+    // be internalized when found from the nodes.
+    u64* type_log = array_new(u64);
+    for(u64 i = 0; i < array_length(unit->types); ++i) {
+        u64 ref = image_type_ref(&img, unit->types[i]);
+        array_push(type_log, ref);
+    }
+    u64 logged_types = array_length(img.types);
+
+    header.nodes = image_section(&out);
+    for(u64 i = 0; i < array_length(unit->nodes); ++i) {
+        Light_Ast node = *unit->nodes[i];
+        image_visit_node(&img, &node);
+        image_append(&out, &node, sizeof(node));
+    }
+
+    header.scopes = image_section(&out);
+    for(u64 i = 0; i < array_length(unit->scopes); ++i) {
+        Light_Scope scope = *unit->scopes[i];
+        image_visit_scope(&img, &scope);
+        image_append(&out, &scope, sizeof(scope));
+    }
+
+    u64* top_level = array_new(u64);
+    for(u64 i = 0; i < array_length(unit->top_level); ++i) {
+        u64 ref = image_ref(&img, unit->top_level[i], IMAGE_REF_NODE);
+        array_push(top_level, ref);
+    }
+
+    u64* imports = array_new(u64);
+    for(u64 i = 0; i < array_length(unit->import_names); ++i) {
+        u64 ref = image_ref(&img, unit->import_names[i], IMAGE_REF_TOKEN);
+        array_push(imports, ref);
+    }
+
+    // Types found while visiting may reference more types
+    header.types = image_section(&out);
+    for(u64 i = 0; i < array_length(img.types); ++i) {
+        if(i >= logged_types && (img.types[i]->flags & TYPE_FLAG_INTERNALIZED))
+            img.failed = true;
+        Light_Type type = *img.types[i];
+        type.flags &= ~(TYPE_FLAG_INTERNALIZED|TYPE_FLAG_IN_TYPE_ARRAY);
+        type.hash = 0;
+        type.type_table_index = 0;
+        image_visit_type(&img, &type);
+        image_append(&out, &type, sizeof(type));
+    }
+
+    // Identifiers are stored by text, their intern ids differ every run
+    s32 intern_count = light_intern_count();
+    u32* ident_index = calloc(intern_count, sizeof(u32));
+    catstring idents = {0};
+    u64 lexer_token_count = array_length(unit->lexer.tokens);
+    u64 token_count = lexer_token_count + array_length(img.extra_tokens);
+
+    header.tokens = image_section(&out);
+    for(u64 i = 0; i < token_count; ++i) {
+        Light_Token token = (i < lexer_token_count) ? unit->lexer.tokens[i] : *img.extra_tokens[i - lexer_token_count];
+        if(token.file_id == unit->lexer.file_id)
+            token.file_id = 0;
+        else if(token.file_id != LIGHT_FILE_ID_NONE)
+            img.failed = true;
+
+        if(token.type == TOKEN_IDENTIFIER) {
+            if(token.ident >= (u32)intern_count) {
+                img.failed = true;
+            } else {
+                if(ident_index[token.ident] == 0) {
+                    const char* ident = light_intern_from_id(token.ident);
+                    u32 length = (u32)light_intern_length(ident);
+                    image_append(&idents, &length, sizeof(length));
+                    image_append(&idents, ident, length);
+                    image_append(&idents, "\0\0\0", (4 - length % 4) % 4);
+                    ident_index[token.ident] = ++header.ident_count;
+                }
+                token.ident = ident_index[token.ident] - 1;
+            }
+        }
+        image_append(&out, &token, sizeof(token));
+    }
+    free(ident_index);
+
+    header.idents = image_section(&out);
+    image_append(&out, idents.data, idents.length);
+    header.arrays = image_section(&out);
+    image_append(&out, img.arrays, array_length(img.arrays) * sizeof(u64));
+    header.top_level = image_section(&out);
+    image_append(&out, top_level, array_length(top_level) * sizeof(u64));
+    header.imports = image_section(&out);
+    image_append(&out, imports, array_length(imports) * sizeof(u64));
+    header.type_log = image_section(&out);
+    image_append(&out, type_log, array_length(type_log) * sizeof(u64));
+
+    header.node_count = (u32)array_length(unit->nodes);
+    header.scope_count = (u32)array_length(unit->scopes);
+    header.type_count = (u32)array_length(img.types);
+    header.token_count = (u32)token_count;
+    header.lexer_token_count = (u32)lexer_token_count;
+    header.top_level_count = (u32)array_length(top_level);
+    header.import_count = (u32)array_length(imports);
+    header.type_log_count = (u32)array_length(type_log);
+    header.ident_bytes = idents.length;
+    header.array_words = array_length(img.arrays);
+    memcpy(out.data, &header, sizeof(header));
+
+    bool written = false;
+    if(!img.failed) {
+        catstring path = {0};
+        image_path(&path, unit->filepath.data);
+        written = light_write_entire_file(path.data, out.data, out.length);
+        catstring_free(&path);
+    }
+
+    catstring_free(&out);
+    catstring_free(&idents);
+    array_free(type_log);
+    array_free(top_level);
+    array_free(imports);
+    array_free(img.types);
+    array_free(img.extra_tokens);
+    array_free(img.arrays);
+    image_entry_table_free(&img.type_indices);
+    image_entry_table_free(&img.token_indices);
+    return written;
+}
+
+// -------------- Load ----------------
+
+static bool
+image_section_valid(const Light_Image_Header* header, u64 size_bytes, u64 offset, u64 count, u64 element_size) {
+    return offset % 8 == 0 && offset >= header->header_size && offset <= size_bytes &&
+        count <= (size_bytes - offset) / element_size;
+}
+
+static bool
+image_header_valid(const Light_Image_Header* header, u64 size_bytes, Light_Lexer* lexer) {
+    if(size_bytes < sizeof(*header)) return false;
+    if(header->magic != LIGHT_IMAGE_MAGIC || header->header_size != sizeof(*header)) return false;
+    if(header->version != light_cache_seed()) return false;
+    if(header->source_size != lexer->stream_size_bytes || header->source_hash != image_source_hash(lexer)) return false;
+    if(header->lexer_token_count > header->token_count) return false;
+
+    return
+        image_section_valid(header, size_bytes, header->nodes, header->node_count, sizeof(Light_Ast)) &&
+        image_section_valid(header, size_bytes, header->scopes, header->scope_count, sizeof(Light_Scope)) &&
+        image_section_valid(header, size_bytes, header->types, header->type_count, sizeof(Light_Type)) &&
+        image_section_valid(header, size_bytes, header->tokens, header->token_count, sizeof(Light_Token)) &&
+        image_section_valid(header, size_bytes, header->idents, header->ident_bytes, 1) &&
+        image_section_valid(header, size_bytes, header->arrays, header->array_words, sizeof(u64)) &&
+        image_section_valid(header, size_bytes, header->top_level, header->top_level_count, sizeof(u64)) &&
+        image_section_valid(header, size_bytes, header->imports, header->import_count, sizeof(u64)) &&
+        image_section_valid(header, size_bytes, header->type_log, header->type_log_count, sizeof(u64));
+}
+
+// Interns the identifiers of the image, returns their ids by index
+static u32*
+image_load_idents(Light_Image* img) {
+    const Light_Image_Header* header = img->header;
+    const u8* at = img->data + header->idents;
+    const u8* end = at + header->ident_bytes;
+
+    u32* ids = array_new_len(u32, header->ident_count + 1);
+    for(u32 i = 0; i < header->ident_count; ++i) {
+        u32 length = 0;
+        if(end - at < (s64)sizeof(length)) break;
+        memcpy(&length, at, sizeof(length));
+        at += sizeof(length);
+        if(length > LIGHT_TOKEN_MAX_LENGTH || (u64)(end - at) < length) break;
+
+        const char* ident = lexer_internalize_identifier((const char*)at, (s32)length);
+        array_push(ids, light_intern_id(ident));
+        at += length + (4 - length % 4) % 4;
+    }
+    if(array_length(ids) != header->ident_count) {
+        array_free(ids);
+        return 0;
+    }
+    return ids;
+}
+
+static bool
+image_load_tokens(Light_Image* img, u32* ident_ids) {
+    const Light_Image_Header* header = img->header;
+    const Light_Token* records = (const Light_Token*)(img->data + header->tokens);
+    u64 extra_count = header->token_count - header->lexer_token_count;
+
+    img->tokens = array_new_len(Light_Token, header->lexer_token_count + 1);
+    array_length(img->tokens) = header->lexer_token_count;
+    img->extra_token_data = (extra_count > 0) ? light_alloc(extra_count * sizeof(Light_Token)) : 0;
+
+    for(u64 i = 0; i < header->token_count; ++i) {
+        Light_Token token = records[i];
+        if(token.file_id == 0)
+            token.file_id = img->unit->lexer.file_id;
+        else if(token.file_id != LIGHT_FILE_ID_NONE)
+            return false;
+        if(token.type == TOKEN_IDENTIFIER) {
+            if(token.ident >= header->ident_count) return false;
+            token.ident = ident_ids[token.ident];
+        }
+
+        if(i < header->lexer_token_count)
+            img->tokens[i] = token;
+        else
+            img->extra_token_data[i - header->lexer_token_count] = token;
+    }
+    return true;
+}
+
+static bool
+image_load_tree(Light_Image* img) {
+    const Light_Image_Header* header = img->header;
+    Light_Parse_Unit* unit = img->unit;
+
+    // Objects are created in the original order, so they get the same ids
+    const Light_Ast* node_records = (const Light_Ast*)(img->data + header->nodes);
+    for(u32 i = 0; i < header->node_count; ++i) {
+        Light_Ast* node = ast_new_copy(&node_records[i]);
+        array_push(img->nodes, node);
+    }
+    const Light_Scope* scope_records = (const Light_Scope*)(img->data + header->scopes);
+    for(u32 i = 0; i < header->scope_count; ++i) {
+        Light_Scope* scope = light_scope_new_copy(&scope_records[i]);
+        array_push(img->scopes, scope);
+    }
+    const Light_Type* type_records = (const Light_Type*)(img->data + header->types);
+    for(u32 i = 0; i < header->type_count; ++i) {
+        Light_Type* type = type_new_copy(&type_records[i]);
+        array_push(img->types, type);
+    }
+
+    // Replay the internalizations in order, every type references only
+    // types internalized before it, so they are already the canonical ones.
+    bool* relocated = calloc(header->type_count + 1, sizeof(bool));
+    const u64* type_log = (const u64*)(img->data + header->type_log);
+    for(u32 i = 0; i < header->type_log_count && !img->failed; ++i) {
+        u64 index = IMAGE_REF_INDEX(type_log[i]);
+        if(IMAGE_REF_KIND(type_log[i]) == IMAGE_REF_BUILTIN_TYPE) {
+            Light_Type* builtin = image_resolve(img, type_log[i], IMAGE_REF_TYPE);
+            if(builtin) type_internalize(builtin);
+            continue;
+        }
+        if(IMAGE_REF_KIND(type_log[i]) != IMAGE_REF_TYPE || index >= header->type_count) {
+            img->failed = true;
+            break;
+        }
+        if(!relocated[index]) {
+            image_visit_type(img, img->types[index]);
+            relocated[index] = true;
+        }
+        if(!img->failed)
+            img->types[index] = type_internalize(img->types[index]);
+    }
+    for(u32 i = 0; i < header->type_count && !img->failed; ++i) {
+        if(!relocated[i]) image_visit_type(img, img->types[i]);
+    }
+    free(relocated);
+
+    for(u32 i = 0; i < header->node_count && !img->failed; ++i)
+        image_visit_node(img, img->nodes[i]);
+    for(u32 i = 0; i < header->scope_count && !img->failed; ++i)
+        image_visit_scope(img, img->scopes[i]);
+
+    const u64* top_level = (const u64*)(img->data + header->top_level);
+    for(u32 i = 0; i < header->top_level_count && !img->failed; ++i) {
+        Light_Ast* node = image_resolve(img, top_level[i], IMAGE_REF_NODE);
+        array_push(unit->top_level, node);
+    }
+    const u64* imports = (const u64*)(img->data + header->imports);
+    for(u32 i = 0; i < header->import_count && !img->failed; ++i) {
+        Light_Token* token = image_resolve(img, imports[i], IMAGE_REF_TOKEN);
+        array_push(unit->import_names, token);
+    }
+    unit->decl_count = header->decl_count;
+
+    return !img->failed;
+}
+
+bool
+light_image_load(Light_Parse_Unit* unit, Light_Scope* global_scope) {
+    catstring path = {0};
+    image_path(&path, unit->filepath.data);
+
+    u64 image_time = light_file_modified_time(path.data);
+    Light_File_Map map = {0};
+    bool mapped = image_time != 0 && image_time >= light_file_modified_time(unit->filepath.data) &&
+        light_map_entire_file(path.data, &map);
+    catstring_free(&path);
+    if(!mapped) return false;
+
+    Light_Image img = {0};
+    img.loading = true;
+    img.unit = unit;
+    img.global_scope = global_scope;
+    img.header = (const Light_Image_Header*)map.data;
+    img.data = (const u8*)map.data;
+
+    bool loaded = false;
+    u32* ident_ids = 0;
+    if(image_header_valid(img.header, map.size_bytes, &unit->lexer) && (ident_ids = image_load_idents(&img)) != 0) {
+        if(image_load_tokens(&img, ident_ids)) {
+            img.nodes = array_new_len(Light_Ast*, img.header->node_count + 1);
+            img.scopes = array_new_len(Light_Scope*, img.header->scope_count + 1);
+            img.types = array_new_len(Light_Type*, img.header->type_count + 1);
+            loaded = image_load_tree(&img);
+            array_free(img.nodes);
+            array_free(img.scopes);
+            array_free(img.types);
+        }
+        array_free(ident_ids);
+    }
+
+    if(loaded) {
+        unit->lexer.tokens = img.tokens;
+    } else {
+        // Drop everything logged, the file is parsed instead
+        if(img.tokens) array_free(img.tokens);
+        array_length(unit->nodes) = 0;
+        array_length(unit->scopes) = 0;
+        array_length(unit->types) = 0;
+        array_length(unit->top_level) = 0;
+        array_length(unit->import_names) = 0;
+        unit->decl_count = 0;
+    }
+
+    light_unmap_file(&map);
+    return loaded;
+}
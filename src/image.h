@@ -0,0 +1,25 @@
+#pragma once
+#include <common.h>
+#include "parser.h"
+
+// Module images, <file>.lim next to <file>.li, hold a parsed file: its
+// tokens, nodes, scopes and the types it created, with every pointer
+// replaced by a reference. They are only written for the standard modules
+// by a build run with -images.
+//
+// A file is loaded from its image instead of being parsed when the image
+// is newer than the source, was written by the same compiler build and
+// matches the source contents. Loading maps the image, then copies every
+// token, node, scope and type into the arenas and relocates the copies,
+// nothing points into the mapping once it is unmapped. What it saves is
+// lexing and parsing, not the copy.
+//
+// The tree is stored as the parser leaves it, type checking resolves
+// names across files, so it still runs on the whole program.
+
+// The lexer of the unit must be opened and the id and type logs active,
+// as when the file is parsed. On failure nothing is left in the unit.
+bool light_image_load(Light_Parse_Unit* unit, Light_Scope* global_scope);
+
+// Must be called right after the unit is parsed, before it is merged.
+bool light_image_write(Light_Parse_Unit* unit, Light_Scope* global_scope);
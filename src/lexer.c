@@ -2,17 +2,84 @@
 #include "utils/os.h"
 #include "global_tables.h"
 #include "utils/allocator.h"
+#include "utils/intern.h"
 #include <stdio.h>
 #include <string.h>
 #include <light_array.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// The scanners below test 16 (SSE2) or 32 (AVX2) bytes at once.
+// Comparisons are signed, so bytes >= 0x80 never fall in an ASCII range.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LEXER_SIMD_WIDTH 32
+#define LEXER_SIMD_ALL   0xffffffffu
+typedef __m256i Lexer_Vector;
+#define lexer_vector_load(P)   _mm256_loadu_si256((const __m256i*)(P))
+#define lexer_vector_set(C)    _mm256_set1_epi8((char)(C))
+#define lexer_vector_eq(A, B)  _mm256_cmpeq_epi8(A, B)
+#define lexer_vector_gt(A, B)  _mm256_cmpgt_epi8(A, B)
+#define lexer_vector_or(A, B)  _mm256_or_si256(A, B)
+#define lexer_vector_and(A, B) _mm256_and_si256(A, B)
+#define lexer_vector_mask(A)   ((u32)_mm256_movemask_epi8(A))
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LEXER_SIMD_WIDTH 16
+#define LEXER_SIMD_ALL   0xffffu
+typedef __m128i Lexer_Vector;
+#define lexer_vector_load(P)   _mm_loadu_si128((const __m128i*)(P))
+#define lexer_vector_set(C)    _mm_set1_epi8((char)(C))
+#define lexer_vector_eq(A, B)  _mm_cmpeq_epi8(A, B)
+#define lexer_vector_gt(A, B)  _mm_cmpgt_epi8(A, B)
+#define lexer_vector_or(A, B)  _mm_or_si128(A, B)
+#define lexer_vector_and(A, B) _mm_and_si128(A, B)
+#define lexer_vector_mask(A)   ((u32)_mm_movemask_epi8(A))
+#endif
+
+// A <= C <= B
+#define lexer_vector_range(C, A, B) \
+    lexer_vector_and(lexer_vector_gt(C, lexer_vector_set((A) - 1)), lexer_vector_gt(lexer_vector_set((B) + 1), C))
+
+static inline s32
+lexer_bit_first(u32 mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (s32)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
 
 string light_special_idents_table[LIGHT_SPECIAL_IDENT_COUNT] = {0};
 
+// Every lexed file, indexed by the file_id of its tokens
+static Light_Source_File* source_files[LIGHT_FILE_ID_NONE];
+static volatile s32       source_files_count = 0;
+
+static u16
+source_file_register(char* filepath, u8* data, u64 size_bytes) {
+    s32 id = light_atomic_add(&source_files_count, 1);
+    if(id >= LIGHT_FILE_ID_NONE) {
+        fprintf(stderr, "Lexer Error: too many source files\n");
+        return LIGHT_FILE_ID_NONE;
+    }
+
+    Light_Source_File* file = light_alloc(sizeof(Light_Source_File));
+    file->filepath = filepath;
+    file->data = data;
+    file->size_bytes = size_bytes;
+    light_mutex_init(&file->mutex);
+    file->line_starts = 0;
+    source_files[id] = file;
+    return (u16)id;
+}
+
 void
 initialize_global_identifiers_table() {
-    if(global_identifiers_table.entries_capacity == 0) {
-        string_table_new(&global_identifiers_table, 1024 * 1024);
-    }
+    light_intern_init();
 
     light_special_idents_table[LIGHT_SPECIAL_IDENT_MAIN]    = MAKE_STR_LEN("main", sizeof("main") - 1);
     light_special_idents_table[LIGHT_SPECIAL_IDENT_FOREIGN] = MAKE_STR_LEN("foreign", sizeof("foreign") - 1);
@@ -27,18 +94,11 @@ initialize_global_identifiers_table() {
     light_special_idents_table[LIGHT_SPECIAL_IDENT_RUN]     = MAKE_STR_LEN("run", sizeof("run") - 1);
     light_special_idents_table[LIGHT_SPECIAL_IDENT_EXTERN] = MAKE_STR_LEN("extern", sizeof("extern") - 1);
 
-    string_table_add(&global_identifiers_table, light_special_idents_table[LIGHT_SPECIAL_IDENT_MAIN], 0);
-    string_table_add(&global_identifiers_table, light_special_idents_table[LIGHT_SPECIAL_IDENT_FOREIGN], 0);
-    string_table_add(&global_identifiers_table, light_special_idents_table[LIGHT_SPECIAL_IDENT_ASSERT], 0);
-    string_table_add(&global_identifiers_table, light_special_idents_table[LIGHT_SPECIAL_IDENT_STRING], 0);
-    string_table_add(&global_identifiers_table, light_special_idents_table[LIGHT_SPECIAL_IDENT_ARRAY], 0);
-    string_table_add(&global_identifiers_table, light_special_idents_table[LIGHT_SPECIAL_IDENT_IMPORT], 0);
-    string_table_add(&global_identifiers_table, light_special_idents_table[LIGHT_SPECIAL_IDENT_SIZEOF], 0);
-    string_table_add(&global_identifiers_table, light_special_idents_table[LIGHT_SPECIAL_IDENT_TYPEOF], 0);
-    string_table_add(&global_identifiers_table, light_special_idents_table[LIGHT_SPECIAL_IDENT_TYPEVALUE], 0);
-    string_table_add(&global_identifiers_table, light_special_idents_table[LIGHT_SPECIAL_IDENT_END], 0);
-    string_table_add(&global_identifiers_table, light_special_idents_table[LIGHT_SPECIAL_IDENT_RUN], 0);
-    string_table_add(&global_identifiers_table, light_special_idents_table[LIGHT_SPECIAL_IDENT_EXTERN], 0);
+    // Special identifiers are compared by pointer, so they must be the interned ones
+    for(s32 i = 0; i < LIGHT_SPECIAL_IDENT_COUNT; ++i) {
+        string* s = &light_special_idents_table[i];
+        s->data = (char*)light_intern(s->data, s->length);
+    }
 }
 
 static bool
@@ -56,12 +116,77 @@ is_hex_digit(char c) {
 	return (is_number(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'));
 }
 
+#define KEYWORD(S, T) if(memcmp(at, S, sizeof(S) - 1) == 0) return T
+
+// Keyword token type of the identifier at 'at', or TOKEN_IDENTIFIER.
+// Keywords are told apart by length and then by first character, so
+// most identifiers are rejected without any comparison.
+static Light_Token_Type
+token_keyword(const u8* at, s64 length) {
+    switch(length) {
+        case 2: switch(at[0]) {
+            case 'i': KEYWORD("if", TOKEN_KEYWORD_IF); break;
+            case 's': KEYWORD("s8", TOKEN_SINT8); break;
+            case 'u': KEYWORD("u8", TOKEN_UINT8); break;
+        } break;
+        case 3: switch(at[0]) {
+            case 'f': KEYWORD("for", TOKEN_KEYWORD_FOR); break;
+            case 'r': KEYWORD("r32", TOKEN_REAL32); KEYWORD("r64", TOKEN_REAL64); break;
+            case 's': KEYWORD("s16", TOKEN_SINT16); KEYWORD("s32", TOKEN_SINT32); KEYWORD("s64", TOKEN_SINT64); break;
+            case 'u': KEYWORD("u16", TOKEN_UINT16); KEYWORD("u32", TOKEN_UINT32); KEYWORD("u64", TOKEN_UINT64); break;
+        } break;
+        case 4: switch(at[0]) {
+            case 'b': KEYWORD("bool", TOKEN_BOOL); break;
+            case 'e': KEYWORD("else", TOKEN_KEYWORD_ELSE); KEYWORD("enum", TOKEN_KEYWORD_ENUM); break;
+            case 'n': KEYWORD("null", TOKEN_KEYWORD_NULL); break;
+            case 't': KEYWORD("true", TOKEN_LITERAL_BOOL_TRUE); break;
+            case 'v': KEYWORD("void", TOKEN_VOID); break;
+        } break;
+        case 5: switch(at[0]) {
+            case 'b': KEYWORD("break", TOKEN_KEYWORD_BREAK); break;
+            case 'f': KEYWORD("false", TOKEN_LITERAL_BOOL_FALSE); break;
+            case 'u': KEYWORD("union", TOKEN_KEYWORD_UNION); break;
+            case 'w': KEYWORD("while", TOKEN_KEYWORD_WHILE); break;
+        } break;
+        case 6: switch(at[0]) {
+            case 'r': KEYWORD("return", TOKEN_KEYWORD_RETURN); break;
+            case 's': KEYWORD("struct", TOKEN_KEYWORD_STRUCT); break;
+        } break;
+        case 8: KEYWORD("continue", TOKEN_KEYWORD_CONTINUE); break;
+    }
+    return TOKEN_IDENTIFIER;
+}
+
+#undef KEYWORD
+
+static bool
+is_identifier_char(u8 c) {
+    return is_letter(c) || is_number(c) || c == '_';
+}
+
+// Returns the end of the run of identifier characters starting at 'at',
+// never reading at or past 'end'.
+static u8*
+identifier_end(u8* at, u8* end) {
+#if defined(LEXER_SIMD_WIDTH)
+    while(end - at >= LEXER_SIMD_WIDTH) {
+        Lexer_Vector c = lexer_vector_load(at);
+        Lexer_Vector letter = lexer_vector_range(lexer_vector_or(c, lexer_vector_set(0x20)), 'a', 'z');
+        Lexer_Vector ident = lexer_vector_or(lexer_vector_or(letter, lexer_vector_range(c, '0', '9')),
+            lexer_vector_eq(c, lexer_vector_set('_')));
+        u32 mask = ~lexer_vector_mask(ident) & LEXER_SIMD_ALL;
+        if(mask) return at + lexer_bit_first(mask);
+        at += LEXER_SIMD_WIDTH;
+    }
+#endif
+    while(at < end && is_identifier_char(*at)) ++at;
+    return at;
+}
+
 static Light_Token
-token_number(u8* at, s32 line, s32 column) {
+token_number(u8* at, s64* length) {
     Light_Token r = {0};
-    r.line = line;
-    r.column = column;
-    r.data = at;
+    u8* start = at;
 
     bool floating = false;
 
@@ -103,23 +228,22 @@ token_number(u8* at, s32 line, s32 column) {
         r.flags |= TOKEN_FLAG_LITERAL;
     }
 
-    r.length = at - r.data;
+    *length = at - start;
 
     return r;
 }
 
-static Light_Token
-token_next(Light_Lexer* lexer) {
+// Returns the length in bytes of the token at the lexer position
+static s64
+token_next(Light_Lexer* lexer, Light_Token* out) {
 	u8* at = lexer->stream + lexer->index;
-	if (!at) return (Light_Token){ 0 };
+	u8* start = at;
+	s64 length = 0;
 
 	Light_Token r = { 0 };
-	r.data = at;
-	r.line = (s32)lexer->line;
-	r.column = (s32)lexer->column;
 
 	switch (*at) {
-		case 0: return (Light_Token) { 0 };
+		case 0: break;
 
         case '<':{
             ++at;
@@ -141,7 +265,7 @@ token_next(Light_Lexer* lexer) {
                 r.type = '<';
                 r.flags |= TOKEN_FLAG_BINARY_OPERATOR;
             }
-            r.length = at - r.data;
+            length = at - start;
         }break;
         case '>':{
             ++at;
@@ -163,7 +287,7 @@ token_next(Light_Lexer* lexer) {
                 r.type = '>';
                 r.flags |= TOKEN_FLAG_BINARY_OPERATOR;
             }
-            r.length = at - r.data;
+            length = at - start;
         }break;
         case '!':{
             ++at;
@@ -175,7 +299,7 @@ token_next(Light_Lexer* lexer) {
                 r.type = '!';
                 r.flags |= TOKEN_FLAG_UNARY_OPERATOR;
             }
-            r.length = at - r.data;
+            length = at - start;
         }break;
         case '|':{
             ++at;
@@ -191,7 +315,7 @@ token_next(Light_Lexer* lexer) {
                 r.type = '|';
                 r.flags |= TOKEN_FLAG_BINARY_OPERATOR;
             }
-            r.length = at - r.data;
+            length = at - start;
         }break;
         case '=':{
             ++at;
@@ -203,7 +327,7 @@ token_next(Light_Lexer* lexer) {
                 r.type = '=';
                 r.flags |= TOKEN_FLAG_ASSIGNMENT_OPERATOR;
             }
-            r.length = at - r.data;
+            length = at - start;
         }break;
         case '/':{
             ++at;
@@ -215,7 +339,7 @@ token_next(Light_Lexer* lexer) {
                 r.type = '/';
                 r.flags |= TOKEN_FLAG_BINARY_OPERATOR;
             }
-            r.length = at - r.data;
+            length = at - start;
         }break;
 		case '&': {
             ++at;
@@ -231,7 +355,7 @@ token_next(Light_Lexer* lexer) {
                 r.type = '&';
                 r.flags |= TOKEN_FLAG_BINARY_OPERATOR;
             }
-            r.length = at - r.data;
+            length = at - start;
         }break;
         case '+':{
             ++at;
@@ -243,7 +367,7 @@ token_next(Light_Lexer* lexer) {
                 r.type = '+';
                 r.flags |= TOKEN_FLAG_BINARY_OPERATOR;
             }
-            r.length = at - r.data;
+            length = at - start;
         }break; 
         case '-':{
             ++at;
@@ -258,7 +382,7 @@ token_next(Light_Lexer* lexer) {
                 r.type = '-';
                 r.flags |= TOKEN_FLAG_BINARY_OPERATOR;
             }
-            r.length = at - r.data;
+            length = at - start;
         }break;
 		case '~':{
             ++at;
@@ -270,7 +394,7 @@ token_next(Light_Lexer* lexer) {
                 r.type = '~';
                 r.flags |= TOKEN_FLAG_UNARY_OPERATOR;
             }
-            r.length = at - r.data;
+            length = at - start;
         }break;
 		case '%':{
             ++at;
@@ -282,7 +406,7 @@ token_next(Light_Lexer* lexer) {
                 r.type = '%';
                 r.flags |= TOKEN_FLAG_BINARY_OPERATOR;
             }
-            r.length = at - r.data;
+            length = at - start;
         }break;
         case '*': {
             ++at;
@@ -294,7 +418,7 @@ token_next(Light_Lexer* lexer) {
                 r.type = '*';
                 r.flags |= TOKEN_FLAG_BINARY_OPERATOR;
             }
-            r.length = at - r.data;
+            length = at - start;
         }break;
         case '^':{
             ++at;
@@ -306,7 +430,7 @@ token_next(Light_Lexer* lexer) {
                 r.type = '^';
                 r.flags |= TOKEN_FLAG_BINARY_OPERATOR;
             }
-            r.length = at - r.data;
+            length = at - start;
         }break;
 
         case '\'': {
@@ -361,13 +485,13 @@ token_next(Light_Lexer* lexer) {
             } else {
                 ++at;
             }
-            r.length = at - r.data;
+            length = at - start;
         } break;
 
         case '.': {
             if(!is_number(at[1])) {
                 r.type = *at;
-                r.length = 1;
+                length = 1;
                 ++at;
                 break;
             }
@@ -379,17 +503,12 @@ token_next(Light_Lexer* lexer) {
             r.flags |= TOKEN_FLAG_LITERAL;
             at++;	// skip "
             for (; *at && *at != '`'; ++at) {
-                if(*at == '\n') {
-                    lexer->column = 0;
-                    lexer->line++;
-                }
-                    
                 if(*at == '\\' && at[1] == '`') {
                     at += 2; // skip \ and `
                 }
             }
             at++; // skip closing `
-            r.length = at - r.data;
+            length = at - start;
         } break;
 		case '"': {
 			r.type = TOKEN_LITERAL_STRING;
@@ -397,10 +516,6 @@ token_next(Light_Lexer* lexer) {
 			at++;	// skip "
 
 			for (; *at && *at != '"'; ++at) {
-                if(*at == '\n') {
-                    lexer->column = 0;
-                    lexer->line++;
-                }
 				if (*at == 0) {
 					break;
 				} else if (*at == '\\') {
@@ -442,13 +557,13 @@ token_next(Light_Lexer* lexer) {
 				}
 			}
 			at++; // skip "
-			r.length = at - r.data;
+			length = at - start;
 		} break;
 
 		default: {
             if(*at == '.') {
                 // float starting with .
-                r = token_number(at, lexer->line, lexer->column);
+                r = token_number(at, &length);
                 break;
             } else if (is_number(*at)) {
 				if (*at == '0' && at[1] == 'x') {
@@ -468,59 +583,49 @@ token_next(Light_Lexer* lexer) {
                     r.type = TOKEN_LITERAL_BIN_INT;
                     r.flags |= TOKEN_FLAG_LITERAL;
 				} else {
-					r = token_number(at, lexer->line, lexer->column);
+					r = token_number(at, &length);
                     break;
 				}
                 r.flags |= TOKEN_FLAG_INTEGER_LITERAL;
                 r.flags |= TOKEN_FLAG_LITERAL;
 			} else if (is_letter(*at) || *at == '_') {
                 // identifier
-				for (; is_letter(*at) || is_number(*at) || *at == '_'; ++at);
+				at = identifier_end(at, lexer->stream + lexer->stream_size_bytes);
+                length = at - start;
 
-				r.type = TOKEN_IDENTIFIER;
-                r.length = at - r.data;
-
-                s32 kw_index = 0;
-                if(string_table_entry_exist(&lexer->keyword_table, MAKE_STR_LEN((char*)r.data, r.length), &kw_index, 0)) {
-                    string kw = string_table_get(&lexer->keyword_table, kw_index);
-                    r.type = kw.value;
+				r.type = token_keyword(start, length);
+                if(r.type != TOKEN_IDENTIFIER) {
                     r.flags |= TOKEN_FLAG_KEYWORD;
-                    if(kw.value == TOKEN_LITERAL_BOOL_TRUE || kw.value == TOKEN_LITERAL_BOOL_FALSE)
+                    if(r.type == TOKEN_LITERAL_BOOL_TRUE || r.type == TOKEN_LITERAL_BOOL_FALSE)
                         r.flags |= TOKEN_FLAG_LITERAL;
                 } else {
                     // internalize the identifier
-                    r.data = (u8*)lexer_internalize_identifier((const char*)r.data, r.length);
+                    r.ident = light_intern_id(lexer_internalize_identifier((const char*)start, (s32)length));
                 }
 
                 break;
 			} else {
 				r.type = *at;
-			    r.length = 1;
                 ++at;
 			}
-			r.length = at - r.data;
+			length = at - start;
 		} break;
 	}
 
-    r.filepath = lexer->filepath;
-	lexer->stream += r.length;
-	lexer->column += r.length;
-	return r;
+    r.length = (u16)length;
+    r.offset = (u32)lexer->index;
+    r.file_id = lexer->file_id;
+    *out = r;
+	return length;
 }
 
 const char*
 lexer_internalize_identifier(const char* data, int length) {
-    s32 identifier_index = 0;
-    if(string_table_entry_exist(&global_identifiers_table, MAKE_STR_LEN((char*)data, length), &identifier_index, 0)) {
-        string v = string_table_get(&global_identifiers_table, identifier_index);
-        return (const char*)v.data;
-    }
-    string_table_add(&global_identifiers_table, MAKE_STR_LEN((char*)data, length), 0);
-    return data;
+    return light_intern(data, length);
 }
 
 static void
-token_print(Light_Token t) {
+token_print(Light_Token* token) {
     /* FOREGROUND */
     const char* RST  = "";//"\x1B[0m";
     const char* KRED = "";//"\x1B[31m";
@@ -531,138 +636,122 @@ token_print(Light_Token t) {
     const char* KCYN = "";//"\x1B[36m";
     const char* KWHT = "";//"\x1B[37m";
 
-    if(t.flags & TOKEN_FLAG_KEYWORD) {
-        if(t.flags & TOKEN_FLAG_TYPE_KEYWORD) {
-            printf("%s%d:%d: %.*s%s\n", KBLU, t.line + 1, t.column, t.length, t.data, RST);
+    s32 line = token_line(token) + 1;
+    s32 column = token_column(token);
+    s32 length = token->length;
+    u8* data = token_data(token);
+
+    if(token->flags & TOKEN_FLAG_KEYWORD) {
+        if(token->flags & TOKEN_FLAG_TYPE_KEYWORD) {
+            printf("%s%d:%d: %.*s%s\n", KBLU, line, column, length, data, RST);
         } else {
-            printf("%s%d:%d: %.*s%s\n", KGRN, t.line + 1, t.column, t.length, t.data, RST);
+            printf("%s%d:%d: %.*s%s\n", KGRN, line, column, length, data, RST);
         }
     } else {
-        if(t.type == TOKEN_IDENTIFIER) {
-            printf("%s%d:%d: %.*s%s\n", KBLU, t.line + 1, t.column, t.length, t.data, RST);
+        if(token->type == TOKEN_IDENTIFIER) {
+            printf("%s%d:%d: %.*s%s\n", KBLU, line, column, length, data, RST);
         } else {
-            printf("%d:%d: %.*s\n", t.line + 1, t.column, t.length, t.data);
+            printf("%d:%d: %.*s\n", line, column, length, data);
         }
     }
 }
 
+static bool
+is_whitespace(u8 c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// First byte at or after 'at' that is not whitespace, or 'end'
+static u8*
+whitespace_end(u8* at, u8* end) {
+#if defined(LEXER_SIMD_WIDTH)
+    while(end - at >= LEXER_SIMD_WIDTH) {
+        Lexer_Vector c = lexer_vector_load(at);
+        Lexer_Vector space = lexer_vector_or(lexer_vector_eq(c, lexer_vector_set(' ')), lexer_vector_range(c, '\t', '\r'));
+        u32 mask = ~lexer_vector_mask(space) & LEXER_SIMD_ALL;
+        if(mask) return at + lexer_bit_first(mask);
+        at += LEXER_SIMD_WIDTH;
+    }
+#endif
+    while(at < end && is_whitespace(*at)) ++at;
+    return at;
+}
+
+// First byte at or after 'at' that is equal to 'a', 'b' or 0, or 'end'
+static u8*
+find_either(u8* at, u8* end, u8 a, u8 b) {
+#if defined(LEXER_SIMD_WIDTH)
+    while(end - at >= LEXER_SIMD_WIDTH) {
+        Lexer_Vector c = lexer_vector_load(at);
+        Lexer_Vector found = lexer_vector_or(lexer_vector_eq(c, lexer_vector_set(a)), lexer_vector_eq(c, lexer_vector_set(b)));
+        found = lexer_vector_or(found, lexer_vector_eq(c, lexer_vector_set(0)));
+        u32 mask = lexer_vector_mask(found);
+        if(mask) return at + lexer_bit_first(mask);
+        at += LEXER_SIMD_WIDTH;
+    }
+#endif
+    while(at < end && *at != a && *at != b && *at != 0) ++at;
+    return at;
+}
+
+// The stream always ends in a 0 byte, so looking one byte ahead of a
+// position before 'end' is safe.
 static void
 lexer_eat_whitespace(Light_Lexer* lexer) {
-    int multiline_level = 0;
-    bool running = true;
-    while(running) 
-    {
-        u8 c = lexer->stream[lexer->index];
-        switch(c) {
-            case ' ': case '\t': case '\v': case '\f': case '\r':
-                lexer->index++;
-                lexer->column++;
-            break;
-            case '\n':
-                lexer->index++;
-                lexer->line++;
-                lexer->column = 0;
-            break;
-            case '/':{
-                u8 next_token = lexer->stream[lexer->index + 1];
-                if(next_token == '/') {
-                    // single line comment
-                    lexer->index += 2;
-                    while (lexer->stream[lexer->index] != '\n') {
-                        if(!lexer->stream[lexer->index]) {
-                            lexer->index--;
-                            break;
-                        }
-                        lexer->index++;
+    u8* at = lexer->stream + lexer->index;
+    u8* end = lexer->stream + lexer->stream_size_bytes;
+
+    while(true) {
+        at = whitespace_end(at, end);
+        if(at >= end || at[0] != '/') break;
+
+        if(at[1] == '/') {
+            // single line comment
+            at = find_either(at + 2, end, '\n', '\n');
+            if(at < end && *at == '\n') ++at;
+        } else if(at[1] == '*') {
+            // multi line comment, they can be nested
+            s32 multiline_level = 1;
+            at += 2;
+            while(true) {
+                at = find_either(at, end, '*', '/');
+                if(at >= end || *at == 0) break;
+                if(at[0] == '*' && at[1] == '/') {
+                    multiline_level--;
+                    if(multiline_level == 0) {
+                        at += 2;
+                        break;
                     }
-                    lexer->line++;
-                    lexer->index++;
-                    lexer->column = 0;
-                } else if(next_token == '*') {
-                    // multi line comment
-                    lexer->index += 2;
+                } else if(at[0] == '/' && at[1] == '*') {
                     multiline_level++;
-                    u8* at = lexer->stream + lexer->index;
-                    while(true) {
-                        if(*at == '*' && at[1] == '/') {
-                            multiline_level--;
-                            if(multiline_level == 0) break;
-                        }
-                        if(*at == '/' && at[1] == '*') {
-                            multiline_level++;
-                        }
-                        if(*at == '\n') {
-                            lexer->line++;
-                            lexer->column = 0;
-                        }
-                        ++at;
-                        ++lexer->index;
-                    }
-                    lexer->index += 2;
-                } else {
-                    running = false;
-                    break;
                 }
-            } break;
-            default: 
-                running = false;
+                ++at;
+            }
+        } else {
             break;
         }
     }
-}
 
-static void
-lexer_internalize_keywords(Light_Lexer* lexer) {
-    if(!lexer->keyword_table_initialized) {
-        string_table_new(&lexer->keyword_table, 2048);
-        string_table_add(&lexer->keyword_table, MAKE_STR("bool", TOKEN_BOOL), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("void", TOKEN_VOID), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("r32", TOKEN_REAL32), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("r64", TOKEN_REAL64), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("s8", TOKEN_SINT8), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("s16", TOKEN_SINT16), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("s32", TOKEN_SINT32), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("s64", TOKEN_SINT64), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("u8", TOKEN_UINT8), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("u16", TOKEN_UINT16), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("u32", TOKEN_UINT32), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("u64", TOKEN_UINT64), 0);
-
-        string_table_add(&lexer->keyword_table, MAKE_STR("true", TOKEN_LITERAL_BOOL_TRUE), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("false", TOKEN_LITERAL_BOOL_FALSE), 0);
-
-        string_table_add(&lexer->keyword_table, MAKE_STR("if", TOKEN_KEYWORD_IF), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("else", TOKEN_KEYWORD_ELSE), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("for", TOKEN_KEYWORD_FOR), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("while", TOKEN_KEYWORD_WHILE), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("break", TOKEN_KEYWORD_BREAK), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("continue", TOKEN_KEYWORD_CONTINUE), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("return", TOKEN_KEYWORD_RETURN), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("struct", TOKEN_KEYWORD_STRUCT), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("enum", TOKEN_KEYWORD_ENUM), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("union", TOKEN_KEYWORD_UNION), 0);
-        string_table_add(&lexer->keyword_table, MAKE_STR("null", TOKEN_KEYWORD_NULL), 0);
-    }
+    lexer->index = (s32)(at - lexer->stream);
 }
 
-Light_Token* 
-lexer_file(Light_Lexer* lexer, const char* filename, u32 flags) {
-    FILE* file = fopen(filename, "rb");
+// Loads the file and registers it as a source file, without lexing it.
+bool
+lexer_open_file(Light_Lexer* lexer, const char* filename) {
+    char*  stream = 0;
+    size_t length_bytes = 0;
 
-    if(!file) {
-        fprintf(stderr, "Could not load file %s\n", filename);
-        return 0;
+    if(light_map_entire_file(filename, &lexer->stream_map)) {
+        stream = lexer->stream_map.data;
+        length_bytes = lexer->stream_map.size_bytes;
+    } else {
+        // Not a regular file or the platform cannot map it with a
+        // trailing sentinel, fallback to reading it.
+        stream = light_read_entire_file(filename, &length_bytes);
+        if(!stream) return false;
+        lexer->stream_buffer = (u8*)stream;
     }
 
-    fseek(file, 0, SEEK_END);
-    size_t length_bytes = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    
-    char* stream = light_alloc(length_bytes + 1);
-
-    fread(stream, length_bytes, 1, file);
-    fclose(file);
-
     // Copy filename to lexer
     size_t filename_size = strlen(filename);
     lexer->filepath = light_alloc(filename_size + 1);
@@ -673,21 +762,48 @@ lexer_file(Light_Lexer* lexer, const char* filename, u32 flags) {
 
     lexer->filename = light_filename_from_path(lexer->filepath);
 
-    return lexer_cstr(lexer, stream, (s32)length_bytes, flags);
+    lexer->stream = (u8*)stream;
+    lexer->stream_size_bytes = length_bytes;
+    lexer->index = 0;
+    lexer->file_id = source_file_register(lexer->filepath, lexer->stream, lexer->stream_size_bytes);
+    return true;
 }
 
 Light_Token* 
-lexer_cstr(Light_Lexer* lexer, char* str, s32 length, u32 flags) {
-    lexer_internalize_keywords(lexer);
+lexer_file(Light_Lexer* lexer, const char* filename, u32 flags) {
+    if(!lexer_open_file(lexer, filename)) return 0;
+    return lexer_tokenize(lexer, flags);
+}
 
+Light_Token* 
+lexer_cstr(Light_Lexer* lexer, char* str, s32 length, u32 flags) {
     lexer->stream = (u8*)str;
     lexer->stream_size_bytes = (size_t)length;
+    lexer->index = 0;
+    lexer->file_id = source_file_register(lexer->filepath, lexer->stream, lexer->stream_size_bytes);
+    return lexer_tokenize(lexer, flags);
+}
 
-	Light_Token* tokens = array_new(Light_Token);
+// Lexes the whole stream of the lexer
+Light_Token*
+lexer_tokenize(Light_Lexer* lexer, u32 flags) {
+    s32 length = (s32)lexer->stream_size_bytes;
+
+    // Most tokens are a few bytes long plus the whitespace around them
+	Light_Token* tokens = array_new_len(Light_Token, length / 4 + 16);
 
     while(true) {
         lexer_eat_whitespace(lexer);
-        Light_Token t = token_next(lexer);
+        Light_Token t = {0};
+        s64 token_length = token_next(lexer, &t);
+
+        if(token_length > LIGHT_TOKEN_MAX_LENGTH) {
+            fprintf(stderr, "%s:%d:%d: Lexer Error: token is longer than %d bytes\n",
+                (lexer->filepath) ? lexer->filepath : "", token_line(&t) + 1, token_column(&t) + 1, LIGHT_TOKEN_MAX_LENGTH);
+            array_free(tokens);
+            return 0;
+        }
+        lexer->index += (s32)token_length;
 
         // push token
 		array_push(tokens, t);
@@ -695,7 +811,7 @@ lexer_cstr(Light_Lexer* lexer, char* str, s32 length, u32 flags) {
         if(t.type == TOKEN_END_OF_STREAM) break;
 
         if(flags & LIGHT_LEXER_PRINT_TOKENS)
-            token_print(t);
+            token_print(&t);
     }
 
 	lexer->tokens = tokens;
@@ -726,15 +842,19 @@ lexer_rewind(Light_Lexer* lexer, s32 count) {
 
 void  
 lexer_free(Light_Lexer* lexer) {
-    // Free keyword table
-    string_table_free(&lexer->keyword_table);
-    lexer->keyword_table_initialized = false;
-
     if(lexer->filepath) {
         // do not free filename, since it is a substring of filepath
         light_free(lexer->filepath);
-        light_free(lexer->stream);
     }
+
+    // Tokens and internalized identifiers point into the stream, this
+    // must only be called once nothing references them anymore.
+    if(lexer->stream_map.data) {
+        light_unmap_file(&lexer->stream_map);
+    } else if(lexer->stream_buffer) {
+        light_free(lexer->stream_buffer);
+    }
+    lexer->stream_buffer = 0;
 }
 
 const char* 
@@ -825,15 +945,86 @@ token_type_to_str(Light_Token_Type token_type) {
     }
 }
 
+Light_Token
+token_identifier(const char* str, int length) {
+    Light_Token token = {0};
+    token.type = TOKEN_IDENTIFIER;
+    token.length = (u16)length;
+    token.file_id = LIGHT_FILE_ID_NONE;
+    token.ident = light_intern_id(lexer_internalize_identifier(str, length));
+    return token;
+}
+
 Light_Token* 
 token_new_identifier_from_string(const char* str, int length) {
     Light_Token* token = (Light_Token*)light_alloc(sizeof(Light_Token));
-    token->column = 0;
-    token->line = 0;
-    token->type = TOKEN_IDENTIFIER;
-    token->length = length;
-    token->flags = 0;
-    token->filepath = 0;
-    token->data = (u8*)lexer_internalize_identifier(str, length);;
+    *token = token_identifier(str, length);
     return token;
-}
\ No newline at end of file
+}
+
+u8*
+token_data(Light_Token* token) {
+    if(token->type == TOKEN_IDENTIFIER)
+        return (u8*)light_intern_from_id(token->ident);
+    if(token->file_id == LIGHT_FILE_ID_NONE)
+        return 0;
+    return source_files[token->file_id]->data + token->offset;
+}
+
+char*
+token_filepath(Light_Token* token) {
+    if(token->file_id == LIGHT_FILE_ID_NONE)
+        return 0;
+    return source_files[token->file_id]->filepath;
+}
+
+static u32*
+source_file_line_starts(Light_Source_File* file) {
+    light_mutex_lock(&file->mutex);
+    if(!file->line_starts) {
+        u32* line_starts = array_new(u32);
+        array_push(line_starts, 0);
+        for(u64 i = 0; i < file->size_bytes; ++i) {
+            if(file->data[i] == '\n') {
+                u32 next = (u32)(i + 1);
+                array_push(line_starts, next);
+            }
+        }
+        file->line_starts = line_starts;
+    }
+    light_mutex_unlock(&file->mutex);
+    return file->line_starts;
+}
+
+// Index of the line containing the token
+static s32
+token_line_index(Light_Token* token, u32** out_line_starts) {
+    if(token->file_id == LIGHT_FILE_ID_NONE)
+        return -1;
+    u32* line_starts = source_file_line_starts(source_files[token->file_id]);
+    s32 low = 0;
+    s32 high = (s32)array_length(line_starts) - 1;
+    while(low < high) {
+        s32 mid = (low + high + 1) / 2;
+        if(line_starts[mid] <= token->offset)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    *out_line_starts = line_starts;
+    return low;
+}
+
+s32
+token_line(Light_Token* token) {
+    u32* line_starts = 0;
+    s32 line = token_line_index(token, &line_starts);
+    return (line < 0) ? 0 : line;
+}
+
+s32
+token_column(Light_Token* token) {
+    u32* line_starts = 0;
+    s32 line = token_line_index(token, &line_starts);
+    return (line < 0) ? 0 : (s32)(token->offset - line_starts[line]);
+}
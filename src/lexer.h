@@ -1,6 +1,8 @@
 #pragma once
 #include <common.h>
 #include "utils/string_table.h"
+#include "utils/os.h"
+#include "utils/thread.h"
 
 typedef enum {
 	TOKEN_END_OF_STREAM = 0,
@@ -110,16 +112,29 @@ typedef enum {
 	TOKEN_FLAG_LITERAL             = (1 << 6),
 } Light_Token_Flag;
 
+#define LIGHT_TOKEN_MAX_LENGTH 0xffff
+#define LIGHT_FILE_ID_NONE     0xffff // tokens made up by the compiler
+
+// Tokens only store where they are in the source; the text, line and column
+// are recovered with the token_* functions below. Identifiers also carry
+// their intern id, so their text is the interned string.
 typedef struct {
-    Light_Token_Type type;
-    s32              line;
-    s32              column;
-    u8*              data;
-    s32              length;
-    u32              flags;
-	char*            filepath;
+    u16 type;    // Light_Token_Type
+    u16 flags;   // Light_Token_Flag
+    u16 length;
+    u16 file_id;
+    u32 offset;  // in bytes from the start of the file
+    u32 ident;   // intern id, only for TOKEN_IDENTIFIER
 } Light_Token;
 
+typedef struct {
+    char*       filepath;
+    u8*         data;
+    u64         size_bytes;
+    Light_Mutex mutex;
+    u32*        line_starts; // built on the first line/column query
+} Light_Source_File;
+
 typedef enum {
 	LIGHT_LEXER_PRINT_TOKENS = (1 << 0),
 } Light_Lexer_Flags;
@@ -129,15 +144,16 @@ typedef struct {
 	char*        filepath;
 	char*        filepath_absolute;
 
-    s32          line;
-    s32          column;
     s32          index;
+    u16          file_id;
     Light_Token* tokens;
     u8*          stream;
     u64          stream_size_bytes;
 
-    String_Table  keyword_table;
-    bool          keyword_table_initialized;
+    // Tokens point directly into the source, so the file stays mapped
+    // until lexer_free is called.
+    Light_File_Map stream_map;
+    u8*            stream_buffer; // heap copy, only when mapping fails
 } Light_Lexer;
 
 typedef enum {
@@ -159,6 +175,8 @@ typedef enum {
 
 Light_Token* lexer_file(Light_Lexer* lexer, const char* filename, u32 flags);
 Light_Token* lexer_cstr(Light_Lexer* lexer, char* str, s32 length, u32 flags);
+bool         lexer_open_file(Light_Lexer* lexer, const char* filename);
+Light_Token* lexer_tokenize(Light_Lexer* lexer, u32 flags);
 Light_Token* lexer_next(Light_Lexer* lexer);
 Light_Token* lexer_peek(Light_Lexer* lexer);
 Light_Token* lexer_peek_n(Light_Lexer* lexer, s32 n);
@@ -170,5 +188,11 @@ void         initialize_global_identifiers_table();
 const char*  token_type_to_str(Light_Token_Type token_type);
 
 Light_Token* token_new_identifier_from_string(const char* str, int length);
+Light_Token  token_identifier(const char* str, int length);
+
+u8*          token_data(Light_Token* token);
+char*        token_filepath(Light_Token* token);
+s32          token_line(Light_Token* token);   // starting at 0
+s32          token_column(Light_Token* token); // starting at 0
 
 extern string light_special_idents_table[LIGHT_SPECIAL_IDENT_COUNT];
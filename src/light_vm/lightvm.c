@@ -4,6 +4,15 @@
 #include <string.h>
 #include "lightvm.h"
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <unistd.h>
+#elif defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#endif
+
 #define true 1
 #define false 0
 
@@ -13,27 +22,158 @@ extern u16 cmp_flags_32(u32 l, u32 r);
 extern u16 cmp_flags_64(u64 l, u64 r);
 extern u64 lvm_ext_call(void* stack, void* proc, u64* flt_ret);
 
+// -------------------------------------
+// ------------ Segments ---------------
+// -------------------------------------
+
+#define LVM_GUARD_SIZE   (64 * 1024)  // on each side of every segment
+#define LVM_INITIAL_SIZE (64 * 1024)  // usable code and data to start with
+
+#if defined(__linux__)
+
+// Reserves the whole range with the guards, nothing is usable yet
+static bool
+segment_reserve(Memory* segment, u64 limit) {
+    u64 page = (u64)sysconf(_SC_PAGESIZE);
+    limit = (limit + page - 1) & ~(page - 1);
+    u8* range = (u8*)mmap(0, limit + 2 * LVM_GUARD_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if(range == MAP_FAILED) return false;
+    segment->block = range + LVM_GUARD_SIZE;
+    segment->size = 0;
+    segment->limit = limit;
+    return true;
+}
+
+static void
+segment_release(Memory* segment) {
+    if(segment->block) munmap((u8*)segment->block - LVM_GUARD_SIZE, segment->limit + 2 * LVM_GUARD_SIZE);
+}
+
+static bool
+segment_commit(u8* start, u64 size) {
+    return mprotect(start, size, PROT_READ|PROT_WRITE) == 0;
+}
+
+#elif defined(_WIN32) || defined(_WIN64)
+
+// Same layout as on Linux, the guards stay reserved and never committed.
+// Faults are not caught, an access to a guard is an access violation.
+static bool
+segment_reserve(Memory* segment, u64 limit) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    u64 page = (u64)info.dwPageSize;
+    limit = (limit + page - 1) & ~(page - 1);
+    u8* range = (u8*)VirtualAlloc(0, limit + 2 * LVM_GUARD_SIZE, MEM_RESERVE, PAGE_NOACCESS);
+    if(!range) return false;
+    segment->block = range + LVM_GUARD_SIZE;
+    segment->size = 0;
+    segment->limit = limit;
+    return true;
+}
+
+static void
+segment_release(Memory* segment) {
+    if(segment->block) VirtualFree((u8*)segment->block - LVM_GUARD_SIZE, 0, MEM_RELEASE);
+}
+
+static bool
+segment_commit(u8* start, u64 size) {
+    return VirtualAlloc(start, size, MEM_COMMIT, PAGE_READWRITE) != 0;
+}
+
+#endif
+
+#if defined(__linux__) || defined(_WIN32) || defined(_WIN64)
+
+int32_t
+light_vm_segment_grow(Memory* segment, uint64_t needed) {
+    if(needed <= segment->size) return true;
+    if(needed > segment->limit) return false;
+
+    u64 size = (segment->size) ? segment->size : LVM_INITIAL_SIZE;
+    while(size < needed) size *= 2;
+    if(size > segment->limit) size = segment->limit;
+    if(!segment_commit((u8*)segment->block + segment->size, size - segment->size))
+        return false;
+    segment->size = size;
+    return true;
+}
+
+#else
+
+// Without a way to reserve address space every segment is allocated
+// whole, so none gets more than the 1MB it always had
+#define LVM_ALLOCATED_LIMIT (1024 * 1024)
+
+static bool
+segment_reserve(Memory* segment, u64 limit) {
+    if(limit > LVM_ALLOCATED_LIMIT) limit = LVM_ALLOCATED_LIMIT;
+    segment->block = calloc(1, limit);
+    segment->size = 0;
+    segment->limit = limit;
+    return segment->block != 0;
+}
+
+static void
+segment_release(Memory* segment) {
+    free(segment->block);
+}
+
+int32_t
+light_vm_segment_grow(Memory* segment, uint64_t needed) {
+    if(needed > segment->limit) return false;
+    if(needed > segment->size) segment->size = needed;
+    return true;
+}
+
+#endif
+
+// Less than LVM_INITIAL_SIZE when that is past the limit
+static u64
+segment_initial_size(Memory* segment) {
+    return (segment->limit < LVM_INITIAL_SIZE) ? segment->limit : LVM_INITIAL_SIZE;
+}
+
 Light_VM_State*
-light_vm_init() {
+light_vm_init_with_limits(Light_VM_Limits limits) {
     Light_VM_State* state = (Light_VM_State*)calloc(1, sizeof(*state));
 
-    state->data.block = calloc(1, 1024 * 1024); // 1MB
-    state->data.size = 1024 * 1024;
+    if(!segment_reserve(&state->code, limits.code) ||
+        !segment_reserve(&state->data, limits.data) ||
+        !segment_reserve(&state->stack, limits.stack) ||
+        !light_vm_segment_grow(&state->code, segment_initial_size(&state->code)) ||
+        !light_vm_segment_grow(&state->data, segment_initial_size(&state->data)) ||
+        !light_vm_segment_grow(&state->stack, state->stack.limit))
+    {
+        light_vm_free(state);
+        return 0;
+    }
 
-    state->code.block = calloc(1, 1024 * 1024); // 1MB
-    state->code.size = 1024 * 1024;
+    return state;
+}
 
-    state->stack.block = calloc(1, 1024 * 1024); // 1MB
-    state->stack.size = 1024 * 1024;
+Light_VM_State*
+light_vm_init() {
+    Light_VM_Limits limits = { LVM_DEFAULT_CODE_LIMIT, LVM_DEFAULT_DATA_LIMIT, LVM_DEFAULT_STACK_LIMIT };
+    return light_vm_init_with_limits(limits);
+}
 
-    return state;
+static void
+light_vm_decoded_free(Light_VM_Decoded* decoded) {
+    free(decoded->instructions);
+    free(decoded->offsets);
+    free(decoded->index);
+    free(decoded->code);
 }
 
 void
 light_vm_free(Light_VM_State* state) {
-    free(state->data.block);
-    free(state->code.block);
-    free(state->stack.block);
+    light_vm_decoded_free(&state->decoded);
+    light_vm_jit_free(state);
+    segment_release(&state->data);
+    segment_release(&state->code);
+    segment_release(&state->stack);
     free(state);
 }
 
@@ -52,6 +192,12 @@ push_immediate(Light_VM_State* state, u8 size_bytes, u64 imm) {
 Light_VM_Instruction_Info 
 light_vm_push_instruction(Light_VM_State* vm_state, Light_VM_Instruction instr, uint64_t immediate) {
     Light_VM_Instruction_Info info = {0};
+    // Room for the instruction and the largest immediate
+    if(!light_vm_segment_grow(&vm_state->code, vm_state->code_offset + sizeof(Light_VM_Instruction) + sizeof(u64))) {
+        vm_state->fault = LVM_FAULT_CODE_FULL;
+        light_vm_report_fault(stderr, vm_state);
+        return info;
+    }
     info.byte_size = (u32)sizeof(Light_VM_Instruction);
     info.offset_address = vm_state->code_offset;
     info.absolute_address = (Light_VM_Instruction*)((u8*)vm_state->code.block + vm_state->code_offset);
@@ -150,6 +296,8 @@ light_vm_push_r64_to_datasegment(Light_VM_State* state, r64 f) {
 
 int64_t
 light_vm_patch_immediate_distance(Light_VM_Instruction_Info from, Light_VM_Instruction_Info to) {
+    // Pushed past the code limit
+    if(!from.absolute_address || !to.absolute_address) return 0;
     switch(((Light_VM_Instruction*)from.absolute_address)->imm_size_bytes) {
         case 1: *(u8*)(from.absolute_address +  1) = (u8)((u8*)to.absolute_address - (u8*)from.absolute_address); break;
         case 2: *(u16*)(from.absolute_address + 1) = (u16)((u8*)to.absolute_address - (u8*)from.absolute_address); break;
@@ -185,6 +333,7 @@ light_vm_offset_from_current_instruction(Light_VM_State* state, Light_VM_Instruc
 
 void
 light_vm_patch_from_to_current_instruction(Light_VM_State* state, Light_VM_Instruction_Info from) {
+    if(!from.absolute_address) return;
     int64_t off = (u8*)state->code.block + state->code_offset - (u8*)from.absolute_address;
     switch(from.absolute_address->imm_size_bytes) {
         case 1: *(u8*)(from.absolute_address + 1)  = (u8)off; break;
@@ -198,6 +347,8 @@ light_vm_patch_from_to_current_instruction(Light_VM_State* state, Light_VM_Instr
 // Returns the immediate size in bytes
 uint8_t
 light_vm_patch_to_current_instruction(Light_VM_State* state, Light_VM_Instruction_Info to) {
+    if(!to.absolute_address || !light_vm_segment_grow(&state->code, state->code_offset + sizeof(Light_VM_Instruction) + sizeof(u64)))
+        return 0;
     Light_VM_Instruction* current_instr = (Light_VM_Instruction*)((u8*)state->code.block + state->code_offset);
     s64 diff = (u8*)to.absolute_address - (u8*)state->code.block;
     uint8_t imm_byte_size = 0;
@@ -1021,6 +1172,560 @@ light_vm_reset(Light_VM_State* state) {
     state->f64registers[FR7] = 0.0;
 }
 
+// Prints every instruction before running it
+static void
+light_vm_execute_traced(Light_VM_State* state) {
+    for(;;) {
+        Light_VM_Instruction in = *(Light_VM_Instruction*)(state->registers[RIP]);
+
+        void* addr_of_imm = ((u8*)state->registers[RIP]) + sizeof(Light_VM_Instruction); // address of immediate
+        u64 imm = get_value_of_immediate(state, in, addr_of_imm);
+        fprintf(stdout, "%ld: ", state->registers[RIP]);
+        light_vm_print_instruction(stdout, in, imm);
+
+        if(in.type == LVM_HLT) break;
+
+        light_vm_execute_instruction(state, in);
+    }
+}
+
+// Runs until hlt going through the switch for every instruction
+static void
+light_vm_execute_switch(Light_VM_State* state) {
+    for(;;) {
+        Light_VM_Instruction in = *(Light_VM_Instruction*)(state->registers[RIP]);
+        if(in.type == LVM_HLT) break;
+        light_vm_execute_instruction(state, in);
+    }
+}
+
+#if defined(__GNUC__)
+
+// -------------------------------------
+// ------- Threaded execution ----------
+// -------------------------------------
+
+// The code block is decoded into state->decoded before it runs, every
+// decoded instruction holds the address of its handler and jumps straight
+// to the one of the next instruction (GCC computed goto). Binary
+// instructions have one handler per opcode, addressing mode and operand
+// size. Instructions without a handler of their own go through
+// light_vm_execute_instruction on the encoded form.
+//
+// RIP is only written when the encoded form runs, instructions that use it
+// as an operand are never decoded. When the code jumps to an address that
+// is not the start of a decoded instruction the rest runs on the switch.
+
+// Key of the handler table: type, binary addressing mode and operand size
+// class, the fields are read as binary for every type, for the other types
+// all the keys of the type lead to the same handler.
+#define LVM_DISPATCH_KEY(I) (((u32)(I)->type << 7) | ((u32)(I)->binary.addr_mode << 3) | lvm_size_class[(I)->binary.bytesize])
+#define LVM_DISPATCH_SIZE   (256 << 7)
+#define LVM_DISPATCH_TYPE_KEYS (1 << 7)
+
+#define LVM_NOT_DECODED 0xffffffff
+
+// Type 255 is not an instruction, its keys lead to the generic handler
+#define LVM_GENERIC_KEY (LVM_DISPATCH_SIZE - 1)
+
+// 1, 2, 4 and 8 bytes, every other size is invalid and is left to the switch
+static const u8 lvm_size_class[16] = { 4, 0, 1, 4, 2, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, 4 };
+
+#define LVM_DISPATCH() goto *in->handler
+
+// Operands of each binary addressing mode, same as light_vm_execute_binary_arithmetic_instruction
+#define LVM_OPERANDS_REG_TO_REG          dst = in->dst; src = in->src;
+#define LVM_OPERANDS_REG_TO_MEM          dst = (void*)*in->dst; src = in->src;
+#define LVM_OPERANDS_REG_TO_IMM_MEM      dst = (void*)in->imm; src = in->src;
+#define LVM_OPERANDS_REG_TO_MEM_OFFSETED dst = (void*)(*in->dst + in->imm); src = in->src;
+#define LVM_OPERANDS_REG_OFFSETED_TO_REG src = (void*)(*in->src + in->imm); dst = in->dst;
+#define LVM_OPERANDS_MEM_TO_REG          src = (void*)*in->src; dst = in->dst;
+#define LVM_OPERANDS_MEM_IMM_TO_REG      src = (void*)in->imm; dst = in->dst;
+#define LVM_OPERANDS_IMM_TO_REG          src = (void*)&in->imm; dst = in->dst;
+
+#define LVM_EXEC_CMP(SIZE, U, S) { \
+        u64 flags = cmp_flags_##SIZE(*(U*)dst, *(U*)src); \
+        state->rflags.carry = (flags >> 8) & 0x1; \
+        state->rflags.zerof = (flags >> 14) & 0x1; \
+        state->rflags.sign = (flags >> 15) & 0x1; \
+        state->rflags.overflow = (flags >> 19) & 0x1; \
+    }
+#define LVM_EXEC_MOV(SIZE, U, S)   *(U*)dst = *(U*)src;
+#define LVM_EXEC_ADD_S(SIZE, U, S) *(S*)dst = *(S*)dst + *(S*)src;
+#define LVM_EXEC_SUB_S(SIZE, U, S) *(S*)dst = *(S*)dst - *(S*)src;
+#define LVM_EXEC_MUL_S(SIZE, U, S) *(S*)dst = *(S*)dst * *(S*)src;
+#define LVM_EXEC_DIV_S(SIZE, U, S) *(S*)dst = *(S*)dst / *(S*)src;
+#define LVM_EXEC_MOD_S(SIZE, U, S) *(S*)dst = *(S*)dst % *(S*)src;
+#define LVM_EXEC_ADD_U(SIZE, U, S) *(U*)dst = *(U*)dst + *(U*)src;
+#define LVM_EXEC_SUB_U(SIZE, U, S) *(U*)dst = *(U*)dst - *(U*)src;
+#define LVM_EXEC_MUL_U(SIZE, U, S) *(U*)dst = *(U*)dst * *(U*)src;
+#define LVM_EXEC_DIV_U(SIZE, U, S) *(U*)dst = *(U*)dst / *(U*)src;
+#define LVM_EXEC_MOD_U(SIZE, U, S) *(U*)dst = *(U*)dst % *(U*)src;
+#define LVM_EXEC_SHL(SIZE, U, S)   *(U*)dst = *(U*)dst << *(U*)src;
+#define LVM_EXEC_SHR(SIZE, U, S)   *(U*)dst = *(U*)dst >> *(U*)src;
+#define LVM_EXEC_OR(SIZE, U, S)    *(U*)dst = *(U*)dst | *(U*)src;
+#define LVM_EXEC_AND(SIZE, U, S)   *(U*)dst = *(U*)dst & *(U*)src;
+#define LVM_EXEC_XOR(SIZE, U, S)   *(U*)dst = *(U*)dst ^ *(U*)src;
+
+// X(OP, MODE, SIZE, SIZE_CLASS, UNSIGNED, SIGNED) for every binary handler
+#define LVM_BINARY_SIZES(X, OP, MODE) \
+    X(OP, MODE, 8, 0, u8, s8) X(OP, MODE, 16, 1, u16, s16) X(OP, MODE, 32, 2, u32, s32) X(OP, MODE, 64, 3, u64, s64)
+#define LVM_BINARY_MODES(X, OP) \
+    LVM_BINARY_SIZES(X, OP, REG_TO_REG) LVM_BINARY_SIZES(X, OP, REG_TO_MEM) \
+    LVM_BINARY_SIZES(X, OP, REG_TO_IMM_MEM) LVM_BINARY_SIZES(X, OP, REG_TO_MEM_OFFSETED) \
+    LVM_BINARY_SIZES(X, OP, REG_OFFSETED_TO_REG) LVM_BINARY_SIZES(X, OP, MEM_TO_REG) \
+    LVM_BINARY_SIZES(X, OP, MEM_IMM_TO_REG) LVM_BINARY_SIZES(X, OP, IMM_TO_REG)
+#define LVM_BINARY_HANDLERS(X) \
+    LVM_BINARY_MODES(X, CMP) LVM_BINARY_MODES(X, MOV) \
+    LVM_BINARY_MODES(X, ADD_S) LVM_BINARY_MODES(X, SUB_S) LVM_BINARY_MODES(X, MUL_S) \
+    LVM_BINARY_MODES(X, DIV_S) LVM_BINARY_MODES(X, MOD_S) \
+    LVM_BINARY_MODES(X, ADD_U) LVM_BINARY_MODES(X, SUB_U) LVM_BINARY_MODES(X, MUL_U) \
+    LVM_BINARY_MODES(X, DIV_U) LVM_BINARY_MODES(X, MOD_U) \
+    LVM_BINARY_MODES(X, SHL) LVM_BINARY_MODES(X, SHR) \
+    LVM_BINARY_MODES(X, OR) LVM_BINARY_MODES(X, AND) LVM_BINARY_MODES(X, XOR)
+
+#define LVM_BINARY_ENTRY(OP, MODE, SIZE, SIZE_CLASS, U, S) \
+    dispatch[((u32)LVM_##OP << 7) | ((u32)BIN_ADDR_MODE_##MODE << 3) | SIZE_CLASS] = &&lvm_##OP##_##MODE##_##SIZE;
+
+#define LVM_BINARY_HANDLER(OP, MODE, SIZE, SIZE_CLASS, U, S) \
+    lvm_##OP##_##MODE##_##SIZE: { \
+        LVM_OPERANDS_##MODE \
+        LVM_EXEC_##OP(SIZE, U, S) \
+        in++; \
+        LVM_DISPATCH(); \
+    }
+
+#define LVM_CONDITION_BEQ   state->rflags.zerof
+#define LVM_CONDITION_BNE   !state->rflags.zerof
+#define LVM_CONDITION_BLT_S state->rflags.sign != state->rflags.overflow
+#define LVM_CONDITION_BGT_S !state->rflags.zerof && (state->rflags.sign == state->rflags.overflow)
+#define LVM_CONDITION_BLE_S state->rflags.zerof || (state->rflags.sign != state->rflags.overflow)
+#define LVM_CONDITION_BGE_S state->rflags.sign == state->rflags.overflow
+#define LVM_CONDITION_BLT_U state->rflags.carry
+#define LVM_CONDITION_BGT_U !state->rflags.carry && !state->rflags.zerof
+#define LVM_CONDITION_BLE_U state->rflags.carry || state->rflags.zerof
+#define LVM_CONDITION_BGE_U !state->rflags.carry
+#define LVM_CONDITION_JMP   true
+
+// X(TYPE) for every integer branch
+#define LVM_BRANCHES(X) \
+    X(BEQ) X(BNE) X(BLT_S) X(BGT_S) X(BLE_S) X(BGE_S) \
+    X(BLT_U) X(BGT_U) X(BLE_U) X(BGE_U) X(JMP)
+
+#define LVM_BRANCH_ENTRY(TYPE) \
+    for(u32 k = 0; k < LVM_DISPATCH_TYPE_KEYS; ++k) dispatch[((u32)LVM_##TYPE << 7) | k] = &&lvm_##TYPE;
+
+// imm is the decoded target
+#define LVM_BRANCH_HANDLER(TYPE) \
+    lvm_##TYPE: \
+        if(LVM_CONDITION_##TYPE) { \
+            in = (Light_VM_Decoded_Instruction*)in->imm; \
+        } else { \
+            in++; \
+        } \
+        LVM_DISPATCH();
+
+// -------------------------------------
+// ---------- Superinstructions --------
+// -------------------------------------
+
+// Sequences the bytecode generator emits all the time run in a single
+// handler, see light_vm_fuse. The handler goes on the first instruction
+// of the sequence and reads the operands of the others from the decoded
+// instructions that follow it, which keep their own handlers for code
+// that jumps in the middle of the sequence.
+
+// Keys of the superinstructions, types 253 and 254 are not instructions
+#define LVM_CMP_BRANCH_KEY(TYPE, IMMEDIATE, SIZE_CLASS) \
+    ((254u << 7) | ((u32)((TYPE) - LVM_BEQ) << 3) | ((u32)(IMMEDIATE) << 2) | (SIZE_CLASS))
+#define LVM_FUSED_KEY(N) ((253u << 7) | (N))
+
+typedef enum {
+    LVM_FUSED_MOV_ADD = 0,          // mov r0, r1; adds r0, 0x8
+    LVM_FUSED_LOAD_ADD,             // mov r0, [r1]; adds r2, r0
+    LVM_FUSED_LOAD_OFFSETED_ADD,    // mov r0, [r1 + 0x8]; adds r2, r0
+    LVM_FUSED_ADD_IMMEDIATE_TO_MEM, // mov r0, [r1 + 0x8]; adds r0, 0x1; mov [r1 + 0x8], r0
+} Light_VM_Fused;
+
+#define LVM_CMP_BRANCH_IMMEDIATE_REG_TO_REG 0
+#define LVM_CMP_BRANCH_IMMEDIATE_IMM_TO_REG 1
+
+// X(MODE, SIZE, SIZE_CLASS, UNSIGNED, SIGNED, TYPE) for every compare and conditional branch
+#define LVM_CMP_BRANCH_TYPES(X, MODE, SIZE, SIZE_CLASS, U, S) \
+    X(MODE, SIZE, SIZE_CLASS, U, S, BEQ) X(MODE, SIZE, SIZE_CLASS, U, S, BNE) \
+    X(MODE, SIZE, SIZE_CLASS, U, S, BLT_S) X(MODE, SIZE, SIZE_CLASS, U, S, BGT_S) \
+    X(MODE, SIZE, SIZE_CLASS, U, S, BLE_S) X(MODE, SIZE, SIZE_CLASS, U, S, BGE_S) \
+    X(MODE, SIZE, SIZE_CLASS, U, S, BLT_U) X(MODE, SIZE, SIZE_CLASS, U, S, BGT_U) \
+    X(MODE, SIZE, SIZE_CLASS, U, S, BLE_U) X(MODE, SIZE, SIZE_CLASS, U, S, BGE_U)
+#define LVM_CMP_BRANCH_SIZES(X, MODE) \
+    LVM_CMP_BRANCH_TYPES(X, MODE, 8, 0, u8, s8) LVM_CMP_BRANCH_TYPES(X, MODE, 16, 1, u16, s16) \
+    LVM_CMP_BRANCH_TYPES(X, MODE, 32, 2, u32, s32) LVM_CMP_BRANCH_TYPES(X, MODE, 64, 3, u64, s64)
+#define LVM_CMP_BRANCHES(X) \
+    LVM_CMP_BRANCH_SIZES(X, REG_TO_REG) LVM_CMP_BRANCH_SIZES(X, IMM_TO_REG)
+
+#define LVM_CMP_BRANCH_ENTRY(MODE, SIZE, SIZE_CLASS, U, S, TYPE) \
+    dispatch[LVM_CMP_BRANCH_KEY(LVM_##TYPE, LVM_CMP_BRANCH_IMMEDIATE_##MODE, SIZE_CLASS)] = &&lvm_CMP_##MODE##_##SIZE##_##TYPE;
+
+// Same flags as cmp_flags_*, which never report an overflow, without the call
+#define LVM_CMP_BRANCH_HANDLER(MODE, SIZE, SIZE_CLASS, U, S, TYPE) \
+    lvm_CMP_##MODE##_##SIZE##_##TYPE: { \
+        LVM_OPERANDS_##MODE \
+        U l = *(U*)dst; \
+        U r = *(U*)src; \
+        state->rflags.carry = l < r; \
+        state->rflags.zerof = l == r; \
+        state->rflags.sign = (S)(U)(l - r) < 0; \
+        state->rflags.overflow = 0; \
+        if(LVM_CONDITION_##TYPE) { \
+            in = (Light_VM_Decoded_Instruction*)in[1].imm; \
+        } else { \
+            in += 2; \
+        } \
+        LVM_DISPATCH(); \
+    }
+
+// Decoded instruction starting at address, 0 when there is none
+static Light_VM_Decoded_Instruction*
+decoded_at(Light_VM_State* state, u64 address) {
+    u64 offset = address - (u64)state->code.block;
+    if(offset >= state->decoded.code_size || state->decoded.index[offset] == LVM_NOT_DECODED)
+        return 0;
+    return state->decoded.instructions + state->decoded.index[offset];
+}
+
+static u64
+encoded_address(Light_VM_State* state, Light_VM_Decoded_Instruction* in) {
+    return (u64)state->code.block + state->decoded.offsets[in - state->decoded.instructions];
+}
+
+// Returns the handler table when in is 0, its labels only exist in here.
+static void**
+light_vm_execute_decoded(Light_VM_State* state, Light_VM_Decoded_Instruction* in) {
+    static void* dispatch[LVM_DISPATCH_SIZE];
+    static bool  dispatch_ready = false;
+
+    if(!dispatch_ready) {
+        for(u32 i = 0; i < LVM_DISPATCH_SIZE; ++i)
+            dispatch[i] = &&lvm_generic;
+        for(u32 k = 0; k < LVM_DISPATCH_TYPE_KEYS; ++k) {
+            dispatch[((u32)LVM_NOP << 7) | k] = &&lvm_nop;
+            dispatch[((u32)LVM_PUSH << 7) | k] = &&lvm_push;
+            dispatch[((u32)LVM_POP << 7) | k] = &&lvm_pop;
+            dispatch[((u32)LVM_CALL << 7) | k] = &&lvm_call;
+            dispatch[((u32)LVM_RET << 7) | k] = &&lvm_ret;
+            dispatch[((u32)LVM_HLT << 7) | k] = &&lvm_halt;
+        }
+        LVM_BRANCHES(LVM_BRANCH_ENTRY)
+        LVM_BINARY_HANDLERS(LVM_BINARY_ENTRY)
+        LVM_CMP_BRANCHES(LVM_CMP_BRANCH_ENTRY)
+        dispatch[LVM_FUSED_KEY(LVM_FUSED_MOV_ADD)] = &&lvm_mov_add;
+        dispatch[LVM_FUSED_KEY(LVM_FUSED_LOAD_ADD)] = &&lvm_load_add;
+        dispatch[LVM_FUSED_KEY(LVM_FUSED_LOAD_OFFSETED_ADD)] = &&lvm_load_offseted_add;
+        dispatch[LVM_FUSED_KEY(LVM_FUSED_ADD_IMMEDIATE_TO_MEM)] = &&lvm_add_immediate_to_mem;
+        dispatch_ready = true;
+    }
+    if(!in) return dispatch;
+
+    void* dst = 0;
+    void* src = 0;
+
+    LVM_DISPATCH();
+
+    LVM_BINARY_HANDLERS(LVM_BINARY_HANDLER)
+    LVM_BRANCHES(LVM_BRANCH_HANDLER)
+    LVM_CMP_BRANCHES(LVM_CMP_BRANCH_HANDLER)
+
+lvm_mov_add:
+    *in->dst = *in->src + in[1].imm;
+    in += 2;
+    LVM_DISPATCH();
+
+lvm_load_add:
+    *in->dst = *(u64*)*in->src;
+    *in[1].dst += *in->dst;
+    in += 2;
+    LVM_DISPATCH();
+
+lvm_load_offseted_add:
+    *in->dst = *(u64*)(*in->src + in->imm);
+    *in[1].dst += *in->dst;
+    in += 2;
+    LVM_DISPATCH();
+
+lvm_add_immediate_to_mem: {
+    u64* mem = (u64*)(*in->src + in->imm);
+    *in->dst = *mem + in[1].imm;
+    *mem = *in->dst;
+    in += 3;
+    LVM_DISPATCH();
+}
+
+lvm_nop:
+    in++;
+    LVM_DISPATCH();
+
+// imm is the size
+lvm_push:
+    switch(in->imm) {
+        case 1: *(u8*)state->registers[RSP] = *(u8*)in->src; break;
+        case 2: *(u16*)state->registers[RSP] = *(u16*)in->src; break;
+        case 4: *(u32*)state->registers[RSP] = *(u32*)in->src; break;
+        case 8: *(u64*)state->registers[RSP] = *(u64*)in->src; break;
+        default: assert(0); break;
+    }
+    state->registers[RSP] += in->imm;
+    in++;
+    LVM_DISPATCH();
+
+lvm_pop:
+    switch(in->imm) {
+        case 1: *in->dst = (u64)*((u8*)state->registers[RSP] - 1); break;
+        case 2: *in->dst = (u64)*((u16*)state->registers[RSP] - 1); break;
+        case 4: *in->dst = (u64)*((u32*)state->registers[RSP] - 1); break;
+        case 8: *in->dst = *((u64*)state->registers[RSP] - 1); break;
+        default: assert(0); break;
+    }
+    state->registers[RSP] -= in->imm;
+    in++;
+    LVM_DISPATCH();
+
+// The return address pushed is the encoded one
+lvm_call:
+    *(u64*)state->registers[RSP] = encoded_address(state, in + 1);
+    state->registers[RSP] += sizeof(u64);
+    in = (Light_VM_Decoded_Instruction*)in->imm;
+    LVM_DISPATCH();
+
+lvm_ret:
+    state->registers[RIP] = *((u64*)state->registers[RSP] - 1);
+    state->registers[RSP] -= sizeof(u64);
+    in = decoded_at(state, state->registers[RIP]);
+    if(!in) goto lvm_encoded;
+    LVM_DISPATCH();
+
+lvm_generic:
+    state->registers[RIP] = encoded_address(state, in);
+    light_vm_execute_instruction(state, *(Light_VM_Instruction*)state->registers[RIP]);
+    in = decoded_at(state, state->registers[RIP]);
+    if(!in) goto lvm_encoded;
+    LVM_DISPATCH();
+
+lvm_halt:
+    state->registers[RIP] = encoded_address(state, in);
+    return dispatch;
+
+lvm_encoded:
+    light_vm_execute_switch(state);
+    return dispatch;
+}
+
+// Branch and call targets
+static bool
+decode_target(Light_VM_State* state, Light_VM_Instruction* encoded, Light_VM_Decoded_Instruction* out) {
+    void* address_of_imm = (u8*)encoded + sizeof(Light_VM_Instruction);
+    u64 target = 0;
+    switch(encoded->branch.addr_mode) {
+        case BRANCH_ADDR_MODE_IMMEDIATE_ABSOLUTE:
+            target = (u64)get_signed_value_of_immediate(state, *encoded, address_of_imm);
+            break;
+        case BRANCH_ADDR_MODE_IMMEDIATE_RELATIVE:
+            target = (u64)encoded + get_signed_value_of_immediate(state, *encoded, address_of_imm);
+            break;
+        default: return false;
+    }
+    Light_VM_Decoded_Instruction* decoded = decoded_at(state, target);
+    out->imm = (u64)decoded;
+    return decoded != 0;
+}
+
+static void
+decode_instruction(Light_VM_State* state, void** dispatch, Light_VM_Instruction* encoded, Light_VM_Decoded_Instruction* out) {
+    void* address_of_imm = (u8*)encoded + sizeof(Light_VM_Instruction);
+    bool decoded = true;
+
+    out->handler = dispatch[LVM_DISPATCH_KEY(encoded)];
+    switch(encoded->type) {
+        case LVM_CMP:
+        case LVM_SHL: case LVM_SHR:
+        case LVM_OR: case LVM_AND:
+        case LVM_XOR: case LVM_MOV:
+        case LVM_ADD_S: case LVM_SUB_S:
+        case LVM_MUL_S: case LVM_DIV_S:
+        case LVM_MOD_S: case LVM_ADD_U:
+        case LVM_SUB_U: case LVM_MUL_U:
+        case LVM_DIV_U: case LVM_MOD_U: {
+            decoded = encoded->binary.dst_reg != RIP && encoded->binary.src_reg != RIP;
+            out->dst = &state->registers[encoded->binary.dst_reg];
+            out->src = &state->registers[encoded->binary.src_reg];
+            switch(encoded->binary.addr_mode) {
+                case BIN_ADDR_MODE_REG_TO_IMM_MEM:
+                case BIN_ADDR_MODE_MEM_IMM_TO_REG:
+                    out->imm = *(u64*)address_of_imm;
+                    break;
+                case BIN_ADDR_MODE_REG_TO_MEM_OFFSETED:
+                case BIN_ADDR_MODE_REG_OFFSETED_TO_REG:
+                    out->imm = get_value_of_immediate(state, *encoded, address_of_imm);
+                    if(encoded->binary.sign) out->imm = -out->imm;
+                    break;
+                case BIN_ADDR_MODE_IMM_TO_REG:
+                    out->imm = get_value_of_immediate(state, *encoded, address_of_imm);
+                    break;
+                default: break;
+            }
+        } break;
+
+        case LVM_BEQ: case LVM_BNE: case LVM_BLT_S:
+        case LVM_BGT_S: case LVM_BLE_S: case LVM_BGE_S:
+        case LVM_BLT_U: case LVM_BGT_U: case LVM_BLE_U:
+        case LVM_BGE_U: case LVM_JMP: case LVM_CALL:
+            decoded = decode_target(state, encoded, out);
+            break;
+
+        case LVM_PUSH:
+            decoded = encoded->push.addr_mode == PUSH_ADDR_MODE_REGISTER && encoded->push.reg != RIP;
+            out->src = &state->registers[encoded->push.reg];
+            out->imm = encoded->push.byte_size;
+            break;
+        case LVM_POP:
+            decoded = encoded->unary.reg != RIP;
+            out->dst = &state->registers[encoded->unary.reg];
+            out->imm = encoded->unary.byte_size;
+            break;
+
+        default: break;
+    }
+    if(!decoded)
+        out->handler = dispatch[LVM_GENERIC_KEY];
+}
+
+static bool
+is_binary(Light_VM_Instruction* in, u8 type, u32 addr_mode, u32 bytesize) {
+    return in->type == type && in->binary.addr_mode == addr_mode && in->binary.bytesize == bytesize;
+}
+
+static bool
+is_add_64(Light_VM_Instruction* in, u32 addr_mode) {
+    return is_binary(in, LVM_ADD_S, addr_mode, 8) || is_binary(in, LVM_ADD_U, addr_mode, 8);
+}
+
+// Peephole pass putting superinstruction handlers on the decoded sequences
+// they match, only over instructions that were decoded with a handler of
+// their own. The set is fixed, these are the sequences the bytecode
+// generator emits the most.
+static void
+light_vm_fuse(Light_VM_State* state, void** dispatch) {
+    Light_VM_Decoded* decoded = &state->decoded;
+    u8* code = (u8*)state->code.block;
+    const void* generic = dispatch[LVM_GENERIC_KEY];
+
+    for(u64 i = 0; i + 1 < decoded->count; ++i) {
+        Light_VM_Decoded_Instruction* in = decoded->instructions + i;
+        if(in[0].handler == generic || in[1].handler == generic)
+            continue;
+        Light_VM_Instruction* a = (Light_VM_Instruction*)(code + decoded->offsets[i]);
+        Light_VM_Instruction* b = (Light_VM_Instruction*)(code + decoded->offsets[i + 1]);
+        Light_VM_Instruction* c = (i + 2 < decoded->count && in[2].handler != generic) ?
+            (Light_VM_Instruction*)(code + decoded->offsets[i + 2]) : 0;
+
+        // cmp r0, r1; beq label
+        if(a->type == LVM_CMP && b->type >= LVM_BEQ && b->type <= LVM_BGE_U &&
+            (a->binary.addr_mode == BIN_ADDR_MODE_REG_TO_REG || a->binary.addr_mode == BIN_ADDR_MODE_IMM_TO_REG) &&
+            lvm_size_class[a->binary.bytesize] < 4)
+        {
+            bool immediate = a->binary.addr_mode == BIN_ADDR_MODE_IMM_TO_REG;
+            in->handler = dispatch[LVM_CMP_BRANCH_KEY(b->type, immediate, lvm_size_class[a->binary.bytesize])];
+        }
+        else if(is_binary(a, LVM_MOV, BIN_ADDR_MODE_REG_TO_REG, 8) && is_add_64(b, BIN_ADDR_MODE_IMM_TO_REG) &&
+            b->binary.dst_reg == a->binary.dst_reg)
+        {
+            in->handler = dispatch[LVM_FUSED_KEY(LVM_FUSED_MOV_ADD)];
+        }
+        else if(c && is_binary(a, LVM_MOV, BIN_ADDR_MODE_REG_OFFSETED_TO_REG, 8) && is_add_64(b, BIN_ADDR_MODE_IMM_TO_REG) &&
+            is_binary(c, LVM_MOV, BIN_ADDR_MODE_REG_TO_MEM_OFFSETED, 8) &&
+            a->binary.dst_reg != a->binary.src_reg && b->binary.dst_reg == a->binary.dst_reg &&
+            c->binary.src_reg == a->binary.dst_reg && c->binary.dst_reg == a->binary.src_reg && in[2].imm == in[0].imm)
+        {
+            in->handler = dispatch[LVM_FUSED_KEY(LVM_FUSED_ADD_IMMEDIATE_TO_MEM)];
+        }
+        else if((is_binary(a, LVM_MOV, BIN_ADDR_MODE_MEM_TO_REG, 8) || is_binary(a, LVM_MOV, BIN_ADDR_MODE_REG_OFFSETED_TO_REG, 8)) &&
+            is_add_64(b, BIN_ADDR_MODE_REG_TO_REG) && b->binary.src_reg == a->binary.dst_reg)
+        {
+            bool offseted = a->binary.addr_mode == BIN_ADDR_MODE_REG_OFFSETED_TO_REG;
+            in->handler = dispatch[LVM_FUSED_KEY(offseted ? LVM_FUSED_LOAD_OFFSETED_ADD : LVM_FUSED_LOAD_ADD)];
+        }
+    }
+}
+
+// Decodes the code block unless it is the same that was decoded last
+static void
+light_vm_decode(Light_VM_State* state) {
+    Light_VM_Decoded* decoded = &state->decoded;
+    u64 size = state->code_offset;
+    if(decoded->code && decoded->code_size == size && memcmp(decoded->code, state->code.block, size) == 0)
+        return;
+
+    light_vm_decoded_free(decoded);
+    memset(decoded, 0, sizeof(*decoded));
+    void** dispatch = light_vm_execute_decoded(state, 0);
+    u8* code = (u8*)state->code.block;
+
+    // Instruction boundaries, as the interpreter advances
+    decoded->code_size = size;
+    decoded->index = (u32*)malloc(size * sizeof(u32) + 1);
+    memset(decoded->index, 0xff, size * sizeof(u32));
+    u64 offset = 0;
+    for(; offset + sizeof(Light_VM_Instruction) <= size; offset += sizeof(Light_VM_Instruction) + ((Light_VM_Instruction*)(code + offset))->imm_size_bytes) {
+        decoded->index[offset] = (u32)decoded->count++;
+    }
+
+    decoded->offsets = (u32*)malloc((decoded->count + 1) * sizeof(u32));
+    decoded->instructions = (Light_VM_Decoded_Instruction*)calloc(decoded->count + 1, sizeof(Light_VM_Decoded_Instruction));
+    for(offset = 0; offset < size; ++offset) {
+        if(decoded->index[offset] != LVM_NOT_DECODED)
+            decoded->offsets[decoded->index[offset]] = (u32)offset;
+    }
+    decoded->offsets[decoded->count] = (u32)offset;
+
+    for(u64 i = 0; i < decoded->count; ++i)
+        decode_instruction(state, dispatch, (Light_VM_Instruction*)(code + decoded->offsets[i]), decoded->instructions + i);
+    // Running past the end goes back to the encoded form
+    decoded->instructions[decoded->count].handler = dispatch[LVM_GENERIC_KEY];
+    light_vm_fuse(state, dispatch);
+
+    decoded->code = (u8*)malloc(size + 1);
+    memcpy(decoded->code, code, size);
+}
+
+static void
+light_vm_execute_threaded(Light_VM_State* state) {
+    light_vm_decode(state);
+    Light_VM_Decoded_Instruction* in = decoded_at(state, state->registers[RIP]);
+    if(in) {
+        light_vm_execute_decoded(state, in);
+    } else {
+        light_vm_execute_switch(state);
+    }
+}
+
+#else
+
+// Computed goto is a GCC extension, elsewhere every instruction goes through the switch
+static void
+light_vm_execute_threaded(Light_VM_State* state) {
+    light_vm_execute_switch(state);
+}
+
+#endif
+
+static void
+light_vm_run(Light_VM_State* state, void* print_steps) {
+    if(*(bool*)print_steps) {
+        light_vm_execute_traced(state);
+    } else {
+        light_vm_execute_threaded(state);
+    }
+}
+
 void
 light_vm_execute(Light_VM_State* state, void* entry_point, bool print_steps) {
     light_vm_reset(state);
@@ -1029,18 +1734,103 @@ light_vm_execute(Light_VM_State* state, void* entry_point, bool print_steps) {
         state->registers[RIP] = (u64)entry_point;
     }
 
-    for(u64 i = 0;; ++i) {
-        Light_VM_Instruction in = *(Light_VM_Instruction*)(state->registers[RIP]);
+    light_vm_run_guarded(state, light_vm_run, &print_steps);
+}
 
-        if(print_steps) {
-            void* addr_of_imm = ((u8*)state->registers[RIP]) + sizeof(Light_VM_Instruction); // address of immediate
-            u64 imm = get_value_of_immediate(state, in, addr_of_imm);
-            fprintf(stdout, "%ld: ", state->registers[RIP]);
-            light_vm_print_instruction(stdout, in, imm);
-        }
+// -------------------------------------
+// -------------- Faults ---------------
+// -------------------------------------
 
-        if(in.type == LVM_HLT) break;
+void
+light_vm_report_fault(FILE* out, Light_VM_State* state) {
+    switch(state->fault) {
+        case LVM_FAULT_NONE: return;
+        case LVM_FAULT_STACK_OVERFLOW:  fprintf(out, "LightVM fault: stack overflow"); break;
+        case LVM_FAULT_STACK_UNDERFLOW: fprintf(out, "LightVM fault: stack underflow"); break;
+        case LVM_FAULT_CODE:            fprintf(out, "LightVM fault: access past the end of the code"); break;
+        case LVM_FAULT_DATA:            fprintf(out, "LightVM fault: access past the end of the data"); break;
+        case LVM_FAULT_CODE_FULL:
+            fprintf(out, "LightVM fault: code segment limit of %llu bytes reached\n", (unsigned long long)state->code.limit);
+            return;
+        case LVM_FAULT_DATA_FULL:
+            fprintf(out, "LightVM fault: data segment limit of %llu bytes reached\n", (unsigned long long)state->data.limit);
+            return;
+    }
+    fprintf(out, " at 0x%llx\n", (unsigned long long)state->fault_address);
+    light_vm_debug_dump_registers(out, state, LVM_PRINT_FLAGS_REGISTER);
+}
 
-        light_vm_execute_instruction(state, in);
+#if defined(__linux__)
+
+static __thread Light_VM_State* lvm_running;
+static __thread sigjmp_buf      lvm_fault_jump;
+static struct sigaction         lvm_previous_segv;
+static struct sigaction         lvm_previous_bus;
+
+// Outside of what the segment uses, within its guards
+static bool
+segment_fault(Memory* segment, u64 address) {
+    u64 start = (u64)segment->block;
+    if(!segment->block || address < start - LVM_GUARD_SIZE || address >= start + segment->limit + LVM_GUARD_SIZE)
+        return false;
+    return address < start || address >= start + segment->size;
+}
+
+static void
+light_vm_fault_handler(int signal, siginfo_t* info, void* context) {
+    Light_VM_State* state = lvm_running;
+    u64 address = (u64)info->si_addr;
+    if(state) {
+        Light_VM_Fault fault = LVM_FAULT_NONE;
+        if(segment_fault(&state->stack, address)) {
+            fault = (address < (u64)state->stack.block) ? LVM_FAULT_STACK_UNDERFLOW : LVM_FAULT_STACK_OVERFLOW;
+        } else if(segment_fault(&state->code, address)) {
+            fault = LVM_FAULT_CODE;
+        } else if(segment_fault(&state->data, address)) {
+            fault = LVM_FAULT_DATA;
+        }
+        if(fault != LVM_FAULT_NONE) {
+            state->fault = fault;
+            state->fault_address = address;
+            siglongjmp(lvm_fault_jump, 1);
+        }
+    }
+    // Not ours, the access faults again with the handler there was before
+    sigaction(signal, (signal == SIGSEGV) ? &lvm_previous_segv : &lvm_previous_bus, 0);
+}
+
+int32_t
+light_vm_run_guarded(Light_VM_State* state, void (*run)(Light_VM_State*, void*), void* data) {
+    struct sigaction action = {0};
+    action.sa_sigaction = light_vm_fault_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &lvm_previous_segv);
+    sigaction(SIGBUS, &action, &lvm_previous_bus);
+
+    bool faulted = false;
+    state->fault = LVM_FAULT_NONE;
+    lvm_running = state;
+    if(sigsetjmp(lvm_fault_jump, 1) == 0) {
+        run(state, data);
+    } else {
+        faulted = true;
     }
-}
\ No newline at end of file
+    lvm_running = 0;
+
+    sigaction(SIGSEGV, &lvm_previous_segv, 0);
+    sigaction(SIGBUS, &lvm_previous_bus, 0);
+    if(faulted) light_vm_report_fault(stderr, state);
+    return !faulted;
+}
+
+#else
+
+int32_t
+light_vm_run_guarded(Light_VM_State* state, void (*run)(Light_VM_State*, void*), void* data) {
+    state->fault = LVM_FAULT_NONE;
+    run(state, data);
+    return true;
+}
+
+#endif
\ No newline at end of file
@@ -76,6 +76,8 @@ typedef enum {
     LVM_ASSERT,
 
     LVM_HLT, // Halt
+
+    LVM_TYPE_COUNT,
 } Light_VM_Instruction_Type;
 
 typedef struct {
@@ -218,11 +220,56 @@ typedef struct {
     uint8_t  float_index[256];
 } Light_VM_EXT_Stack;
 
+// A segment is a reserved address range, size bytes of it are usable and
+// it can grow up to limit without moving. See light_vm_segment_grow.
 typedef struct {
-    int32_t   size;
+    uint64_t  size;
     void* block;
+    uint64_t  limit;
 } Memory;
 
+// How far each segment can grow, light_vm_init uses the LVM_DEFAULT_* ones.
+// Targets other than Linux and Windows allocate segments whole, at most 1MB.
+typedef struct {
+    uint64_t code;
+    uint64_t data;
+    uint64_t stack;
+} Light_VM_Limits;
+
+#define LVM_DEFAULT_CODE_LIMIT  (64 * 1024 * 1024)
+#define LVM_DEFAULT_DATA_LIMIT  (64 * 1024 * 1024)
+#define LVM_DEFAULT_STACK_LIMIT (8 * 1024 * 1024)
+
+typedef enum {
+    LVM_FAULT_NONE = 0,
+    LVM_FAULT_STACK_OVERFLOW,
+    LVM_FAULT_STACK_UNDERFLOW,
+    LVM_FAULT_CODE,      // access past the code pushed
+    LVM_FAULT_DATA,      // access past the data pushed
+    LVM_FAULT_CODE_FULL, // push past the code limit
+    LVM_FAULT_DATA_FULL, // push past the data limit
+} Light_VM_Fault;
+
+// Fixed-width form of an instruction, built from the code block before
+// it runs (see light_vm_execute). Operands are pointers into the register
+// file of the state, immediates are already extended and branch targets
+// point to the decoded instruction.
+typedef struct {
+    const void* handler;
+    uint64_t*   dst;
+    uint64_t*   src;
+    uint64_t    imm; // immediate, offset with its sign applied, size or target
+} Light_VM_Decoded_Instruction;
+
+typedef struct {
+    Light_VM_Decoded_Instruction* instructions;
+    uint64_t                      count;
+    uint32_t*                     offsets; // code offset of every instruction, and of the end
+    uint32_t*                     index;   // instruction at every code offset
+    uint8_t*                      code;    // copy of the code that was decoded
+    uint64_t                      code_size;
+} Light_VM_Decoded;
+
 // State
 typedef struct {
     Light_VM_Flags_Register       rflags;
@@ -237,6 +284,10 @@ typedef struct {
     Memory                        heap;
     Memory                        code;
     uint64_t                           code_offset;
+    Light_VM_Decoded              decoded;
+    void*                         jit; // see lightvm_jit.c
+    Light_VM_Fault                fault;
+    uint64_t                      fault_address;
 } Light_VM_State;
 
 typedef struct {
@@ -246,7 +297,11 @@ typedef struct {
     uint32_t   immediate_byte_size; // immediate value only
 } Light_VM_Instruction_Info;
 
+// Past the limit of a segment the pushes set state->fault, code pushes
+// return an empty Light_VM_Instruction_Info and data pushes 0. The patch
+// functions do nothing with an empty info.
 Light_VM_State*           light_vm_init();
+Light_VM_State*           light_vm_init_with_limits(Light_VM_Limits limits);
 void                      light_vm_free(Light_VM_State* state);
 Light_VM_Instruction_Info light_vm_push_instruction(Light_VM_State* vm_state, Light_VM_Instruction instr, uint64_t immediate);
 Light_VM_Instruction_Info light_vm_push(Light_VM_State* vm_state, const char* instruction);
@@ -270,6 +325,9 @@ enum {
     LVM_PRINT_FLAGS_REGISTER           = (1 << 2),
 }; 
 void light_vm_print_instruction(FILE* out, Light_VM_Instruction instr, uint64_t imm);
+const char* light_vm_instruction_name(uint8_t type);
+int32_t     light_vm_addressing_mode(Light_VM_Instruction instr);
+const char* light_vm_addressing_mode_name(uint8_t type, int32_t mode);
 void light_vm_debug_dump_registers(FILE* out, Light_VM_State* state, uint32_t flags);
 void light_vm_debug_dump_code(FILE* out, Light_VM_State* state);
 
@@ -280,6 +338,59 @@ void light_vm_execute(Light_VM_State* state, void* entry_point, int32_t print_st
 void light_vm_execute_instruction(Light_VM_State* state, Light_VM_Instruction instr);
 void light_vm_reset(Light_VM_State* state);
 
+// -------------------------------------
+// ------------ Segments ---------------
+// -------------------------------------
+
+// Every segment has guard pages on both sides. On Linux the stack is
+// usable up to its limit, pages are backed when first touched, code and
+// data only up to what was pushed, they grow with the pushes.
+
+// Makes the first needed bytes of the segment usable, 0 past its limit
+int32_t light_vm_segment_grow(Memory* segment, uint64_t needed);
+
+// Runs run(state, data) so that an access to a guard page or to the unused
+// part of a segment stops it, with state->fault set and the fault and the
+// registers printed to stderr, instead of crashing the host. Returns 0 when
+// it faulted. The light_vm_execute* functions all run guarded. RIP in the
+// dump is exact only for the engines that go through the switch.
+int32_t light_vm_run_guarded(Light_VM_State* state, void (*run)(Light_VM_State*, void*), void* data);
+void    light_vm_report_fault(FILE* out, Light_VM_State* state);
+
+// -------------------------------------
+// --------------- JIT -----------------
+// -------------------------------------
+
+// Same as light_vm_execute, but the code is translated to x86-64 the
+// first time it is reached. Instructions the translator does not handle
+// run on the interpreter. Elsewhere than x86-64 Linux it only interprets.
+void light_vm_execute_jit(Light_VM_State* state, void* entry_point);
+void light_vm_jit_free(Light_VM_State* state);
+
+// -------------------------------------
+// ------------ Profiling --------------
+// -------------------------------------
+
+// Execution counts, they add up over every run with the same profile
+typedef struct {
+    uint64_t  instructions;
+    uint64_t  by_type[LVM_TYPE_COUNT];
+    uint64_t  by_mode[LVM_TYPE_COUNT][16];         // addressing mode of the instruction
+    uint64_t  pairs[LVM_TYPE_COUNT][LVM_TYPE_COUNT]; // type, then type of the next instruction
+    uint64_t* by_offset;                           // every code offset, 0 where no instruction starts
+    uint64_t  code_size;
+} Light_VM_Profile;
+
+// Same as light_vm_execute counting every instruction that runs, it goes
+// through the switch for every instruction and costs a few counters each.
+void light_vm_execute_profiled(Light_VM_State* state, void* entry_point, Light_VM_Profile* profile);
+void light_vm_profile_free(Light_VM_Profile* profile);
+
+// Most executed types, addressing modes, pairs and instructions, at most top lines each.
+// The JSON has all of them, write_json returns 0 when the file cannot be written.
+void light_vm_profile_report(FILE* out, Light_VM_State* state, Light_VM_Profile* profile, int32_t top);
+int32_t light_vm_profile_write_json(const char* path, Light_VM_State* state, Light_VM_Profile* profile);
+
 #if defined(__cplusplus)
 } // extern "C"
 #endif
\ No newline at end of file
@@ -0,0 +1,665 @@
+#include "ast.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "lightvm.h"
+
+#define true 1
+#define false 0
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+
+// Code reached for the first time is translated from there until a ret,
+// hlt or jmp that no branch before it jumps over, so a procedure is
+// translated whole on its first call. The translation goes in a single
+// buffer and every instruction translated is recorded, later branches
+// and calls to it jump straight there.
+//
+// VM registers and flags stay in the state, the native code works on them
+// in memory through rbx, so the interpreter can run any instruction in
+// between. Native code exits back to light_vm_execute_jit with RIP set:
+// - at ret, calls and branches out of what is translated, to continue there;
+// - at instructions it does not handle, for the interpreter to run them;
+// - at hlt.
+
+#define LVM_JIT_BUFFER_SIZE  (16 * 1024 * 1024)
+#define LVM_JIT_MAX_REGION   4096 // instructions translated at once
+#define LVM_JIT_MAX_EMIT     128  // bytes of native code of one instruction, at most
+#define LVM_JIT_NONE         0xffffffff
+
+typedef enum {
+    JIT_EXIT_CONTINUE = 0, // run from RIP
+    JIT_EXIT_INTERPRET,    // interpret the instruction at RIP
+    JIT_EXIT_HALT,
+} Light_VM_Jit_Exit;
+
+typedef struct {
+    u32 at;     // rel32 to patch
+    u64 target; // code offset
+} Light_VM_Jit_Patch;
+
+typedef struct {
+    u8* buffer;
+    u64 used;
+    u64 epilogue;
+    u32* native_at; // native offset of the instruction at every code offset
+    u8*  code;      // copy of the code that was translated
+    u64  code_size;
+    Light_VM_Jit_Patch patches[LVM_JIT_MAX_REGION];
+    s32                patch_count;
+} Light_VM_Jit;
+
+typedef u32 (*Light_VM_Jit_Enter)(Light_VM_State* state, void* native);
+
+enum {
+    X64_RAX = 0, X64_RCX = 1, X64_RDX = 2, X64_RBX = 3, X64_RSI = 6, X64_R8 = 8,
+};
+
+#define REGISTER_OFFSET(R) (u32)(offsetof(Light_VM_State, registers) + (R) * sizeof(u64))
+#define FLAGS_OFFSET       (u32)offsetof(Light_VM_State, rflags)
+
+static void
+emit8(Light_VM_Jit* jit, u8 b) {
+    jit->buffer[jit->used++] = b;
+}
+
+static void
+emit32(Light_VM_Jit* jit, u32 v) {
+    memcpy(jit->buffer + jit->used, &v, sizeof(v));
+    jit->used += sizeof(v);
+}
+
+static void
+emit64(Light_VM_Jit* jit, u64 v) {
+    memcpy(jit->buffer + jit->used, &v, sizeof(v));
+    jit->used += sizeof(v);
+}
+
+static void
+emit_bytes(Light_VM_Jit* jit, const u8* bytes, s32 count) {
+    memcpy(jit->buffer + jit->used, bytes, count);
+    jit->used += count;
+}
+
+static void
+emit_rex(Light_VM_Jit* jit, bool wide, u32 reg, u32 base) {
+    u8 rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (base >> 3);
+    if(rex != 0x40) emit8(jit, rex);
+}
+
+// op reg, [rbx + offset]
+static void
+emit_state_op(Light_VM_Jit* jit, bool wide, u8 opcode, u32 reg, u32 offset) {
+    emit_rex(jit, wide, reg, X64_RBX);
+    emit8(jit, opcode);
+    emit8(jit, 0x80 | ((reg & 7) << 3) | X64_RBX);
+    emit32(jit, offset);
+}
+
+static void
+emit_mov_imm64(Light_VM_Jit* jit, u32 reg, u64 imm) {
+    emit_rex(jit, true, 0, reg);
+    emit8(jit, 0xb8 + (reg & 7));
+    emit64(jit, imm);
+}
+
+// reg = [base] extended to 64 bits
+static void
+emit_load(Light_VM_Jit* jit, u32 reg, u32 base, u32 size, bool sign) {
+    u8 modrm = ((reg & 7) << 3) | (base & 7);
+    switch(size) {
+        case 1: emit_rex(jit, sign, reg, base); emit8(jit, 0x0f); emit8(jit, sign ? 0xbe : 0xb6); break;
+        case 2: emit_rex(jit, sign, reg, base); emit8(jit, 0x0f); emit8(jit, sign ? 0xbf : 0xb7); break;
+        case 4: emit_rex(jit, sign, reg, base); emit8(jit, sign ? 0x63 : 0x8b); break;
+        case 8: emit_rex(jit, true, reg, base); emit8(jit, 0x8b); break;
+        default: assert(0); break;
+    }
+    emit8(jit, modrm);
+}
+
+// [base] = low size bytes of reg
+static void
+emit_store(Light_VM_Jit* jit, u32 reg, u32 base, u32 size) {
+    if(size == 2) emit8(jit, 0x66);
+    emit_rex(jit, size == 8, reg, base);
+    emit8(jit, size == 1 ? 0x88 : 0x89);
+    emit8(jit, ((reg & 7) << 3) | (base & 7));
+}
+
+static void
+emit_jump(Light_VM_Jit* jit, u64 native) {
+    emit8(jit, 0xe9);
+    emit32(jit, (u32)(native - (jit->used + 4)));
+}
+
+// Jumps to the code at target once it is translated, see jit_resolve_patches
+static void
+emit_jump_to_code(Light_VM_Jit* jit, const u8* opcode, s32 opcode_size, u64 target) {
+    emit_bytes(jit, opcode, opcode_size);
+    Light_VM_Jit_Patch* patch = &jit->patches[jit->patch_count++];
+    patch->at = (u32)jit->used;
+    patch->target = target;
+    emit32(jit, 0);
+}
+
+static void
+emit_exit(Light_VM_Jit* jit, Light_VM_State* state, u64 code_offset, Light_VM_Jit_Exit reason) {
+    emit_mov_imm64(jit, X64_RAX, (u64)state->code.block + code_offset);
+    emit_state_op(jit, true, 0x89, X64_RAX, REGISTER_OFFSET(RIP));
+    emit8(jit, 0xb8);
+    emit32(jit, reason);
+    emit_jump(jit, jit->epilogue);
+}
+
+static u64
+immediate_value(Light_VM_Instruction* instr, bool sign) {
+    void* imm = instr + 1;
+    switch(instr->imm_size_bytes) {
+        case 1: return sign ? (u64)*(s8*)imm : (u64)*(u8*)imm;
+        case 2: return sign ? (u64)*(s16*)imm : (u64)*(u16*)imm;
+        case 4: return sign ? (u64)*(s32*)imm : (u64)*(u32*)imm;
+        case 8: return *(u64*)imm;
+        default: break;
+    }
+    return 0;
+}
+
+// Value of size bytes of v read as the operand of a signed or unsigned instruction
+static u64
+extend(u64 v, u32 size, bool sign) {
+    switch(size) {
+        case 1: return sign ? (u64)(s8)v : (u64)(u8)v;
+        case 2: return sign ? (u64)(s16)v : (u64)(u16)v;
+        case 4: return sign ? (u64)(s32)v : (u64)(u32)v;
+        default: break;
+    }
+    return v;
+}
+
+static bool
+valid_size(u32 size) {
+    return size == 1 || size == 2 || size == 4 || size == 8;
+}
+
+// Leaves the destination address in r8 and the source value in rcx,
+// same operands as light_vm_execute_binary_arithmetic_instruction.
+static bool
+emit_binary_operands(Light_VM_Jit* jit, Light_VM_Instruction* instr, bool sign) {
+    u32 dst = instr->binary.dst_reg;
+    u32 src = instr->binary.src_reg;
+    u32 size = instr->binary.bytesize;
+    u64 offset = immediate_value(instr, false);
+    if(instr->binary.sign) offset = -offset;
+
+    switch(instr->binary.addr_mode) {
+        case BIN_ADDR_MODE_REG_TO_REG:
+        case BIN_ADDR_MODE_REG_OFFSETED_TO_REG:
+        case BIN_ADDR_MODE_MEM_TO_REG:
+        case BIN_ADDR_MODE_MEM_IMM_TO_REG:
+        case BIN_ADDR_MODE_IMM_TO_REG:
+            emit_state_op(jit, true, 0x8d, X64_R8, REGISTER_OFFSET(dst)); // lea r8, reg
+            break;
+        case BIN_ADDR_MODE_REG_TO_MEM:
+            emit_state_op(jit, true, 0x8b, X64_R8, REGISTER_OFFSET(dst));
+            break;
+        case BIN_ADDR_MODE_REG_TO_IMM_MEM:
+            emit_mov_imm64(jit, X64_R8, *(u64*)(instr + 1));
+            break;
+        case BIN_ADDR_MODE_REG_TO_MEM_OFFSETED: {
+            emit_state_op(jit, true, 0x8b, X64_R8, REGISTER_OFFSET(dst));
+            emit_mov_imm64(jit, X64_RAX, offset);
+            const u8 add_r8_rax[] = { 0x49, 0x01, 0xc0 };
+            emit_bytes(jit, add_r8_rax, sizeof(add_r8_rax));
+        } break;
+        default: return false;
+    }
+
+    switch(instr->binary.addr_mode) {
+        case BIN_ADDR_MODE_REG_TO_REG:
+        case BIN_ADDR_MODE_REG_TO_MEM:
+        case BIN_ADDR_MODE_REG_TO_IMM_MEM:
+        case BIN_ADDR_MODE_REG_TO_MEM_OFFSETED:
+            emit_state_op(jit, true, 0x8d, X64_RSI, REGISTER_OFFSET(src)); // lea rsi, reg
+            break;
+        case BIN_ADDR_MODE_MEM_TO_REG:
+            emit_state_op(jit, true, 0x8b, X64_RSI, REGISTER_OFFSET(src));
+            break;
+        case BIN_ADDR_MODE_MEM_IMM_TO_REG:
+            emit_mov_imm64(jit, X64_RSI, *(u64*)(instr + 1));
+            break;
+        case BIN_ADDR_MODE_REG_OFFSETED_TO_REG: {
+            emit_state_op(jit, true, 0x8b, X64_RSI, REGISTER_OFFSET(src));
+            emit_mov_imm64(jit, X64_RAX, offset);
+            const u8 add_rsi_rax[] = { 0x48, 0x01, 0xc6 };
+            emit_bytes(jit, add_rsi_rax, sizeof(add_rsi_rax));
+        } break;
+        case BIN_ADDR_MODE_IMM_TO_REG:
+            emit_mov_imm64(jit, X64_RCX, extend(immediate_value(instr, false), size, sign));
+            return true;
+    }
+    emit_load(jit, X64_RCX, X64_RSI, size, sign);
+    return true;
+}
+
+static bool
+emit_binary(Light_VM_Jit* jit, Light_VM_Instruction* instr) {
+    u32 size = instr->binary.bytesize;
+    if(!valid_size(size) || instr->binary.dst_reg == RIP || instr->binary.src_reg == RIP)
+        return false;
+
+    bool sign = (instr->type == LVM_DIV_S || instr->type == LVM_MOD_S);
+    if(!emit_binary_operands(jit, instr, sign))
+        return false;
+    if(instr->type != LVM_MOV)
+        emit_load(jit, X64_RAX, X64_R8, size, sign);
+
+    switch(instr->type) {
+        case LVM_MOV: {
+            const u8 mov_rax_rcx[] = { 0x48, 0x89, 0xc8 };
+            emit_bytes(jit, mov_rax_rcx, sizeof(mov_rax_rcx));
+        } break;
+        case LVM_CMP: {
+            // Flags as cmp_flags_* leaves them, the overflow flag is not read
+            if(size == 2) emit8(jit, 0x66);
+            if(size == 8) emit8(jit, 0x48);
+            emit8(jit, size == 1 ? 0x38 : 0x39); // cmp rax, rcx
+            emit8(jit, 0xc8);
+            const u8 flags[] = {
+                0x0f, 0x92, 0xc0, // setc al
+                0x0f, 0x94, 0xc1, // setz cl
+                0x0f, 0x98, 0xc2, // sets dl
+                0x0f, 0xb6, 0xc0, // movzx eax, al
+                0x0f, 0xb6, 0xc9, // movzx ecx, cl
+                0x0f, 0xb6, 0xd2, // movzx edx, dl
+                0xd1, 0xe1,       // shl ecx, 1
+                0xc1, 0xe2, 0x02, // shl edx, 2
+                0x09, 0xc8,       // or eax, ecx
+                0x09, 0xd0,       // or eax, edx
+            };
+            emit_bytes(jit, flags, sizeof(flags));
+            emit_state_op(jit, false, 0x8b, X64_RCX, FLAGS_OFFSET);
+            const u8 merge[] = {
+                0x83, 0xe1, 0xf0, // and ecx, ~0xf
+                0x09, 0xc1,       // or ecx, eax
+            };
+            emit_bytes(jit, merge, sizeof(merge));
+            emit_state_op(jit, false, 0x89, X64_RCX, FLAGS_OFFSET);
+            return true;
+        }
+        case LVM_ADD_S: case LVM_ADD_U: { const u8 op[] = { 0x48, 0x01, 0xc8 }; emit_bytes(jit, op, sizeof(op)); } break;
+        case LVM_SUB_S: case LVM_SUB_U: { const u8 op[] = { 0x48, 0x29, 0xc8 }; emit_bytes(jit, op, sizeof(op)); } break;
+        case LVM_MUL_S: case LVM_MUL_U: { const u8 op[] = { 0x48, 0x0f, 0xaf, 0xc1 }; emit_bytes(jit, op, sizeof(op)); } break;
+        case LVM_OR:  { const u8 op[] = { 0x48, 0x09, 0xc8 }; emit_bytes(jit, op, sizeof(op)); } break;
+        case LVM_AND: { const u8 op[] = { 0x48, 0x21, 0xc8 }; emit_bytes(jit, op, sizeof(op)); } break;
+        case LVM_XOR: { const u8 op[] = { 0x48, 0x31, 0xc8 }; emit_bytes(jit, op, sizeof(op)); } break;
+        // Shifts below 64 bits are done in 32 bits, as C promotes the operands
+        case LVM_SHL: case LVM_SHR: {
+            if(size == 8) emit8(jit, 0x48);
+            emit8(jit, 0xd3);
+            emit8(jit, instr->type == LVM_SHL ? 0xe0 : 0xe8);
+        } break;
+        case LVM_DIV_S: case LVM_MOD_S: {
+            const u8 op[] = { 0x48, 0x99, 0x48, 0xf7, 0xf9 }; // cqo, idiv rcx
+            emit_bytes(jit, op, sizeof(op));
+        } break;
+        case LVM_DIV_U: case LVM_MOD_U: {
+            const u8 op[] = { 0x31, 0xd2, 0x48, 0xf7, 0xf1 }; // xor edx, edx, div rcx
+            emit_bytes(jit, op, sizeof(op));
+        } break;
+        default: return false;
+    }
+    if(instr->type == LVM_MOD_S || instr->type == LVM_MOD_U) {
+        const u8 mov_rax_rdx[] = { 0x48, 0x89, 0xd0 };
+        emit_bytes(jit, mov_rax_rdx, sizeof(mov_rax_rdx));
+    }
+    emit_store(jit, X64_RAX, X64_R8, size);
+    return true;
+}
+
+// Branch and call targets, as code offsets
+static bool
+branch_target(Light_VM_State* state, Light_VM_Instruction* instr, u64* target) {
+    u64 address = 0;
+    switch(instr->branch.addr_mode) {
+        case BRANCH_ADDR_MODE_IMMEDIATE_ABSOLUTE: address = immediate_value(instr, true); break;
+        case BRANCH_ADDR_MODE_IMMEDIATE_RELATIVE: address = (u64)instr + immediate_value(instr, true); break;
+        default: return false;
+    }
+    *target = address - (u64)state->code.block;
+    return *target < state->code_offset;
+}
+
+// Condition of the branch from the flags in the state, ends with the jcc
+// opcode taken when the branch is
+static bool
+emit_branch(Light_VM_Jit* jit, Light_VM_Instruction* instr, u64 target) {
+    const u8 jz[] = { 0x0f, 0x84 };
+    const u8 jnz[] = { 0x0f, 0x85 };
+    const u8 jmp[] = { 0xe9 };
+    const u8 sign_differs[] = {
+        0x89, 0xc1,       // mov ecx, eax
+        0xd1, 0xe9,       // shr ecx, 1
+        0x31, 0xc1,       // xor ecx, eax
+    };
+    const u8 sign_differs_or_zero[] = {
+        0x83, 0xe1, 0x04, // and ecx, 4
+        0x83, 0xe0, 0x02, // and eax, 2
+        0x09, 0xc1,       // or ecx, eax
+    };
+    const u8 test_sign_differs[] = { 0xf6, 0xc1, 0x04 }; // test cl, 4
+
+    if(instr->type == LVM_JMP) {
+        emit_jump_to_code(jit, jmp, sizeof(jmp), target);
+        return true;
+    }
+
+    // carry: bit 0, zero: bit 1, sign: bit 2, overflow: bit 3
+    emit_state_op(jit, false, 0x8b, X64_RAX, FLAGS_OFFSET);
+    const u8* jcc = jnz;
+    switch(instr->type) {
+        case LVM_BEQ:   emit8(jit, 0xa8); emit8(jit, 0x02); break;
+        case LVM_BNE:   emit8(jit, 0xa8); emit8(jit, 0x02); jcc = jz; break;
+        case LVM_BLT_U: emit8(jit, 0xa8); emit8(jit, 0x01); break;
+        case LVM_BGE_U: emit8(jit, 0xa8); emit8(jit, 0x01); jcc = jz; break;
+        case LVM_BLE_U: emit8(jit, 0xa8); emit8(jit, 0x03); break;
+        case LVM_BGT_U: emit8(jit, 0xa8); emit8(jit, 0x03); jcc = jz; break;
+        case LVM_BLT_S:
+        case LVM_BGE_S:
+            emit_bytes(jit, sign_differs, sizeof(sign_differs));
+            emit_bytes(jit, test_sign_differs, sizeof(test_sign_differs));
+            if(instr->type == LVM_BGE_S) jcc = jz;
+            break;
+        case LVM_BLE_S:
+        case LVM_BGT_S:
+            emit_bytes(jit, sign_differs, sizeof(sign_differs));
+            emit_bytes(jit, sign_differs_or_zero, sizeof(sign_differs_or_zero));
+            if(instr->type == LVM_BGT_S) jcc = jz;
+            break;
+        default: return false;
+    }
+    emit_jump_to_code(jit, jcc, 2, target);
+    return true;
+}
+
+// Returns false when the instruction is left to the interpreter
+static bool
+emit_instruction(Light_VM_Jit* jit, Light_VM_State* state, Light_VM_Instruction* instr, u64 offset, u64 next) {
+    switch(instr->type) {
+        case LVM_NOP: return true;
+
+        case LVM_CMP:
+        case LVM_SHL: case LVM_SHR:
+        case LVM_OR: case LVM_AND:
+        case LVM_XOR: case LVM_MOV:
+        case LVM_ADD_S: case LVM_SUB_S:
+        case LVM_MUL_S: case LVM_DIV_S:
+        case LVM_MOD_S: case LVM_ADD_U:
+        case LVM_SUB_U: case LVM_MUL_U:
+        case LVM_DIV_U: case LVM_MOD_U:
+            return emit_binary(jit, instr);
+
+        case LVM_NOT:
+        case LVM_NEG:
+            if(instr->unary.reg == RIP) return false;
+            emit_state_op(jit, true, 0xf7, instr->type == LVM_NOT ? 2 : 3, REGISTER_OFFSET(instr->unary.reg));
+            return true;
+
+        case LVM_BEQ: case LVM_BNE: case LVM_BLT_S:
+        case LVM_BGT_S: case LVM_BLE_S: case LVM_BGE_S:
+        case LVM_BLT_U: case LVM_BGT_U: case LVM_BLE_U:
+        case LVM_BGE_U: case LVM_JMP: {
+            u64 target = 0;
+            return branch_target(state, instr, &target) && emit_branch(jit, instr, target);
+        }
+
+        case LVM_PUSH: {
+            u32 size = instr->push.byte_size;
+            if(instr->push.addr_mode != PUSH_ADDR_MODE_REGISTER || instr->push.reg == RIP || !valid_size(size))
+                return false;
+            emit_state_op(jit, true, 0x8b, X64_R8, REGISTER_OFFSET(RSP));
+            emit_state_op(jit, true, 0x8d, X64_RSI, REGISTER_OFFSET(instr->push.reg));
+            emit_load(jit, X64_RAX, X64_RSI, size, false);
+            emit_store(jit, X64_RAX, X64_R8, size);
+            emit_state_op(jit, true, 0x81, 0, REGISTER_OFFSET(RSP)); // add [rsp], size
+            emit32(jit, size);
+            return true;
+        }
+        case LVM_POP: {
+            u32 size = instr->unary.byte_size;
+            if(instr->unary.reg == RIP || !valid_size(size))
+                return false;
+            emit_state_op(jit, true, 0x81, 5, REGISTER_OFFSET(RSP)); // sub [rsp], size
+            emit32(jit, size);
+            emit_state_op(jit, true, 0x8b, X64_RSI, REGISTER_OFFSET(RSP));
+            emit_load(jit, X64_RAX, X64_RSI, size, false);
+            emit_state_op(jit, true, 0x89, X64_RAX, REGISTER_OFFSET(instr->unary.reg));
+            return true;
+        }
+
+        // The return address pushed is the one of the code
+        case LVM_CALL: {
+            u64 target = 0;
+            if(!branch_target(state, instr, &target))
+                return false;
+            const u8 store_return[] = { 0x48, 0x89, 0x06 }; // mov [rsi], rax
+            const u8 jmp[] = { 0xe9 };
+            emit_state_op(jit, true, 0x8b, X64_RSI, REGISTER_OFFSET(RSP));
+            emit_mov_imm64(jit, X64_RAX, (u64)state->code.block + next);
+            emit_bytes(jit, store_return, sizeof(store_return));
+            emit_state_op(jit, true, 0x81, 0, REGISTER_OFFSET(RSP));
+            emit32(jit, sizeof(u64));
+            emit_jump_to_code(jit, jmp, sizeof(jmp), target);
+            return true;
+        }
+        case LVM_RET: {
+            const u8 load_return[] = { 0x48, 0x8b, 0x06 }; // mov rax, [rsi]
+            emit_state_op(jit, true, 0x81, 5, REGISTER_OFFSET(RSP));
+            emit32(jit, sizeof(u64));
+            emit_state_op(jit, true, 0x8b, X64_RSI, REGISTER_OFFSET(RSP));
+            emit_bytes(jit, load_return, sizeof(load_return));
+            emit_state_op(jit, true, 0x89, X64_RAX, REGISTER_OFFSET(RIP));
+            emit8(jit, 0xb8);
+            emit32(jit, JIT_EXIT_CONTINUE);
+            emit_jump(jit, jit->epilogue);
+            return true;
+        }
+
+        case LVM_HLT:
+            emit_exit(jit, state, offset, JIT_EXIT_HALT);
+            return true;
+
+        default: break;
+    }
+    return false;
+}
+
+// Branches to code translated jump there, the others leave through an exit
+static void
+jit_resolve_patches(Light_VM_Jit* jit, Light_VM_State* state) {
+    for(s32 i = 0; i < jit->patch_count; ++i) {
+        Light_VM_Jit_Patch* patch = &jit->patches[i];
+        u64 native = jit->native_at[patch->target];
+        if(native == LVM_JIT_NONE) {
+            native = jit->used;
+            emit_exit(jit, state, patch->target, JIT_EXIT_CONTINUE);
+        }
+        u32 rel = (u32)(native - (patch->at + 4));
+        memcpy(jit->buffer + patch->at, &rel, sizeof(rel));
+    }
+    jit->patch_count = 0;
+}
+
+static bool
+jit_terminates(Light_VM_Instruction* instr) {
+    return instr->type == LVM_RET || instr->type == LVM_HLT || instr->type == LVM_JMP;
+}
+
+// Translates from the code offset start, returns the native offset
+static u64
+jit_translate(Light_VM_Jit* jit, Light_VM_State* state, u64 start) {
+    // The patches need room for their exit
+    u64 room = (LVM_JIT_MAX_EMIT + 32) * LVM_JIT_MAX_REGION;
+    if(jit->used + room > LVM_JIT_BUFFER_SIZE)
+        return LVM_JIT_NONE;
+
+    u8* code = (u8*)state->code.block;
+    u64 native_start = jit->used;
+    u64 furthest_target = start;
+    u64 offset = start;
+    bool ended = false;
+
+    for(s32 count = 0; count < LVM_JIT_MAX_REGION && offset + sizeof(Light_VM_Instruction) <= state->code_offset; ++count) {
+        if(offset != start && jit->native_at[offset] != LVM_JIT_NONE) {
+            emit_jump(jit, jit->native_at[offset]);
+            ended = true;
+            break;
+        }
+
+        Light_VM_Instruction* instr = (Light_VM_Instruction*)(code + offset);
+        u64 next = offset + sizeof(Light_VM_Instruction) + instr->imm_size_bytes;
+        jit->native_at[offset] = (u32)jit->used;
+
+        u64 instruction_start = jit->used;
+        s32 patch_count = jit->patch_count;
+        if(emit_instruction(jit, state, instr, offset, next)) {
+            assert(jit->used - instruction_start <= LVM_JIT_MAX_EMIT);
+            if(jit->patch_count > patch_count && jit->patches[patch_count].target > furthest_target)
+                furthest_target = jit->patches[patch_count].target;
+        } else {
+            jit->used = instruction_start;
+            jit->patch_count = patch_count;
+            emit_exit(jit, state, offset, JIT_EXIT_INTERPRET);
+        }
+
+        offset = next;
+        if(jit_terminates(instr) && furthest_target < offset) {
+            ended = true;
+            break;
+        }
+    }
+    if(!ended)
+        emit_exit(jit, state, offset, JIT_EXIT_CONTINUE);
+
+    jit_resolve_patches(jit, state);
+    return native_start;
+}
+
+static void
+jit_reset(Light_VM_Jit* jit, Light_VM_State* state) {
+    free(jit->native_at);
+    free(jit->code);
+    jit->code_size = state->code_offset;
+    jit->native_at = (u32*)malloc(jit->code_size * sizeof(u32) + 1);
+    memset(jit->native_at, 0xff, jit->code_size * sizeof(u32));
+    jit->code = (u8*)malloc(jit->code_size + 1);
+    memcpy(jit->code, state->code.block, jit->code_size);
+    jit->patch_count = 0;
+
+    // u32 enter(Light_VM_State* state, void* native)
+    const u8 enter[] = {
+        0x53,             // push rbx
+        0x48, 0x89, 0xfb, // mov rbx, rdi
+        0xff, 0xe6,       // jmp rsi
+    };
+    const u8 leave[] = {
+        0x5b,             // pop rbx
+        0xc3,             // ret
+    };
+    jit->used = 0;
+    emit_bytes(jit, enter, sizeof(enter));
+    jit->epilogue = jit->used;
+    emit_bytes(jit, leave, sizeof(leave));
+}
+
+static Light_VM_Jit*
+jit_get(Light_VM_State* state) {
+    Light_VM_Jit* jit = (Light_VM_Jit*)state->jit;
+    if(!jit) {
+        void* buffer = mmap(0, LVM_JIT_BUFFER_SIZE, PROT_READ|PROT_EXEC, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if(buffer == MAP_FAILED) return 0;
+        jit = (Light_VM_Jit*)calloc(1, sizeof(*jit));
+        jit->buffer = (u8*)buffer;
+        state->jit = jit;
+    }
+
+    // Anything translated from code that changed since is dropped
+    if(!jit->code || jit->code_size != state->code_offset || memcmp(jit->code, state->code.block, jit->code_size) != 0) {
+        mprotect(jit->buffer, LVM_JIT_BUFFER_SIZE, PROT_READ|PROT_WRITE);
+        jit_reset(jit, state);
+        mprotect(jit->buffer, LVM_JIT_BUFFER_SIZE, PROT_READ|PROT_EXEC);
+    }
+    return jit;
+}
+
+// Native code for the instruction at address, translated if it was not
+static void*
+jit_native(Light_VM_Jit* jit, Light_VM_State* state, u64 address) {
+    u64 offset = address - (u64)state->code.block;
+    if(offset >= jit->code_size)
+        return 0;
+
+    u64 native = jit->native_at[offset];
+    if(native == LVM_JIT_NONE) {
+        mprotect(jit->buffer, LVM_JIT_BUFFER_SIZE, PROT_READ|PROT_WRITE);
+        native = jit_translate(jit, state, offset);
+        if(native == LVM_JIT_NONE) {
+            // Full, start over
+            jit_reset(jit, state);
+            native = jit_translate(jit, state, offset);
+        }
+        mprotect(jit->buffer, LVM_JIT_BUFFER_SIZE, PROT_READ|PROT_EXEC);
+    }
+    return jit->buffer + native;
+}
+
+static void
+jit_run(Light_VM_State* state, void* data) {
+    Light_VM_Jit* jit = jit_get(state);
+    Light_VM_Jit_Enter enter = jit ? (Light_VM_Jit_Enter)jit->buffer : 0;
+    for(;;) {
+        void* native = jit ? jit_native(jit, state, state->registers[RIP]) : 0;
+        if(native) {
+            u32 reason = enter(state, native);
+            if(reason == JIT_EXIT_HALT) break;
+            if(reason == JIT_EXIT_CONTINUE) continue;
+        }
+        Light_VM_Instruction in = *(Light_VM_Instruction*)(state->registers[RIP]);
+        if(in.type == LVM_HLT) break;
+        light_vm_execute_instruction(state, in);
+    }
+}
+
+void
+light_vm_execute_jit(Light_VM_State* state, void* entry_point) {
+    light_vm_reset(state);
+    if(entry_point != 0) {
+        state->registers[RIP] = (u64)entry_point;
+    }
+    light_vm_run_guarded(state, jit_run, 0);
+}
+
+void
+light_vm_jit_free(Light_VM_State* state) {
+    Light_VM_Jit* jit = (Light_VM_Jit*)state->jit;
+    if(!jit) return;
+    munmap(jit->buffer, LVM_JIT_BUFFER_SIZE);
+    free(jit->native_at);
+    free(jit->code);
+    free(jit);
+    state->jit = 0;
+}
+
+#else
+
+void
+light_vm_execute_jit(Light_VM_State* state, void* entry_point) {
+    light_vm_execute(state, entry_point, 0);
+}
+
+void
+light_vm_jit_free(Light_VM_State* state) {
+}
+
+#endif
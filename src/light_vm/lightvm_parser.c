@@ -568,6 +568,11 @@ light_vm_push_fmt(Light_VM_State* vm_state, const char* instruction, ...) {
 
 void*
 light_vm_push_data_segment(Light_VM_State* vm_state, Light_VM_Data data) {
+    if(!light_vm_segment_grow(&vm_state->data, vm_state->data_offset + data.byte_size)) {
+        vm_state->fault = LVM_FAULT_DATA_FULL;
+        light_vm_report_fault(stderr, vm_state);
+        return 0;
+    }
     void* ptr = ((u8*)vm_state->data.block +vm_state->data_offset);
 
     switch(data.byte_size) {
@@ -585,6 +590,11 @@ light_vm_push_data_segment(Light_VM_State* vm_state, Light_VM_Data data) {
 
 void*
 light_vm_push_bytes_data_segment(Light_VM_State* vm_state, u8* bytes, s32 byte_count) {
+    if(!light_vm_segment_grow(&vm_state->data, vm_state->data_offset + byte_count)) {
+        vm_state->fault = LVM_FAULT_DATA_FULL;
+        light_vm_report_fault(stderr, vm_state);
+        return 0;
+    }
     void* ptr = ((u8*)vm_state->data.block + vm_state->data_offset);
     memcpy(ptr, bytes, byte_count);
     vm_state->data_offset += byte_count;
@@ -369,6 +369,176 @@ print_copy_instruction(FILE* out, Light_VM_Instruction instr, u64 imm) {
     print_register(out, instr.copy.size_bytes_reg, 8);
 }
 
+const char*
+light_vm_instruction_name(u8 type) {
+    switch(type) {
+        case LVM_NOP:     return "NOP";
+        case LVM_ADD_S:   return "ADDS";
+        case LVM_SUB_S:   return "SUBS";
+        case LVM_MUL_S:   return "MULS";
+        case LVM_DIV_S:   return "DIVS";
+        case LVM_MOD_S:   return "MODS";
+        case LVM_ADD_U:   return "ADDU";
+        case LVM_SUB_U:   return "SUBU";
+        case LVM_MUL_U:   return "MULU";
+        case LVM_DIV_U:   return "DIVU";
+        case LVM_MOD_U:   return "MODU";
+        case LVM_NEG:     return "NEG";
+        case LVM_MOV:     return "MOV";
+        case LVM_SHL:     return "SHL";
+        case LVM_SHR:     return "SHR";
+        case LVM_OR:      return "OR";
+        case LVM_AND:     return "AND";
+        case LVM_XOR:     return "XOR";
+        case LVM_NOT:     return "NOT";
+        case LVM_FADD:    return "FADD";
+        case LVM_FSUB:    return "FSUB";
+        case LVM_FMUL:    return "FMUL";
+        case LVM_FDIV:    return "FDIV";
+        case LVM_FMOV:    return "FMOV";
+        case LVM_FBEQ:    return "FBEQ";
+        case LVM_FBNE:    return "FBNE";
+        case LVM_FBGT:    return "FBGT";
+        case LVM_FBLT:    return "FBLT";
+        case LVM_FNEG:    return "FNEG";
+        case LVM_FCMP:    return "FCMP";
+        case LVM_CMP:     return "CMP";
+        case LVM_BEQ:     return "BEQ";
+        case LVM_BNE:     return "BNE";
+        case LVM_BLT_S:   return "BLTS";
+        case LVM_BGT_S:   return "BGTS";
+        case LVM_BLE_S:   return "BLES";
+        case LVM_BGE_S:   return "BGES";
+        case LVM_BLT_U:   return "BLTU";
+        case LVM_BGT_U:   return "BGTU";
+        case LVM_BLE_U:   return "BLEU";
+        case LVM_BGE_U:   return "BGEU";
+        case LVM_MOVEQ:   return "MOVEQ";
+        case LVM_MOVNE:   return "MOVNE";
+        case LVM_MOVLT_S: return "MOVLTS";
+        case LVM_MOVGT_S: return "MOVGTS";
+        case LVM_MOVLE_S: return "MOVLES";
+        case LVM_MOVGE_S: return "MOVGES";
+        case LVM_MOVLT_U: return "MOVLTU";
+        case LVM_MOVGT_U: return "MOVGTU";
+        case LVM_MOVLE_U: return "MOVLEU";
+        case LVM_MOVGE_U: return "MOVGEU";
+        case LVM_JMP:     return "JMP";
+        case LVM_CALL:    return "CALL";
+        case LVM_PUSH:    return "PUSH";
+        case LVM_POP:     return "POP";
+        case LVM_RET:     return "RET";
+        case LVM_EXPUSHI: return "EXPUSHI";
+        case LVM_EXPUSHF: return "EXPUSHF";
+        case LVM_EXPOP:   return "EXPOP";
+        case LVM_EXTCALL: return "EXTCALL";
+        case LVM_COPY:    return "COPY";
+        case LVM_ALLOC:   return "ALLOC";
+        case LVM_ASSERT:  return "ASSERT";
+        case LVM_HLT:     return "HLT";
+        default: break;
+    }
+    return "UNKNOWN";
+}
+
+// Addressing mode field of instr, -1 for instructions without one
+s32
+light_vm_addressing_mode(Light_VM_Instruction instr) {
+    switch(instr.type) {
+        case LVM_CMP:
+        case LVM_SHL: case LVM_SHR:
+        case LVM_OR: case LVM_AND:
+        case LVM_XOR: case LVM_MOV:
+        case LVM_ADD_S: case LVM_SUB_S:
+        case LVM_MUL_S: case LVM_DIV_S:
+        case LVM_MOD_S: case LVM_ADD_U:
+        case LVM_SUB_U: case LVM_MUL_U:
+        case LVM_DIV_U: case LVM_MOD_U:
+            return instr.binary.addr_mode;
+
+        case LVM_FADD: case LVM_FSUB:
+        case LVM_FMUL: case LVM_FDIV:
+        case LVM_FCMP: case LVM_FMOV:
+            return instr.ifloat.addr_mode;
+
+        case LVM_BEQ: case LVM_BNE: case LVM_BLT_S:
+        case LVM_BGT_S: case LVM_BLE_S: case LVM_BGE_S:
+        case LVM_BLT_U: case LVM_BGT_U: case LVM_BLE_U:
+        case LVM_BGE_U: case LVM_JMP:
+        case LVM_FBEQ: case LVM_FBNE:
+        case LVM_FBGT: case LVM_FBLT:
+        case LVM_CALL: case LVM_EXTCALL:
+            return instr.branch.addr_mode;
+
+        case LVM_PUSH: case LVM_EXPUSHI: case LVM_EXPUSHF:
+            return instr.push.addr_mode;
+
+        default: break;
+    }
+    return -1;
+}
+
+// Operands of an addressing mode of the type, "" for a mode of -1
+const char*
+light_vm_addressing_mode_name(u8 type, s32 mode) {
+    if(mode < 0) return "";
+    switch(type) {
+        case LVM_FADD: case LVM_FSUB:
+        case LVM_FMUL: case LVM_FDIV:
+        case LVM_FCMP: case LVM_FMOV:
+            switch(mode) {
+                case FLOAT_ADDR_MODE_REG_TO_REG:          return "freg, freg";
+                case FLOAT_ADDR_MODE_REG_TO_MEM:          return "[reg], freg";
+                case FLOAT_ADDR_MODE_MEM_TO_REG:          return "freg, [reg]";
+                case FLOAT_ADDR_MODE_REG_OFFSETED_TO_REG: return "freg, [reg + imm]";
+                case FLOAT_ADDR_MODE_REG_TO_MEM_OFFSETED: return "[reg + imm], freg";
+                default: break;
+            }
+            break;
+
+        case LVM_BEQ: case LVM_BNE: case LVM_BLT_S:
+        case LVM_BGT_S: case LVM_BLE_S: case LVM_BGE_S:
+        case LVM_BLT_U: case LVM_BGT_U: case LVM_BLE_U:
+        case LVM_BGE_U: case LVM_JMP:
+        case LVM_FBEQ: case LVM_FBNE:
+        case LVM_FBGT: case LVM_FBLT:
+        case LVM_CALL: case LVM_EXTCALL:
+            switch(mode) {
+                case BRANCH_ADDR_MODE_IMMEDIATE_ABSOLUTE: return "imm";
+                case BRANCH_ADDR_MODE_IMMEDIATE_RELATIVE: return "imm(rel)";
+                case BRANCH_ADDR_MODE_REGISTER:           return "reg";
+                case BRANCH_ADDR_MODE_REGISTER_INDIRECT:  return "[reg]";
+                default: break;
+            }
+            break;
+
+        case LVM_PUSH: case LVM_EXPUSHI: case LVM_EXPUSHF:
+            switch(mode) {
+                case PUSH_ADDR_MODE_IMMEDIATE:          return "imm";
+                case PUSH_ADDR_MODE_IMMEDIATE_INDIRECT: return "[imm]";
+                case PUSH_ADDR_MODE_REGISTER:           return "reg";
+                case PUSH_ADDR_MODE_REGISTER_INDIRECT:  return "[reg]";
+                default: break;
+            }
+            break;
+
+        default: {
+            switch(mode) {
+                case BIN_ADDR_MODE_REG_TO_REG:          return "reg, reg";
+                case BIN_ADDR_MODE_REG_TO_MEM:          return "[reg], reg";
+                case BIN_ADDR_MODE_REG_TO_IMM_MEM:      return "[imm], reg";
+                case BIN_ADDR_MODE_REG_TO_MEM_OFFSETED: return "[reg + imm], reg";
+                case BIN_ADDR_MODE_REG_OFFSETED_TO_REG: return "reg, [reg + imm]";
+                case BIN_ADDR_MODE_MEM_TO_REG:          return "reg, [reg]";
+                case BIN_ADDR_MODE_MEM_IMM_TO_REG:      return "reg, [imm]";
+                case BIN_ADDR_MODE_IMM_TO_REG:          return "reg, imm";
+                default: break;
+            }
+        } break;
+    }
+    return "invalid";
+}
+
 void 
 light_vm_print_instruction(FILE* out, Light_VM_Instruction instr, uint64_t imm) {
     
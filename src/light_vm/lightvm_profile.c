@@ -0,0 +1,219 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include "ast.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lightvm.h"
+
+#define true 1
+#define false 0
+
+static void
+profile_run(Light_VM_State* state, void* data) {
+    Light_VM_Profile* profile = (Light_VM_Profile*)data;
+    u8 previous = LVM_TYPE_COUNT;
+    for(;;) {
+        Light_VM_Instruction in = *(Light_VM_Instruction*)(state->registers[RIP]);
+
+        u64 offset = state->registers[RIP] - (u64)state->code.block;
+        if(offset < profile->code_size) profile->by_offset[offset]++;
+        if(in.type < LVM_TYPE_COUNT) {
+            s32 mode = light_vm_addressing_mode(in);
+            profile->by_type[in.type]++;
+            if(mode >= 0) profile->by_mode[in.type][mode]++;
+            if(previous < LVM_TYPE_COUNT) profile->pairs[previous][in.type]++;
+        }
+        profile->instructions++;
+        previous = in.type;
+
+        if(in.type == LVM_HLT) break;
+
+        light_vm_execute_instruction(state, in);
+    }
+}
+
+void
+light_vm_execute_profiled(Light_VM_State* state, void* entry_point, Light_VM_Profile* profile) {
+    light_vm_reset(state);
+    if(entry_point != 0) {
+        state->registers[RIP] = (u64)entry_point;
+    }
+
+    if(profile->code_size < state->code_offset) {
+        profile->by_offset = (uint64_t*)realloc(profile->by_offset, state->code_offset * sizeof(u64));
+        memset(profile->by_offset + profile->code_size, 0, (state->code_offset - profile->code_size) * sizeof(u64));
+        profile->code_size = state->code_offset;
+    }
+
+    light_vm_run_guarded(state, profile_run, profile);
+}
+
+void
+light_vm_profile_free(Light_VM_Profile* profile) {
+    free(profile->by_offset);
+    profile->by_offset = 0;
+    profile->code_size = 0;
+}
+
+typedef struct {
+    u64 count;
+    u32 first;  // type, or code offset
+    u32 second; // addressing mode, or type of the next instruction
+} Light_VM_Profile_Entry;
+
+static int
+profile_entry_more(const void* a, const void* b) {
+    const Light_VM_Profile_Entry* l = (const Light_VM_Profile_Entry*)a;
+    const Light_VM_Profile_Entry* r = (const Light_VM_Profile_Entry*)b;
+    if(l->count != r->count) return (l->count < r->count) ? 1 : -1;
+    if(l->first != r->first) return (l->first < r->first) ? -1 : 1;
+    return (l->second < r->second) ? -1 : (l->second > r->second);
+}
+
+typedef enum {
+    PROFILE_TYPES,
+    PROFILE_MODES,
+    PROFILE_PAIRS,
+    PROFILE_OFFSETS,
+} Light_VM_Profile_Table;
+
+// Non zero counts of the table, most executed first, the caller frees them
+static Light_VM_Profile_Entry*
+profile_sorted(Light_VM_Profile* profile, Light_VM_Profile_Table table, u64* count) {
+    u64 capacity = 0;
+    switch(table) {
+        case PROFILE_TYPES:   capacity = LVM_TYPE_COUNT; break;
+        case PROFILE_MODES:   capacity = LVM_TYPE_COUNT * 16; break;
+        case PROFILE_PAIRS:   capacity = LVM_TYPE_COUNT * LVM_TYPE_COUNT; break;
+        case PROFILE_OFFSETS: capacity = profile->code_size; break;
+    }
+    Light_VM_Profile_Entry* entries = (Light_VM_Profile_Entry*)malloc((capacity + 1) * sizeof(*entries));
+
+    u64 n = 0;
+    for(u64 i = 0; i < capacity; ++i) {
+        u64 c = 0;
+        u32 first = (u32)i, second = 0;
+        switch(table) {
+            case PROFILE_TYPES:   c = profile->by_type[i]; break;
+            case PROFILE_MODES:   first = (u32)(i / 16); second = (u32)(i % 16); c = profile->by_mode[first][second]; break;
+            case PROFILE_PAIRS:   first = (u32)(i / LVM_TYPE_COUNT); second = (u32)(i % LVM_TYPE_COUNT); c = profile->pairs[first][second]; break;
+            case PROFILE_OFFSETS: c = profile->by_offset[i]; break;
+        }
+        if(c == 0) continue;
+        entries[n].count = c;
+        entries[n].first = first;
+        entries[n].second = second;
+        n++;
+    }
+    qsort(entries, n, sizeof(*entries), profile_entry_more);
+    *count = n;
+    return entries;
+}
+
+static double
+percent(u64 count, u64 total) {
+    return (total) ? 100.0 * (double)count / (double)total : 0.0;
+}
+
+static u64
+immediate_at(Light_VM_Instruction* in) {
+    u8* imm = (u8*)(in + 1);
+    switch(in->imm_size_bytes) {
+        case 1: return *(u8*)imm;
+        case 2: return *(u16*)imm;
+        case 4: return *(u32*)imm;
+        case 8: return *(u64*)imm;
+        default: break;
+    }
+    return 0;
+}
+
+void
+light_vm_profile_report(FILE* out, Light_VM_State* state, Light_VM_Profile* profile, int32_t top) {
+    u64 total = profile->instructions;
+    u64 count = 0;
+    fprintf(out, "instructions executed: %llu\n", (unsigned long long)total);
+
+    Light_VM_Profile_Entry* types = profile_sorted(profile, PROFILE_TYPES, &count);
+    fprintf(out, "\nby type:\n");
+    for(u64 i = 0; i < count && i < (u64)top; ++i) {
+        fprintf(out, "  %12llu %6.2f%%  %s\n", (unsigned long long)types[i].count, percent(types[i].count, total),
+            light_vm_instruction_name(types[i].first));
+    }
+    free(types);
+
+    Light_VM_Profile_Entry* modes = profile_sorted(profile, PROFILE_MODES, &count);
+    fprintf(out, "\nby addressing mode:\n");
+    for(u64 i = 0; i < count && i < (u64)top; ++i) {
+        fprintf(out, "  %12llu %6.2f%%  %s %s\n", (unsigned long long)modes[i].count, percent(modes[i].count, total),
+            light_vm_instruction_name(modes[i].first), light_vm_addressing_mode_name(modes[i].first, modes[i].second));
+    }
+    free(modes);
+
+    Light_VM_Profile_Entry* pairs = profile_sorted(profile, PROFILE_PAIRS, &count);
+    fprintf(out, "\npairs:\n");
+    for(u64 i = 0; i < count && i < (u64)top; ++i) {
+        fprintf(out, "  %12llu %6.2f%%  %s, %s\n", (unsigned long long)pairs[i].count, percent(pairs[i].count, total),
+            light_vm_instruction_name(pairs[i].first), light_vm_instruction_name(pairs[i].second));
+    }
+    free(pairs);
+
+    Light_VM_Profile_Entry* offsets = profile_sorted(profile, PROFILE_OFFSETS, &count);
+    fprintf(out, "\nhottest instructions:\n");
+    for(u64 i = 0; i < count && i < (u64)top; ++i) {
+        Light_VM_Instruction* in = (Light_VM_Instruction*)((u8*)state->code.block + offsets[i].first);
+        fprintf(out, "  %12llu %6.2f%%  0x%06x  ", (unsigned long long)offsets[i].count, percent(offsets[i].count, total), offsets[i].first);
+        light_vm_print_instruction(out, *in, immediate_at(in));
+    }
+    free(offsets);
+}
+
+int32_t
+light_vm_profile_write_json(const char* path, Light_VM_State* state, Light_VM_Profile* profile) {
+    FILE* out = fopen(path, "wb");
+    if(!out) return false;
+
+    u64 count = 0;
+    fprintf(out, "{\n  \"instructions\": %llu,\n", (unsigned long long)profile->instructions);
+
+    Light_VM_Profile_Entry* types = profile_sorted(profile, PROFILE_TYPES, &count);
+    fprintf(out, "  \"types\": [");
+    for(u64 i = 0; i < count; ++i) {
+        fprintf(out, "%s\n    {\"type\": \"%s\", \"count\": %llu}", (i) ? "," : "",
+            light_vm_instruction_name(types[i].first), (unsigned long long)types[i].count);
+    }
+    fprintf(out, "\n  ],\n");
+    free(types);
+
+    Light_VM_Profile_Entry* modes = profile_sorted(profile, PROFILE_MODES, &count);
+    fprintf(out, "  \"modes\": [");
+    for(u64 i = 0; i < count; ++i) {
+        fprintf(out, "%s\n    {\"type\": \"%s\", \"mode\": \"%s\", \"count\": %llu}", (i) ? "," : "",
+            light_vm_instruction_name(modes[i].first), light_vm_addressing_mode_name(modes[i].first, modes[i].second),
+            (unsigned long long)modes[i].count);
+    }
+    fprintf(out, "\n  ],\n");
+    free(modes);
+
+    Light_VM_Profile_Entry* pairs = profile_sorted(profile, PROFILE_PAIRS, &count);
+    fprintf(out, "  \"pairs\": [");
+    for(u64 i = 0; i < count; ++i) {
+        fprintf(out, "%s\n    {\"first\": \"%s\", \"second\": \"%s\", \"count\": %llu}", (i) ? "," : "",
+            light_vm_instruction_name(pairs[i].first), light_vm_instruction_name(pairs[i].second), (unsigned long long)pairs[i].count);
+    }
+    fprintf(out, "\n  ],\n");
+    free(pairs);
+
+    Light_VM_Profile_Entry* offsets = profile_sorted(profile, PROFILE_OFFSETS, &count);
+    fprintf(out, "  \"offsets\": [");
+    for(u64 i = 0; i < count; ++i) {
+        Light_VM_Instruction* in = (Light_VM_Instruction*)((u8*)state->code.block + offsets[i].first);
+        fprintf(out, "%s\n    {\"offset\": %u, \"type\": \"%s\", \"count\": %llu}", (i) ? "," : "",
+            offsets[i].first, light_vm_instruction_name(in->type), (unsigned long long)offsets[i].count);
+    }
+    fprintf(out, "\n  ]\n}\n");
+    free(offsets);
+
+    fclose(out);
+    return true;
+}
@@ -46,6 +46,9 @@ lvm_ext_call:
     mov [rsp + 32], r12
     mov [rsp + 40], rbx
 
+    ; a callee that returns no float leaves xmm0 as is, make that 0
+    pxor xmm0, xmm0
+
     mov r10, rsi        ; r10 = funcptr
 
     mov rax, rdi        ; rax = struct*
@@ -48,6 +48,9 @@ lvm_ext_call proc
     mov [rsp + 48], r12
     mov [rsp + 56], rbx
 
+    ; a callee that returns no float leaves xmm0 as is, make that 0
+    pxor xmm0, xmm0
+
     mov r10, rdx        ; r10 = funcptr
 
     mov rax, rcx        ; rax = struct*
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include "ast.h"
 #include "lightvm.h"
 #include <stdint.h>
@@ -12,6 +13,56 @@
 #include <windows.h>
 #endif
 
+// Counts of every example when run with -profile
+static Light_VM_Profile* profile;
+
+// The plain switch loop, one instruction at a time
+static void
+execute_switch(Light_VM_State* state, void* entry_point) {
+    light_vm_reset(state);
+    if(entry_point != 0) {
+        state->registers[RIP] = (u64)entry_point;
+    }
+    for(;;) {
+        Light_VM_Instruction in = *(Light_VM_Instruction*)(state->registers[RIP]);
+        if(in.type == LVM_HLT) break;
+        light_vm_execute_instruction(state, in);
+    }
+}
+
+// Runs on the interpreter, then again on the JIT and on the switch loop
+// which must all end the same way, and on the profiler with -profile.
+// light_vm_reset leaves the flags as they were, every run starts them at 0.
+void execute(Light_VM_State* state, void* entry_point, bool print_steps) {
+    memset(&state->rflags, 0, sizeof(state->rflags));
+    light_vm_execute(state, entry_point, print_steps);
+    uint64_t registers[R_COUNT];
+    double   f64registers[FREG_COUNT];
+    memcpy(registers, state->registers, sizeof(registers));
+    memcpy(f64registers, state->f64registers, sizeof(f64registers));
+    Light_VM_Flags_Register rflags = state->rflags;
+
+    memset(&state->rflags, 0, sizeof(state->rflags));
+    light_vm_execute_jit(state, entry_point);
+    assert(memcmp(registers, state->registers, sizeof(registers)) == 0);
+    assert(memcmp(f64registers, state->f64registers, sizeof(f64registers)) == 0);
+    assert(memcmp(&rflags, &state->rflags, sizeof(rflags)) == 0);
+
+    memset(&state->rflags, 0, sizeof(state->rflags));
+    execute_switch(state, entry_point);
+    assert(memcmp(registers, state->registers, sizeof(registers)) == 0);
+    assert(memcmp(f64registers, state->f64registers, sizeof(f64registers)) == 0);
+    assert(memcmp(&rflags, &state->rflags, sizeof(rflags)) == 0);
+
+    if(profile) {
+        memset(&state->rflags, 0, sizeof(state->rflags));
+        light_vm_execute_profiled(state, entry_point, profile);
+        assert(memcmp(registers, state->registers, sizeof(registers)) == 0);
+        assert(memcmp(f64registers, state->f64registers, sizeof(f64registers)) == 0);
+        assert(memcmp(&rflags, &state->rflags, sizeof(rflags)) == 0);
+    }
+}
+
 void example1(Light_VM_State* state) {
     // branch test
     Light_VM_Instruction_Info entry = 
@@ -23,7 +74,7 @@ void example1(Light_VM_State* state) {
     Light_VM_Instruction_Info hlt = light_vm_push(state, "hlt");
     light_vm_patch_immediate_distance(b, hlt);
 
-    light_vm_execute(state, entry.absolute_address, 0);
+    execute(state, entry.absolute_address, 0);
     assert(state->registers[R0] == 5 && state->registers[R1] == 5);
 }
 
@@ -36,7 +87,7 @@ void example2(Light_VM_State* state) {
     light_vm_push(state, "pop r1");
     light_vm_push(state, "hlt");
 
-    light_vm_execute(state, entry.absolute_address, 0);
+    execute(state, entry.absolute_address, 0);
     assert(state->registers[R0] == 25 && state->registers[R1] == 5);
 }
 
@@ -50,7 +101,7 @@ void example3(Light_VM_State* state) {
 
     light_vm_patch_immediate_distance(call, proc);
 
-    light_vm_execute(state, call.absolute_address, 0);
+    execute(state, call.absolute_address, 0);
     assert(state->registers[R0] == 0x69);
 }
 
@@ -83,7 +134,7 @@ void example4(Light_VM_State* state) {
 
     light_vm_debug_dump_code(stdout, state);
 
-    light_vm_execute(state, entry.absolute_address, 0);
+    execute(state, entry.absolute_address, 0);
     light_vm_debug_dump_registers(stdout, state, LVM_PRINT_DECIMAL);
     assert(state->registers[R0] == 120 && state->registers[R1] == 5);
 
@@ -106,7 +157,7 @@ void example5(Light_VM_State* state) {
 
     light_vm_patch_immediate_distance(branch, start);
 
-    light_vm_execute(state, entry.absolute_address, 0);
+    execute(state, entry.absolute_address, 0);
     light_vm_debug_dump_registers(stdout, state, LVM_PRINT_DECIMAL);
     assert(state->registers[R1] == 120);
 }
@@ -134,7 +185,7 @@ void example6(Light_VM_State* state) {
 
     // Should print 2 5 11.100000
 	light_vm_debug_dump_code(stdout, state);
-    light_vm_execute(state, entry.absolute_address, 1);
+    execute(state, entry.absolute_address, 1);
     assert(state->f32registers[FR0] == 1.544f);
 }
 
@@ -156,7 +207,7 @@ void example7(Light_VM_State* state) {
     light_vm_push(state, "hlt");
 
     // Should print Hello World!\n
-    light_vm_execute(state, entry.absolute_address, 0);
+    execute(state, entry.absolute_address, 0);
 }
 #elif defined(_WIN32) || defined(_WIN64)
 void example7(Light_VM_State* state) {
@@ -177,7 +228,7 @@ void example7(Light_VM_State* state) {
     light_vm_push(state, "hlt");
 
     // Should print Hello World!\n
-    light_vm_execute(state, entry.absolute_address, 1);
+    execute(state, entry.absolute_address, 1);
 }
 #endif
 
@@ -194,7 +245,7 @@ void example8(Light_VM_State* state) {
     light_vm_push(state, "copy r0, r1, r2");
     light_vm_push(state, "hlt");
 
-    light_vm_execute(state, entry.absolute_address, 0);
+    execute(state, entry.absolute_address, 0);
     assert(memcmp((void*)state->registers[R0], (void*)state->registers[R1], sizeof(str) - 1) == 0);
 }
 
@@ -210,8 +261,11 @@ void example9(Light_VM_State* state) {
     light_vm_push(state, "copy r0, r1, r2");
     light_vm_push(state, "hlt");
 
+    // r0 is a new allocation on each run
     light_vm_execute(state, entry.absolute_address, 0);
     assert(memcmp((void*)state->registers[R0], (void*)state->registers[RDP], sizeof(str) - 1) == 0);
+    light_vm_execute_jit(state, entry.absolute_address);
+    assert(memcmp((void*)state->registers[R0], (void*)state->registers[RDP], sizeof(str) - 1) == 0);
 }
 
 s32 func_add(int a, int b) {
@@ -238,7 +292,7 @@ void example10(Light_VM_State* state) {
 
     *(void**)(((Light_VM_Instruction*)entry_info.absolute_address) + 1) = func_add;
 
-    light_vm_execute(state, entry_info.absolute_address, 0);
+    execute(state, entry_info.absolute_address, 0);
     light_vm_debug_dump_registers(stdout, state, LVM_PRINT_DECIMAL);
 }
 
@@ -255,14 +309,318 @@ void example11(Light_VM_State* state) {
 
     light_vm_push(state, "hlt");
 
-    light_vm_execute(state, entry.absolute_address, 0);
+    execute(state, entry.absolute_address, 0);
     light_vm_debug_dump_registers(stdout, state, LVM_PRINT_DECIMAL);
     assert(state->registers[R1] == 0 && state->registers[R2] == 1);
 }
 
-int main() {
+// Random operands for every binary opcode, addressing mode and size, each
+// followed by a random branch. The engines must end with the same registers,
+// flags and memory.
+static u64 random_state = 88172645463325252ull;
+static u8  random_memory[2048];
+static u8  random_memory_initial[2048];
+
+typedef struct {
+    u64                     registers[R_COUNT];
+    Light_VM_Flags_Register rflags;
+    u8                      memory[sizeof(random_memory)];
+} Random_Run;
+
+static u64
+random_next() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+// Divisors are not 0 and shifts are within the smallest size
+static u64
+random_operand(u8 type) {
+    switch(type) {
+        case LVM_DIV_S: case LVM_MOD_S: case LVM_DIV_U: case LVM_MOD_U: return 1 + random_next() % 100;
+        case LVM_SHL: case LVM_SHR: return 1 + random_next() % 7;
+        default: return random_next();
+    }
+}
+
+static void
+random_run(Light_VM_State* state, void* entry_point, s32 engine, Random_Run* out) {
+    memcpy(random_memory, random_memory_initial, sizeof(random_memory));
+    memset(&state->rflags, 0, sizeof(state->rflags));
+    switch(engine) {
+        case 0: light_vm_execute(state, entry_point, 0); break;
+        case 1: execute_switch(state, entry_point); break;
+        case 2: light_vm_execute_jit(state, entry_point); break;
+        case 3: {
+            Light_VM_Profile unused = {0};
+            light_vm_execute_profiled(state, entry_point, &unused);
+            light_vm_profile_free(&unused);
+        } break;
+    }
+    memcpy(out->registers, state->registers, sizeof(out->registers));
+    out->rflags = state->rflags;
+    memcpy(out->memory, random_memory, sizeof(out->memory));
+}
+
+// On a state of its own, the code is replaced on every trial
+void example12(Light_VM_State* shared) {
+    const u8 types[] = { LVM_CMP, LVM_MOV, LVM_ADD_S, LVM_SUB_S, LVM_MUL_S, LVM_DIV_S, LVM_MOD_S, LVM_ADD_U,
+        LVM_SUB_U, LVM_MUL_U, LVM_DIV_U, LVM_MOD_U, LVM_SHL, LVM_SHR, LVM_OR, LVM_AND, LVM_XOR };
+    const u8 branches[] = { LVM_BEQ, LVM_BNE, LVM_BLT_S, LVM_BGT_S, LVM_BLE_S, LVM_BGE_S, LVM_BLT_U, LVM_BGT_U,
+        LVM_BLE_U, LVM_BGE_U, LVM_JMP };
+    const u32 sizes[] = { 1, 2, 4, 8 };
+    Light_VM_State* state = light_vm_init();
+
+    for(s32 trial = 0; trial < 10000; ++trial) {
+        state->code_offset = 0;
+        Light_VM_Instruction in = {0};
+        in.type = types[random_next() % sizeof(types)];
+        in.binary.addr_mode = random_next() % 8;
+        in.binary.bytesize = sizes[random_next() % 4];
+        in.binary.dst_reg = random_next() % 8;
+        do {
+            in.binary.src_reg = random_next() % 8;
+        } while(in.binary.src_reg == in.binary.dst_reg);
+
+        for(s32 i = 0; i < sizeof(random_memory); i += 8) {
+            u64 value = random_operand(in.type);
+            memcpy(random_memory_initial + i, &value, sizeof(value));
+        }
+
+        // Registers that address memory point to the middle of it
+        Light_VM_Instruction_Info entry = {0};
+        for(s32 r = 0; r < 8; ++r) {
+            u64 value = random_operand(in.type);
+            u32 mode = in.binary.addr_mode;
+            if((r == in.binary.dst_reg && (mode == BIN_ADDR_MODE_REG_TO_MEM || mode == BIN_ADDR_MODE_REG_TO_MEM_OFFSETED)) ||
+                (r == in.binary.src_reg && (mode == BIN_ADDR_MODE_MEM_TO_REG || mode == BIN_ADDR_MODE_REG_OFFSETED_TO_REG)))
+            {
+                value = (u64)(random_memory + 1024 + (random_next() % 64) * 8);
+            }
+            Light_VM_Instruction_Info info = light_vm_push_fmt(state, "mov r%d, 0x%llx", r, value);
+            if(r == 0) entry = info;
+        }
+
+        u64 immediate = 0;
+        switch(in.binary.addr_mode) {
+            case BIN_ADDR_MODE_REG_TO_IMM_MEM:
+            case BIN_ADDR_MODE_MEM_IMM_TO_REG:
+                in.imm_size_bytes = 8;
+                immediate = (u64)(random_memory + (random_next() % 200) * 8);
+                break;
+            case BIN_ADDR_MODE_REG_TO_MEM_OFFSETED:
+            case BIN_ADDR_MODE_REG_OFFSETED_TO_REG:
+                in.imm_size_bytes = sizes[random_next() % 4];
+                in.binary.sign = random_next() & 1;
+                immediate = (random_next() % 32) * 8;
+                break;
+            case BIN_ADDR_MODE_IMM_TO_REG:
+                in.imm_size_bytes = sizes[random_next() % 4];
+                immediate = random_operand(in.type);
+                if(in.imm_size_bytes < 8) immediate &= (1ull << (8 * in.imm_size_bytes)) - 1;
+                if(immediate == 0) immediate = 1;
+                break;
+            default: break;
+        }
+        light_vm_push_instruction(state, in, immediate);
+
+        Light_VM_Instruction branch = {0};
+        branch.type = branches[random_next() % sizeof(branches)];
+        branch.imm_size_bytes = 1;
+        branch.branch.addr_mode = BRANCH_ADDR_MODE_IMMEDIATE_RELATIVE;
+        Light_VM_Instruction_Info branch_info = light_vm_push_instruction(state, branch, 0);
+        light_vm_push(state, "mov r7, 0x77");
+        Light_VM_Instruction_Info hlt = light_vm_push(state, "hlt");
+        light_vm_patch_immediate_distance(branch_info, hlt);
+
+        Random_Run threaded, other;
+        random_run(state, entry.absolute_address, 0, &threaded);
+        for(s32 engine = 1; engine < 4; ++engine) {
+            random_run(state, entry.absolute_address, engine, &other);
+            assert(memcmp(threaded.registers, other.registers, sizeof(threaded.registers)) == 0);
+            assert(memcmp(&threaded.rflags, &other.rflags, sizeof(threaded.rflags)) == 0);
+            assert(memcmp(threaded.memory, other.memory, sizeof(threaded.memory)) == 0);
+        }
+    }
+
+    light_vm_free(state);
+}
+
+void example13(Light_VM_State* state) {
+    // sequences the threaded loop runs as one superinstruction
+    Light_VM_Instruction_Info entry =
+    light_vm_push(state, "mov r1, rsp");
+    light_vm_push(state, "mov r0, 0x10");
+    light_vm_push(state, "mov [r1 + 0x8], r0");
+    light_vm_push(state, "mov r0, 0x20");
+    light_vm_push(state, "mov [r1 + 0x10], r0");
+
+    light_vm_push(state, "mov r2, r1");          // LVM_FUSED_MOV_ADD
+    light_vm_push(state, "adds r2, 0x8");
+    light_vm_push(state, "mov r4, 0x1");
+    light_vm_push(state, "mov r3, [r2]");        // LVM_FUSED_LOAD_ADD
+    light_vm_push(state, "addu r4, r3");
+    light_vm_push(state, "mov r5, [r1 + 0x10]"); // LVM_FUSED_LOAD_OFFSETED_ADD
+    light_vm_push(state, "adds r4, r5");
+    light_vm_push(state, "mov r6, [r1 + 0x8]");  // LVM_FUSED_ADD_IMMEDIATE_TO_MEM
+    light_vm_push(state, "adds r6, 0x5");
+    light_vm_push(state, "mov [r1 + 0x8], r6");
+    light_vm_push(state, "mov r7, [r1 + 0x8]");
+    light_vm_push(state, "hlt");
+
+    execute(state, entry.absolute_address, 0);
+    assert(state->registers[R2] == state->registers[R1] + 8);
+    assert(state->registers[R3] == 0x10 && state->registers[R5] == 0x20);
+    assert(state->registers[R4] == 0x31);
+    assert(state->registers[R6] == 0x15 && state->registers[R7] == 0x15);
+}
+
+static bool
+branch_taken(u8 type, s64 l, s64 r, u64 ul, u64 ur) {
+    switch(type) {
+        case LVM_BEQ:   return l == r;
+        case LVM_BNE:   return l != r;
+        case LVM_BLT_S: return l < r;
+        case LVM_BGT_S: return l > r;
+        case LVM_BLE_S: return l <= r;
+        case LVM_BGE_S: return l >= r;
+        case LVM_BLT_U: return ul < ur;
+        case LVM_BGT_U: return ul > ur;
+        case LVM_BLE_U: return ul <= ur;
+        case LVM_BGE_U: return ul >= ur;
+        default: assert(0); break;
+    }
+    return 0;
+}
+
+void example14(Light_VM_State* state) {
+    // cmp followed by a branch, on every size and branch, register and immediate
+    const char* sizes[] = {"b", "w", "d", ""};
+    const char* branches[] = {"beq", "bne", "blts", "bgts", "bles", "bges", "bltu", "bgtu", "bleu", "bgeu"};
+
+    for(s32 size = 0; size < 4; ++size) {
+        s32 bits = 8 << size;
+        u64 mask = (bits == 64) ? ~0ull : (1ull << bits) - 1;
+        // Negative and positive at this size, with garbage above it
+        u64 values[] = {((u64)-3 & mask) | (~mask & 0x5a5a5a5a5a5a5a5aull), 5 | (~mask & 0xa5a5a5a5a5a5a5a5ull)};
+
+        for(s32 b = 0; b < 10; ++b) {
+            for(s32 pair = 0; pair < 4; ++pair) {
+                u64 l = values[pair & 1];
+                u64 r = values[pair >> 1];
+
+                for(s32 immediate = 0; immediate < 2; ++immediate) {
+                    Light_VM_Instruction_Info entry =
+                    light_vm_push(state, "mov r2, 0x0");
+                    light_vm_push_fmt(state, "mov r0, 0x%llx", l);
+                    light_vm_push_fmt(state, "mov r1, 0x%llx", r);
+                    if(immediate) {
+                        light_vm_push_fmt(state, "cmp r0%s, 0x%llx", sizes[size], r & mask);
+                    } else {
+                        light_vm_push_fmt(state, "cmp r0%s, r1%s", sizes[size], sizes[size]);
+                    }
+                    Light_VM_Instruction_Info branch = light_vm_push_fmt(state, "%s 0xff", branches[b]);
+                    light_vm_push(state, "mov r2, 0x1");
+                    Light_VM_Instruction_Info taken = light_vm_push(state, "hlt");
+                    light_vm_patch_immediate_distance(branch, taken);
+
+                    execute(state, entry.absolute_address, 0);
+                    s64 sl = (s64)(l << (64 - bits)) >> (64 - bits);
+                    s64 sr = (s64)(r << (64 - bits)) >> (64 - bits);
+                    assert(state->registers[R2] == !branch_taken(LVM_BEQ + b, sl, sr, l & mask, r & mask));
+                }
+            }
+        }
+    }
+}
+
+// Runs on every engine, each one must stop with the fault. The profiler
+// runs on the switch loop.
+void execute_fault(Light_VM_State* state, void* entry_point, Light_VM_Fault fault) {
+    light_vm_execute(state, entry_point, 0);
+    assert(state->fault == fault);
+    light_vm_execute_jit(state, entry_point);
+    assert(state->fault == fault);
+    Light_VM_Profile unused = {0};
+    light_vm_execute_profiled(state, entry_point, &unused);
+    light_vm_profile_free(&unused);
+    assert(state->fault == fault);
+}
+
+void example15(Light_VM_State* state) {
+    // infinite recursion runs into the guard page above the stack
+    Light_VM_Instruction_Info recursion = light_vm_push(state, "call 0xff");
+    light_vm_push(state, "hlt");
+    light_vm_patch_immediate_distance(recursion, recursion);
+    execute_fault(state, recursion.absolute_address, LVM_FAULT_STACK_OVERFLOW);
+
+    // popping from the empty stack runs into the one below it
+    Light_VM_Instruction_Info pop = light_vm_push(state, "pop r0");
+    light_vm_push(state, "hlt");
+    execute_fault(state, pop.absolute_address, LVM_FAULT_STACK_UNDERFLOW);
+
+    // the state can still be used after a fault
+    example5(state);
+}
+
+void example16(Light_VM_State* state) {
+    // code and data grow past what is usable at first
+    u64 code_size = state->code.size;
+    Light_VM_Instruction_Info entry =
+    light_vm_push(state, "mov r0, 0x0");
+    u64 count = 0;
+    for(; state->code_offset <= code_size; ++count) {
+        light_vm_push(state, "adds r0, 0x1");
+    }
+
+    u64 data_size = state->data.size;
+    u8 bytes[4096];
+    for(s32 i = 0; i < sizeof(bytes); ++i) bytes[i] = (u8)i;
+    void* last = 0;
+    while(state->data_offset <= data_size) {
+        last = light_vm_push_bytes_data_segment(state, bytes, sizeof(bytes));
+    }
+    light_vm_push_fmt(state, "mov r1, %p", (u8*)last + sizeof(bytes) - 8);
+    light_vm_push(state, "mov r2, [r1]");
+    light_vm_push(state, "hlt");
+
+    execute(state, entry.absolute_address, 0);
+    assert(state->code.size > code_size && state->data.size > data_size);
+    assert(state->registers[R0] == count && state->registers[R2] == 0xfffefdfcfbfaf9f8);
+}
+
+void example17(Light_VM_State* state) {
+    // pushes stop at the limits of the segments
+    Light_VM_Limits limits = { 4096, 4096, 4096 };
+    Light_VM_State* small = light_vm_init_with_limits(limits);
+
+    Light_VM_Instruction_Info first = light_vm_push(small, "jmp 0xff");
+    Light_VM_Instruction_Info info = first;
+    while(info.absolute_address) {
+        info = light_vm_push(small, "mov r0, 0x1");
+    }
+    assert(small->fault == LVM_FAULT_CODE_FULL && small->code_offset <= small->code.limit);
+    light_vm_patch_immediate_distance(first, info);
+
+    u8 bytes[1024] = {0};
+    while(light_vm_push_bytes_data_segment(small, bytes, sizeof(bytes))) {}
+    assert(small->fault == LVM_FAULT_DATA_FULL && small->data_offset == small->data.limit);
+
+    light_vm_free(small);
+}
+
+int main(int argc, char** argv) {
     Light_VM_State* state = light_vm_init();
 
+    // lightvm -profile out.json
+    const char* profile_file = 0;
+    if(argc > 2 && strcmp(argv[1], "-profile") == 0) {
+        profile_file = argv[2];
+        profile = (Light_VM_Profile*)calloc(1, sizeof(Light_VM_Profile));
+    }
+
     example1(state);
     example2(state);
     example3(state);
@@ -274,8 +632,22 @@ int main() {
     example9(state);
     example10(state);
     example11(state);
+    example12(state);
+    example13(state);
+    example14(state);
+    example15(state);
+    example16(state);
+    example17(state);
     light_vm_debug_dump_registers(stdout, state, LVM_PRINT_FLAGS_REGISTER|LVM_PRINT_DECIMAL);
 
+    if(profile) {
+        light_vm_profile_report(stdout, state, profile, 10);
+        if(!light_vm_profile_write_json(profile_file, state, profile))
+            fprintf(stderr, "could not write the profile to %s\n", profile_file);
+        light_vm_profile_free(profile);
+        free(profile);
+    }
+
     //Light_VM_Instruction_Info from = {0};
     //from.absolute_address = state->code.block - 0x02;
     //printf("0x%lx\n", light_vm_offset_from_current_instruction(state, from));
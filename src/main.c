@@ -1,4 +1,6 @@
 #define LIGHT_ARENA_IMPLEMENT
+#define LIGHT_ARENA_ON_ALLOC(SIZE) if(light_profile_enabled) light_profile_alloc(LIGHT_PROFILE_ARENA, SIZE)
+#include "utils/profile.h"
 #include <stdio.h>
 #include "lexer.h"
 #include "parser.h"
@@ -8,61 +10,128 @@
 #include "top_typecheck.h"
 #include "bytecode.h"
 #include "backend/c/toplevel.h"
+#include "utils/thread.h"
 #include <light_array.h>
+#include <stdlib.h>
+#include "utils/intern.h"
+#include "cache.h"
+#include "server.h"
+#include "bench.h"
+#include <string.h>
 
-int main(int argc, char** argv) {
-    double start = os_time_us();
+static void
+print_memory_usage(const char* name, Light_Arena_Stats stats) {
+    printf("  %-16s %.1f KB used, %.1f KB wasted, %.1f KB in %zu blocks\n", name,
+        stats.bytes_requested / 1024.0, stats.bytes_wasted / 1024.0, stats.bytes_reserved / 1024.0, stats.blocks);
+}
 
-    light_set_global_tables(argv[0]);
+static void
+print_usage(const char* compiler) {
+    fprintf(stderr, "usage: %s [-jN] [-uN] [-cache] [-images] [-profile file] [-trace file] filename\n", compiler);
+    fprintf(stderr, "       %s [-jN] [-images] --server socket\n", compiler);
+    fprintf(stderr, "       %s --connect socket [-jN] [-uN] [-cache] [-images] [-profile file] [-trace file] filename\n", compiler);
+    fprintf(stderr, "       %s --bench [options]\n", compiler);
+    fprintf(stderr, "  -jN  use N threads (default: number of cores)\n");
+    fprintf(stderr, "  -uN  split the generated C in N units compiled in parallel (default: 1)\n");
+    fprintf(stderr, "  -cache  reuse the results of previous builds from .light_cache\n");
+    fprintf(stderr, "  -images  write images of the standard modules parsed, later builds load them instead\n");
+    fprintf(stderr, "  -profile  write the time and allocations of every phase, file and procedure as JSON\n");
+    fprintf(stderr, "  -trace    write the same scopes in the Chrome trace event format\n");
+    fprintf(stderr, "  --server   keep the standard modules loaded and compile the requests sent to socket\n");
+    fprintf(stderr, "  --connect  compile through the server listening on socket\n");
+    fprintf(stderr, "  --bench    measure the throughput of every phase on a generated program, see --bench -help\n");
+}
 
-    if(argc < 2) {
-        fprintf(stderr, "usage: %s filename\n", argv[0]);
-        return 1;
+typedef struct {
+    const char* main_file;
+    s32         thread_count;
+    s32         unit_count;
+    bool        use_cache;
+    bool        write_images;
+    const char* server_socket;
+    const char* profile_file;
+    const char* trace_file;
+} Light_Options;
+
+static bool
+parse_options(int argc, char** argv, Light_Options* options) {
+    options->thread_count = light_thread_hardware_count();
+    options->unit_count = 1;
+    for(int i = 1; i < argc; ++i) {
+        if(argv[i][0] == '-' && argv[i][1] == 'j') {
+            options->thread_count = atoi(argv[i] + 2);
+            if(options->thread_count <= 0) return false;
+        } else if(strcmp(argv[i], "-cache") == 0) {
+            options->use_cache = true;
+        } else if(strcmp(argv[i], "-images") == 0) {
+            options->write_images = true;
+        } else if(strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            options->server_socket = argv[++i];
+        } else if(strcmp(argv[i], "-profile") == 0 && i + 1 < argc) {
+            options->profile_file = argv[++i];
+        } else if(strcmp(argv[i], "-trace") == 0 && i + 1 < argc) {
+            options->trace_file = argv[++i];
+        } else if(argv[i][0] == '-' && argv[i][1] == 'u') {
+            options->unit_count = atoi(argv[i] + 2);
+            if(options->unit_count <= 0) return false;
+        } else if(!options->main_file) {
+            options->main_file = argv[i];
+        } else {
+            return false;
+        }
     }
+    return (options->main_file != 0) != (options->server_socket != 0);
+}
 
-    size_t compiler_path_size = 0;
-    const char* compiler_path = light_path_from_filename(argv[0], &compiler_path_size);
+// Compiles options->main_file, the parser must have been set up with
+// parse_init_modules. Returns the exit code of the compiler.
+static int
+compile(Light_Options* options, Light_Parser* parser, Light_Scope* global_scope, catstring* output, double start) {
+    const char* main_file = options->main_file;
+    s32 thread_count = options->thread_count;
 
     size_t real_path_size = 0;
-    const char* main_file_directory = light_path_from_filename(argv[1], &real_path_size);
+    const char* main_file_directory = light_path_from_filename(main_file, &real_path_size);
+    if(!main_file_directory) {
+        fprintf(stderr, "could not find file %s\n", main_file);
+        return 1;
+    }
+    const char* outfile = light_extensionless_filename(light_filename_from_path(main_file));
 
-    Light_Lexer  lexer = {0};
-    Light_Parser parser = {0};
-    Light_Scope  global_scope = {0};
+    output->length = 0;
+    #if defined(_WIN32) || defined(_WIN64)
+    catsprint(output, "%s%s.exe\0", main_file_directory, outfile);
+    #else
+    catsprint(output, "%s%s\0", main_file_directory, outfile);
+    #endif
 
-    initialize_global_identifiers_table();
+    if(options->use_cache) {
+        light_cache_init(main_file_directory);
+        if(light_cache_manifest_fresh(outfile, output->data)) {
+            printf("%s is up to date\n", main_file);
+            return 0;
+        }
+    }
 
     u32 parser_error = 0;
-    parse_init(&parser, &lexer, &global_scope, compiler_path, compiler_path_size, argv[1]);
-
-    Light_Ast** ast = 0;
+    parser->queue->write_images = options->write_images;
+    parse_push_root(parser, main_file);
 
+    // Parse the main file and all other files included by it
     double parse_start = os_time_us();
-    double lexing_elapsed = 0.0;
-    // Parse all other files included in the main file
-    while(array_length(parser.parse_queue_array) > 0) {
-        Light_Lexer lexer = {0};
-        double lexer_start = os_time_us();
-        Light_Token* tokens = lexer_file(&lexer, parser.parse_queue_array[0].data, 0);
-        lexing_elapsed += (os_time_us() - lexer_start) / 1000.0;
-
-        if(tokens == 0) {
-            // File does not exist
-            return 1;
-        }
-
-        ast = parse_top_level(&parser, &lexer, &global_scope, &parser_error);
-
-        if(parser_error & PARSER_ERROR_FATAL)
-            return 1;
-
-        array_remove(parser.parse_queue_array, 0);
-    }
+    light_profile_begin("parse", 0, 0);
+    Light_Ast** ast = parse_files(parser, thread_count, &parser_error);
+    light_profile_end();
+    if(parser_error & PARSER_ERROR_FATAL)
+        return 1;
     double parse_elapsed = (os_time_us() - parse_start) / 1000.0;
+    double lexing_elapsed = parser->lexing_elapsed;
     
     // Type checking
     double tcheck_start = os_time_us();
-    Light_Type_Error type_error = top_typecheck(ast, &global_scope);
+    light_profile_begin("type check", 0, 0);
+    Light_Type_Error type_error = top_typecheck(ast, global_scope, thread_count);
+    light_profile_end();
     if(type_error & TYPE_ERROR) {
         return 1;
     }
@@ -75,26 +144,41 @@ int main(int argc, char** argv) {
 #endif
 
 #if 1
-    const char* outfile = light_extensionless_filename(light_filename_from_path(argv[1]));
-
     double generate_start = os_time_us();
-    backend_c_generate_top_level(ast, global_type_table, &global_scope, main_file_directory, outfile, compiler_path);
+    light_profile_begin("code generation", 0, 0);
+    backend_c_generate_top_level(ast, global_type_table, global_scope, main_file_directory, outfile, global_compiler_path.data, thread_count, options->unit_count);
+    light_profile_end();
     double generate_elapsed = (os_time_us() - generate_start) / 1000.0;
 
     double total_elapsed = (os_time_us() - start) / 1000.0;
 
     double gcc_start = os_time_us();
-    backend_c_compile_with_gcc(ast, outfile, main_file_directory);
+    light_profile_begin("gcc", 0, 0);
+    bool compiled = backend_c_compile_with_gcc(ast, outfile, main_file_directory, thread_count);
+    light_profile_end();
+    if(compiled && options->use_cache)
+        light_cache_manifest_write(outfile, parser->queue);
     double gcc_elapsed = (os_time_us() - gcc_start) / 1000.0;
-
     printf("- elapsed time:\n\n");
-    printf("  lexing:          %.2f ms\n", lexing_elapsed);
-    printf("  parse:           %.2f ms\n", parse_elapsed);
-    printf("  type check:      %.2f ms\n", tcheck_elapsed);
-    printf("  code generation: %.2f ms\n", generate_elapsed);
+    printf("  lexing:          %.2f ms (all threads)\n", lexing_elapsed);
+    printf("  parse:           %.2f ms (%d threads)\n", parse_elapsed, thread_count);
+    printf("  type check:      %.2f ms (%d threads)\n", tcheck_elapsed, thread_count);
+    printf("  code generation: %.2f ms (%d threads)\n", generate_elapsed, thread_count);
     printf("  total:           %.2f ms\n", total_elapsed);
     printf("\n");
     printf("  gcc backend:     %.2f ms\n", gcc_elapsed);
+
+    Light_Arena_Stats ast_memory = {0};
+    Light_Arena_Stats type_memory = {0};
+    Light_Arena_Stats ident_memory = {0};
+    ast_arenas_stats(&ast_memory);
+    type_arenas_stats(&type_memory);
+    light_intern_stats(&ident_memory);
+
+    printf("\n- memory:\n\n");
+    print_memory_usage("ast:", ast_memory);
+    print_memory_usage("types:", type_memory);
+    print_memory_usage("identifiers:", ident_memory);
 #endif
 
 #if 0
@@ -106,5 +190,87 @@ int main(int argc, char** argv) {
     light_vm_debug_dump_registers(stdout, state.vmstate, LVM_PRINT_FLOATING_POINT_REGISTERS|LVM_PRINT_DECIMAL);
 #endif
 
+    ast_arenas_free();
+
     return 0;
+}
+
+static int
+profile_write(Light_Options* options, int result) {
+    if(options->profile_file && !light_profile_write_json(options->profile_file)) {
+        fprintf(stderr, "could not write the profile to %s\n", options->profile_file);
+        result = 1;
+    }
+    if(options->trace_file && !light_profile_write_trace(options->trace_file)) {
+        fprintf(stderr, "could not write the trace to %s\n", options->trace_file);
+        result = 1;
+    }
+    return result;
+}
+
+typedef struct {
+    Light_Parser* parser;
+    Light_Scope*  global_scope;
+} Light_Server_State;
+
+// Runs in a child of the server, see server.h
+static int
+server_compile(int argc, char** argv, catstring* output, void* data) {
+    Light_Server_State* state = (Light_Server_State*)data;
+    double start = os_time_us();
+
+    Light_Options options = {0};
+    if(!parse_options(argc, argv, &options) || options.server_socket) {
+        print_usage("light");
+        return 1;
+    }
+    if(options.profile_file || options.trace_file)
+        light_profile_enable();
+    return profile_write(&options, compile(&options, state->parser, state->global_scope, output, start));
+}
+
+int main(int argc, char** argv) {
+    double start = os_time_us();
+
+    if(argc >= 3 && strcmp(argv[1], "--connect") == 0)
+        return light_server_connect(argv[2], argc - 3, argv + 3);
+
+    if(argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+        light_set_global_tables(argv[0]);
+        initialize_global_identifiers_table();
+        return light_bench_run(argc - 2, argv + 2);
+    }
+
+    Light_Options options = {0};
+    if(!parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if(options.profile_file || options.trace_file)
+        light_profile_enable();
+
+    light_set_global_tables(argv[0]);
+
+    Light_Parser parser = {0};
+    Light_Scope  global_scope = {0};
+
+    initialize_global_identifiers_table();
+    parse_init_modules(&parser, &global_scope, global_compiler_path.data, global_compiler_path.length);
+
+    if(options.server_socket) {
+        // Every request starts from the modules parsed here
+        u32 parser_error = 0;
+        parser.queue->write_images = options.write_images;
+        parse_preload(&parser, options.thread_count, &parser_error);
+        if(parser_error & PARSER_ERROR_FATAL)
+            return 1;
+
+        Light_Server_State state = {&parser, &global_scope};
+        return light_server_listen(options.server_socket, server_compile, &state);
+    }
+
+    catstring output = {0};
+    int result = profile_write(&options, compile(&options, &parser, &global_scope, &output, start));
+    catstring_free(&output);
+    return result;
 }
\ No newline at end of file
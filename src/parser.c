@@ -3,6 +3,10 @@
 #include "global_tables.h"
 #include "utils/os.h"
 #include "utils/allocator.h"
+#include "utils/intern.h"
+#include "utils/profile.h"
+#include "type.h"
+#include "image.h"
 #include <light_array.h>
 #include <stdarg.h>
 #include <assert.h>
@@ -10,17 +14,18 @@
 //#include "hash_tables.h"
 
 #define ReturnIfError() if(*error & PARSER_ERROR_FATAL) return 0
-#define TOKEN_STR(T) (T)->length, (T)->data
+#define TOKEN_STR(T) (T)->length, token_data(T)
 
 // Forward declarations
 static Light_Ast* parse_decl_variable(Light_Parser* parser, Light_Token* name, Light_Type* type, Light_Scope* scope, u32* error, bool require_expr);
+static Light_Parse_Unit* parse_queue_push(Light_Parse_Queue* queue, string filepath);
 
 static s32
 parser_error_location(Light_Parser* parser, Light_Token* t) {
     if(!t) {
         return fprintf(stderr, "%s: ", parser->lexer->filepath);
     } else {
-        return fprintf(stderr, "%s:%d:%d: ", parser->lexer->filepath, t->line + 1, t->column + 1);
+        return fprintf(stderr, "%s:%d:%d: ", parser->lexer->filepath, token_line(t) + 1, token_column(t) + 1);
     }
 }
 
@@ -45,6 +50,29 @@ parser_require_and_eat(Light_Parser* parser, Light_Token_Type type) {
     return PARSER_OK;
 }
 
+// Queues the file named by the #import filename token of the current unit
+static u32
+parse_import(Light_Parser* parser, Light_Token* filename_token) {
+    const char* current_filepath_absolute = parser->unit->lexer.filepath_absolute;
+
+    char* full_imported_filepath = light_filepath_relative_to(
+        (char*)token_data(filename_token) + 1, filename_token->length - 2, 
+        current_filepath_absolute);
+
+    if(!full_imported_filepath) {
+        // TODO(psv): maybe to not fatal here
+        return parser_error_fatal(parser, filename_token, "Could not import %.*s: file not found\n", TOKEN_STR(filename_token));
+    }
+
+    string src_str = {0};
+    src_str.data = full_imported_filepath;
+    src_str.length = strlen(full_imported_filepath);
+
+    Light_Parse_Unit* imported = parse_queue_push(parser->queue, src_str);
+    array_push(parser->unit->imports, imported);
+    return PARSER_OK;
+}
+
 static Light_Ast* 
 parse_directive(Light_Parser* parser, Light_Scope* scope, u32* error) {
     *error |= parser_require_and_eat(parser, '#');
@@ -52,7 +80,7 @@ parse_directive(Light_Parser* parser, Light_Scope* scope, u32* error) {
 
     Light_Token* tag = lexer_next(parser->lexer);
 
-    if(tag->type == TOKEN_IDENTIFIER && tag->data == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_IMPORT].data) {
+    if(tag->type == TOKEN_IDENTIFIER && token_data(tag) == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_IMPORT].data) {
         Light_Token* filename_token = lexer_next(parser->lexer);
 
         if(filename_token->type != TOKEN_LITERAL_STRING) {
@@ -61,35 +89,16 @@ parse_directive(Light_Parser* parser, Light_Scope* scope, u32* error) {
         }
 
         // Directive #import "filename"
-        const char* current_filepath_absolute = parser->lexer->filepath_absolute;
-
-        char* full_imported_filepath = light_filepath_relative_to(
-            (char*)filename_token->data + 1, filename_token->length - 2, 
-            current_filepath_absolute);
-
-        if(!full_imported_filepath) {
-            // TODO(psv): maybe to not fatal here
-            *error |= parser_error_fatal(parser, filename_token, "Could not import %.*s: file not found\n", TOKEN_STR(filename_token));
-            ReturnIfError();
-        }
-
-        string src_str = {0};
-        src_str.data = full_imported_filepath;
-        src_str.length = strlen(full_imported_filepath);
-
-        int index = 0;
-        if(!string_table_entry_exist(&parser->parse_queue, src_str, &index, 0)) 
-        {
-            string_table_add(&parser->parse_queue, src_str, &index);
-            array_push(parser->parse_queue_array, src_str);
-        }
-    } else if(tag->type == TOKEN_IDENTIFIER && tag->data == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_EXTERN].data) {
+        *error |= parse_import(parser, filename_token);
+        ReturnIfError();
+        array_push(parser->unit->import_names, filename_token);
+    } else if(tag->type == TOKEN_IDENTIFIER && token_data(tag) == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_EXTERN].data) {
         // TODO(psv): Implement extern
         assert(0);        
     } else if(tag->type == TOKEN_IDENTIFIER) {
-        *error |= parser_error_fatal(parser, tag, "Unrecognized directive '%.*s'\n", tag->length, tag->data);
+        *error |= parser_error_fatal(parser, tag, "Unrecognized directive '%.*s'\n", tag->length, token_data(tag));
     } else if(tag->type != TOKEN_END_OF_STREAM) {
-        *error |= parser_error_fatal(parser, tag, "Expected directive identifier but got '%.*s'\n", tag->length, tag->data);
+        *error |= parser_error_fatal(parser, tag, "Expected directive identifier but got '%.*s'\n", tag->length, token_data(tag));
     } else {
         *error |= parser_error_fatal(parser, tag, "Unexpected end of file in directive declaration\n");
     }
@@ -578,7 +587,7 @@ parse_decl_procedure(Light_Parser* parser, Light_Token* name, Light_Scope* scope
         Light_Token* tag = lexer_next(lexer);
 
         // extern
-        if(tag->data == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_EXTERN].data) {
+        if(token_data(tag) == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_EXTERN].data) {
             flags |= DECL_PROC_FLAG_EXTERN;
             
             *error |= parser_require_and_eat(parser, '(');
@@ -663,33 +672,220 @@ parse_decl_variable(Light_Parser* parser, Light_Token* name, Light_Type* type, L
     return ast_new_decl_variable(scope, name, type, expr, STORAGE_CLASS_STACK, 0);
 }
 
+// Returns the unit of the file, it is queued to be parsed the first time it is seen.
+static Light_Parse_Unit*
+parse_queue_push(Light_Parse_Queue* queue, string filepath) {
+    Light_Parse_Unit* unit = 0;
+    s32 index = 0;
+
+    light_mutex_lock(&queue->mutex);
+    if(string_table_entry_exist(&queue->files, filepath, &index, 0)) {
+        unit = queue->units[string_table_get(&queue->files, index).value];
+    } else {
+        unit = light_alloc(sizeof(Light_Parse_Unit));
+        unit->filepath = filepath;
+        filepath.value = (u32)array_length(queue->units);
+        string_table_add(&queue->files, filepath, 0);
+        array_push(queue->units, unit);
+        light_condition_broadcast(&queue->condition);
+    }
+    light_mutex_unlock(&queue->mutex);
+
+    return unit;
+}
+
 static void
 parse_push_internal_file(Light_Parser* parser, const char* filepath, const char* compiler_path, u64 compiler_path_size) {
     // Find internal files based on compiler path
     uint64_t internal_file_size = 0;
     const char* internal_file = light_real_path_from(compiler_path, compiler_path_size, filepath, &internal_file_size);
     string ifile = {internal_file_size, 0, (char*)internal_file};
-    array_push(parser->parse_queue_array, ifile);
-    string_table_add(&parser->parse_queue, ifile, 0);
+    array_push(parser->queue->roots, parse_queue_push(parser->queue, ifile));
 }
 
 void
-parse_init(Light_Parser* parser, Light_Lexer* lexer, Light_Scope* global_scope, const char* compiler_path, u64 compiler_path_size, const char* main_file) {
+parse_push_root(Light_Parser* parser, const char* filepath) {
+    string file = {strlen(filepath), 0, (char*)filepath};
+    array_push(parser->queue->roots, parse_queue_push(parser->queue, file));
+}
+
+void
+parse_init(Light_Parser* parser, Light_Scope* global_scope, const char* compiler_path, u64 compiler_path_size, const char* main_file) {
+    parse_init_modules(parser, global_scope, compiler_path, compiler_path_size);
+    parse_push_root(parser, main_file);
+}
+
+// Queues the modules every program imports, without a main file yet.
+void
+parse_init_modules(Light_Parser* parser, Light_Scope* global_scope, const char* compiler_path, u64 compiler_path_size) {
     parser->scope_global = global_scope;
-    parser->lexer = lexer;
     parser->top_level = array_new_len(Light_Ast*, 1024);
 
     // Create hash table for files to parse
-    parser->parse_queue_array = array_new_len(string, 2048);
-    string_table_new(&parser->parse_queue, 1024 * 1024);
+    Light_Parse_Queue* queue = light_alloc(sizeof(Light_Parse_Queue));
+    light_mutex_init(&queue->mutex);
+    light_condition_init(&queue->condition);
+    queue->units = array_new_len(Light_Parse_Unit*, 2048);
+    queue->roots = array_new(Light_Parse_Unit*);
+    string_table_new(&queue->files, 64);
+    parser->queue = queue;
+
+    uint64_t modules_directory_size = 0;
+    queue->modules_directory = light_real_path_from(compiler_path, compiler_path_size, "/../modules", &modules_directory_size);
+    if(!queue->modules_directory) queue->modules_directory = "";
 
     // TODO(psv): error when this file is not found
     parse_push_internal_file(parser, "/../modules/base.li", compiler_path, compiler_path_size); // base must be first
     parse_push_internal_file(parser, "/../modules/reflect.li", compiler_path, compiler_path_size);
+}
+
+// Whether the file is in the modules directory of the compiler
+static bool
+parse_is_module(Light_Parse_Queue* queue, const char* filepath) {
+    size_t length = strlen(queue->modules_directory);
+    return length > 0 && strncmp(filepath, queue->modules_directory, length) == 0 &&
+        (filepath[length] == '/' || filepath[length] == '\\');
+}
+
+static void
+parse_unit(Light_Parser* parser, Light_Parse_Unit* unit) {
+    unit->top_level = array_new(Light_Ast*);
+    unit->imports = array_new(Light_Parse_Unit*);
+    unit->import_names = array_new(Light_Token*);
+    unit->nodes = array_new(Light_Ast*);
+    unit->scopes = array_new(Light_Scope*);
+    unit->types = array_new(Light_Type*);
+    parser->unit = unit;
+
+    ast_id_log_begin(&unit->nodes, &unit->scopes);
+    type_internalize_log_begin(&unit->types);
+
+    light_profile_begin("parse file", unit->filepath.data, (s32)unit->filepath.length);
+    double lexer_start = os_time_us();
+    bool opened = lexer_open_file(&unit->lexer, unit->filepath.data);
+    bool loaded = false;
+    if(opened) {
+        light_profile_begin("load image", 0, 0);
+        loaded = light_image_load(unit, parser->scope_global);
+        light_profile_end();
+    }
+
+    if(!opened) {
+        // File does not exist
+        unit->error |= PARSER_ERROR_FATAL;
+    } else if(loaded) {
+        parser->lexer = &unit->lexer;
+        for(u64 i = 0; i < array_length(unit->import_names) && !(unit->error & PARSER_ERROR_FATAL); ++i)
+            unit->error |= parse_import(parser, unit->import_names[i]);
+        unit->lexing_elapsed = (os_time_us() - lexer_start) / 1000.0;
+    } else {
+        light_profile_begin("lex", 0, 0);
+        lexer_tokenize(&unit->lexer, 0);
+        light_profile_end();
+        unit->lexing_elapsed = (os_time_us() - lexer_start) / 1000.0;
+        parse_top_level(parser, &unit->lexer, parser->scope_global, &unit->error);
+
+        // The standard modules rarely change, keep them parsed when asked to
+        if(parser->queue->write_images && !(unit->error & PARSER_ERROR_FATAL) && parse_is_module(parser->queue, unit->filepath.data)) {
+            light_profile_begin("write image", 0, 0);
+            light_image_write(unit, parser->scope_global);
+            light_profile_end();
+        }
+    }
+    light_profile_end();
+
+    type_internalize_log_end();
+    ast_id_log_end();
+    parser->unit = 0;
+}
+
+static void
+parse_worker(void* arg, s32 worker_index) {
+    Light_Parse_Queue* queue = ((Light_Parser*)arg)->queue;
+    Light_Parser parser = *(Light_Parser*)arg;
+
+    light_mutex_lock(&queue->mutex);
+    while(!(queue->error & PARSER_ERROR_FATAL)) {
+        if(queue->next < (s32)array_length(queue->units)) {
+            Light_Parse_Unit* unit = queue->units[queue->next++];
+            queue->active++;
+            light_mutex_unlock(&queue->mutex);
+
+            parse_unit(&parser, unit);
+
+            light_mutex_lock(&queue->mutex);
+            queue->active--;
+            queue->error |= unit->error;
+            light_condition_broadcast(&queue->condition);
+        } else if(queue->active > 0) {
+            // Files being parsed may still import new ones
+            light_condition_wait(&queue->condition, &queue->mutex);
+        } else {
+            break;
+        }
+    }
+    light_mutex_unlock(&queue->mutex);
+}
+
+// Parses what is queued so far without merging it, a later parse_files only
+// parses the files queued after this and merges everything in order.
+void
+parse_preload(Light_Parser* parser, s32 thread_count, u32* error) {
+    u64 types_start = array_length(global_type_array);
+    light_threads_run(thread_count, parse_worker, parser);
+    *error |= parser->queue->error;
 
-    string mf = {strlen(main_file), 0, (char*)main_file};
-    array_push(parser->parse_queue_array, mf);
-    string_table_add(&parser->parse_queue, mf, 0);
+    // parse_files rebuilds the type array in merge order
+    type_array_truncate(types_start);
+}
+
+// Parses every file in the queue, and the files they import, using thread_count threads.
+// The result is merged in the same order the files would be parsed one after the
+// other, so node ids and the type array do not depend on the scheduling.
+Light_Ast**
+parse_files(Light_Parser* parser, s32 thread_count, u32* error) {
+    Light_Parse_Queue* queue = parser->queue;
+    u64 types_start = array_length(global_type_array);
+
+    light_threads_run(thread_count, parse_worker, parser);
+
+    *error |= queue->error;
+    if(*error & PARSER_ERROR_FATAL)
+        return 0;
+
+    type_array_truncate(types_start);
+
+    Light_Parse_Unit** pending = array_new(Light_Parse_Unit*);
+    for(u64 i = 0; i < array_length(queue->roots); ++i) {
+        if(queue->roots[i]->merged) continue;
+        queue->roots[i]->merged = true;
+        array_push(pending, queue->roots[i]);
+    }
+    while(array_length(pending) > 0) {
+        Light_Parse_Unit* unit = pending[0];
+        for(u64 i = 0; i < array_length(unit->imports); ++i) {
+            if(!unit->imports[i]->merged) {
+                unit->imports[i]->merged = true;
+                array_push(pending, unit->imports[i]);
+            }
+        }
+
+        ast_id_rebase(unit->nodes, unit->scopes);
+        type_array_replay(unit->types);
+        for(u64 i = 0; i < array_length(unit->top_level); ++i) {
+            array_push(parser->top_level, unit->top_level[i]);
+        }
+        parser->scope_global->decl_count += unit->decl_count;
+        parser->lexing_elapsed += unit->lexing_elapsed;
+
+        array_free(unit->nodes);
+        array_free(unit->scopes);
+        array_free(unit->types);
+        array_remove(pending, 0);
+    }
+    array_free(pending);
+
+    return parser->top_level;
 }
 
 Light_Ast** 
@@ -710,15 +906,15 @@ parse_top_level(Light_Parser* parser, Light_Lexer* lexer, Light_Scope* global_sc
             case '#':{
                 Light_Ast* directive = parse_directive(parser, global_scope, error);
                 if(directive) {
-                    array_push(parser->top_level, directive);
+                    array_push(parser->unit->top_level, directive);
                 }
             }break;
             case TOKEN_IDENTIFIER:{
                 Light_Ast* decl = parse_declaration(parser, global_scope, true, error);
                 if(*error & PARSER_ERROR_FATAL) break;
                 if(decl) {
-                    array_push(parser->top_level, decl);
-                    global_scope->decl_count++;
+                    array_push(parser->unit->top_level, decl);
+                    parser->unit->decl_count++;
                 }
             }break;
             default:{
@@ -727,7 +923,7 @@ parse_top_level(Light_Parser* parser, Light_Lexer* lexer, Light_Scope* global_sc
         }
     }
 
-    return parser->top_level;
+    return parser->unit->top_level;
 }
 
 Light_Ast*
@@ -872,18 +1068,17 @@ Light_Ast* parse_expr_literal(Light_Parser* parser, Light_Scope* scope, u32* err
             // string -> struct { u64 length, u64 capacity, u8* data }
             // Create a token for the string
             Light_Token* string_token = light_alloc(sizeof(Light_Token));
-            string_token->line = first->line;
-            string_token->column = first->column;
-            string_token->filepath = first->filepath;
+            string_token->file_id = first->file_id;
+            string_token->offset = first->offset;
             string_token->flags = first->flags;
             string_token->type = TOKEN_IDENTIFIER;
-            string_token->data = (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_STRING].data;
+            string_token->ident = light_intern_id(light_special_idents_table[LIGHT_SPECIAL_IDENT_STRING].data);
             string_token->length = light_special_idents_table[LIGHT_SPECIAL_IDENT_STRING].length;
 
             Light_Ast* arr = ast_new_expr_literal_array(scope, first, 0);
             arr->expr_literal_array.raw_data = true;
             arr->expr_literal_array.array_strong_type = 0;
-            arr->expr_literal_array.data = first->data;
+            arr->expr_literal_array.data = token_data(first);
             arr->expr_literal_array.data_length_bytes = (u64)first->length;
 
             Light_Ast* cast = ast_new_expr_unary(scope, arr, string_token, OP_UNARY_CAST);
@@ -1029,15 +1224,15 @@ parse_expr_directive(Light_Parser* parser, Light_Scope* scope, u32* error) {
         return 0;
     }
 
-    if(directive->data == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_TYPEOF].data) {
+    if(token_data(directive) == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_TYPEOF].data) {
         Light_Ast* expression = parse_expression(parser, scope, error);
         ReturnIfError();
         return ast_new_expr_directive(scope, EXPR_DIRECTIVE_TYPEOF, directive, expression, 0);
-    } else if(directive->data == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_TYPEVALUE].data) {
+    } else if(token_data(directive) == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_TYPEVALUE].data) {
         Light_Type* type = parse_type(parser, scope, error);
         ReturnIfError();
         return ast_new_expr_directive(scope, EXPR_DIRECTIVE_TYPEVALUE, directive, 0, type);
-    } else if(directive->data == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_SIZEOF].data) {
+    } else if(token_data(directive) == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_SIZEOF].data) {
         // can't have optional parantheses because of functional types
         Light_Type* type = parse_type(parser, scope, error);
         ReturnIfError();
@@ -1515,7 +1710,7 @@ parse_directive_typeof(Light_Parser* parser, Light_Scope* scope, u32* error) {
     ReturnIfError();
 
     Light_Token* directive = lexer_next(parser->lexer);
-    if(directive->type != TOKEN_IDENTIFIER || directive->data != (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_TYPEOF].data) {
+    if(directive->type != TOKEN_IDENTIFIER || token_data(directive) != (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_TYPEOF].data) {
         *error |= parser_error_fatal(parser, directive, "expected 'type_of' but got '%.*s'\n", TOKEN_STR(directive));
         return 0;
     }
@@ -1,7 +1,9 @@
+#pragma once
 #include <common.h>
 #include "ast.h"
 #include "lexer.h"
 #include "utils/catstring.h"
+#include "utils/thread.h"
 
 typedef enum {
     PARSER_OK            = 0,
@@ -9,19 +11,58 @@ typedef enum {
     PARSER_ERROR_WARNING = (1 << 1),
 } Light_Parser_Error;
 
+// A single file of the parse queue, lexed and parsed by one thread.
+typedef struct Light_Parse_Unit_t {
+    string       filepath;
+    Light_Lexer  lexer;
+
+    Light_Ast**  top_level;
+    s32          decl_count;
+    u32          error;
+
+    struct Light_Parse_Unit_t** imports; // every #import in source order
+    Light_Token** import_names;          // filename token of every #import
+    Light_Ast**  nodes;                  // nodes created, ids are rebased on merge
+    Light_Scope** scopes;                // scopes created, ids are rebased on merge
+    Light_Type** types;                  // types internalized, in order
+    bool         merged;
+
+    double       lexing_elapsed;
+} Light_Parse_Unit;
+
+typedef struct {
+    Light_Mutex        mutex;
+    Light_Condition    condition;
+
+    String_Table       files;   // value is the index in units
+    Light_Parse_Unit** units;
+    Light_Parse_Unit** roots;   // merged first, in this order
+    const char*        modules_directory; // module images are only written here
+    bool               write_images;      // write images of the modules parsed, see image.h
+    s32                next;    // next unit to be parsed
+    s32                active;  // units being parsed right now
+    u32                error;
+} Light_Parse_Queue;
+
 typedef struct Light_Parser_t{
     Light_Lexer* lexer;
     Light_Scope* scope_global;
 
     Light_Ast**  top_level;
 
-    String_Table parse_queue;
-    string*      parse_queue_array;
+    Light_Parse_Unit*  unit;
+    Light_Parse_Queue* queue;
+
+    double       lexing_elapsed;
 } Light_Parser;
 
 // General
 Light_Ast** parse_top_level(Light_Parser* parser, Light_Lexer* lexer, Light_Scope* global_scope, u32* error);
-void        parse_init(Light_Parser* parser, Light_Lexer* lexer, Light_Scope* global_scope, const char* compiler_path, u64 compiler_path_size, const char* main_file);
+void        parse_init(Light_Parser* parser, Light_Scope* global_scope, const char* compiler_path, u64 compiler_path_size, const char* main_file);
+void        parse_init_modules(Light_Parser* parser, Light_Scope* global_scope, const char* compiler_path, u64 compiler_path_size);
+void        parse_push_root(Light_Parser* parser, const char* filepath);
+void        parse_preload(Light_Parser* parser, s32 thread_count, u32* error);
+Light_Ast** parse_files(Light_Parser* parser, s32 thread_count, u32* error);
 
 // Type
 Light_Type* parse_type(Light_Parser* parser, Light_Scope* scope, u32* error);
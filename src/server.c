@@ -0,0 +1,223 @@
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LIGHT_SERVER_TRAILER "light-server: "
+#define LIGHT_SERVER_MAX_ARGS 64
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static bool
+socket_address(struct sockaddr_un* address, const char* socket_path) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "socket path is too long: %s\n", socket_path);
+        return false;
+    }
+    strcpy(address->sun_path, socket_path);
+    return true;
+}
+
+static bool
+write_all(int fd, const char* data, size_t size) {
+    while(size > 0) {
+        ssize_t written = write(fd, data, size);
+        if(written < 0 && errno == EINTR) continue;
+        if(written <= 0) return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Reads lines until an empty one, lines point into request once split.
+static s32
+read_request(int fd, catstring* request, char** lines, s32 max_lines) {
+    char c = 0;
+    catstring byte = {1, 1, &c};
+    while(request->length < 2 || request->data[request->length - 1] != '\n' || request->data[request->length - 2] != '\n') {
+        if(read(fd, &c, 1) != 1) return -1;
+        catstring_append(request, &byte);
+    }
+
+    s32 count = 0;
+    for(char* at = request->data; *at != '\n';) {
+        if(count == max_lines) return -1;
+        lines[count++] = at;
+        at = strchr(at, '\n');
+        *at++ = 0;
+    }
+    return count;
+}
+
+static void
+serve_request(int client, Light_Server_Compile compile, void* data) {
+    catstring request = {0};
+    char* lines[LIGHT_SERVER_MAX_ARGS + 1] = {0};
+    s32 count = read_request(client, &request, lines, LIGHT_SERVER_MAX_ARGS);
+
+    int exit_code = 1;
+    catstring output = {0};
+    catsprint(&output, "\0");
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(client, STDOUT_FILENO);
+    dup2(client, STDERR_FILENO);
+
+    if(count < 1) {
+        fprintf(stderr, "light-server: invalid request\n");
+    } else if(chdir(lines[0]) != 0) {
+        fprintf(stderr, "light-server: could not change to directory %s\n", lines[0]);
+    } else {
+        // lines[0] takes the place of the program name
+        exit_code = compile(count, lines, &output, data);
+    }
+
+    fflush(stderr);
+    printf(LIGHT_SERVER_TRAILER "exit=%d output=%s\n", exit_code, output.data);
+    fflush(stdout);
+}
+
+int
+light_server_listen(const char* socket_path, Light_Server_Compile compile, void* data) {
+    struct sockaddr_un address;
+    if(!socket_address(&address, socket_path)) return 1;
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(server < 0) {
+        fprintf(stderr, "could not create socket: %s\n", strerror(errno));
+        return 1;
+    }
+    unlink(socket_path);
+    if(bind(server, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(server, 16) != 0) {
+        fprintf(stderr, "could not listen on %s: %s\n", socket_path, strerror(errno));
+        close(server);
+        return 1;
+    }
+
+    // Children are never waited for
+    signal(SIGCHLD, SIG_IGN);
+    printf("light-server: listening on %s\n", socket_path);
+    fflush(stdout);
+
+    while(true) {
+        int client = accept(server, 0, 0);
+        if(client < 0) {
+            if(errno == EINTR) continue;
+            fprintf(stderr, "accept failed: %s\n", strerror(errno));
+            break;
+        }
+
+        pid_t pid = fork();
+        if(pid == 0) {
+            // The build waits for gcc
+            signal(SIGCHLD, SIG_DFL);
+            close(server);
+            serve_request(client, compile, data);
+            close(client);
+            _exit(0);
+        } else if(pid < 0) {
+            fprintf(stderr, "fork failed: %s\n", strerror(errno));
+        }
+        close(client);
+    }
+
+    close(server);
+    unlink(socket_path);
+    return 1;
+}
+
+int
+light_server_connect(const char* socket_path, int argc, char** argv) {
+    struct sockaddr_un address;
+    if(!socket_address(&address, socket_path)) return 1;
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(server < 0 || connect(server, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "could not connect to %s: %s\n", socket_path, strerror(errno));
+        if(server >= 0) close(server);
+        return 1;
+    }
+
+    char cwd[4096] = {0};
+    if(!getcwd(cwd, sizeof(cwd))) {
+        fprintf(stderr, "could not get the current directory\n");
+        close(server);
+        return 1;
+    }
+
+    catstring request = {0};
+    catsprint(&request, "%s\n", cwd);
+    for(int i = 0; i < argc; ++i)
+        catsprint(&request, "%s\n", argv[i]);
+    catsprint(&request, "\n");
+    bool sent = write_all(server, request.data, request.length);
+    catstring_free(&request);
+    if(!sent) {
+        fprintf(stderr, "could not send the request to %s\n", socket_path);
+        close(server);
+        return 1;
+    }
+
+    // Relay every line, except the trailer which carries the exit code and
+    // the path of the executable, printed last on stderr
+    int exit_code = 1;
+    catstring output = {0};
+    catstring line = {0};
+    catstring byte = {1, 1, 0};
+    char buffer[4096];
+    ssize_t size = 0;
+    while((size = read(server, buffer, sizeof(buffer))) > 0 || (size < 0 && errno == EINTR)) {
+        for(ssize_t i = 0; i < size; ++i) {
+            byte.data = buffer + i;
+            catstring_append(&line, &byte);
+            if(buffer[i] != '\n') continue;
+
+            size_t prefix = sizeof(LIGHT_SERVER_TRAILER) - 1;
+            if(line.length > prefix + 5 && strncmp(line.data, LIGHT_SERVER_TRAILER "exit=", prefix + 5) == 0) {
+                exit_code = atoi(line.data + prefix + 5);
+                char* path = strstr(line.data, " output=");
+                if(path && line.data + line.length - 1 > path + 8) {
+                    output.length = 0;
+                    catsprint(&output, "%s+", (int)(line.data + line.length - 1 - (path + 8)), path + 8);
+                }
+            } else {
+                fwrite(line.data, 1, line.length, stdout);
+            }
+            line.length = 0;
+        }
+    }
+    fwrite(line.data, 1, line.length, stdout);
+    fflush(stdout);
+    if(output.length > 0)
+        fprintf(stderr, "output: %.*s\n", (int)output.length, output.data);
+    catstring_free(&output);
+    catstring_free(&line);
+    close(server);
+
+    return exit_code;
+}
+
+#else
+
+int
+light_server_listen(const char* socket_path, Light_Server_Compile compile, void* data) {
+    fprintf(stderr, "the compile server is not supported on this platform\n");
+    return 1;
+}
+
+int
+light_server_connect(const char* socket_path, int argc, char** argv) {
+    fprintf(stderr, "the compile server is not supported on this platform\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+#include "utils/catstring.h"
+
+// Compile server, keeps the standard modules parsed between builds.
+//
+// A request is the working directory of the client followed by its
+// command line arguments, one per line and ended by an empty line. The
+// server replies with everything the compiler prints and a last line
+// "light-server: exit=<code> output=<path>".
+//
+// Every request is compiled in a forked child, so whatever a build
+// changes is dropped with it and the server only keeps what was
+// loaded before the first request.
+
+// Builds argv in the current directory, returns the exit code and the
+// path of the executable in output.
+typedef int (*Light_Server_Compile)(int argc, char** argv, catstring* output, void* data);
+
+int light_server_listen(const char* socket_path, Light_Server_Compile compile, void* data);
+// Sends argv to the server and relays its reply, then prints the path of
+// the executable on stderr. Returns the exit code of the build.
+int light_server_connect(const char* socket_path, int argc, char** argv);
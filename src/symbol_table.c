@@ -1,12 +1,13 @@
 #include "symbol_table.h"
 #include "utils/allocator.h"
+#include "utils/intern.h"
 
 u64 symbol_hash(Light_Symbol s) {
-    return fnv_1_hash(s.token->data, s.token->length);
+    return light_intern_hash(token_data(s.token));
 }
 
 int symbol_equal(Light_Symbol s1, Light_Symbol s2) {
-    return s1.token->data == s2.token->data;
+    return s1.token->ident == s2.token->ident;
 }
 
 GENERATE_HASH_TABLE_IMPLEMENTATION(Symbol, symbol, Light_Symbol, symbol_hash, light_alloc, light_free, symbol_equal)
\ No newline at end of file
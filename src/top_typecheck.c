@@ -3,19 +3,52 @@
 #include "type.h"
 #include "type_infer.h"
 #include "utils/allocator.h"
+#include "utils/thread.h"
+#include "utils/os.h"
+#include "utils/profile.h"
 #include "global_tables.h"
 #include "eval.h"
 #include "error.h"
 #include <light_array.h>
 #include <assert.h>
+#include <stdlib.h>
 
-#define TOKEN_STR(T) (T)->length, (T)->data
+#define TOKEN_STR(T) (T)->length, token_data(T)
 #define MAX(A, B) (((A) > (B)) ? (A) : (B))
 #define MIN(A, B) (((A) < (B)) ? (A) : (B))
 
 void typecheck_information_pass_decl(Light_Ast* node, u32 flags, u32* error);
 void typecheck_information_pass_command(Light_Ast* node, u32 flags, u32* error);
 
+// Dependency graph of the infer queue. A node that could not be inferred
+// waits on the declaration it was blocked on and only runs again once
+// that declaration leaves the queue. infer_dependencies is kept parallel
+// to global_infer_queue, node ids are not unique while procedure bodies
+// are checked in parallel.
+typedef struct {
+    Light_Ast** waiters;    // nodes to run again when this one resolves
+    Light_Ast*  blocked_on; // last declaration this node waited on
+} Light_Infer_Dependency;
+
+static light_thread_local Light_Infer_Dependency* infer_dependencies;
+static light_thread_local Light_Ast**             infer_worklist;
+
+// Top level procedure bodies are left for the parallel phase
+static bool typecheck_bodies_deferred;
+
+static bool
+typecheck_in_infer_queue(Light_Ast* node) {
+    return (node->flags & AST_FLAG_INFER_QUEUED) &&
+        node->infer_queue_index < (s32)array_length(global_infer_queue) &&
+        global_infer_queue[node->infer_queue_index] == node;
+}
+
+static Light_Ast*
+typecheck_blocked_on(Light_Ast* node) {
+    if(!typecheck_in_infer_queue(node)) return 0;
+    return infer_dependencies[node->infer_queue_index].blocked_on;
+}
+
 static bool
 typecheck_push_to_infer_queue(Light_Ast* node) {
     if(node->flags & AST_FLAG_INFER_QUEUED)
@@ -23,6 +56,9 @@ typecheck_push_to_infer_queue(Light_Ast* node) {
     array_push(global_infer_queue, node);
     node->flags |= AST_FLAG_INFER_QUEUED;
     node->infer_queue_index = array_length(global_infer_queue) - 1;
+
+    Light_Infer_Dependency empty = {0};
+    array_push(infer_dependencies, empty);
     return true;
 }
 
@@ -31,6 +67,15 @@ typecheck_remove_from_infer_queue(Light_Ast* node) {
     if(!(node->flags & AST_FLAG_INFER_QUEUED))
         return false; // not in infer queue
 
+    // Everything waiting on this node can run again
+    Light_Infer_Dependency* dep = &infer_dependencies[node->infer_queue_index];
+    if(dep->waiters) {
+        for(u64 i = 0; i < array_length(dep->waiters); ++i)
+            array_push(infer_worklist, dep->waiters[i]);
+        array_free(dep->waiters);
+    }
+    array_remove(infer_dependencies, node->infer_queue_index);
+
     global_infer_queue[array_length(global_infer_queue) - 1]->infer_queue_index = node->infer_queue_index;
     array_remove(global_infer_queue, node->infer_queue_index);
     node->flags &= ~(AST_FLAG_INFER_QUEUED);
@@ -38,6 +83,73 @@ typecheck_remove_from_infer_queue(Light_Ast* node) {
     return true;
 }
 
+// Runs a queued node and, if it stays queued, makes it wait on whatever
+// blocked it. Nodes blocked on something that is not queued are left for
+// the next full pass over the queue.
+static void
+typecheck_infer_run(Light_Ast* node, u32* error) {
+    type_infer_blocking_take();
+    typecheck_information_pass_decl(node, 0, error);
+    Light_Ast* blocker = type_infer_blocking_take();
+
+    if(*error & TYPE_ERROR) return;
+    if(!typecheck_in_infer_queue(node)) return;
+
+    infer_dependencies[node->infer_queue_index].blocked_on = blocker;
+    if(blocker && blocker != node && typecheck_in_infer_queue(blocker)) {
+        Light_Infer_Dependency* dep = &infer_dependencies[blocker->infer_queue_index];
+        if(!dep->waiters) dep->waiters = array_new(Light_Ast*);
+        array_push(dep->waiters, node);
+    }
+}
+
+static Light_Token*
+typecheck_decl_name(Light_Ast* node) {
+    switch(node->kind) {
+        case AST_DECL_PROCEDURE: return node->decl_proc.name;
+        case AST_DECL_CONSTANT:  return node->decl_constant.name;
+        case AST_DECL_VARIABLE:  return node->decl_variable.name;
+        case AST_DECL_TYPEDEF:   return node->decl_typedef.name;
+        default: return 0;
+    }
+}
+
+// Follows the declarations the remaining nodes wait on until one repeats
+// and reports that chain as the cycle.
+static void
+typecheck_report_cycle(u32* error) {
+    type_error(error, 0, "circular dependencies\n");
+
+    for(u64 i = 0; i < array_length(global_infer_queue); ++i) {
+        Light_Ast* start = global_infer_queue[i];
+        if(!typecheck_decl_name(start)) continue;
+
+        // Walk twice the chain length at most, anything longer has no cycle
+        Light_Ast* slow = start;
+        Light_Ast* fast = start;
+        bool found = false;
+        while(true) {
+            Light_Ast* next = typecheck_blocked_on(fast);
+            if(!next || !typecheck_decl_name(next)) break;
+            fast = typecheck_blocked_on(next);
+            if(!fast || !typecheck_decl_name(fast)) break;
+            slow = typecheck_blocked_on(slow);
+            if(slow == fast) { found = true; break; }
+        }
+        if(!found) continue;
+
+        Light_Ast* at = slow;
+        do {
+            Light_Token* name = typecheck_decl_name(at);
+            fprintf(TYPE_ERROR_STREAM, "  - ");
+            type_error_location(name);
+            fprintf(TYPE_ERROR_STREAM, "'%.*s' depends on '%.*s'\n", TOKEN_STR(name), TOKEN_STR(typecheck_decl_name(typecheck_blocked_on(at))));
+            at = typecheck_blocked_on(at);
+        } while(at != slow);
+        return;
+    }
+}
+
 static Light_Ast* 
 typecheck_decl_proc_from_scope(Light_Scope* scope) {
     while(scope) {
@@ -78,10 +190,10 @@ decl_check_redefinition(Light_Scope* scope, Light_Ast* node, Light_Token* token)
         Light_Symbol decl_symbol = symbol_table_get(symbol_table, index);
         if(decl_symbol.decl == node) return TYPE_OK;
         type_error_location(token);
-        fprintf(stderr, "Type error: redeclaration of name '%.*s'\n", TOKEN_STR(token));
-        fprintf(stderr, "  - previously declared at: ");
+        fprintf(TYPE_ERROR_STREAM, "Type error: redeclaration of name '%.*s'\n", TOKEN_STR(token));
+        fprintf(TYPE_ERROR_STREAM, "  - previously declared at: ");
         type_error_location(decl_symbol.token);
-        fprintf(stderr, "\n");
+        fprintf(TYPE_ERROR_STREAM, "\n");
         return TYPE_ERROR;
     } else {
         symbol_table_add(symbol_table, s, 0);
@@ -90,14 +202,135 @@ decl_check_redefinition(Light_Scope* scope, Light_Ast* node, Light_Token* token)
     return TYPE_OK;
 }
 
+// Run every queued node once to learn what it waits on, then only
+// run the nodes whose dependency resolved. Nodes blocked for a reason
+// that is not tracked get another pass when the worklist runs dry, if
+// that pass resolves nothing the remaining nodes are in a cycle.
+static void
+typecheck_infer_queue_resolve(u32* error) {
+    infer_worklist = array_new(Light_Ast*);
+    Light_Ast** pass = array_new(Light_Ast*);
+
+    while(array_length(global_infer_queue) > 0 && !(*error & TYPE_ERROR)) {
+        if(array_length(infer_worklist) > 0) {
+            // Nodes are pushed here as their dependencies resolve, running them may push more
+            for(u64 i = 0; i < array_length(infer_worklist) && !(*error & TYPE_ERROR); ++i) {
+                if(infer_worklist[i]->flags & AST_FLAG_INFER_QUEUED)
+                    typecheck_infer_run(infer_worklist[i], error);
+            }
+            array_length(infer_worklist) = 0;
+            continue;
+        }
+
+        // Worklist is dry, run every node still queued
+        u64 queue_length = array_length(global_infer_queue);
+        array_length(pass) = 0;
+        for(u64 i = 0; i < queue_length; ++i)
+            array_push(pass, global_infer_queue[i]);
+
+        for(u64 i = 0; i < array_length(pass) && !(*error & TYPE_ERROR); ++i) {
+            if(pass[i]->flags & AST_FLAG_INFER_QUEUED)
+                typecheck_infer_run(pass[i], error);
+        }
+        if(*error & TYPE_ERROR)
+            break;
+
+        if(array_length(global_infer_queue) >= queue_length && array_length(infer_worklist) == 0) {
+            typecheck_report_cycle(error);
+            break;
+        }
+    }
+
+    array_free(infer_worklist);
+    array_free(pass);
+    infer_worklist = 0;
+}
+
+static void
+typecheck_infer_dependencies_free() {
+    for(u64 i = 0; i < array_length(infer_dependencies); ++i) {
+        if(infer_dependencies[i].waiters) array_free(infer_dependencies[i].waiters);
+    }
+    array_free(infer_dependencies);
+    infer_dependencies = 0;
+}
+
+// A top level procedure body checked on its own, with its own infer queue.
+// New nodes and types are logged so they can be merged in declaration
+// order, errors are buffered and printed in that same order.
+typedef struct {
+    Light_Ast*    proc;
+    u32           error;
+    Light_Ast**   nodes;
+    Light_Scope** scopes;
+    Light_Type**  types;
+    char*         errors;
+    size_t        errors_size;
+} Light_Typecheck_Body;
+
+typedef struct {
+    Light_Typecheck_Body* bodies;
+    volatile s32          next;
+} Light_Typecheck_Bodies;
+
+static void
+typecheck_body(Light_Typecheck_Body* body) {
+    Light_Token* name = body->proc->decl_proc.name;
+    light_profile_begin("type check procedure", (const char*)token_data(name), name->length);
+
+    Light_Ast** queue = global_infer_queue;
+    global_infer_queue = array_new(Light_Ast*);
+    infer_dependencies = array_new(Light_Infer_Dependency);
+
+    body->nodes = array_new(Light_Ast*);
+    body->scopes = array_new(Light_Scope*);
+    body->types = array_new(Light_Type*);
+    ast_id_log_begin(&body->nodes, &body->scopes);
+    type_internalize_log_begin(&body->types);
+
+    Light_Memory_Stream stream = {0};
+    bool buffered = light_memory_stream_open(&stream);
+    if(buffered) type_error_stream = stream.file;
+
+    typecheck_information_pass_command(body->proc->decl_proc.body, 0, &body->error);
+    if(!(body->error & TYPE_ERROR))
+        typecheck_infer_queue_resolve(&body->error);
+
+    if(buffered) {
+        type_error_stream = 0;
+        light_memory_stream_close(&stream);
+        body->errors = stream.data;
+        body->errors_size = stream.size_bytes;
+    }
+
+    type_internalize_log_end();
+    ast_id_log_end();
+
+    typecheck_infer_dependencies_free();
+    array_free(global_infer_queue);
+    global_infer_queue = queue;
+
+    light_profile_end();
+}
+
+static void
+typecheck_body_worker(void* arg, s32 worker_index) {
+    Light_Typecheck_Bodies* bodies = (Light_Typecheck_Bodies*)arg;
+    while(true) {
+        s32 index = light_atomic_add(&bodies->next, 1);
+        if(index >= (s32)array_length(bodies->bodies)) break;
+        typecheck_body(&bodies->bodies[index]);
+    }
+}
+
 Light_Type_Error 
-top_typecheck(Light_Ast** top_level, Light_Scope* global_scope) {
+top_typecheck(Light_Ast** top_level, Light_Scope* global_scope, s32 thread_count) {
     Light_Type_Error error = TYPE_OK;
 
     if(!top_level) return error;
 
     global_scope->symb_table = light_alloc(sizeof(Symbol_Table));
-    symbol_table_new((Symbol_Table*)global_scope->symb_table, (global_scope->decl_count + 4) * 8);
+    symbol_table_new((Symbol_Table*)global_scope->symb_table, (global_scope->decl_count + 4) * 2);
 
     // Check redefinition at top level
     for(u64 i = 0; i < array_length(top_level); ++i) {
@@ -119,33 +352,53 @@ top_typecheck(Light_Ast** top_level, Light_Scope* global_scope) {
         }
     }
 
-    // All symbols are loaded, perform normal typecheck
+    // All symbols are loaded, perform normal typecheck. Top level procedure
+    // bodies are left out, nothing outside of them can depend on them.
+    infer_dependencies = array_new(Light_Infer_Dependency);
+    typecheck_bodies_deferred = true;
     for(u64 i = 0; i < array_length(top_level); ++i) {
         Light_Ast* node = top_level[i];
         typecheck_information_pass_decl(node, 0, (u32*)&error);
     }
+    if(!(error & TYPE_ERROR))
+        typecheck_infer_queue_resolve((u32*)&error);
+    typecheck_bodies_deferred = false;
+    typecheck_infer_dependencies_free();
+
     if(error & TYPE_ERROR)
         return error;
 
-    // Try to resolve everything in the infer table while
-    // the table is shrinking
-    u64 starting_length = array_length(global_infer_queue);
-    while(starting_length > 0) {
-        for(u64 i = 0; i < array_length(global_infer_queue); ++i) {
-            Light_Ast* node = global_infer_queue[i];
-            typecheck_information_pass_decl(node, 0, (u32*)&error);
-            if(error & TYPE_ERROR) break;
+    // Every declaration is resolved, check the bodies in parallel
+    Light_Typecheck_Bodies bodies = {0};
+    bodies.bodies = array_new(Light_Typecheck_Body);
+    for(u64 i = 0; i < array_length(top_level); ++i) {
+        Light_Ast* node = top_level[i];
+        if(node->kind == AST_DECL_PROCEDURE && node->decl_proc.body) {
+            Light_Typecheck_Body body = {0};
+            body.proc = node;
+            array_push(bodies.bodies, body);
         }
+    }
 
-        if(error & TYPE_ERROR)
-            break;
-
-        if(array_length(global_infer_queue) == starting_length) {
-            type_error((u32*)&error, 0, "circular dependencies\n");
-            break;
+    u64 types_start = array_length(global_type_array);
+    light_threads_run(thread_count, typecheck_body_worker, &bodies);
+    type_array_truncate(types_start);
+
+    for(u64 i = 0; i < array_length(bodies.bodies); ++i) {
+        Light_Typecheck_Body* body = &bodies.bodies[i];
+        ast_id_rebase(body->nodes, body->scopes);
+        type_array_replay(body->types);
+        if(body->errors) {
+            fwrite(body->errors, 1, body->errors_size, stderr);
+            free(body->errors);
         }
-        starting_length = array_length(global_infer_queue);
+        error |= body->error;
+
+        array_free(body->nodes);
+        array_free(body->scopes);
+        array_free(body->types);
     }
+    array_free(bodies.bodies);
 
     return error;
 }
@@ -181,7 +434,7 @@ typecheck_resolve_type_symbol_tables(Light_Type* type, u32 flags, u32* error) {
             Light_Scope* scope = type->struct_info.struct_scope;
             if(!scope->symb_table) {
                 scope->symb_table = light_alloc(sizeof(Symbol_Table));
-                symbol_table_new(scope->symb_table, (scope->decl_count + 4) * 8);
+                symbol_table_new(scope->symb_table, (scope->decl_count + 4) * 2);
             }
             for(s32 i = 0; i < type->struct_info.fields_count; ++i) {
                 *error |= decl_check_redefinition(scope, type->struct_info.fields[i], type->struct_info.fields[i]->decl_variable.name);
@@ -191,7 +444,7 @@ typecheck_resolve_type_symbol_tables(Light_Type* type, u32 flags, u32* error) {
             Light_Scope* scope = type->union_info.union_scope;
             if(!scope->symb_table) {
                 scope->symb_table = light_alloc(sizeof(Symbol_Table));
-                symbol_table_new(scope->symb_table, (scope->decl_count + 4) * 8);
+                symbol_table_new(scope->symb_table, (scope->decl_count + 4) * 2);
             }
             for(s32 i = 0; i < type->union_info.fields_count; ++i) {
                 *error |= decl_check_redefinition(scope, type->union_info.fields[i], type->union_info.fields[i]->decl_variable.name);
@@ -201,7 +454,7 @@ typecheck_resolve_type_symbol_tables(Light_Type* type, u32 flags, u32* error) {
             Light_Scope* scope = type->enumerator.enum_scope;
             if(!scope->symb_table) {
                 scope->symb_table = light_alloc(sizeof(Symbol_Table));
-                symbol_table_new(scope->symb_table, (scope->decl_count + 4) * 8);
+                symbol_table_new(scope->symb_table, (scope->decl_count + 4) * 2);
             }
             for(s32 i = 0; i < type->enumerator.field_count; ++i) {
                 Light_Ast* field = type->enumerator.fields[i];
@@ -286,13 +539,13 @@ typecheck_resolve_type(Light_Scope* scope, Light_Type* type, u32 flags, u32* err
             if(!type_primitive_int(dim_type)) {
                 type_error(error, type->array_info.token_array, "Type Error: Array dimension must be an integer type constant expression, given '");
                 ast_print_type(dim_type, LIGHT_AST_PRINT_STDERR, 0);
-                fprintf(stderr, "'\n");
+                fprintf(TYPE_ERROR_STREAM, "'\n");
                 return type;
             }
 
             // Array dimension must be constant
             if(!eval_expr_is_constant(type->array_info.const_expr, EVAL_ERROR_REPORT, error)) {
-                fprintf(stderr, "  could not resolve array type, dimension is not a constant integer\n");
+                fprintf(TYPE_ERROR_STREAM, "  could not resolve array type, dimension is not a constant integer\n");
                 return type;
             }
 
@@ -351,9 +604,9 @@ typecheck_resolve_type(Light_Scope* scope, Light_Type* type, u32 flags, u32* err
                             type_error(error, field->decl_variable.name, 
                                 "type mismatch in struct field declaration. '");
                             ast_print_type(field->decl_variable.assignment->type, LIGHT_AST_PRINT_STDERR, 0);
-                            fprintf(stderr, "' vs '");
+                            fprintf(TYPE_ERROR_STREAM, "' vs '");
                             ast_print_type(field_type, LIGHT_AST_PRINT_STDERR, 0);
-                            fprintf(stderr, "'\n");
+                            fprintf(TYPE_ERROR_STREAM, "'\n");
                             all_fields_internalized = false;
                         }
                     }
@@ -499,7 +752,7 @@ typecheck_resolve_type(Light_Scope* scope, Light_Type* type, u32 flags, u32* err
                                 "enumeration requires integer fields, but field '%.*s' evaluated to '", 
                                     TOKEN_STR(field_name));
                             ast_print_type(field_type, LIGHT_AST_PRINT_STDERR, 0);
-                            fprintf(stderr, "'\n");
+                            fprintf(TYPE_ERROR_STREAM, "'\n");
                             continue;
                         }
 
@@ -566,6 +819,7 @@ typecheck_resolve_type(Light_Scope* scope, Light_Type* type, u32 flags, u32* err
                     return type;
                 }
                 if(!(decl->decl_typedef.type_referenced->flags & TYPE_FLAG_INTERNALIZED)) {
+                    type_infer_blocked_on(decl);
                     return type;
                 }
                 type = decl->decl_typedef.type_referenced;
@@ -627,7 +881,7 @@ typecheck_information_pass_decl(Light_Ast* node, u32 flags, u32* decl_error) {
                 // Type check
                 if(node->decl_constant.type_info != type) {
                     type_error_mismatch(&error, node->decl_constant.name, node->decl_constant.type_info, type);
-                    fprintf(stderr, " in '%.*s' constant declaration\n", TOKEN_STR(node->decl_constant.name));
+                    fprintf(TYPE_ERROR_STREAM, " in '%.*s' constant declaration\n", TOKEN_STR(node->decl_constant.name));
                     *decl_error |= error;
                     return;
                 }
@@ -680,7 +934,7 @@ typecheck_information_pass_decl(Light_Ast* node, u32 flags, u32* decl_error) {
                     // Type check
                     if(!type_check_equality(node->decl_variable.type, type)) {
                         type_error_mismatch(&error, node->decl_variable.name, node->decl_variable.type, type);
-                        fprintf(stderr, " in '%.*s' variable declaration\n", TOKEN_STR(node->decl_variable.name));
+                        fprintf(TYPE_ERROR_STREAM, " in '%.*s' variable declaration\n", TOKEN_STR(node->decl_variable.name));
                         *decl_error |= error;
                         return;
                     }
@@ -710,7 +964,7 @@ typecheck_information_pass_decl(Light_Ast* node, u32 flags, u32* decl_error) {
                 Light_Scope* arg_scope = node->decl_proc.arguments_scope;
                 if(!arg_scope->symb_table) {
                     arg_scope->symb_table = light_alloc(sizeof(Symbol_Table));
-                    symbol_table_new(arg_scope->symb_table, (arg_scope->decl_count + 4) * 8);
+                    symbol_table_new(arg_scope->symb_table, (arg_scope->decl_count + 4) * 2);
                 }
                 for(s32 i = 0; i < node->decl_proc.argument_count; ++i) {
                     Light_Ast* var = node->decl_proc.arguments[i];
@@ -724,7 +978,7 @@ typecheck_information_pass_decl(Light_Ast* node, u32 flags, u32* decl_error) {
 
             node->decl_proc.proc_type = typecheck_resolve_type(scope, node->decl_proc.proc_type, flags, &error);
             if(error & TYPE_ERROR) { *decl_error |= error; return; }
-            if(node->decl_proc.body) {
+            if(node->decl_proc.body && !(typecheck_bodies_deferred && scope->level == 0)) {
                 typecheck_information_pass_command(node->decl_proc.body, flags, &error);
                 if(error & TYPE_ERROR) { *decl_error |= error; return; }
             }
@@ -734,7 +988,7 @@ typecheck_information_pass_decl(Light_Ast* node, u32 flags, u32* decl_error) {
                 node->decl_proc.return_type = node->decl_proc.proc_type->function.return_type;
                 typecheck_remove_from_infer_queue(node);
 
-                if(node->decl_proc.name->data == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_MAIN].data) {
+                if(token_data(node->decl_proc.name) == (u8*)light_special_idents_table[LIGHT_SPECIAL_IDENT_MAIN].data) {
                     node->decl_proc.flags |= DECL_PROC_FLAG_MAIN;
                 }
             }
@@ -777,7 +1031,7 @@ typecheck_information_pass_command(Light_Ast* node, u32 flags, u32* error) {
             if(!block_scope) return;
             if(!block_scope->symb_table && block_scope->decl_count > 0) {
                 block_scope->symb_table = light_alloc(sizeof(Symbol_Table));
-                symbol_table_new(block_scope->symb_table, (block_scope->decl_count + 4) * 8);
+                symbol_table_new(block_scope->symb_table, (block_scope->decl_count + 4) * 2);
             }
 
             for(s32 i = 0; i < node->comm_block.command_count; ++i) {
@@ -816,7 +1070,7 @@ typecheck_information_pass_command(Light_Ast* node, u32 flags, u32* error) {
             // Type check
             if(inferred_left && !type_check_equality(inferred_left, inferred_right)) {
                 type_error_mismatch(error, node->comm_assignment.op_token, inferred_left, inferred_right);
-                fprintf(stderr, " in assignment\n");
+                fprintf(TYPE_ERROR_STREAM, " in assignment\n");
                 return;
             }
 
@@ -840,7 +1094,7 @@ typecheck_information_pass_command(Light_Ast* node, u32 flags, u32* error) {
                 if(!type_primitive_int(type)) {
                     type_error(error, node->comm_break.token_break, "break expression must be of integer type, but got '\n");
                     ast_print_type(type, LIGHT_AST_PRINT_STDERR, 0);
-                    fprintf(stderr, "'\n");
+                    fprintf(TYPE_ERROR_STREAM, "'\n");
                     return;
                 }
 
@@ -884,7 +1138,7 @@ typecheck_information_pass_command(Light_Ast* node, u32 flags, u32* error) {
                 if(!type_primitive_int(type)) {
                     type_error(error, node->comm_continue.token_continue, "continue expression must be of integer type, but got '\n");
                     ast_print_type(type, LIGHT_AST_PRINT_STDERR, 0);
-                    fprintf(stderr, "'\n");
+                    fprintf(TYPE_ERROR_STREAM, "'\n");
                     return;
                 }
 
@@ -950,9 +1204,9 @@ typecheck_information_pass_command(Light_Ast* node, u32 flags, u32* error) {
                 type_error(error, node->comm_return.token_return, 
                     "procedure '%.*s' requires return type '", TOKEN_STR(decl_proc->decl_proc.name));
                 ast_print_type(decl_proc->decl_proc.proc_type->function.return_type, LIGHT_AST_PRINT_STDERR, 0);
-                fprintf(stderr, "', but got '");
+                fprintf(TYPE_ERROR_STREAM, "', but got '");
                 ast_print_type(expr_type, LIGHT_AST_PRINT_STDERR, 0);
-                fprintf(stderr, "'\n");
+                fprintf(TYPE_ERROR_STREAM, "'\n");
                 return;
             }
 
@@ -963,7 +1217,7 @@ typecheck_information_pass_command(Light_Ast* node, u32 flags, u32* error) {
             if(for_scope) {
                 if(!for_scope->symb_table && for_scope->decl_count > 0) {
                     for_scope->symb_table = light_alloc(sizeof(Symbol_Table));
-                    symbol_table_new(for_scope->symb_table, (for_scope->decl_count + 4) * 8);
+                    symbol_table_new(for_scope->symb_table, (for_scope->decl_count + 4) * 2);
                 }
             }
 
@@ -994,7 +1248,7 @@ typecheck_information_pass_command(Light_Ast* node, u32 flags, u32* error) {
                     type_error(error, node->comm_for.for_token, 
                         "for command requires boolean type condition, but got '");
                     ast_print_type(type, LIGHT_AST_PRINT_STDERR, 0);
-                    fprintf(stderr, "'\n");
+                    fprintf(TYPE_ERROR_STREAM, "'\n");
                     return;
                 }
             }
@@ -1022,7 +1276,7 @@ typecheck_information_pass_command(Light_Ast* node, u32 flags, u32* error) {
                 type_error(error, node->comm_if.if_token, 
                     "if command requires boolean type condition, but got '");
                 ast_print_type(type, LIGHT_AST_PRINT_STDERR, 0);
-                fprintf(stderr, "'\n");
+                fprintf(TYPE_ERROR_STREAM, "'\n");
                 return;
             }
 
@@ -1045,7 +1299,7 @@ typecheck_information_pass_command(Light_Ast* node, u32 flags, u32* error) {
                 type_error(error, node->comm_while.while_token, 
                     "while command requires boolean type condition, but got '");
                 ast_print_type(type, LIGHT_AST_PRINT_STDERR, 0);
-                fprintf(stderr, "'\n");
+                fprintf(TYPE_ERROR_STREAM, "'\n");
                 return;
             }
 
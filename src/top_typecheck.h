@@ -13,6 +13,6 @@ typedef enum {
 #define TYPE_WEAK(T) ((T)->flags & TYPE_FLAG_WEAK)
 
 Light_Type_Error decl_check_redefinition(Light_Scope* scope, Light_Ast* node, Light_Token* token);
-Light_Type_Error top_typecheck(Light_Ast** top_level, Light_Scope* global_scope);
+Light_Type_Error top_typecheck(Light_Ast** top_level, Light_Scope* global_scope, s32 thread_count);
 void             typecheck_information_pass_decl(Light_Ast* node, u32 flags, u32* decl_error);
 Light_Type*      typecheck_resolve_type(Light_Scope* scope, Light_Type* type, u32 flags, u32* error);
\ No newline at end of file
@@ -2,6 +2,8 @@
 #include <assert.h>
 #include "global_tables.h"
 #include "light_array.h"
+#include "utils/thread.h"
+#include "utils/intern.h"
 
 static u64 primitive_table_hash[TYPE_PRIMITIVE_COUNT] = {0};
 static u64 struct_hash = 0;
@@ -15,11 +17,32 @@ Light_Type* global_type_empty_struct;
 Light_Type* global_type_empty_union;
 Light_Type* global_type_empty_enum;
 
+// Files are parsed concurrently, the type table is shared by all parser
+// threads. While a file is parsed every internalization is logged so the
+// order of global_type_array can be rebuilt as if it was parsed alone.
+static Light_Mutex type_table_mutex;
+static light_thread_local Light_Type*** type_internalize_log = 0;
+static Light_Arena** type_arenas = 0; // every thread arena, for the stats
+static u64 type_internalize_calls = 0;
+
 static Light_Type*
 type_alloc() {
+    if(!global_type_arena) {
+        global_type_arena = arena_create(65536);
+        light_mutex_lock(&type_table_mutex);
+        array_push(type_arenas, global_type_arena);
+        light_mutex_unlock(&type_table_mutex);
+    }
     return arena_alloc(global_type_arena, sizeof(Light_Type));
 }
 
+void
+type_arenas_stats(Light_Arena_Stats* stats) {
+    for(u64 i = 0; i < array_length(type_arenas); ++i) {
+        arena_stats_accumulate(stats, type_arenas[i]);
+    }
+}
+
 Light_Type*
 type_alias_root(Light_Type* type) {
     while(type && type->kind == TYPE_KIND_ALIAS)
@@ -159,6 +182,16 @@ type_new_pointer(Light_Type* pointer_to) {
     return result;
 }
 
+// Not internalized, even if the original was
+Light_Type*
+type_new_copy(const Light_Type* type) {
+    Light_Type* result = type_alloc();
+    *result = *type;
+    result->flags &= ~(TYPE_FLAG_INTERNALIZED|TYPE_FLAG_IN_TYPE_ARRAY);
+    result->hash = 0;
+    return result;
+}
+
 Light_Type* 
 type_new_directive(Light_Ast* expr) {
     Light_Type* result = type_alloc();
@@ -183,6 +216,7 @@ type_new_alias(Light_Scope* scope, Light_Token* name, Light_Type* alias_to) {
     result->alias.scope = scope;
 
     s32 index = -1;
+    light_mutex_lock(&type_table_mutex);
     if(type_table_entry_exist(&global_type_table, result, &index, 0)) {
         assert(index >= 0);
         
@@ -195,6 +229,7 @@ type_new_alias(Light_Scope* scope, Light_Token* name, Light_Type* alias_to) {
         }
         result = found_type;
     }
+    light_mutex_unlock(&type_table_mutex);
 
     return result;
 }
@@ -296,10 +331,13 @@ type_primitive_hash(Light_Type_Primitive p) {
 	return primitive_table_hash[p];
 }
 
+// Internalized types keep their hash, so hashing a type only walks down
+// to its first internalized children, which usually are the direct ones.
 u64 
 type_hash(Light_Type* type) {
 	u64 hash = 0;
 	if(!type) return 0;
+	if(type->flags & TYPE_FLAG_INTERNALIZED) return type->hash;
 	switch (type->kind) {
 		case TYPE_KIND_PRIMITIVE:
 			hash = type_primitive_hash(type->primitive); 
@@ -314,7 +352,7 @@ type_hash(Light_Type* type) {
                     Light_Ast* field_node = type->struct_info.fields[i];
                     u64 rhash = type_hash(field_node->decl_variable.type);
                     u64 nhash = fnv_1_hash_from_start(rhash, 
-                        field_node->decl_variable.name->data, field_node->decl_variable.name->length);
+                        token_data(field_node->decl_variable.name), field_node->decl_variable.name->length);
                     hash = fnv_1_hash_combine(hash, nhash);
                 }
             }
@@ -326,7 +364,7 @@ type_hash(Light_Type* type) {
                     Light_Ast* field_node = type->union_info.fields[i];
                     u64 rhash = type_hash(field_node->decl_variable.type);
                     u64 nhash = fnv_1_hash_from_start(rhash, 
-                        field_node->decl_variable.name->data, field_node->decl_variable.name->length);
+                        token_data(field_node->decl_variable.name), field_node->decl_variable.name->length);
                     hash = fnv_1_hash_combine(hash, nhash);
                     
                 }
@@ -345,7 +383,7 @@ type_hash(Light_Type* type) {
 			hash = fnv_1_hash_combine(type_hash(type->array_info.array_of), type->array_info.dimension); break;
             break;
         case TYPE_KIND_ALIAS:
-            hash = fnv_1_hash(type->alias.name->data, type->alias.name->length);
+            hash = light_intern_hash(token_data(type->alias.name));
             hash = fnv_1_hash_combine(hash, (u64)type->alias.scope);
             break;
         case TYPE_KIND_ENUM: 
@@ -356,7 +394,7 @@ type_hash(Light_Type* type) {
                 for(s32 i = 0; i < type->enumerator.field_count; ++i) {
                     // TODO(psv): field value be part of the hash
                     Light_Token* field_name = type->enumerator.fields[i]->decl_constant.name;
-                    hash = fnv_1_hash_from_start(hash, field_name->data, field_name->length);
+                    hash = fnv_1_hash_from_start(hash, token_data(field_name), field_name->length);
                 }
             }
             break;
@@ -368,6 +406,9 @@ type_hash(Light_Type* type) {
 
 void
 type_tables_initialize() {
+    light_mutex_init(&type_table_mutex);
+    type_arenas = array_new(Light_Arena*);
+
     // Initialize hashes
     pointer_hash = fnv_1_hash((const u8*)"pointer", sizeof("pointer") - 1);
     struct_hash = fnv_1_hash((const u8*)"struct", sizeof("struct") - 1);
@@ -425,11 +466,18 @@ type_internalize(Light_Type* type) {
         assert(type->flags & TYPE_FLAG_SIZE_RESOLVED);
 
     s32 index = 0;
+    light_mutex_lock(&type_table_mutex);
+    type_internalize_calls++;
     bool added = type_table_add(&global_type_table, type, &index);
     // Works even if the type already exist in the table.
     Light_Type* internalized = type_table_get(&global_type_table, index);
-    internalized->flags |= TYPE_FLAG_INTERNALIZED;
-    internalized->flags &= ~(TYPE_FLAG_WEAK);
+    if(added) internalized->hash = global_type_table.entries[index].hash;
+    // Type checker threads read the flags of internalized types without
+    // the lock, only write them when they change.
+    if((internalized->flags & (TYPE_FLAG_INTERNALIZED|TYPE_FLAG_WEAK)) != TYPE_FLAG_INTERNALIZED) {
+        internalized->flags |= TYPE_FLAG_INTERNALIZED;
+        internalized->flags &= ~(TYPE_FLAG_WEAK);
+    }
 
     if(added && !(internalized->flags & TYPE_FLAG_UNRESOLVED)) {
         internalized->flags |= TYPE_FLAG_IN_TYPE_ARRAY;
@@ -442,9 +490,47 @@ type_internalize(Light_Type* type) {
         array_push(global_type_array, internalized);
     }
 
+    if(type_internalize_log)
+        array_push(*type_internalize_log, internalized);
+    light_mutex_unlock(&type_table_mutex);
+
     return internalized;
 }
 
+u64
+type_internalize_count() {
+    return type_internalize_calls;
+}
+
+void
+type_internalize_log_begin(Light_Type*** log) {
+    type_internalize_log = log;
+}
+
+void
+type_internalize_log_end() {
+    type_internalize_log = 0;
+}
+
+void
+type_array_truncate(u64 length) {
+    for(u64 i = length; i < array_length(global_type_array); ++i) {
+        global_type_array[i]->flags &= ~(TYPE_FLAG_IN_TYPE_ARRAY);
+    }
+    array_length(global_type_array) = length;
+}
+
+void
+type_array_replay(Light_Type** log) {
+    for(u64 i = 0; i < array_length(log); ++i) {
+        Light_Type* t = log[i];
+        if(!(t->flags & TYPE_FLAG_IN_TYPE_ARRAY) && !(t->flags & TYPE_FLAG_UNRESOLVED)) {
+            t->flags |= TYPE_FLAG_IN_TYPE_ARRAY;
+            array_push(global_type_array, t);
+        }
+    }
+}
+
 Light_Type*
 type_primitive_get(Light_Type_Primitive t) {
     return primitive_type_table[t];
@@ -504,11 +590,14 @@ type_alias_by_name_str(Light_Scope* decl_scope, const char* name, int length) {
     t.alias.scope = decl_scope;
 
     s32 index = -1;
+    Light_Type* result = 0;
+    light_mutex_lock(&type_table_mutex);
     if(type_table_entry_exist(&global_type_table, &t, &index, 0)) {
         assert(index >= 0);
-        return type_table_get(&global_type_table, index);
+        result = type_table_get(&global_type_table, index);
     }
-    return 0;
+    light_mutex_unlock(&type_table_mutex);
+    return result;
 }
 
 Light_Type* 
@@ -519,11 +608,14 @@ type_alias_by_name(Light_Scope* decl_scope, Light_Token* name) {
     t.alias.scope = decl_scope;
 
     s32 index = -1;
+    Light_Type* result = 0;
+    light_mutex_lock(&type_table_mutex);
     if(type_table_entry_exist(&global_type_table, &t, &index, 0)) {
         assert(index >= 0);
-        return type_table_get(&global_type_table, index);
+        result = type_table_get(&global_type_table, index);
     }
-    return 0;
+    light_mutex_unlock(&type_table_mutex);
+    return result;
 }
 
 // Creates a struct literal of type User_Type_Info representing the type
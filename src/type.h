@@ -9,7 +9,13 @@ extern Light_Type* global_type_empty_enum;
 
 void        type_tables_initialize();
 void        type_table_print();
+void        type_arenas_stats(Light_Arena_Stats* stats);
 Light_Type* type_internalize(Light_Type* type);
+u64         type_internalize_count(); // calls to type_internalize so far
+void        type_internalize_log_begin(Light_Type*** log);
+void        type_internalize_log_end();
+void        type_array_truncate(u64 length);
+void        type_array_replay(Light_Type** log);
 Light_Type* type_alias_by_name(Light_Scope* decl_scope, Light_Token* name);
 Light_Type* type_alias_by_name_str(Light_Scope* decl_scope, const char* name, int length);
 Light_Type* type_primitive_from_token(Light_Token_Type token);
@@ -41,5 +47,6 @@ Light_Type* type_new_enum(Light_Ast** fields, s32 fields_count, Light_Type* type
 Light_Type* type_new_struct(Light_Ast** fields, s32 fields_count, Light_Scope* struct_scope);
 Light_Type* type_new_union(Light_Ast** fields, s32 fields_count, Light_Scope* union_scope);
 Light_Type* type_new_directive(Light_Ast* expr);
+Light_Type* type_new_copy(const Light_Type* type);
 
 s32 type_alignment_get(Light_Type* type);
\ No newline at end of file
@@ -11,7 +11,7 @@
 #include <light_array.h>
 
 #define MAX(A, B) (((A) > (B)) ? A : B)
-#define TOKEN_STR(T) (T)->length, (T)->data
+#define TOKEN_STR(T) (T)->length, token_data(T)
 
 static bool
 type_cast_is_valid(Light_Type* from, Light_Type* to) {
@@ -56,6 +56,21 @@ type_cast_is_valid(Light_Type* from, Light_Type* to) {
     return false;
 }
 
+static light_thread_local Light_Ast* type_infer_blocking_decl;
+
+void
+type_infer_blocked_on(Light_Ast* decl) {
+    if(!type_infer_blocking_decl)
+        type_infer_blocking_decl = decl;
+}
+
+Light_Ast*
+type_infer_blocking_take() {
+    Light_Ast* decl = type_infer_blocking_decl;
+    type_infer_blocking_decl = 0;
+    return decl;
+}
+
 Light_Ast*
 type_infer_decl_from_name(Light_Scope* scope, Light_Token* name) {
     Light_Symbol s = {0};
@@ -83,7 +98,7 @@ type_infer_propagate_literal_array(Light_Type* type, Light_Ast* expr, u32* error
     if(type && type->kind != TYPE_KIND_ARRAY) {
         type_error_mismatch(error, expr->expr_literal_array.token_array, 
             type, expr->type);
-            fprintf(stderr, " in literal array\n");
+            fprintf(TYPE_ERROR_STREAM, " in literal array\n");
         return 0;
     }
 
@@ -111,7 +126,7 @@ type_infer_propagate_literal_array(Light_Type* type, Light_Ast* expr, u32* error
                 if(array_of_type && !type_check_equality(propagated, array_of_type)) {
                     type_error_mismatch(error, expr->expr_literal_array.token_array, 
                         propagated, array_of_type);
-                    fprintf(stderr, " in literal array\n");
+                    fprintf(TYPE_ERROR_STREAM, " in literal array\n");
                     break;
                 }
             }
@@ -126,7 +141,7 @@ type_infer_propagate_literal_array(Light_Type* type, Light_Ast* expr, u32* error
                 if(!type_check_equality(t, type)) {
                     type_error_mismatch(error, expr->expr_literal_array.token_array, 
                         t, type);
-                    fprintf(stderr, " in literal array\n");
+                    fprintf(TYPE_ERROR_STREAM, " in literal array\n");
                     expr->type = 0;
                 } else {
                     expr->type = type;
@@ -152,7 +167,7 @@ type_infer_propagate_literal_array(Light_Type* type, Light_Ast* expr, u32* error
                 if(!type_check_equality(propagated, array_of_type)) {
                     type_error_mismatch(error, expr->expr_literal_array.token_array, 
                         propagated, array_of_type);
-                    fprintf(stderr, " in literal array\n");
+                    fprintf(TYPE_ERROR_STREAM, " in literal array\n");
                     break;
                 }
             }
@@ -398,17 +413,21 @@ type_infer_expr_variable(Light_Ast* expr, u32* error) {
 
     switch(decl->kind) {
         case AST_DECL_CONSTANT:{
+            if(!decl->decl_constant.type_info)
+                type_infer_blocked_on(decl);
             return decl->decl_constant.type_info;
         } break;
         case AST_DECL_PROCEDURE:{
             expr->flags |= AST_FLAG_EXPRESSION_LVALUE;
             if(decl->decl_proc.proc_type && decl->decl_proc.proc_type->flags & TYPE_FLAG_INTERNALIZED)
                 return decl->decl_proc.proc_type;
+            type_infer_blocked_on(decl);
         } break;
         case AST_DECL_VARIABLE:{
             expr->flags |= AST_FLAG_EXPRESSION_LVALUE;
             if(decl->decl_variable.type && decl->decl_variable.type->flags & TYPE_FLAG_INTERNALIZED)
                 return decl->decl_variable.type;
+            type_infer_blocked_on(decl);
         } break;
         case AST_DECL_TYPEDEF:{
             Light_Type* type = decl->decl_typedef.type_referenced;
@@ -416,7 +435,10 @@ type_infer_expr_variable(Light_Ast* expr, u32* error) {
             if(type && type->kind == TYPE_KIND_ENUM && expr->flags & AST_FLAG_ALLOW_BASE_ENUM) {
                 return decl->decl_typedef.type_referenced;
             }
-            if(!type) return 0;
+            if(!type) {
+                type_infer_blocked_on(decl);
+                return 0;
+            }
             // Error, referencing a typename instead of a declaration
             type_error(error, expr->expr_variable.name, "referencing the typename '%.*s' as an rvalue\n", TOKEN_STR(expr->expr_variable.name));
         } break;
@@ -449,6 +471,7 @@ type_infer_expr_literal_struct(Light_Ast* expr, u32* error) {
         }
         // Require to be internalized to proceed with the type inference.
         if(!(struct_type->flags & TYPE_FLAG_INTERNALIZED)) {
+            type_infer_blocked_on(decl);
             return expr->type;
         }
 
@@ -479,7 +502,7 @@ type_infer_expr_literal_struct(Light_Ast* expr, u32* error) {
         for(s32 i = 0; i < struct_type->struct_info.fields_count; ++i) {
             if(named) {
                 Light_Ast* field = expr->expr_literal_struct.struct_decls[i];
-                if(struct_type->struct_info.fields[i]->decl_variable.name->data != field->decl_variable.name->data) 
+                if(struct_type->struct_info.fields[i]->decl_variable.name->ident != field->decl_variable.name->ident) 
                 {
                     // TODO(psv): orderless fields
                     // Fields names are incompatible
@@ -498,9 +521,9 @@ type_infer_expr_literal_struct(Light_Ast* expr, u32* error) {
                     type_error(error, expr->expr_literal_struct.token_struct,
                         "type mismatch in field #%d of struct literal. '", i + 1);
                     ast_print_type(expr_type, LIGHT_AST_PRINT_STDERR, 0);
-                    fprintf(stderr, "' vs '");
+                    fprintf(TYPE_ERROR_STREAM, "' vs '");
                     ast_print_type(field_type, LIGHT_AST_PRINT_STDERR, 0);
-                    fprintf(stderr, "'\n");
+                    fprintf(TYPE_ERROR_STREAM, "'\n");
                 }
             }
         }
@@ -565,7 +588,7 @@ type_infer_expr_literal_array(Light_Ast* lexpr, u32* error) {
                 if(!type_check_equality(expr->type, strong_type)) {
                     // TODO(psv): use lexing range for all expressions when is implemented
                     type_error_mismatch(error, lexpr->expr_literal_array.token_array, expr->type, strong_type);
-                    fprintf(stderr, " in array literal\n");
+                    fprintf(TYPE_ERROR_STREAM, " in array literal\n");
                 }
             } else {
                 Light_Type* t = type_infer_propagate(strong_type, expr, error);
@@ -589,7 +612,7 @@ type_infer_expr_literal_array(Light_Ast* lexpr, u32* error) {
             if(expr->type->flags & TYPE_FLAG_INTERNALIZED) {
                 if(!type_check_equality(expr->type, strong_type)) {
                     type_error_mismatch(error, lexpr->expr_literal_array.token_array, expr->type, strong_type);
-                    fprintf(stderr, "\n");
+                    fprintf(TYPE_ERROR_STREAM, "\n");
                 }
             } else {
                 Light_Type* t = type_infer_propagate(strong_type, expr, error);
@@ -705,9 +728,9 @@ type_infer_expr_unary(Light_Ast* expr, u32* error) {
             } else if(!type_cast_is_valid(lroot, rroot)) {
                 type_error(error, expr->expr_unary.token_op, "invalid type conversion from '");
                 ast_print_type(expr->expr_unary.operand->type, LIGHT_AST_PRINT_STDERR, 0);
-                fprintf(stderr, "' to '");
+                fprintf(TYPE_ERROR_STREAM, "' to '");
                 ast_print_type(expr->expr_unary.type_to_cast, LIGHT_AST_PRINT_STDERR, 0);
-                fprintf(stderr, "'\n");
+                fprintf(TYPE_ERROR_STREAM, "'\n");
             }
         } break;
         case OP_UNARY_DEREFERENCE:{
@@ -822,7 +845,7 @@ type_infer_expr_proc_call(Light_Ast* expr, u32* error) {
     if(caller_type->kind != TYPE_KIND_FUNCTION) {
         type_error(error, expr->expr_proc_call.token, "expected procedure type, but got '");
         ast_print_type(caller_type, LIGHT_AST_PRINT_STDERR, 0);
-        fprintf(stderr, "'\n");
+        fprintf(TYPE_ERROR_STREAM, "'\n");
         return expr->type;
     }
     
@@ -859,7 +882,7 @@ type_infer_expr_proc_call(Light_Ast* expr, u32* error) {
             all_arguments_internalized = false;
             if(!types_compatible(at, arg_type)) {
                 type_error_mismatch(error, expr->expr_proc_call.token, at, arg_type);
-                fprintf(stderr, " in argument #%d of procedure call\n", i + 1);
+                fprintf(TYPE_ERROR_STREAM, " in argument #%d of procedure call\n", i + 1);
             }
             continue;
         }
@@ -868,7 +891,7 @@ type_infer_expr_proc_call(Light_Ast* expr, u32* error) {
         if(!type_check_equality(at, arg_type)) {
             type_check_equality(at, arg_type);
             type_error_mismatch(error, expr->expr_proc_call.token, at, arg_type);
-            fprintf(stderr, " in argument #%d of procedure call\n", i + 1);
+            fprintf(TYPE_ERROR_STREAM, " in argument #%d of procedure call\n", i + 1);
         }
     }
 
@@ -1089,13 +1112,13 @@ type_infer_expr_binary(Light_Ast* expr, u32* error) {
                 Light_Type* res = types_compatible(left, right);
                 if(!res) {
                     type_error_mismatch(error, expr->expr_binary.token_op, left, right);
-                    fprintf(stderr, " in binary operation '%.*s'\n", TOKEN_STR(expr->expr_binary.token_op));
+                    fprintf(TYPE_ERROR_STREAM, " in binary operation '%.*s'\n", TOKEN_STR(expr->expr_binary.token_op));
                 }
                 return res;
             }
             if(!type_check_equality(left, right)) {
                 type_error_mismatch(error, expr->expr_binary.token_op, left, right);
-                fprintf(stderr, " in binary operation '%.*s'\n", TOKEN_STR(expr->expr_binary.token_op));
+                fprintf(TYPE_ERROR_STREAM, " in binary operation '%.*s'\n", TOKEN_STR(expr->expr_binary.token_op));
             } else {
                 return left;
             }
@@ -1122,14 +1145,14 @@ type_infer_expr_binary(Light_Ast* expr, u32* error) {
                     Light_Type* res = types_compatible(left, right);
                     if(!res) {
                         type_error_mismatch(error, expr->expr_binary.token_op, left, right);
-                        fprintf(stderr, " in binary operation '%.*s'\n", TOKEN_STR(expr->expr_binary.token_op));
+                        fprintf(TYPE_ERROR_STREAM, " in binary operation '%.*s'\n", TOKEN_STR(expr->expr_binary.token_op));
                     }
                     left = type_infer_propagate(0, expr->expr_binary.left, error);
                     right = type_infer_propagate(0, expr->expr_binary.right, error);
                 }
                 if(!type_check_equality(left, right)) {
                     type_error_mismatch(error, expr->expr_binary.token_op, left, right);
-                    fprintf(stderr, " in binary operation '%.*s'\n", TOKEN_STR(expr->expr_binary.token_op));
+                    fprintf(TYPE_ERROR_STREAM, " in binary operation '%.*s'\n", TOKEN_STR(expr->expr_binary.token_op));
                 }
                 return type_primitive_get(TYPE_PRIMITIVE_BOOL);
             } else {
@@ -1160,7 +1183,7 @@ type_infer_expr_binary(Light_Ast* expr, u32* error) {
                 }
                 if(!type_check_equality(left, right)) {
                     type_error_mismatch(error, expr->expr_binary.token_op, left, right);
-                    fprintf(stderr, " in binary operation '%.*s'\n", TOKEN_STR(expr->expr_binary.token_op));
+                    fprintf(TYPE_ERROR_STREAM, " in binary operation '%.*s'\n", TOKEN_STR(expr->expr_binary.token_op));
                 } else {
                     type_infer_propagate(0, expr->expr_binary.left, error);
                     type_infer_propagate(0, expr->expr_binary.right, error);
@@ -1193,7 +1216,7 @@ type_infer_expr_binary(Light_Ast* expr, u32* error) {
                 type_error(error, expr->expr_binary.token_op, 
                     "vector accessing operator requires integer indices, but got '");
                 ast_print_type(right, LIGHT_AST_PRINT_STDERR, 0);
-                fprintf(stderr, "'\n");
+                fprintf(TYPE_ERROR_STREAM, "'\n");
             }
         } break;
 
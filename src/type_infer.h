@@ -8,5 +8,10 @@ Light_Type* type_alias_root(Light_Type* type);
 Light_Type* type_infer_expression(Light_Ast* expr, u32* error);
 Light_Type* type_infer_propagate(Light_Type* type, Light_Ast* expr, u32* error);
 Light_Ast*  type_infer_decl_from_name(Light_Scope* scope, Light_Token* name);
+
+// The first unresolved declaration seen since the last call to
+// type_infer_blocking_take, inference cannot proceed until it resolves.
+void        type_infer_blocked_on(Light_Ast* decl);
+Light_Ast*  type_infer_blocking_take();
 Light_Ast*  find_enum_field_decl(Light_Scope* scope, Light_Token* ident, u32* error);
 
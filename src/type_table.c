@@ -3,6 +3,16 @@
 #include "type.h"
 #include <assert.h>
 
+// Internalized types are unique, so two different internalized types
+// are never equal and only types still being built are compared deeply.
+static int
+type_child_equal(Light_Type* t1, Light_Type* t2) {
+    if(t1 == t2) return 1;
+    if((t1->flags & TYPE_FLAG_INTERNALIZED) && (t2->flags & TYPE_FLAG_INTERNALIZED))
+        return 0;
+    return type_equal(t1, t2);
+}
+
 int 
 type_equal(Light_Type* t1, Light_Type* t2) {
     if(t1 == t2) return 1;
@@ -13,12 +23,12 @@ type_equal(Light_Type* t1, Light_Type* t2) {
         case TYPE_KIND_PRIMITIVE:
             return (t1->primitive == t2->primitive);
         case TYPE_KIND_POINTER:
-            return type_equal(t1->pointer_to, t2->pointer_to);
+            return type_child_equal(t1->pointer_to, t2->pointer_to);
         case TYPE_KIND_STRUCT:{
             if(t1->struct_info.fields_count != t2->struct_info.fields_count)
                 return 0;
             for(u64 i = 0; i < t1->struct_info.fields_count; ++i) {
-                if(!type_equal(
+                if(!type_child_equal(
                     t1->struct_info.fields[i]->decl_variable.type,
                     t2->struct_info.fields[i]->decl_variable.type))
                 {
@@ -31,7 +41,7 @@ type_equal(Light_Type* t1, Light_Type* t2) {
             if(t1->union_info.fields_count != t2->union_info.fields_count)
                 return 0;
             for(u64 i = 0; i < t1->union_info.fields_count; ++i) {
-                if(!type_equal(
+                if(!type_child_equal(
                     t1->union_info.fields[i]->decl_variable.type,
                     t2->union_info.fields[i]->decl_variable.type))
                 {
@@ -49,26 +59,26 @@ type_equal(Light_Type* t1, Light_Type* t2) {
             return 0;
         } break;
         case TYPE_KIND_FUNCTION:{
-            if(!type_equal(t1->function.return_type, t1->function.return_type))
+            if(!type_child_equal(t1->function.return_type, t2->function.return_type))
                 return 0;
             if(t1->function.arguments_count != t2->function.arguments_count)
                 return 0;
             for(s32 i = 0; i < t1->function.arguments_count; ++i) {
-                if(!type_equal(t1->function.arguments_type[i], t2->function.arguments_type[i]))
+                if(!type_child_equal(t1->function.arguments_type[i], t2->function.arguments_type[i]))
                     return 0;
             }
             return 1;
         } break;
         case TYPE_KIND_ENUM:{
             if(t1->enumerator.type_hint && t2->enumerator.type_hint) {
-                return type_equal(t1->enumerator.type_hint, t2->enumerator.type_hint);
+                return type_child_equal(t1->enumerator.type_hint, t2->enumerator.type_hint);
             } else {
                 if(t1->enumerator.field_count != t2->enumerator.field_count)
                     return 0;
                 // TODO(psv): consider enum values
                 for(s32 i = 0; i < t1->enumerator.field_count; ++i) {
-                    if(t1->enumerator.fields[i]->decl_constant.name->data != 
-                        t2->enumerator.fields[i]->decl_constant.name->data)
+                    if(t1->enumerator.fields[i]->decl_constant.name->ident != 
+                        t2->enumerator.fields[i]->decl_constant.name->ident)
                         return 0;
                 }
                 return 1;
@@ -79,7 +89,7 @@ type_equal(Light_Type* t1, Light_Type* t2) {
             // in the same scope there can only be one type definition
             // with the same name.
             if(t1->alias.scope != t2->alias.scope) return 0;
-            return t1->alias.name->data == t2->alias.name->data;
+            return t1->alias.name->ident == t2->alias.name->ident;
         } break;
     }
     return 0;
@@ -3,4 +3,6 @@
 #include "type.h"
 #include "utils/hash.h"
 
-GENERATE_HASH_TABLE(Type, type, Light_Type*)
\ No newline at end of file
+GENERATE_HASH_TABLE(Type, type, Light_Type*)
+
+int type_equal(Light_Type* t1, Light_Type* t2);
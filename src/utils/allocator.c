@@ -1,8 +1,10 @@
 #include "allocator.h"
+#include "profile.h"
 #include <stdlib.h>
 
 void* 
 light_alloc(u64 size_bytes) {
+    if(light_profile_enabled) light_profile_alloc(LIGHT_PROFILE_HEAP, size_bytes);
     return calloc(1, size_bytes);
 }
 
@@ -13,5 +15,6 @@ light_free(void* block) {
 
 void* 
 light_realloc(void* block, u64 size_bytes) {
+    if(light_profile_enabled) light_profile_alloc(LIGHT_PROFILE_HEAP, size_bytes);
     return realloc(block, size_bytes);
 }
\ No newline at end of file
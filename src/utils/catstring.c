@@ -42,7 +42,7 @@ catsprint_token(catstring* buffer, Light_Token* t) {
     if((buffer->length + t->length) >= buffer->capacity) {
         buffer_grow_by(buffer, t->length);
     }
-    memcpy(buffer->data + buffer->length, t->data, t->length);
+    memcpy(buffer->data + buffer->length, token_data(t), t->length);
     buffer->length += t->length;
 
     return t->length;
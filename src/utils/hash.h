@@ -1,5 +1,73 @@
+#pragma once
+#include <string.h>
+#include "profile.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HASH_TABLE_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #define HASH_TABLE_OCCUPIED (1 << 0)
 
+// Open addressing tables in the style of SwissTable. Every slot has a control
+// byte telling whether it is empty, deleted, or full, in which case it holds
+// the low 7 bits of the hash (h2). Slots are probed in aligned groups of 16
+// control bytes, comparing the whole group against h2 at once.
+// The capacity is always a power of 2 and the table grows when it gets to
+// 7/8 of its capacity (deleted slots included).
+#define HASH_TABLE_GROUP_SIZE    16
+#define HASH_TABLE_CTRL_EMPTY    0x80
+#define HASH_TABLE_CTRL_DELETED  0xFE
+#define HASH_TABLE_H1(H) ((H) >> 7)
+#define HASH_TABLE_H2(H) ((unsigned char)((H) & 0x7f))
+
+static inline int
+hash_table_bit_first(unsigned int mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Bit i is set when control byte i of the group is equal to c
+static inline unsigned int
+hash_table_group_match(const unsigned char* group, unsigned char c) {
+#if defined(HASH_TABLE_SSE2)
+    __m128i g = _mm_loadu_si128((const __m128i*)group);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)c)));
+#else
+    unsigned int mask = 0;
+    for(int i = 0; i < HASH_TABLE_GROUP_SIZE; ++i)
+        if(group[i] == c) mask |= (1u << i);
+    return mask;
+#endif
+}
+
+// Bit i is set when slot i of the group is free (empty or deleted)
+static inline unsigned int
+hash_table_group_match_free(const unsigned char* group) {
+#if defined(HASH_TABLE_SSE2)
+    return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    unsigned int mask = 0;
+    for(int i = 0; i < HASH_TABLE_GROUP_SIZE; ++i)
+        if(group[i] & 0x80) mask |= (1u << i);
+    return mask;
+#endif
+}
+
+static inline int
+hash_table_capacity_round(int capacity) {
+    int result = HASH_TABLE_GROUP_SIZE;
+    while(result < capacity) result <<= 1;
+    return result;
+}
+
 #define GENERATE_HASH_TABLE(UNAME, LNAME, TYPE) \
 typedef struct { \
     unsigned int       flags; \
@@ -11,6 +79,8 @@ typedef struct UNAME##_Table_t { \
     int                  entries_count; \
 	int                  entries_capacity; \
 	int                  hash_collision_count; \
+	int                  deleted_count; \
+	unsigned char*       control; \
 	UNAME##_Table_Entry* entries; \
 } UNAME##_Table; \
 void LNAME##_table_new(UNAME##_Table* table, int capacity); \
@@ -21,66 +91,145 @@ int LNAME##_table_del(UNAME##_Table* table, TYPE v); \
 TYPE LNAME##_table_get(UNAME##_Table* table, int index);
 
 #define GENERATE_HASH_TABLE_IMPLEMENTATION(UNAME, LNAME, TYPE, HASHFUNC, ALLOCATOR, FREE, EQUALITY) \
+/* Only used while profiling */ \
+static light_thread_local Hash_Table_Stats* LNAME##_table_stats_local; \
+static Hash_Table_Stats* LNAME##_table_stats() { \
+    if(!LNAME##_table_stats_local) LNAME##_table_stats_local = hash_table_stats_register(#LNAME); \
+    return LNAME##_table_stats_local; \
+} \
+\
 void LNAME##_table_new(UNAME##_Table* table, int capacity) { \
+    capacity = hash_table_capacity_round(capacity); \
     table->entries = (UNAME##_Table_Entry*)ALLOCATOR(capacity * sizeof(UNAME##_Table_Entry)); \
+    table->control = (unsigned char*)ALLOCATOR(capacity); \
+    memset(table->control, HASH_TABLE_CTRL_EMPTY, capacity); \
     table->entries_capacity = capacity; \
     table->entries_count = 0; \
+    table->deleted_count = 0; \
     table->hash_collision_count = 0; \
 } \
 \
 void \
 LNAME##_table_free(UNAME##_Table* table) { \
     FREE(table->entries); \
+    FREE(table->control); \
+    table->entries = 0; \
+    table->control = 0; \
     table->entries_capacity = 0; \
     table->entries_count = 0; \
+    table->deleted_count = 0; \
     table->hash_collision_count = 0; \
 } \
 \
-int LNAME##_table_add(UNAME##_Table* table, TYPE v, int* out_index) { \
-    unsigned long int hash = HASHFUNC(v); \
-	int index = (int)(hash % table->entries_capacity); \
+/* Returns the first free slot for the hash, the value must not be in the table */ \
+static int LNAME##_table_find_free(UNAME##_Table* table, unsigned long int hash) { \
+    int group_mask = (table->entries_capacity / HASH_TABLE_GROUP_SIZE) - 1; \
+    int group = (int)(HASH_TABLE_H1(hash) & group_mask); \
+    for(int step = 1; ; ++step) { \
+        unsigned int free_mask = hash_table_group_match_free(table->control + group * HASH_TABLE_GROUP_SIZE); \
+        if(free_mask) { \
+            if(step > 1) table->hash_collision_count += 1; \
+            return group * HASH_TABLE_GROUP_SIZE + hash_table_bit_first(free_mask); \
+        } \
+        group = (group + step) & group_mask; \
+    } \
+} \
 \
-	while (table->entries[index].flags & (1 << 0)) { \
-		if (table->entries[index].hash == hash && (EQUALITY(table->entries[index].data, v))) { \
-            if(out_index) *out_index = index; \
-			return 0; \
-		} \
+static void LNAME##_table_rehash(UNAME##_Table* table, int capacity) { \
+    UNAME##_Table old = *table; \
+    LNAME##_table_new(table, capacity); \
+    for(int i = 0; i < old.entries_capacity; ++i) { \
+        if(!(old.control[i] & 0x80)) { \
+            int index = LNAME##_table_find_free(table, old.entries[i].hash); \
+            table->control[index] = old.control[i]; \
+            table->entries[index] = old.entries[i]; \
+            table->entries_count += 1; \
+        } \
+    } \
+    FREE(old.entries); \
+    FREE(old.control); \
+    if(light_profile_enabled) LNAME##_table_stats()->rehashes += 1; \
+} \
 \
-        table->entries[index].flags |= (1 << 1); \
-		index = (index + 1) % table->entries_capacity; \
-	} \
+int LNAME##_table_add(UNAME##_Table* table, TYPE v, int* out_index) { \
+    unsigned long int hash = 0; \
+    if(LNAME##_table_entry_exist(table, v, out_index, &hash)) { \
+        return 0; \
+    } \
 \
+    if((table->entries_count + table->deleted_count + 1) * 8 > table->entries_capacity * 7) { \
+        /* only grow when the table is full of live entries, otherwise just drop the tombstones */ \
+        int capacity = table->entries_capacity; \
+        if((table->entries_count + 1) * 2 > capacity) capacity *= 2; \
+        LNAME##_table_rehash(table, capacity); \
+    } \
+\
+    int index = LNAME##_table_find_free(table, hash); \
+    if(table->control[index] == HASH_TABLE_CTRL_DELETED) table->deleted_count -= 1; \
+    if(light_profile_enabled) { \
+        Hash_Table_Stats* stats = LNAME##_table_stats(); \
+        int group_mask = (table->entries_capacity / HASH_TABLE_GROUP_SIZE) - 1; \
+        stats->inserts += 1; \
+        if(index / HASH_TABLE_GROUP_SIZE != (int)(HASH_TABLE_H1(hash) & group_mask)) stats->displaced += 1; \
+    } \
+    table->control[index] = HASH_TABLE_H2(hash); \
 	table->entries[index].hash = hash; \
 	table->entries[index].data = v; \
-	table->entries[index].flags = (1 << 0); \
+	table->entries[index].flags = HASH_TABLE_OCCUPIED; \
 	table->entries_count += 1; \
     if(out_index) *out_index = index; \
-    return true; \
+    return 1; \
 } \
 \
 int LNAME##_table_entry_exist(UNAME##_Table* table, TYPE v, int* out_index, unsigned long int* out_hash) { \
     unsigned long int hash = HASHFUNC(v); \
-	int index = (int)(hash % table->entries_capacity); \
+    if(out_hash) *out_hash = hash; \
 \
-	while (table->entries[index].flags & (1 << 0)) { \
-		if (table->entries[index].hash == hash && (EQUALITY(table->entries[index].data, v))) { \
-            if(out_index) { \
-                *out_index = index; \
-            } \
-            if(out_hash) { \
-                *out_hash = hash; \
+    unsigned char h2 = HASH_TABLE_H2(hash); \
+    int group_mask = (table->entries_capacity / HASH_TABLE_GROUP_SIZE) - 1; \
+    int group = (int)(HASH_TABLE_H1(hash) & group_mask); \
+    int found = 0; \
+    int probes = 0; \
+    int collisions = 0; \
+    while(!found && probes <= group_mask) { \
+        const unsigned char* control = table->control + group * HASH_TABLE_GROUP_SIZE; \
+        unsigned int match = hash_table_group_match(control, h2); \
+        probes += 1; \
+        while(match) { \
+            int index = group * HASH_TABLE_GROUP_SIZE + hash_table_bit_first(match); \
+            if (table->entries[index].hash == hash && (EQUALITY(table->entries[index].data, v))) { \
+                if(out_index) *out_index = index; \
+                found = 1; \
+                break; \
             } \
-            return 1; \
-		} \
-\
-		index = (index + 1) % table->entries_capacity; \
-	} \
-	return 0; \
+            collisions += 1; \
+            match &= match - 1; \
+        } \
+        /* a group with an empty slot ends the probe sequence */ \
+        if(hash_table_group_match(control, HASH_TABLE_CTRL_EMPTY)) break; \
+        group = (group + probes) & group_mask; \
+    } \
+    if(light_profile_enabled) { \
+        Hash_Table_Stats* stats = LNAME##_table_stats(); \
+        stats->lookups += 1; \
+        stats->probes += probes; \
+        stats->collisions += collisions; \
+    } \
+	return found; \
 } \
 \
 int LNAME##_table_del(UNAME##_Table* table, TYPE v) { \
     int index = 0; \
     if(LNAME##_table_entry_exist(table, v, &index, 0)) { \
+        /* no probe sequence went past a group that still has an empty slot, \
+           so the slot can be emptied instead of leaving a tombstone */ \
+        const unsigned char* control = table->control + (index & ~(HASH_TABLE_GROUP_SIZE - 1)); \
+        if(hash_table_group_match(control, HASH_TABLE_CTRL_EMPTY)) { \
+            table->control[index] = HASH_TABLE_CTRL_EMPTY; \
+        } else { \
+            table->control[index] = HASH_TABLE_CTRL_DELETED; \
+            table->deleted_count += 1; \
+        } \
 		table->entries[index].flags = 0; \
         table->entries[index].hash = 0; \
 		table->entries_count -= 1; \
@@ -0,0 +1,148 @@
+#include "intern.h"
+#include "allocator.h"
+#include "string_table.h"
+#include "thread.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <light_arena.h>
+
+// The table is split in shards chosen by the top bits of the hash, each one
+// with its own lock, slots and arena, so threads lexing different files
+// rarely wait on each other. Shards grow independently.
+#define LIGHT_INTERN_SHARD_BITS  6
+#define LIGHT_INTERN_SHARD_COUNT (1 << LIGHT_INTERN_SHARD_BITS)
+#define LIGHT_INTERN_SHARD_SLOTS 1024
+#define LIGHT_INTERN_ARENA_SIZE  (4 * 1024)
+
+// Strings by id, in chunks that never move so lookups need no lock
+#define LIGHT_INTERN_ID_CHUNK_BITS  12
+#define LIGHT_INTERN_ID_CHUNK_SIZE  (1 << LIGHT_INTERN_ID_CHUNK_BITS)
+#define LIGHT_INTERN_ID_CHUNK_COUNT 4096
+#define LIGHT_INTERN_ID_MAX         (LIGHT_INTERN_ID_CHUNK_COUNT * LIGHT_INTERN_ID_CHUNK_SIZE)
+
+typedef struct {
+    Light_Mutex  mutex;
+    const char** slots;          // interned strings, 0 when empty
+    u32          slots_capacity; // always a power of 2
+    u32          count;
+    Light_Arena* arena;
+} Light_Intern_Shard;
+
+static Light_Intern_Shard intern_shards[LIGHT_INTERN_SHARD_COUNT];
+static const char**       intern_ids[LIGHT_INTERN_ID_CHUNK_COUNT];
+static Light_Mutex        intern_ids_mutex;
+static s32                intern_next_id = 0;
+static bool               intern_initialized = false;
+
+void
+light_intern_init() {
+    if(intern_initialized) return;
+    light_mutex_init(&intern_ids_mutex);
+    for(s32 i = 0; i < LIGHT_INTERN_SHARD_COUNT; ++i) {
+        Light_Intern_Shard* shard = &intern_shards[i];
+        light_mutex_init(&shard->mutex);
+        shard->slots_capacity = LIGHT_INTERN_SHARD_SLOTS;
+        shard->slots = light_alloc(shard->slots_capacity * sizeof(*shard->slots));
+        shard->arena = arena_create(LIGHT_INTERN_ARENA_SIZE);
+    }
+    intern_initialized = true;
+}
+
+static void
+intern_shard_grow(Light_Intern_Shard* shard) {
+    u32 capacity = shard->slots_capacity * 2;
+    const char** slots = light_alloc(capacity * sizeof(*slots));
+
+    for(u32 i = 0; i < shard->slots_capacity; ++i) {
+        const char* s = shard->slots[i];
+        if(!s) continue;
+        u32 index = (u32)light_intern_hash(s) & (capacity - 1);
+        while(slots[index])
+            index = (index + 1) & (capacity - 1);
+        slots[index] = s;
+    }
+
+    light_free(shard->slots);
+    shard->slots = slots;
+    shard->slots_capacity = capacity;
+}
+
+static const char*
+intern_copy(Light_Intern_Shard* shard, const char* data, s32 length, u64 hash) {
+    u64 size = sizeof(Light_Intern_Header) + length + 1;
+    Light_Intern_Header* header = arena_alloc_aligned(shard->arena, size, sizeof(u64));
+    header->hash = hash;
+    header->length = length;
+
+    char* result = (char*)(header + 1);
+    memcpy(result, data, length);
+    result[length] = 0;
+
+    light_mutex_lock(&intern_ids_mutex);
+    if(intern_next_id >= LIGHT_INTERN_ID_MAX) {
+        // Every chunk is taken, a new id would index past intern_ids
+        fprintf(stderr, "Fatal Error: more than %d distinct identifiers\n", LIGHT_INTERN_ID_MAX);
+        exit(1);
+    }
+    u32 id = (u32)intern_next_id++;
+    const char*** chunk = &intern_ids[id >> LIGHT_INTERN_ID_CHUNK_BITS];
+    if(!*chunk)
+        *chunk = light_alloc(LIGHT_INTERN_ID_CHUNK_SIZE * sizeof(**chunk));
+    (*chunk)[id & (LIGHT_INTERN_ID_CHUNK_SIZE - 1)] = result;
+    header->id = id;
+    light_mutex_unlock(&intern_ids_mutex);
+
+    return result;
+}
+
+const char*
+light_intern(const char* data, s32 length) {
+    u64 hash = fnv_1_hash((const u8*)data, length);
+    Light_Intern_Shard* shard = &intern_shards[hash >> (64 - LIGHT_INTERN_SHARD_BITS)];
+
+    light_mutex_lock(&shard->mutex);
+
+    u32 mask = shard->slots_capacity - 1;
+    u32 index = (u32)hash & mask;
+    const char* s = 0;
+    while((s = shard->slots[index]) != 0) {
+        Light_Intern_Header* header = light_intern_header(s);
+        if(header->hash == hash && header->length == length && memcmp(s, data, length) == 0) {
+            light_mutex_unlock(&shard->mutex);
+            return s;
+        }
+        index = (index + 1) & mask;
+    }
+
+    s = intern_copy(shard, data, length, hash);
+    shard->slots[index] = s;
+    shard->count++;
+
+    // Keep the load factor under 3/4
+    if(shard->count * 4 > shard->slots_capacity * 3)
+        intern_shard_grow(shard);
+
+    light_mutex_unlock(&shard->mutex);
+    return s;
+}
+
+void
+light_intern_stats(Light_Arena_Stats* stats) {
+    for(s32 i = 0; i < LIGHT_INTERN_SHARD_COUNT; ++i) {
+        arena_stats_accumulate(stats, intern_shards[i].arena);
+    }
+}
+
+const char*
+light_intern_from_id(u32 id) {
+    return intern_ids[id >> LIGHT_INTERN_ID_CHUNK_BITS][id & (LIGHT_INTERN_ID_CHUNK_SIZE - 1)];
+}
+
+s32
+light_intern_count() {
+    light_mutex_lock(&intern_ids_mutex);
+    s32 count = intern_next_id;
+    light_mutex_unlock(&intern_ids_mutex);
+    return count;
+}
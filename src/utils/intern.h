@@ -0,0 +1,23 @@
+#pragma once
+#include <common.h>
+#include <light_arena.h>
+
+// Every interned string is copied once and preceded by this header, so the
+// hash, id and length of an identifier can be read back in O(1) from the
+// interned pointer. Interned pointers are stable for the whole compilation.
+typedef struct {
+    u64 hash;
+    u32 id;     // dense, starting at 0 in interning order
+    s32 length;
+} Light_Intern_Header;
+
+#define light_intern_header(S) (((Light_Intern_Header*)(S)) - 1)
+#define light_intern_hash(S)   (light_intern_header(S)->hash)
+#define light_intern_id(S)     (light_intern_header(S)->id)
+#define light_intern_length(S) (light_intern_header(S)->length)
+
+void        light_intern_init();
+const char* light_intern(const char* data, s32 length); // exits past 16M distinct strings
+const char* light_intern_from_id(u32 id);
+s32         light_intern_count();
+void        light_intern_stats(Light_Arena_Stats* stats);
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "catstring.h"
+#include <errno.h>
 
 #if defined(__linux__)
 #include <time.h>
@@ -102,19 +103,12 @@ light_path_from_filename(const char* filename, uint64_t* size) {
 
 const char*
 light_filename_from_path(const char* path) {
-	size_t len = strlen(path);
-	size_t i = len - 1;
-	for (; i >= 0; --i) {
+	size_t i = strlen(path);
+	for (; i > 0; --i) {
 #if defined (_WIN32) || defined(_WIN64)
-		if (path[i] == '\\') {
-			i++;
-			break;
-		}
+		if (path[i - 1] == '\\') break;
 #endif
-		if (path[i] == '/') {
-			i++;
-			break;
-		}
+		if (path[i - 1] == '/') break;
 	}
 	return path + i;
 }
@@ -174,4 +168,233 @@ light_read_entire_file(const char* filename, size_t* size) {
     fclose(file);
 
 	return stream;
-}
\ No newline at end of file
+}
+// Maps the file as a private (copy-on-write) view, the source buffer is never
+// copied. The view is padded to a page boundary with at least one extra zero
+// byte so the lexer can keep relying on a NUL terminated stream.
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+int
+light_map_entire_file(const char* filename, Light_File_Map* map) {
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1) return 0;
+
+	struct stat st;
+	if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return 0;
+	}
+
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	size_t size_bytes = (size_t)st.st_size;
+	size_t mapped_bytes = (size_bytes + page_size) & ~(page_size - 1);
+
+	// Reserve a zeroed region first, the file is then mapped on top of it.
+	// When the file size is a multiple of the page size the trailing page
+	// of the reservation works as the sentinel.
+	char* base = mmap(0, mapped_bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(base == MAP_FAILED) {
+		close(fd);
+		return 0;
+	}
+
+	if(size_bytes > 0) {
+		void* view = mmap(base, size_bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, 0);
+		if(view == MAP_FAILED) {
+			munmap(base, mapped_bytes);
+			close(fd);
+			return 0;
+		}
+	}
+	close(fd);
+
+	map->data = base;
+	map->size_bytes = size_bytes;
+	map->mapped_bytes = mapped_bytes;
+	map->handle = 0;
+	return 1;
+}
+
+void
+light_unmap_file(Light_File_Map* map) {
+	if(map->data) {
+		munmap(map->data, map->mapped_bytes);
+	}
+	map->data = 0;
+	map->size_bytes = 0;
+	map->mapped_bytes = 0;
+}
+
+#elif defined(_WIN32) || defined(_WIN64)
+
+int
+light_map_entire_file(const char* filename, Light_File_Map* map) {
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if(file == INVALID_HANDLE_VALUE) return 0;
+
+	LARGE_INTEGER size = {0};
+	SYSTEM_INFO info = {0};
+	GetSystemInfo(&info);
+	if(!GetFileSizeEx(file, &size) || size.QuadPart == 0 || (size.QuadPart % info.dwPageSize) == 0) {
+		// Views cannot extend past the end of the file, without a zeroed
+		// tail in the last page there is no room for the sentinel.
+		CloseHandle(file);
+		return 0;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+	CloseHandle(file);
+	if(!mapping) return 0;
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	if(!view) {
+		CloseHandle(mapping);
+		return 0;
+	}
+
+	map->data = (char*)view;
+	map->size_bytes = (size_t)size.QuadPart;
+	map->mapped_bytes = (size_t)size.QuadPart;
+	map->handle = (void*)mapping;
+	return 1;
+}
+
+void
+light_unmap_file(Light_File_Map* map) {
+	if(map->data) {
+		UnmapViewOfFile(map->data);
+		CloseHandle((HANDLE)map->handle);
+	}
+	map->data = 0;
+	map->handle = 0;
+	map->size_bytes = 0;
+	map->mapped_bytes = 0;
+}
+#endif
+
+int
+light_memory_stream_open(Light_Memory_Stream* stream) {
+	stream->data = 0;
+	stream->size_bytes = 0;
+#if defined(_WIN32) || defined(_WIN64)
+	stream->file = tmpfile();
+#else
+	stream->file = open_memstream(&stream->data, &stream->size_bytes);
+#endif
+	return stream->file != 0;
+}
+
+void
+light_memory_stream_close(Light_Memory_Stream* stream) {
+	if(!stream->file) return;
+#if defined(_WIN32) || defined(_WIN64)
+	fseek(stream->file, 0, SEEK_END);
+	stream->size_bytes = ftell(stream->file);
+	fseek(stream->file, 0, SEEK_SET);
+	stream->data = malloc(stream->size_bytes + 1);
+	fread(stream->data, stream->size_bytes, 1, stream->file);
+	stream->data[stream->size_bytes] = 0;
+#endif
+	fclose(stream->file);
+	stream->file = 0;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <direct.h>
+#include <sys/stat.h>
+#include <io.h>
+int
+light_make_directory(const char* path) {
+	return _mkdir(path) == 0 || errno == EEXIST;
+}
+
+int
+light_file_exists(const char* path) {
+	return _access(path, 0) == 0;
+}
+
+uint64_t
+light_file_modified_time(const char* path) {
+	struct _stat64 st;
+	if(_stat64(path, &st) != 0) return 0;
+	return (uint64_t)st.st_mtime * 1000000000ull;
+}
+
+int
+light_write_entire_file(const char* path, const void* data, size_t size_bytes) {
+	catstring temp = {0};
+	catsprint(&temp, "%s.%u.tmp\0", path, (unsigned long long)GetCurrentProcessId());
+	FILE* file = fopen(temp.data, "wb");
+	int written = file && fwrite(data, 1, size_bytes, file) == size_bytes;
+	if(file) written = (fclose(file) == 0) && written;
+	written = written && MoveFileExA(temp.data, path, MOVEFILE_REPLACE_EXISTING);
+	if(!written) remove(temp.data);
+	catstring_free(&temp);
+	return written;
+}
+
+int
+light_directory_each(const char* path, Light_Directory_Proc proc, void* user) {
+	catstring pattern = {0};
+	catsprint(&pattern, "%s*\0", path);
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA(pattern.data, &entry);
+	catstring_free(&pattern);
+	if(find == INVALID_HANDLE_VALUE) return 0;
+	do {
+		if(!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) proc(entry.cFileName, user);
+	} while(FindNextFileA(find, &entry));
+	FindClose(find);
+	return 1;
+}
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+int
+light_make_directory(const char* path) {
+	return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+int
+light_file_exists(const char* path) {
+	return access(path, F_OK) == 0;
+}
+
+uint64_t
+light_file_modified_time(const char* path) {
+	struct stat st;
+	if(stat(path, &st) != 0) return 0;
+	return (uint64_t)st.st_mtim.tv_sec * 1000000000ull + (uint64_t)st.st_mtim.tv_nsec;
+}
+
+// Written next to the destination and renamed over it, so a concurrent
+// reader sees either the old or the new file.
+int
+light_write_entire_file(const char* path, const void* data, size_t size_bytes) {
+	catstring temp = {0};
+	catsprint(&temp, "%s.%u.tmp\0", path, (unsigned long long)getpid());
+	FILE* file = fopen(temp.data, "wb");
+	int written = file && fwrite(data, 1, size_bytes, file) == size_bytes;
+	if(file) written = (fclose(file) == 0) && written;
+	written = written && rename(temp.data, path) == 0;
+	if(!written) remove(temp.data);
+	catstring_free(&temp);
+	return written;
+}
+int
+light_directory_each(const char* path, Light_Directory_Proc proc, void* user) {
+	DIR* directory = opendir(path);
+	if(!directory) return 0;
+	struct dirent* entry;
+	while((entry = readdir(directory)) != 0) {
+		if(entry->d_name[0] != '.') proc(entry->d_name, user);
+	}
+	closedir(directory);
+	return 1;
+}
+#endif
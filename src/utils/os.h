@@ -1,6 +1,17 @@
 #pragma once
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdio.h>
+
+// Private copy-on-write view of a file mapped into memory, writes to it never
+// reach the file. The view is always followed by at least one zero byte, so
+// it can be consumed as a NUL terminated string.
+typedef struct {
+	char*  data;
+	size_t size_bytes;
+	size_t mapped_bytes;
+	void*  handle;
+} Light_File_Map;
 
 const char* light_real_path(const char* path, uint64_t* size);
 const char* light_path_from_filename(const char* filename, uint64_t* size);
@@ -9,4 +20,26 @@ const char* light_filename_from_path(const char* path);
 char*       light_filepath_relative_to(const char* path, int path_length, const char* path_relative);
 const char* light_extensionless_filename(const char* filename);
 char*       light_read_entire_file(const char* filename, size_t* size);
-double      os_time_us();
\ No newline at end of file
+int         light_map_entire_file(const char* filename, Light_File_Map* map);
+void        light_unmap_file(Light_File_Map* map);
+double      os_time_us();
+int         light_make_directory(const char* path); // succeeds if it already exists
+int         light_file_exists(const char* path);
+uint64_t    light_file_modified_time(const char* path); // 0 when the file does not exist
+int         light_write_entire_file(const char* path, const void* data, size_t size_bytes); // replaces path atomically
+
+// Calls proc with the name of every file in the directory path, which ends
+// with a separator. Returns 0 when the directory cannot be read.
+typedef void (*Light_Directory_Proc)(const char* name, void* user);
+int         light_directory_each(const char* path, Light_Directory_Proc proc, void* user);
+
+// A FILE* writing to memory, data and size_bytes are only valid after
+// light_memory_stream_close and data must be released with free.
+typedef struct {
+	FILE*  file;
+	char*  data;
+	size_t size_bytes;
+} Light_Memory_Stream;
+
+int         light_memory_stream_open(Light_Memory_Stream* stream);
+void        light_memory_stream_close(Light_Memory_Stream* stream);
\ No newline at end of file
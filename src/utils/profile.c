@@ -0,0 +1,326 @@
+#include "profile.h"
+#include "os.h"
+#include "thread.h"
+#include <light_array.h>
+#include <string.h>
+#include <stdio.h>
+
+bool light_profile_enabled = false;
+
+typedef struct {
+    const char* name;
+    char*       detail;
+    double      start_us;
+    double      duration_us;
+    s32         depth;
+    u64         allocs[LIGHT_PROFILE_ALLOC_KIND_COUNT]; // made while the scope was open
+    u64         bytes[LIGHT_PROFILE_ALLOC_KIND_COUNT];
+} Light_Profile_Event;
+
+typedef struct {
+    s32                  index;
+    Light_Profile_Event* events;
+    s32*                 open;  // events not ended yet, innermost last
+    u64                  allocs[LIGHT_PROFILE_ALLOC_KIND_COUNT];
+    u64                  bytes[LIGHT_PROFILE_ALLOC_KIND_COUNT];
+} Light_Profile_Thread;
+
+typedef struct {
+    const char*      name;
+    Hash_Table_Stats stats;
+} Light_Profile_Hash_Table;
+
+// Threads register themselves the first time they record anything. The
+// results are only read once every worker has been joined.
+static Light_Mutex                profile_mutex;
+static double                     profile_start_us;
+static Light_Profile_Thread**     profile_threads;
+static Light_Profile_Hash_Table** profile_hash_tables;
+static light_thread_local Light_Profile_Thread* profile_thread_local;
+
+static const char* profile_alloc_kind_names[LIGHT_PROFILE_ALLOC_KIND_COUNT] = {"heap", "arena"};
+
+void
+light_profile_enable() {
+    if(light_profile_enabled) return;
+    light_mutex_init(&profile_mutex);
+    profile_threads = array_new(Light_Profile_Thread*);
+    profile_hash_tables = array_new(Light_Profile_Hash_Table*);
+    profile_start_us = os_time_us();
+    light_profile_enabled = true;
+}
+
+// Not allocated with light_alloc, it would count itself
+static Light_Profile_Thread*
+profile_thread() {
+    if(!profile_thread_local) {
+        Light_Profile_Thread* thread = calloc(1, sizeof(Light_Profile_Thread));
+        thread->events = array_new(Light_Profile_Event);
+        thread->open = array_new(s32);
+
+        light_mutex_lock(&profile_mutex);
+        thread->index = (s32)array_length(profile_threads);
+        array_push(profile_threads, thread);
+        light_mutex_unlock(&profile_mutex);
+        profile_thread_local = thread;
+    }
+    return profile_thread_local;
+}
+
+void
+light_profile_begin(const char* name, const char* detail, s32 detail_length) {
+    if(!light_profile_enabled) return;
+    Light_Profile_Thread* thread = profile_thread();
+
+    Light_Profile_Event event = {0};
+    event.name = name;
+    event.depth = (s32)array_length(thread->open);
+    if(detail) {
+        event.detail = calloc(1, detail_length + 1);
+        memcpy(event.detail, detail, detail_length);
+    }
+    // Allocations are the difference with the thread counters at the end
+    for(s32 i = 0; i < LIGHT_PROFILE_ALLOC_KIND_COUNT; ++i) {
+        event.allocs[i] = thread->allocs[i];
+        event.bytes[i] = thread->bytes[i];
+    }
+    s32 index = (s32)array_length(thread->events);
+    array_push(thread->open, index);
+    event.start_us = os_time_us();
+    array_push(thread->events, event);
+}
+
+void
+light_profile_end() {
+    if(!light_profile_enabled) return;
+    double end_us = os_time_us();
+    Light_Profile_Thread* thread = profile_thread();
+    if(array_length(thread->open) == 0) return;
+
+    Light_Profile_Event* event = &thread->events[thread->open[array_length(thread->open) - 1]];
+    array_length(thread->open) -= 1;
+    event->duration_us = end_us - event->start_us;
+    for(s32 i = 0; i < LIGHT_PROFILE_ALLOC_KIND_COUNT; ++i) {
+        event->allocs[i] = thread->allocs[i] - event->allocs[i];
+        event->bytes[i] = thread->bytes[i] - event->bytes[i];
+    }
+}
+
+void
+light_profile_alloc(Light_Profile_Alloc_Kind kind, u64 size_bytes) {
+    if(!light_profile_enabled) return;
+    Light_Profile_Thread* thread = profile_thread();
+    thread->allocs[kind] += 1;
+    thread->bytes[kind] += size_bytes;
+}
+
+Hash_Table_Stats*
+hash_table_stats_register(const char* name) {
+    Light_Profile_Hash_Table* table = calloc(1, sizeof(Light_Profile_Hash_Table));
+    table->name = name;
+    light_mutex_lock(&profile_mutex);
+    array_push(profile_hash_tables, table);
+    light_mutex_unlock(&profile_mutex);
+    return &table->stats;
+}
+
+// -------------- Output ----------------
+
+static void
+json_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for(; s && *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if(c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if(c == '\n') fprintf(out, "\\n");
+        else if(c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static void
+json_allocations(FILE* out, const u64* allocs, const u64* bytes) {
+    for(s32 i = 0; i < LIGHT_PROFILE_ALLOC_KIND_COUNT; ++i) {
+        fprintf(out, ", \"%s_allocs\": %llu, \"%s_bytes\": %llu", profile_alloc_kind_names[i],
+            (unsigned long long)allocs[i], profile_alloc_kind_names[i], (unsigned long long)bytes[i]);
+    }
+}
+
+// Counters of every thread summed by table type, in registration order
+static Light_Profile_Hash_Table*
+profile_hash_tables_summed() {
+    Light_Profile_Hash_Table* result = array_new(Light_Profile_Hash_Table);
+    for(u64 i = 0; i < array_length(profile_hash_tables); ++i) {
+        Light_Profile_Hash_Table* table = profile_hash_tables[i];
+        u64 j = 0;
+        while(j < array_length(result) && strcmp(result[j].name, table->name) != 0) ++j;
+        if(j == array_length(result)) {
+            Light_Profile_Hash_Table empty = {table->name};
+            array_push(result, empty);
+        }
+        Hash_Table_Stats* sum = &result[j].stats;
+        sum->lookups += table->stats.lookups;
+        sum->probes += table->stats.probes;
+        sum->collisions += table->stats.collisions;
+        sum->inserts += table->stats.inserts;
+        sum->displaced += table->stats.displaced;
+        sum->rehashes += table->stats.rehashes;
+    }
+    return result;
+}
+
+typedef struct {
+    const char* name;
+    u64         count;
+    double      total_us;
+    double      max_us;
+    u64         allocs[LIGHT_PROFILE_ALLOC_KIND_COUNT];
+    u64         bytes[LIGHT_PROFILE_ALLOC_KIND_COUNT];
+} Light_Profile_Summary;
+
+static int
+profile_event_slower(const void* a, const void* b) {
+    double da = (*(const Light_Profile_Event**)a)->duration_us;
+    double db = (*(const Light_Profile_Event**)b)->duration_us;
+    return (da < db) - (da > db);
+}
+
+bool
+light_profile_write_json(const char* path) {
+    FILE* out = fopen(path, "wb");
+    if(!out) return false;
+
+    // Scopes by name, in the order they first ran
+    Light_Profile_Summary* summaries = array_new(Light_Profile_Summary);
+    Light_Profile_Event** detailed = array_new(Light_Profile_Event*);
+    u64 allocs[LIGHT_PROFILE_ALLOC_KIND_COUNT] = {0};
+    u64 bytes[LIGHT_PROFILE_ALLOC_KIND_COUNT] = {0};
+    for(u64 t = 0; t < array_length(profile_threads); ++t) {
+        Light_Profile_Thread* thread = profile_threads[t];
+        for(s32 i = 0; i < LIGHT_PROFILE_ALLOC_KIND_COUNT; ++i) {
+            allocs[i] += thread->allocs[i];
+            bytes[i] += thread->bytes[i];
+        }
+        for(u64 e = 0; e < array_length(thread->events); ++e) {
+            Light_Profile_Event* event = &thread->events[e];
+            u64 j = 0;
+            while(j < array_length(summaries) && strcmp(summaries[j].name, event->name) != 0) ++j;
+            if(j == array_length(summaries)) {
+                Light_Profile_Summary empty = {event->name};
+                array_push(summaries, empty);
+            }
+            Light_Profile_Summary* summary = &summaries[j];
+            summary->count += 1;
+            summary->total_us += event->duration_us;
+            if(event->duration_us > summary->max_us) summary->max_us = event->duration_us;
+            for(s32 i = 0; i < LIGHT_PROFILE_ALLOC_KIND_COUNT; ++i) {
+                summary->allocs[i] += event->allocs[i];
+                summary->bytes[i] += event->bytes[i];
+            }
+            if(event->detail) array_push(detailed, event);
+        }
+    }
+    qsort(detailed, array_length(detailed), sizeof(*detailed), profile_event_slower);
+
+    fprintf(out, "{\n  \"total_ms\": %.3f,\n  \"threads\": %llu,\n", (os_time_us() - profile_start_us) / 1000.0,
+        (unsigned long long)array_length(profile_threads));
+
+    fprintf(out, "  \"allocations\": {");
+    for(s32 i = 0; i < LIGHT_PROFILE_ALLOC_KIND_COUNT; ++i) {
+        fprintf(out, "%s\"%s\": {\"count\": %llu, \"bytes\": %llu}", (i > 0) ? ", " : "",
+            profile_alloc_kind_names[i], (unsigned long long)allocs[i], (unsigned long long)bytes[i]);
+    }
+    fprintf(out, "},\n");
+
+    // Scopes nested in another of the same name are counted in both
+    fprintf(out, "  \"scopes\": [\n");
+    for(u64 i = 0; i < array_length(summaries); ++i) {
+        Light_Profile_Summary* summary = &summaries[i];
+        fprintf(out, "    {\"name\": ");
+        json_string(out, summary->name);
+        fprintf(out, ", \"count\": %llu, \"total_ms\": %.3f, \"max_ms\": %.3f", (unsigned long long)summary->count,
+            summary->total_us / 1000.0, summary->max_us / 1000.0);
+        json_allocations(out, summary->allocs, summary->bytes);
+        fprintf(out, "}%s\n", (i + 1 < array_length(summaries)) ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+
+    // Every file and procedure, slowest first
+    fprintf(out, "  \"details\": [\n");
+    for(u64 i = 0; i < array_length(detailed); ++i) {
+        Light_Profile_Event* event = detailed[i];
+        fprintf(out, "    {\"name\": ");
+        json_string(out, event->name);
+        fprintf(out, ", \"detail\": ");
+        json_string(out, event->detail);
+        fprintf(out, ", \"ms\": %.3f", event->duration_us / 1000.0);
+        json_allocations(out, event->allocs, event->bytes);
+        fprintf(out, "}%s\n", (i + 1 < array_length(detailed)) ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+
+    Light_Profile_Hash_Table* tables = profile_hash_tables_summed();
+    fprintf(out, "  \"hash_tables\": [\n");
+    for(u64 i = 0; i < array_length(tables); ++i) {
+        Hash_Table_Stats* stats = &tables[i].stats;
+        fprintf(out, "    {\"name\": ");
+        json_string(out, tables[i].name);
+        fprintf(out, ", \"lookups\": %llu, \"probes\": %llu, \"collisions\": %llu, \"inserts\": %llu, \"displaced\": %llu, \"rehashes\": %llu, \"probes_per_lookup\": %.3f}%s\n",
+            (unsigned long long)stats->lookups, (unsigned long long)stats->probes, (unsigned long long)stats->collisions,
+            (unsigned long long)stats->inserts, (unsigned long long)stats->displaced, (unsigned long long)stats->rehashes,
+            stats->lookups ? (double)stats->probes / (double)stats->lookups : 0.0,
+            (i + 1 < array_length(tables)) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    array_free(tables);
+    array_free(summaries);
+    array_free(detailed);
+    return fclose(out) == 0;
+}
+
+// Complete ("X") events in microseconds from the start of the profile,
+// one trace thread per compiler thread.
+bool
+light_profile_write_trace(const char* path) {
+    FILE* out = fopen(path, "wb");
+    if(!out) return false;
+
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    for(u64 t = 0; t < array_length(profile_threads); ++t) {
+        Light_Profile_Thread* thread = profile_threads[t];
+        fprintf(out, "%s{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s %d\"}}",
+            first ? "" : ",\n", thread->index, (thread->index == 0) ? "main" : "thread", thread->index);
+        first = false;
+
+        for(u64 e = 0; e < array_length(thread->events); ++e) {
+            Light_Profile_Event* event = &thread->events[e];
+            fprintf(out, ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"name\": ",
+                thread->index, event->start_us - profile_start_us, event->duration_us);
+            json_string(out, event->name);
+            fprintf(out, ", \"args\": {\"detail\": ");
+            json_string(out, event->detail);
+            json_allocations(out, event->allocs, event->bytes);
+            fprintf(out, "}}");
+        }
+    }
+
+    // Hash table totals as counters at the end of the trace
+    Light_Profile_Hash_Table* tables = profile_hash_tables_summed();
+    double end_us = os_time_us() - profile_start_us;
+    for(u64 i = 0; i < array_length(tables); ++i) {
+        Hash_Table_Stats* stats = &tables[i].stats;
+        fprintf(out, "%s{\"ph\": \"C\", \"pid\": 1, \"tid\": 0, \"ts\": %.3f, \"name\": \"hash table %s\", \"args\": "
+            "{\"lookups\": %llu, \"probes\": %llu, \"collisions\": %llu, \"inserts\": %llu, \"displaced\": %llu, \"rehashes\": %llu}}",
+            first ? "" : ",\n", end_us, tables[i].name,
+            (unsigned long long)stats->lookups, (unsigned long long)stats->probes, (unsigned long long)stats->collisions,
+            (unsigned long long)stats->inserts, (unsigned long long)stats->displaced, (unsigned long long)stats->rehashes);
+        first = false;
+    }
+    fprintf(out, "\n]}\n");
+
+    array_free(tables);
+    return fclose(out) == 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <common.h>
+
+// Compiler instrumentation, everything is off until light_profile_enable.
+//
+// Timed scopes nest per thread, each one records its duration and the
+// number and size of the allocations its thread made with light_alloc and
+// arena_alloc while it was open, work handed to other threads is counted
+// in their own scopes. Hash tables count their lookups, probes and key
+// collisions per table type (see utils/hash.h).
+//
+// The results are written either as a JSON summary or in the Chrome trace
+// event format, which chrome://tracing and Perfetto open.
+
+typedef enum {
+    LIGHT_PROFILE_HEAP = 0, // light_alloc, light_realloc
+    LIGHT_PROFILE_ARENA,    // arena_alloc
+
+    LIGHT_PROFILE_ALLOC_KIND_COUNT,
+} Light_Profile_Alloc_Kind;
+
+// Counters of every table of one type, kept per thread
+typedef struct {
+    u64 lookups;
+    u64 probes;     // groups visited by the lookups
+    u64 collisions; // keys compared that were not the one looked up
+    u64 inserts;
+    u64 displaced;  // inserts that did not land in the first group of their hash
+    u64 rehashes;
+} Hash_Table_Stats;
+
+extern bool light_profile_enabled;
+
+void light_profile_enable();
+
+// name must outlive the profile, detail is copied and may be 0
+void light_profile_begin(const char* name, const char* detail, s32 detail_length);
+void light_profile_end();
+void light_profile_alloc(Light_Profile_Alloc_Kind kind, u64 size_bytes);
+
+// Counters of the calling thread for the tables of type name
+Hash_Table_Stats* hash_table_stats_register(const char* name);
+
+bool light_profile_write_json(const char* path);
+bool light_profile_write_trace(const char* path);
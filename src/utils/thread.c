@@ -0,0 +1,134 @@
+#include "thread.h"
+#include "allocator.h"
+
+typedef struct {
+    Light_Worker_Proc proc;
+    void*             arg;
+    s32               worker_index;
+} Light_Worker_Start;
+
+#if defined(_WIN32) || defined(_WIN64)
+void light_mutex_init(Light_Mutex* mutex)    { InitializeCriticalSection(mutex); }
+void light_mutex_lock(Light_Mutex* mutex)    { EnterCriticalSection(mutex); }
+void light_mutex_unlock(Light_Mutex* mutex)  { LeaveCriticalSection(mutex); }
+void light_mutex_destroy(Light_Mutex* mutex) { DeleteCriticalSection(mutex); }
+
+void light_condition_init(Light_Condition* condition) { InitializeConditionVariable(condition); }
+void light_condition_wait(Light_Condition* condition, Light_Mutex* mutex) { SleepConditionVariableCS(condition, mutex, INFINITE); }
+void light_condition_broadcast(Light_Condition* condition) { WakeAllConditionVariable(condition); }
+
+s32
+light_atomic_add(volatile s32* value, s32 amount) {
+    return InterlockedExchangeAdd((volatile LONG*)value, amount);
+}
+
+void*
+light_atomic_exchange_pointer(void* volatile* target, void* value) {
+    return InterlockedExchangePointer(target, value);
+}
+
+s32
+light_thread_hardware_count() {
+    SYSTEM_INFO info = {0};
+    GetSystemInfo(&info);
+    return (s32)info.dwNumberOfProcessors;
+}
+
+static DWORD WINAPI
+light_thread_start(void* arg) {
+    Light_Worker_Start start = *(Light_Worker_Start*)arg;
+    start.proc(start.arg, start.worker_index);
+    return 0;
+}
+
+static bool
+light_thread_create(Light_Thread* thread, Light_Worker_Start* start) {
+    *thread = CreateThread(0, 0, light_thread_start, start, 0, 0);
+    return *thread != 0;
+}
+
+static void
+light_thread_join(Light_Thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+#else
+#include <unistd.h>
+
+void light_mutex_init(Light_Mutex* mutex)    { pthread_mutex_init(mutex, 0); }
+void light_mutex_lock(Light_Mutex* mutex)    { pthread_mutex_lock(mutex); }
+void light_mutex_unlock(Light_Mutex* mutex)  { pthread_mutex_unlock(mutex); }
+void light_mutex_destroy(Light_Mutex* mutex) { pthread_mutex_destroy(mutex); }
+
+void light_condition_init(Light_Condition* condition) { pthread_cond_init(condition, 0); }
+void light_condition_wait(Light_Condition* condition, Light_Mutex* mutex) { pthread_cond_wait(condition, mutex); }
+void light_condition_broadcast(Light_Condition* condition) { pthread_cond_broadcast(condition); }
+
+s32
+light_atomic_add(volatile s32* value, s32 amount) {
+    return __sync_fetch_and_add(value, amount);
+}
+
+void*
+light_atomic_exchange_pointer(void* volatile* target, void* value) {
+    return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+s32
+light_thread_hardware_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (s32)count : 1;
+}
+
+static void*
+light_thread_start(void* arg) {
+    Light_Worker_Start start = *(Light_Worker_Start*)arg;
+    start.proc(start.arg, start.worker_index);
+    return 0;
+}
+
+static bool
+light_thread_create(Light_Thread* thread, Light_Worker_Start* start) {
+    return pthread_create(thread, 0, light_thread_start, start) == 0;
+}
+
+static void
+light_thread_join(Light_Thread thread) {
+    pthread_join(thread, 0);
+}
+#endif
+
+// Runs 'proc' on 'thread_count' workers and waits for all of them to finish.
+// Workers that could not be started are run on the calling thread instead.
+void
+light_threads_run(s32 thread_count, Light_Worker_Proc proc, void* arg) {
+    if(thread_count <= 1) {
+        proc(arg, 0);
+        return;
+    }
+
+    Light_Thread*       threads = light_alloc(sizeof(Light_Thread) * thread_count);
+    Light_Worker_Start* starts = light_alloc(sizeof(Light_Worker_Start) * thread_count);
+    bool*               started = light_alloc(sizeof(bool) * thread_count);
+
+    for(s32 i = 1; i < thread_count; ++i) {
+        starts[i].proc = proc;
+        starts[i].arg = arg;
+        starts[i].worker_index = i;
+        started[i] = light_thread_create(&threads[i], &starts[i]);
+    }
+
+    proc(arg, 0);
+
+    for(s32 i = 1; i < thread_count; ++i) {
+        if(started[i]) {
+            light_thread_join(threads[i]);
+        } else {
+            proc(arg, i);
+        }
+    }
+
+    light_free(threads);
+    light_free(starts);
+    light_free(started);
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <common.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+typedef CRITICAL_SECTION   Light_Mutex;
+typedef CONDITION_VARIABLE Light_Condition;
+typedef HANDLE             Light_Thread;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t    Light_Mutex;
+typedef pthread_cond_t     Light_Condition;
+typedef pthread_t          Light_Thread;
+#endif
+
+// Procedure run by every worker of light_threads_run, worker 0 is
+// always the calling thread.
+typedef void (*Light_Worker_Proc)(void* arg, s32 worker_index);
+
+void  light_mutex_init(Light_Mutex* mutex);
+void  light_mutex_lock(Light_Mutex* mutex);
+void  light_mutex_unlock(Light_Mutex* mutex);
+void  light_mutex_destroy(Light_Mutex* mutex);
+
+void  light_condition_init(Light_Condition* condition);
+void  light_condition_wait(Light_Condition* condition, Light_Mutex* mutex);
+void  light_condition_broadcast(Light_Condition* condition);
+
+s32   light_atomic_add(volatile s32* value, s32 amount); // returns the previous value
+void* light_atomic_exchange_pointer(void* volatile* target, void* value); // returns the previous value
+s32   light_thread_hardware_count();
+void  light_threads_run(s32 thread_count, Light_Worker_Proc proc, void* arg);